@@ -31,7 +31,7 @@ SOURCES += \
     infra/calibrationworker.cpp \
     util/ioutil.cpp \
     util/v4l2util.cpp \
-    infra/concurrentqueue.cpp \
+    infra/lockfreequeue.cpp \
     infra/acquisitionvideostats.cpp \
     infra/analysisvideostats.cpp \
     util/mathutil.cpp \
@@ -42,6 +42,7 @@ SOURCES += \
     gui/calibrationwidget.cpp \
     infra/calibrationinventory.cpp \
     util/sourcedetector.cpp \
+    util/framediffutil.cpp \
     infra/source.cpp \
     infra/sample.cpp \
     util/coordinateutil.cpp \
@@ -57,7 +58,25 @@ SOURCES += \
     infra/meteorimagelocationmeasurement.cpp \
     infra/imaged.cpp \
     infra/imageui.cpp \
+    infra/framepool.cpp \
+    infra/clipwriter.cpp \
+    infra/clipfile.cpp \
+    infra/framecodec.cpp \
+    infra/workerpool.cpp \
+    infra/videoencoder.cpp \
+    infra/archiveindex.cpp \
+    infra/eventcatalogue.cpp \
+    infra/pixelstatsaccumulator.cpp \
+    infra/spatialgrid.cpp \
+    infra/referencestarcatalogue.cpp \
+    infra/attitudetracker.cpp \
+    infra/asterismindex.cpp \
+    infra/platesolver.cpp \
+    util/parallelutil.cpp \
+    util/medianfilterutil.cpp \
+    optics/inversedistortionmap.cpp \
     math/geocalfitter.cpp \
+    math/multiepochgeocalfitter.cpp \
     optics/pinholecamerawithsipdistortion.cpp
 
 HEADERS += \
@@ -89,10 +108,12 @@ HEADERS += \
     infra/analysisinventory.h \
     config/analysisparameters.h \
     config/calibrationparameters.h \
+    config/processingparameters.h \
     infra/calibrationworker.h \
     util/ioutil.h \
     util/v4l2util.h \
-    infra/concurrentqueue.h \
+    infra/lockfreequeue.h \
+    infra/mpmcqueue.h \
     infra/acquisitionvideostats.h \
     infra/analysisvideostats.h \
     util/mathutil.h \
@@ -103,6 +124,7 @@ HEADERS += \
     gui/calibrationwidget.h \
     infra/calibrationinventory.h \
     util/sourcedetector.h \
+    util/framediffutil.h \
     infra/source.h \
     infra/sample.h \
     util/coordinateutil.h \
@@ -121,7 +143,27 @@ HEADERS += \
     infra/imaged.h \
     util/serializationutil.h \
     infra/imageui.h \
+    infra/framepool.h \
+    infra/clipwriter.h \
+    infra/clipfile.h \
+    infra/framecodec.h \
+    infra/workerpool.h \
+    infra/videoencoder.h \
+    infra/archiveindex.h \
+    infra/eventcatalogue.h \
+    infra/pixelstatsaccumulator.h \
+    infra/spatialgrid.h \
+    infra/referencestarcatalogue.h \
+    infra/attitudetracker.h \
+    infra/asterismindex.h \
+    infra/platesolver.h \
+    util/parallelutil.h \
+    util/medianfilterutil.h \
+    optics/inversedistortionmap.h \
+    optics/cameramodelkernels.h \
+    infra/spscqueue.h \
     math/geocalfitter.h \
+    math/multiepochgeocalfitter.h \
     optics/pinholecamerawithsipdistortion.h \
     config/parametermultiplechoice.h \
     config/configparameterbase.h \
@@ -130,7 +172,15 @@ HEADERS += \
 
 # Add precompiled libraries (-L vs. -l: -L specifies where to look; -l specifies the library name)
 LIBS += -L/usr/local/lib -lboost_serialization -lboost_system -lboost_wserialization
-LIBS += -ljpeg -lftgl -lfreetype -lGLU
+LIBS += -ljpeg -lftgl -lfreetype -lGLU -lsqlite3
+
+# Videos of the clips are encoded in-process with the libav libraries, if they're installed. Build without
+# them (e.g. for headless stations that don't publish videos) with: qmake CONFIG+=no_libav
+!no_libav:packagesExist(libavformat libavcodec libavutil) {
+    DEFINES += ASTERIA_WITH_LIBAV
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libavformat libavcodec libavutil
+}
 
 # Includes headers/sources to be compiled into project
 INCLUDEPATH += /usr/include/freetype2/ \
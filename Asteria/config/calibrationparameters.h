@@ -6,6 +6,7 @@
 #include "config/parametersingle.h"
 #include "infra/asteriastate.h"
 #include "optics/cameramodelbase.h"
+#include "util/medianfilterutil.h"
 
 #include <QDebug>
 
@@ -13,7 +14,7 @@ class CalibrationParameters : public ConfigParameterFamily {
 
 public:
 
-    CalibrationParameters(AsteriaState * state) : ConfigParameterFamily("Calibration", 6) {
+    CalibrationParameters(AsteriaState * state) : ConfigParameterFamily("Calibration", 14) {
 
         parameters = new ConfigParameterBase*[numPar];
         validators = new ParameterValidator*[numPar];
@@ -25,6 +26,14 @@ public:
         validators[3] = new ValidateWithinLimits<unsigned int>(0u, 30u);
         validators[4] = new ValidateWithinLimits<double>(0.0, 50.0);
         validators[5] = new ValidateWithinLimits<double>(-1.0, 20.0);
+        validators[6] = NULL;
+        validators[7] = new ValidateWithinLimits<double>(-10.0, 50.0);
+        validators[8] = new ValidateWithinInclusiveLimits<unsigned int>(0u, 99u);
+        validators[9] = new ValidateWithinLimits<unsigned int>(1u, 10000u);
+        validators[10] = new ValidateWithinLimits<unsigned int>(2u, 50u);
+        validators[11] = new ValidateWithinLimits<double>(0.0, 50.0);
+        validators[12] = new ValidateWithinInclusiveLimits<unsigned int>(0u, 999u);
+        validators[13] = new ValidateWithinLimits<double>(0.0, 8.0);
 
         // Create parameters
 
@@ -42,6 +51,14 @@ public:
         parameters[3] = new ParameterSingle<unsigned int>("bkg_median_filter_half_width", "Half-width of median filter kernel for background estimation", "pixels", validators[3], &(state->bkg_median_filter_half_width));
         parameters[4] = new ParameterSingle<double>("source_detection_threshold_sigmas", "Source detection threshold, in sigmas above the background level", "-", validators[4], &(state->source_detection_threshold_sigmas));
         parameters[5] = new ParameterSingle<double>("ref_star_faint_mag_limit", "Reference star faint magnitude limit", "mag", validators[5], &(state->ref_star_faint_mag_limit));
+        parameters[6] = new ParameterMultipleChoice<string>("bkg_median_filter_algorithm", "Algorithm used for the background median filter", MedianFilterUtil::algorithmNames, &(state->bkg_median_filter_algorithm));
+        parameters[7] = new ParameterSingle<double>("source_pixel_threshold_sigmas", "Threshold for inclusion of pixels in sources, in sigmas above the background level", "-", validators[7], &(state->source_pixel_threshold_sigmas));
+        parameters[8] = new ParameterSingle<unsigned int>("attitude_tracking_stars", "Number of bright stars used to track the camera orientation between calibrations (0 to disable)", "-", validators[8], &(state->attitude_tracking_stars));
+        parameters[9] = new ParameterSingle<unsigned int>("attitude_tracking_interval", "Interval between updates of the tracked camera orientation", "frames", validators[9], &(state->attitude_tracking_interval));
+        parameters[10] = new ParameterSingle<unsigned int>("attitude_tracking_roi_half_width", "Half-width of the region used to measure each tracked star", "pixels", validators[10], &(state->attitude_tracking_roi_half_width));
+        parameters[11] = new ParameterSingle<double>("attitude_tracking_residual_threshold", "RMS residual of the tracked stars that triggers a calibration", "pixels", validators[11], &(state->attitude_tracking_residual_threshold));
+        parameters[12] = new ParameterSingle<unsigned int>("blind_solve_min_xms", "Number of cross-matches below which the calibration is solved blindly (0 to disable)", "-", validators[12], &(state->blind_solve_min_xms));
+        parameters[13] = new ParameterSingle<double>("blind_solve_mag_limit", "Faint magnitude limit of the stars used for blind solutions", "mag", validators[13], &(state->blind_solve_mag_limit));
     }
 };
 
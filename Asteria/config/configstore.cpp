@@ -6,6 +6,7 @@
 #include "config/detectionparameters.h"
 #include "config/analysisparameters.h"
 #include "config/calibrationparameters.h"
+#include "config/processingparameters.h"
 #include "infra/asteriastate.h"
 #include "util/ioutil.h"
 
@@ -16,7 +17,7 @@
 #include <QDebug>
 
 ConfigStore::ConfigStore(AsteriaState *state) {
-    numFamilies = 6;
+    numFamilies = 7;
     families = new ConfigParameterFamily*[numFamilies];
     families[0] = new SystemParameters(state);
     families[1] = new StationParameters(state);
@@ -24,6 +25,7 @@ ConfigStore::ConfigStore(AsteriaState *state) {
     families[3] = new DetectionParameters(state);
     families[4] = new AnalysisParameters(state);
     families[5] = new CalibrationParameters(state);
+    families[6] = new ProcessingParameters(state);
 }
 
 ConfigStore::~ConfigStore() {
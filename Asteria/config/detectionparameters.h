@@ -9,7 +9,7 @@ class DetectionParameters : public ConfigParameterFamily {
 
 public:
 
-    DetectionParameters(AsteriaState * state) : ConfigParameterFamily("Detection", 5) {
+    DetectionParameters(AsteriaState * state) : ConfigParameterFamily("Detection", 7) {
 
         parameters = new ConfigParameterBase*[numPar];
         validators = new ParameterValidator*[numPar];
@@ -20,6 +20,8 @@ public:
         validators[2] = new ValidateWithinLimits<double>(0.0, 2.0);
         validators[3] = new ValidateWithinLimits<unsigned int>(1u, 2550u);
         validators[4] = new ValidateWithinLimits<unsigned int>(1u, 100000u);
+        validators[5] = new ValidateWithinLimits<unsigned int>(0u, 10000u);
+        validators[6] = new ValidateWithinInclusiveLimits<unsigned int>(0u, 9999u);
 
         // Create parameters
         parameters[0] = new ParameterSingle<unsigned int>("detection_head", "Detection head", "frames", validators[0], &(state->detection_head));
@@ -27,6 +29,8 @@ public:
         parameters[2] = new ParameterSingle<double>("clip_max_length", "Maximum clip length, excluding head", "minutes", validators[2], &(state->clip_max_length));
         parameters[3] = new ParameterSingle<unsigned int>("pixel_difference_threshold", "Pixel difference threshold", "ADU", validators[3], &(state->pixel_difference_threshold));
         parameters[4] = new ParameterSingle<unsigned int>("n_changed_pixels_for_trigger", "Number of changed pixels that triggers an event", "pixels", validators[4], &(state->n_changed_pixels_for_trigger));
+        parameters[5] = new ParameterSingle<unsigned int>("clip_writer_window", "Maximum number of clip frames waiting to be written to disk", "frames", validators[5], &(state->clip_writer_window));
+        parameters[6] = new ParameterSingle<unsigned int>("clip_key_frame_interval", "Interval between key frames in compressed clips (0 = uncompressed)", "frames", validators[6], &(state->clip_key_frame_interval));
     }
 };
 
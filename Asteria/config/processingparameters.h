@@ -0,0 +1,37 @@
+#ifndef PROCESSINGPARAMETERS_H
+#define PROCESSINGPARAMETERS_H
+
+#include "config/configparameterfamily.h"
+#include "config/parametermultiplechoice.h"
+#include "config/parametersingle.h"
+#include "infra/asteriastate.h"
+#include "infra/workerpool.h"
+
+class ProcessingParameters : public ConfigParameterFamily {
+
+public:
+
+    ProcessingParameters(AsteriaState * state) : ConfigParameterFamily("Processing", 6) {
+
+        parameters = new ConfigParameterBase*[numPar];
+        validators = new ParameterValidator*[numPar];
+
+        // Create validators for each parameter
+        validators[0] = new ValidateWithinLimits<unsigned int>(0u, 65u);
+        validators[1] = new ValidateWithinLimits<int>(-21, 20);
+        validators[2] = new ValidateWithinLimits<unsigned int>(0u, 1000u);
+        validators[3] = NULL;
+        validators[4] = new ValidateWithinInclusiveLimits<unsigned int>(0u, 1000u);
+        validators[5] = new ValidateWithinInclusiveLimits<unsigned int>(0u, 99u);
+
+        // Create parameters
+        parameters[0] = new ParameterSingle<unsigned int>("worker_threads", "Number of threads for analysis and calibration", "threads", validators[0], &(state->worker_threads));
+        parameters[1] = new ParameterSingle<int>("worker_nice", "Nice level of the analysis and calibration threads", "-", validators[1], &(state->worker_nice));
+        parameters[2] = new ParameterSingle<unsigned int>("worker_queue_depth", "Maximum number of analysis and calibration jobs waiting for a thread", "jobs", validators[2], &(state->worker_queue_depth));
+        parameters[3] = new ParameterMultipleChoice<string>("worker_queue_policy", "Action when the job queue is full", WorkerPool::fullQueuePolicyNames, &(state->worker_queue_policy));
+        parameters[4] = new ParameterSingle<unsigned int>("worker_max_deferred", "Maximum number of analysis and calibration jobs deferred while the queue is full", "jobs", validators[4], &(state->worker_max_deferred));
+        parameters[5] = new ParameterSingle<unsigned int>("video_queue_depth", "Maximum number of videos waiting to be encoded (0 disables video encoding)", "videos", validators[5], &(state->video_queue_depth));
+    }
+};
+
+#endif
@@ -64,6 +64,34 @@ public:
     }
 };
 
+/**
+ * Class template that provides implementations of ParameterValidator that verify
+ * that a parameter is within specified limits, including the limits themselves. This
+ * is needed for unsigned parameters for which zero is a valid (e.g. disabling) value.
+ */
+template < typename T >
+class ValidateWithinInclusiveLimits : public ParameterValidator {
+
+public:
+    ValidateWithinInclusiveLimits(const T &lower, const T &upper) : lower(lower), upper(upper) {
+
+    }
+
+    T lower;
+    T upper;
+
+    bool validate(const void *pvalue, std::ostringstream &strs) const {
+
+        const T * value = static_cast<const T *>(pvalue);
+
+        if(*value < lower || *value > upper) {
+            strs << "Value (" << *value << ") lies outside allowed range [" << lower << ":" << upper << "]";
+            return false;
+        }
+        return true;
+    }
+};
+
 /**
  * @brief The ValidatePath class
  * Used to check and validate file and directory paths.
@@ -37,6 +37,8 @@ AcquisitionWidget::AcquisitionWidget(QWidget *parent, AsteriaState * state) : QW
     totalFramesField = new QLabel("");
     QLabel * droppedFramesLabel = new QLabel("Dropped frames: ");
     droppedFramesField = new QLabel("");
+    QLabel * queueDepthLabel = new QLabel("Queued frames (capture/decode): ");
+    queueDepthField = new QLabel("");
 
     QWidget * acqStateDisplay = new QWidget(this);
 
@@ -56,6 +58,8 @@ AcquisitionWidget::AcquisitionWidget(QWidget *parent, AsteriaState * state) : QW
     layout->addWidget(droppedFramesLabel, 4, 0);
     layout->addWidget(droppedFramesField, 4, 1);
     layout->addWidget(overlaycheckbox, 4, 2);
+    layout->addWidget(queueDepthLabel, 5, 0);
+    layout->addWidget(queueDepthField, 5, 1);
 
     acqStateDisplay->setLayout(layout);
 
@@ -103,4 +107,5 @@ void AcquisitionWidget::updateVideoStats(const AcquisitionVideoStats &stats) {
     fpsField->setText(QString::asprintf("%5.3f", stats.fps));
     totalFramesField->setText(QString::asprintf("%5d", stats.totalFrames));
     droppedFramesField->setText(QString::asprintf("%5d", stats.droppedFrames));
+    queueDepthField->setText(QString::asprintf("%2d / %2d", stats.captureQueueDepth, stats.decodeQueueDepth));
 }
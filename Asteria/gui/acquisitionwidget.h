@@ -35,6 +35,7 @@ public:
     QLabel *fpsField;
     QLabel *totalFramesField;
     QLabel *droppedFramesField;
+    QLabel *queueDepthField;
 
 signals:
     // Forward the signals from the AcquisitionThread
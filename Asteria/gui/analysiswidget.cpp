@@ -1,6 +1,7 @@
 #include "gui/analysiswidget.h"
 #include "infra/analysisinventory.h"
 #include "infra/asteriastate.h"
+#include "infra/workerpool.h"
 #include "gui/videodirectorymodel.h"
 #include "util/timeutil.h"
 #include "gui/videoplayerwidget.h"
@@ -96,16 +97,16 @@ void AnalysisWidget::loadClip(QString path) {
             fprintf(stderr, "No clip to analyse!\n");
             return;
         }
-        QThread* thread = new QThread;
+        if(!state->workerPool) {
+            fprintf(stderr, "No worker pool to run the analysis!\n");
+            return;
+        }
         // TODO: reanalyse using specific calibration and not the one currently loaded in the state object, which may be inappropriate
         AnalysisWorker* worker = new AnalysisWorker(NULL, this->state, this->state->cal, inv->eventFrames);
-        worker->moveToThread(thread);
-        connect(thread, SIGNAL(started()), worker, SLOT(process()));
-        connect(worker, SIGNAL(finished(std::string)), thread, SLOT(quit()));
-        connect(worker, SIGNAL(finished(std::string)), worker, SLOT(deleteLater()));
         connect(worker, SIGNAL(finished(std::string)), this, SLOT(reanalysisComplete(std::string)));
-        connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
-        thread->start();
+        // The worker is run and deleted on a pool thread
+        worker->moveToThread(0);
+        state->workerPool->submit("reanalysis", [worker]() {worker->process(); delete worker;}, [worker]() {delete worker;});
     }
 
     void AnalysisWidget::reanalysisComplete(std::string utc) {
@@ -1,6 +1,7 @@
 #include "gui/calibrationwidget.h"
 #include "infra/calibrationinventory.h"
 #include "infra/asteriastate.h"
+#include "infra/workerpool.h"
 #include "gui/videodirectorymodel.h"
 #include "util/timeutil.h"
 #include "gui/videoplayerwidget.h"
@@ -126,15 +127,20 @@ void CalibrationWidget::loadClip(QString path) {
             fprintf(stderr, "No clip to analyse!\n");
             return;
         }
-        QThread* thread = new QThread;
+        if(!state->workerPool) {
+            fprintf(stderr, "No worker pool to run the calibration!\n");
+            return;
+        }
+        // Calibrations made during acquisition keep only the first and last frames, so need the stored signal and noise images
+        if(inv->calibrationFrames.size() < state->calibration_stack && !(inv->signal && inv->noise)) {
+            fprintf(stderr, "Only %lu calibration frames and no stored signal and noise images; can't recalibrate!\n", inv->calibrationFrames.size());
+            return;
+        }
         CalibrationWorker* worker = new CalibrationWorker(NULL, state, inv, inv->calibrationFrames);
-        worker->moveToThread(thread);
-        connect(thread, SIGNAL(started()), worker, SLOT(process()));
-        connect(worker, SIGNAL(finished(std::string)), thread, SLOT(quit()));
-        connect(worker, SIGNAL(finished(std::string)), worker, SLOT(deleteLater()));
         connect(worker, SIGNAL(finished(std::string)), this, SLOT(recalibrationComplete(std::string)));
-        connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
-        thread->start();
+        // The worker is run and deleted on a pool thread
+        worker->moveToThread(0);
+        state->workerPool->submit("recalibration", [worker]() {worker->process(); delete worker;}, [worker]() {delete worker;});
     }
 
     void CalibrationWidget::recalibrationComplete(std::string utc) {
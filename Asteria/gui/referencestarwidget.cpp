@@ -8,6 +8,8 @@
 #include "util/ioutil.h"
 #include "gui/doubleslider.h"
 #include "infra/calibrationinventory.h"
+#include "infra/spatialgrid.h"
+#include "infra/referencestarcatalogue.h"
 
 #include <QPushButton>
 #include <QVBoxLayout>
@@ -149,23 +151,10 @@ void ReferenceStarWidget::mouseReleaseEvent(QMouseEvent *e) {
         if(mouseStartI == mouse.x() && mouseStartJ == mouse.y()) {
             // No drag occurred, just a click: locate the closest reference star
             selectedRefStar = 0;
-            double minDistanceToReferenceStar = std::sqrt(state->width * state->width + state->height * state->height);
-
-            for(ReferenceStar * refStarPtr : visibleReferenceStars) {
-
-                double di = refStarPtr->i - mouse.x();
-                double dj = refStarPtr->j - mouse.y();
-
-                // Quick bounding box check to reject reference stars much further away than the current limit
-                if(std::fabs(di) > minDistanceToReferenceStar || std::fabs(dj) > minDistanceToReferenceStar) {
-                    continue;
-                }
-                // Passed bounding box check: compute Euclidean distance
-                double distanceToReferenceStar = std::sqrt(di * di + dj * dj);
-
-                if(distanceToReferenceStar < minDistanceToReferenceStar) {
-                    minDistanceToReferenceStar = distanceToReferenceStar;
-                    selectedRefStar = refStarPtr;
+            if(visibleReferenceStarGrid) {
+                int nearestIdx = visibleReferenceStarGrid->nearest(mouse.x(), mouse.y());
+                if(nearestIdx >= 0) {
+                    selectedRefStar = visibleReferenceStars[nearestIdx];
                 }
             }
 
@@ -330,20 +319,31 @@ void ReferenceStarWidget::update() {
     // Full transformation BCRF->CAM
     Matrix3d r_bcrf_cam = r_sez_cam * r_ecef_sez * r_bcrf_ecef;
 
-    for(ReferenceStar &star : state->refStarCatalogue) {
+    // The selected star is found again among the new set of visible stars by its position
+    bool starWasSelected = (selectedRefStar != 0);
+    double selectedRa = starWasSelected ? selectedRefStar->ra : 0.0;
+    double selectedDec = starWasSelected ? selectedRefStar->dec : 0.0;
+    selectedRefStar = 0;
 
-        // Skip stars fainter than faint mag limit
-        if(star.mag > state->ref_star_faint_mag_limit) {
-            continue;
+    // Get the stars brighter than the faint mag limit that are visible in the image
+    referenceStars.clear();
+    if(state->refStarCatalogue) {
+        state->refStarCatalogue->getVisibleStars(r_bcrf_cam, *(inv->cam), state->ref_star_faint_mag_limit, referenceStars);
+    }
+    for(ReferenceStar &star : referenceStars) {
+        visibleReferenceStars.push_back(&star);
+        if(starWasSelected && star.ra == selectedRa && star.dec == selectedDec) {
+            selectedRefStar = &star;
         }
+    }
 
-        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, *(inv->cam));
-
-        if(star.visible) {
-            // Star is visible in image!
-            visibleReferenceStars.push_back(&star);
-        }
+    // Index the visible stars for selection by mouse click
+    std::vector<double> refStarI, refStarJ;
+    for(ReferenceStar * star : visibleReferenceStars) {
+        refStarI.push_back(star->i);
+        refStarJ.push_back(star->j);
     }
+    visibleReferenceStarGrid = std::make_shared<SpatialGrid>(refStarI, refStarJ, 32.0);
 
     if(displayRefStars) {
 
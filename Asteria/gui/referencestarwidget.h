@@ -13,6 +13,7 @@ class AsteriaState;
 class GLMeteorDrawer;
 class QGroupBox;
 class CalibrationInventory;
+class SpatialGrid;
 
 /**
  * @brief Provides a QWidget used to display the median image overlaid with the current positions of
@@ -44,11 +45,21 @@ public:
      */
     GLMeteorDrawer * signalImageViewer;
 
+    /**
+     * @brief The ReferenceStars currently visible, as found in the catalogue.
+     */
+    std::vector<ReferenceStar> referenceStars;
+
     /**
      * @brief Vector of ReferenceStars currently visible.
      */
     std::vector<ReferenceStar *> visibleReferenceStars;
 
+    /**
+     * @brief Spatial index of the visible ReferenceStars, used to find the star nearest to a mouse click.
+     */
+    std::shared_ptr<SpatialGrid> visibleReferenceStarGrid;
+
     /**
      * @brief Pointer to the currently selected ReferenceStar.
      */
@@ -12,6 +12,7 @@
  * The data stored by each TreeItem:
  * [0] - The short string to be displayed in the viewer
  * [1] - Full path to the node represented by this TreeItem
+ * [2] - Optional tooltip, e.g. the summary of the event for clip items
  *
  * Follows the example at http://doc.qt.io/qt-5/qtwidgets-itemviews-simpletreemodel-example.html
  */
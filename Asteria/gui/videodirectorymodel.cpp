@@ -3,12 +3,20 @@
 #include "util/timeutil.h"
 #include "gui/treeitemaction.h"
 #include "util/fileutil.h"
+#include "infra/archiveindex.h"
+#include "infra/eventcatalogue.h"
 
-#include <regex>
-#include <dirent.h>
+#include <map>
 
 #include <QDebug>
 
+/**
+ * @brief Get the summary of an event from the catalogue, displayed as the tooltip of the clip item.
+ */
+static QString getEventSummary(const EventCatalogue::Event &event) {
+    return QString::asprintf("%d frames (%d localised); motion %.1f px; peak %d", event.nFrames, event.nLocalised, event.motion, event.peak);
+}
+
 VideoDirectoryModel::VideoDirectoryModel(std::string path, std::string title, QWidget *widget, QObject *parent) : QAbstractItemModel(parent) {
     QList<QVariant> rootData;
     rootData << title.c_str();
@@ -97,6 +105,10 @@ QVariant VideoDirectoryModel::data(const QModelIndex &index, int role) const {
         return item->getIcon();
     }
 
+    if(role == Qt::ToolTipRole) {
+        return item->data(2);
+    }
+
     if(role != Qt::DisplayRole && role != Qt::EditRole) {
         return QVariant();
     }
@@ -123,138 +135,81 @@ QVariant VideoDirectoryModel::headerData(int section, Qt::Orientation orientatio
 
 void VideoDirectoryModel::setupModelData(const std::string &rootPath) {
 
-    // This regex usage relies on version 4.9 or later of the GCC
-    const std::regex yearRegex("[0-9]{4}");
-    const std::regex monthDayRegex("[0-9]{2}");
-
     QIcon folderIcon(":/images/folder-outline-filled.png");
     QIcon meteorIcon(":/images/meteor-512.png");
 
-    // Vector containing names for all YYYY directories found in the root directory, so we can sort them into
-    // numerical order for displaying in the tree view
-    std::vector<std::string> years;
-    DIR *rootDir;
-    if ((rootDir = opendir (rootPath.c_str())) != NULL) {
-        // Loop over all the files/directories in the root directory
-        struct dirent *rootFile;
-        while ((rootFile = readdir (rootDir)) != NULL) {
-            // Detect directories with names matching the format YYYY
-            if(rootFile->d_type == DT_DIR && std::regex_match (rootFile->d_name, yearRegex)) {
-                years.push_back(rootFile->d_name);
-            }
+    // The clips are listed by the archive index, in ascending order of time; bring it up to date with any
+    // changes made to the directory tree by other means first
+    std::shared_ptr<ArchiveIndex> index = ArchiveIndex::get(rootPath);
+    index->reconcile();
+
+    // Summaries of the events, by the path to the clip, if this is the video directory
+    std::map<std::string, EventCatalogue::Event> events;
+    if(FileUtil::fileExists(rootPath + "/" + EventCatalogue::filename)) {
+        for(const EventCatalogue::Event &event : EventCatalogue::get(rootPath)->query(EventCatalogue::Query())) {
+            events[event.path] = event;
         }
-        closedir (rootDir);
     }
 
-    // Now sort the YYYY directories into ascending numerical order
-    std::sort(years.begin(), years.end());
-
-    // Loop over each YYYY directory
-    for(unsigned int p=0; p<years.size(); p++) {
-        std::string yearPath = rootPath + "/" + years[p];
-
-        // Create a TreeItem then search for MM subdirectories
-        QList<QVariant> yearData;
-        yearData << years[p].c_str() << yearPath.c_str();
-        TreeItem * yearItem = new TreeItem(yearData, rootItem);
-        yearItem->setIcon(folderIcon);
-        addContextMenu(yearItem);
-        rootItem->appendChild(yearItem);
-
-        // Locate all the subdirectories corresponding to months in the year
-        std::vector<std::string> months;
-        DIR *yearDir;
-        if ((yearDir = opendir (yearPath.c_str())) != NULL) {
-            struct dirent *yearFile;
-            while ((yearFile = readdir (yearDir)) != NULL) {
-                // Detect directories with names matching the format MM
-                if(yearFile->d_type == DT_DIR && std::regex_match (yearFile->d_name, monthDayRegex)) {
-                    months.push_back(yearFile->d_name);
-                }
-            }
-            closedir (yearDir);
+    TreeItem * yearItem = NULL;
+    TreeItem * monthItem = NULL;
+    TreeItem * dayItem = NULL;
+
+    for(const ArchiveIndex::Entry &entry : index->getAll()) {
+
+        std::string yyyy = TimeUtil::extractYearFromUtcString(entry.utc);
+        std::string mm = TimeUtil::extractMonthFromUtcString(entry.utc);
+        std::string dd = TimeUtil::extractDayFromUtcString(entry.utc);
+
+        std::string yearPath = rootPath + "/" + yyyy;
+        std::string monthPath = yearPath + "/" + mm;
+        std::string dayPath = monthPath + "/" + dd;
+
+        // Create a TreeItem for each new YYYY, MM and DD directory
+        if(!yearItem || yyyy.compare(yearItem->data(0).toString().toStdString()) != 0) {
+            QList<QVariant> yearData;
+            yearData << yyyy.c_str() << yearPath.c_str();
+            yearItem = new TreeItem(yearData, rootItem);
+            yearItem->setIcon(folderIcon);
+            addContextMenu(yearItem);
+            rootItem->appendChild(yearItem);
+            monthItem = NULL;
         }
 
-        // Now sort the MM directories into ascending numerical order
-        std::sort(months.begin(), months.end());
-
-        // Loop over each MM directory
-        for(unsigned int q=0; q<months.size(); q++) {
-            std::string monthPath = yearPath + "/" + months[q];
-
-            // Create a TreeItem then search for DD subdirectories
+        if(!monthItem || mm.compare(monthItem->data(0).toString().toStdString()) != 0) {
             QList<QVariant> monthData;
-            monthData << months[q].c_str() << monthPath.c_str();
-            TreeItem * monthItem = new TreeItem(monthData, yearItem);
+            monthData << mm.c_str() << monthPath.c_str();
+            monthItem = new TreeItem(monthData, yearItem);
             monthItem->setIcon(folderIcon);
             addContextMenu(monthItem);
             yearItem->appendChild(monthItem);
+            dayItem = NULL;
+        }
 
-            // Locate all the subdirectories corresponding to days in the month
-
-            std::vector<std::string> days;
-            DIR *monthDir;
-            if ((monthDir = opendir (monthPath.c_str())) != NULL) {
-                struct dirent *monthFile;
-                while ((monthFile = readdir (monthDir)) != NULL) {
-                    // Detect directories with names matching the format DD
-                    if(monthFile->d_type == DT_DIR && std::regex_match (monthFile->d_name, monthDayRegex)) {
-                        days.push_back(monthFile->d_name);
-                    }
-                }
-                closedir (monthDir);
-            }
+        if(!dayItem || dd.compare(dayItem->data(0).toString().toStdString()) != 0) {
+            QList<QVariant> dayData;
+            dayData << dd.c_str() << dayPath.c_str();
+            dayItem = new TreeItem(dayData, monthItem);
+            dayItem->setIcon(folderIcon);
+            addContextMenu(dayItem);
+            monthItem->appendChild(dayItem);
+        }
 
-            // Now sort the DD directories into ascending numerical order
-            std::sort(days.begin(), days.end());
-
-            // Loop over each DD directory
-            for(unsigned int r=0; r<days.size(); r++) {
-                std::string dayPath = monthPath + "/" + days[r];
-
-                // Create a TreeItem then search for subdirectories containing individual clips
-                QList<QVariant> dayData;
-                dayData << days[r].c_str() << dayPath.c_str();
-                TreeItem * dayItem = new TreeItem(dayData, monthItem);
-                dayItem->setIcon(folderIcon);
-                addContextMenu(dayItem);
-                monthItem->appendChild(dayItem);
-
-                // Locate all the subdirectories corresponding to days in the month
-
-                std::vector<std::string> clips;
-                DIR *dayDir;
-                if ((dayDir = opendir (dayPath.c_str())) != NULL) {
-                    struct dirent *dayFile;
-                    while ((dayFile = readdir (dayDir)) != NULL) {
-                        // Detect directories with names matching the UTC format
-                        if(dayFile->d_type == DT_DIR && std::regex_match (dayFile->d_name, TimeUtil::utcRegex)) {
-                            clips.push_back(dayFile->d_name);
-                        }
-                    }
-                    closedir (dayDir);
-                }
-
-                // Now sort the clip directories into ascending numerical order
-                std::sort(clips.begin(), clips.end());
-
-                // Loop over each clip directory
-                for(unsigned int s=0; s<clips.size(); s++) {
-                    std::string clipPath = dayPath + "/" + clips[s];
-                    // Found a clip directory - create a TreeItem; log the full path to the
-                    // clip and use the time as the title for the node.
-                    // Set the right kind of icon to use.
-                    QList<QVariant> clipData;
-                    // Extract time part of UTC string
-                    clipData << TimeUtil::extractTimeFromUtcString(clips[s]).c_str() << clipPath.c_str();
-                    TreeItem * clipItem = new TreeItem(clipData, dayItem);
-                    clipItem->setIcon(meteorIcon);
-                    addContextMenu(clipItem);
-                    dayItem->appendChild(clipItem);
-                }
-            } // Close loop over DD
-        } // Close loop over MM
-    } // Close loop over YYYY
+        // Found a clip directory - create a TreeItem; log the full path to the
+        // clip and use the time as the title for the node.
+        // Set the right kind of icon to use.
+        QList<QVariant> clipData;
+        // Extract time part of UTC string
+        clipData << TimeUtil::extractTimeFromUtcString(entry.utc).c_str() << entry.path.c_str();
+        std::map<std::string, EventCatalogue::Event>::const_iterator event = events.find(entry.path);
+        if(event != events.end()) {
+            clipData << getEventSummary(event->second);
+        }
+        TreeItem * clipItem = new TreeItem(clipData, dayItem);
+        clipItem->setIcon(meteorIcon);
+        addContextMenu(clipItem);
+        dayItem->appendChild(clipItem);
+    }
 
 }
 
@@ -379,6 +334,19 @@ void VideoDirectoryModel::addNewClipByUtc(std::string utc) {
     // Add new clip
     QList<QVariant> clipData;
     clipData << TimeUtil::extractTimeFromUtcString(utc).c_str() << clipPath.c_str();
+
+    // Look up the summary of the event; the UTC is truncated to milliseconds
+    if(FileUtil::fileExists(rootPath + "/" + EventCatalogue::filename)) {
+        EventCatalogue::Query query;
+        query.startUs = TimeUtil::utcStringToEpoch(utc);
+        query.endUs = query.startUs + 1000;
+        for(const EventCatalogue::Event &event : EventCatalogue::get(rootPath)->query(query)) {
+            if(event.path == clipPath) {
+                clipData << getEventSummary(event);
+                break;
+            }
+        }
+    }
     TreeItem * clipItem = new TreeItem(clipData, clipDayItem);
     clipItem->setIcon(meteorIcon);
     addContextMenu(clipItem);
@@ -404,6 +372,12 @@ void VideoDirectoryModel::deleteItem(TreeItem * itemToDelete) {
     // Delete the files from disk
     FileUtil::deleteFilePath(pathToItem);
 
+    // Remove the deleted clips from the archive index and event catalogue
+    ArchiveIndex::get(rootPath)->remove(pathToItem);
+    if(FileUtil::fileExists(rootPath + "/" + EventCatalogue::filename)) {
+        EventCatalogue::get(rootPath)->remove(pathToItem);
+    }
+
     // Recurse through the tree deleting each child item
     removeTreeItemsRecursive(itemToDelete);
 }
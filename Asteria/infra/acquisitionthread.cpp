@@ -7,10 +7,21 @@
 #include "util/timeutil.h"
 #include "util/ioutil.h"
 #include "util/v4l2util.h"
+#include "util/framediffutil.h"
+#include "infra/workerpool.h"
+#include "infra/videoencoder.h"
+#include "infra/archiveindex.h"
+#include "infra/referencestarcatalogue.h"
+#include "infra/attitudetracker.h"
+#include "infra/asterismindex.h"
+#include "util/mathutil.h"
 
 #include <linux/videodev2.h>
 //#include <sys/ioctl.h>          // IOCTL etc
 #include <sys/mman.h>           // mmap etc
+#include <sys/select.h>         // select(...)
+#include <poll.h>               // poll(...)
+#include <errno.h>
 #include <memory>               // shared_ptr
 #include <sstream>              // ostringstream
 #include <cmath>                // round(...)
@@ -33,7 +44,9 @@ const std::string AcquisitionThread::acquisitionStateNames[] = {"PREVIEWING", "P
 const std::string AcquisitionThread::actionNames[] = {"PREVIEW", "PAUSE", "DETECT"};
 
 AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
-    : QThread(parent), state(state), abort(false), detectionHeadBuffer(state->detection_head) {
+    : QThread(parent), state(state), abort(false), freeRawFrames(rawFrameQueueLength), capturedRawFrames(rawFrameQueueLength),
+      decodedFrames(decodedFrameQueueLength), stopStages(false), streamingRequested(false), detectionHeadBuffer(state->detection_head),
+      actions(actionQueueLength) {
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -42,9 +55,15 @@ AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
     // TODO: this should be loaded elsewhere as part of application initialisation
-    state->refStarCatalogue = ReferenceStar::loadCatalogue(state->refStarCataloguePath);
+    if(!state->refStarCatalogue) {
+        state->refStarCatalogue = ReferenceStarCatalogue::load(state->refStarCataloguePath);
+        if(!state->refStarCatalogue) {
+            // Continue with an empty catalogue
+            state->refStarCatalogue = ReferenceStarCatalogue::build(std::vector<ReferenceStar>());
+        }
+    }
 
-    fprintf(stderr, "Loaded %lu ReferenceStars!\n", state->refStarCatalogue.size());
+    fprintf(stderr, "Loaded %u ReferenceStars!\n", state->refStarCatalogue->size());
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -139,11 +158,11 @@ AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    std::map<long long, std::string> map = FileUtil::mapVideoDirectory(this->state->calibrationDirPath);
+    ArchiveIndex::Entry latest;
 
-    if(!map.empty()) {
+    if(ArchiveIndex::get(this->state->calibrationDirPath)->getLatest(latest)) {
         // Get most recent calibration and load from disk
-        std::string calInvDir = map.rbegin()->second;
+        std::string calInvDir = latest.path;
         this->state->cal = CalibrationInventory::loadFromDir(calInvDir);
         if(!this->state->cal) {
             fprintf(stderr, "Failed to load most recent calibration from %s\n", calInvDir.c_str());
@@ -177,6 +196,62 @@ AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
 
     fprintf(stderr, "Maximum length of a clip = %d [frames]\n", max_clip_length_frames);
 
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //          Create the pool of recycled frames           //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    // The most frames that can be held at once is the detection head plus the clip frames waiting to be
+    // written to disk, plus those queued between the decode and detection stages. Calibration frames are
+    // accumulated into per-pixel statistics, so only the first and last are retained. A few extra frames
+    // are allowed for those in transit to the GUI. Only the detection head is allocated up front; the
+    // remainder are allocated when first needed then retained for reuse.
+    unsigned int nFramesMax = this->state->detection_head + this->state->clip_writer_window + 2 + decodedFrameQueueLength + 4;
+    framePool = FramePool::create(this->state->width, this->state->height, nFramesMax, this->state->detection_head + 4);
+
+    fprintf(stderr, "Frame pool capacity = %d [frames]\n", nFramesMax);
+
+    fprintf(stderr, "Using %s frame difference kernel\n", FrameDiffUtil::getKernelName().c_str());
+
+    // Clips are streamed to disk as they're recorded
+    clipWriter.reset(new ClipWriter(this->state->videoDirPath, this->state->clip_writer_window, this->state->clip_key_frame_interval));
+
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //  Create the worker pool for analysis and calibration  //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    if(!this->state->workerPool) {
+        this->state->workerPool = std::make_shared<WorkerPool>(this->state->worker_threads, this->state->worker_nice, this->state->worker_queue_depth,
+                                                               WorkerPool::getFullQueuePolicyFromName(this->state->worker_queue_policy),
+                                                               this->state->worker_max_deferred);
+        fprintf(stderr, "Worker pool: %d threads at nice level %d, queue depth %d, %s when full, at most %d deferred\n", this->state->worker_threads,
+                this->state->worker_nice, this->state->worker_queue_depth, this->state->worker_queue_policy.c_str(), this->state->worker_max_deferred);
+    }
+
+    // The asterism index is built from the catalogue the first time, and stored alongside it. This is done on the
+    // worker pool so as not to delay the camera start-up; blind solutions are unavailable until it's ready.
+    if(!std::atomic_load(&state->asterismIndex) && state->blind_solve_min_xms > 0 && state->refStarCatalogue->size() > 0) {
+        std::shared_ptr<ReferenceStarCatalogue> catalogue = state->refStarCatalogue;
+        state->workerPool->submit("asterism index", [state, catalogue]() {
+            std::shared_ptr<AsterismIndex> index = AsterismIndex::loadOrBuild(state->refStarCataloguePath + ".idx", *catalogue, state->blind_solve_mag_limit);
+            std::atomic_store(&state->asterismIndex, index);
+        });
+    }
+
+    // Videos of the clips are encoded on the worker pool, if enabled and the encoder is available
+    if(!this->state->videoEncoder && this->state->video_queue_depth > 0) {
+        if(VideoEncoder::isAvailable()) {
+            this->state->videoEncoder = std::make_shared<VideoEncoder>(this->state->workerPool, this->state->video_queue_depth);
+            fprintf(stderr, "Video encoding: %s, queue depth %d\n", VideoEncoder::codecName, this->state->video_queue_depth);
+        }
+        else {
+            fprintf(stderr, "Video encoding: %s encoder not available; no videos will be encoded\n", VideoEncoder::codecName);
+        }
+    }
+
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
     //     Inform device about buffers & streaming mode      //
@@ -234,6 +309,21 @@ AcquisitionThread::AcquisitionThread(QObject *parent, AsteriaState * state)
         memset(buffer_start[b], 0, bufferinfo->length);
     }
 
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                       //
+    //     Allocate buffers used to pass frames between      //
+    //          the capture and decode stages                //
+    //                                                       //
+    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    rawFrames.resize(rawFrameQueueLength);
+    for(unsigned int r = 0; r < rawFrames.size(); r++) {
+        rawFrames[r].data.resize(bufferinfo->length);
+        freeRawFrames.push(r);
+    }
+
+    // A full queue is checked several times per frame period
+    pollPeriodUs = std::max(this->state->nominalFramePeriodUs / 10, 1000u);
 }
 
 AcquisitionThread::~AcquisitionThread()
@@ -263,6 +353,8 @@ AcquisitionThread::~AcquisitionThread()
     delete format;
     delete bufrequest;
 
+    framePool->printStats();
+
     fprintf(stderr, "Closing the camera...\n");
     ::close(*(this->state->fd));
 }
@@ -289,18 +381,21 @@ void AcquisitionThread::shutdown() {
 }
 
 void AcquisitionThread::preview() {
-    QMutexLocker locker(&mutex);
-    actions.push(PREVIEW);
+    queueAction(PREVIEW);
 }
 
 void AcquisitionThread::pause() {
-    QMutexLocker locker(&mutex);
-    actions.push(PAUSE);
+    queueAction(PAUSE);
 }
 
 void AcquisitionThread::detect() {
-    QMutexLocker locker(&mutex);
-    actions.push(DETECT);
+    queueAction(DETECT);
+}
+
+void AcquisitionThread::queueAction(Action action) {
+    if(!actions.tryPush(action)) {
+        fprintf(stderr, "Action queue is full; ignoring action %s\n", AcquisitionThread::actionNames[action].c_str());
+    }
 }
 
 void AcquisitionThread::toggleOverlay(int checkBoxState) {
@@ -324,6 +419,17 @@ void AcquisitionThread::updateCalibration(std::shared_ptr<CalibrationInventory>
     state->cal.swap(cal);
 }
 
+void AcquisitionThread::moveHeadToClip() {
+    std::pair<RingBuffer<std::shared_ptr<Imageuc>>::Span, RingBuffer<std::shared_ptr<Imageuc>>::Span> head = detectionHeadBuffer.spans();
+    for(std::shared_ptr<Imageuc> &headFrame : head.first) {
+        clipWriter->addFrame(std::move(headFrame));
+    }
+    for(std::shared_ptr<Imageuc> &headFrame : head.second) {
+        clipWriter->addFrame(std::move(headFrame));
+    }
+    detectionHeadBuffer.clear();
+}
+
 void AcquisitionThread::transitionToState(AcquisitionThread::AcquisitionState newState) {
     acqState = newState;
     emit transitionedToState(acqState);
@@ -341,7 +447,16 @@ void AcquisitionThread::run() {
     // Start in PAUSED state
     acqState = PAUSED;
     // ... queue up a DETECT action to initiate thread in DETECTING mode
-    actions.push(DETECT);
+    queueAction(DETECT);
+
+    // The acquisition is pipelined: the capture and decode stages run in their own threads and
+    // pass frames to the next stage through bounded queues, so that delays in the later stages
+    // are absorbed by the queues rather than causing V4L2 buffers to be dropped. This thread
+    // runs the detection stage and the state machine.
+    stopStages = false;
+    streamingRequested = false;
+    captureThread = std::thread(&AcquisitionThread::captureStage, this);
+    decodeThread = std::thread(&AcquisitionThread::decodeStage, this);
 
     // The number of frames recorded since the last trigger. Usually, there will be
     // multiple triggers during a single event, so we reset this counter to zero on each trigger
@@ -351,6 +466,18 @@ void AcquisitionThread::run() {
     // Counts the number of frames since we last calibrated
     unsigned int nFramesSinceLastCalibration = 0;
 
+    // Tracks the camera orientation between calibrations using a few bright stars. The refined orientation
+    // replaces that of the calibration in use when it changes significantly, and bumps and drift that the
+    // tracking can't follow trigger a calibration early. The tracking restarts whenever a new calibration is made.
+    std::unique_ptr<AttitudeTracker> attitudeTracker;
+    if(state->attitude_tracking_stars > 0) {
+        attitudeTracker.reset(new AttitudeTracker(state->refStarCatalogue, state->attitude_tracking_stars, state->attitude_tracking_roi_half_width,
+                                                  state->ref_star_faint_mag_limit, state->attitude_tracking_residual_threshold));
+    }
+    std::shared_ptr<CalibrationInventory> trackedCal;
+    // Indicates that a calibration has been triggered by the tracking, and not yet replaced the tracked one
+    bool attitudeRecalibrationPending = false;
+
     // Monitor the FPS using a ringbuffer to buffer the image capture times and get a moving average
     RingBuffer<long long> frameCaptureTimes(100u);
     double fps = 0.0;
@@ -363,12 +490,28 @@ void AcquisitionThread::run() {
     forever {
 
         if(abort) {
-            return;
+            break;
+        }
+
+        // Wait until there's an action to perform or a new image from the decode stage. Time out
+        // periodically to check the abort flag.
+        if(actions.size() == 0 && decodedFrames.size() == 0) {
+            struct pollfd fds[2];
+            fds[0].fd = actions.getWakeupFd();
+            fds[0].events = POLLIN;
+            fds[1].fd = decodedFrames.getWakeupFd();
+            fds[1].events = POLLIN;
+            if(poll(fds, 2, 100) < 0 && errno != EINTR) {
+                perror("poll");
+            }
+            // Items are always pushed before the wakeups are signalled, so they'll be found below
+            actions.clearWakeup();
+            decodedFrames.clearWakeup();
         }
 
         // Check if there's an action to perform
         Action action;
-        if(actions.pop(action)) {
+        if(actions.tryPop(action)) {
             // action now contains the action to perform
             switch(action) {
             case PREVIEW:
@@ -379,21 +522,7 @@ void AcquisitionThread::run() {
                     break;
                 case PAUSED:
                     // Turn on streaming; transition to PREVIEWING
-                    fprintf(stderr, "Adding buffers to incoming queue...\n");
-                    for(unsigned long k = 0; k<bufrequest->count; k++) {
-                        bufferinfo->index = k;
-                        bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                        bufferinfo->memory = V4L2_MEMORY_MMAP;
-                        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
-                            perror("VIDIOC_QBUF");
-                            exit(1);
-                        }
-                    }
-                    fprintf(stderr, "Activating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMON, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMON");
-                        exit(1);
-                    }
+                    streamingRequested = true;
                     transitionToState(PREVIEWING);
                     break;
                 case DETECTING:
@@ -402,13 +531,14 @@ void AcquisitionThread::run() {
                     break;
                 case RECORDING:
                     // Abort recording; don't save the partial results
-                    eventFrames.clear();
+                    clipWriter->abortClip();
                     nFramesSinceLastTrigger = 0;
                     transitionToState(PREVIEWING);
                     break;
                 case CALIBRATING:
                     // Abort calibration; don't save the partial results
                     calibrationFrames.clear();
+                    calibrationStats.reset();
                     transitionToState(PREVIEWING);
                     break;
                 }
@@ -418,11 +548,7 @@ void AcquisitionThread::run() {
                 switch(acqState) {
                 case PREVIEWING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
+                    streamingRequested = false;
                     i=0;
                     frameCaptureTimes.clear();
                     detectionHeadBuffer.clear();
@@ -433,11 +559,7 @@ void AcquisitionThread::run() {
                     break;
                 case DETECTING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
+                    streamingRequested = false;
                     i=0;
                     frameCaptureTimes.clear();
                     detectionHeadBuffer.clear();
@@ -445,31 +567,24 @@ void AcquisitionThread::run() {
                     break;
                 case RECORDING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
+                    streamingRequested = false;
                     i=0;
                     frameCaptureTimes.clear();
                     detectionHeadBuffer.clear();
                     // Abort recording; don't save the partial results
-                    eventFrames.clear();
+                    clipWriter->abortClip();
                     nFramesSinceLastTrigger = 0;
                     transitionToState(PAUSED);
                     break;
                 case CALIBRATING:
                     // Turn off streaming; transition to PAUSED
-                    fprintf(stderr, "Deactivating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMOFF");
-                        exit(1);
-                    }
+                    streamingRequested = false;
                     i=0;
                     frameCaptureTimes.clear();
                     detectionHeadBuffer.clear();
                     // Abort calibration; don't save the partial results
                     calibrationFrames.clear();
+                    calibrationStats.reset();
                     transitionToState(PAUSED);
                     break;
                 }
@@ -483,21 +598,7 @@ void AcquisitionThread::run() {
                     break;
                 case PAUSED:
                     // Turn on streaming; transition to DETECTING
-                    fprintf(stderr, "Adding buffers to incoming queue...\n");
-                    for(unsigned long k = 0; k<bufrequest->count; k++) {
-                        bufferinfo->index = k;
-                        bufferinfo->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-                        bufferinfo->memory = V4L2_MEMORY_MMAP;
-                        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
-                            perror("VIDIOC_QBUF");
-                            exit(1);
-                        }
-                    }
-                    fprintf(stderr, "Activating streaming...\n");
-                    if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMON, &(bufferinfo->type)) < 0){
-                        perror("VIDIOC_STREAMON");
-                        exit(1);
-                    }
+                    streamingRequested = true;
                     transitionToState(DETECTING);
                     break;
                 case DETECTING:
@@ -514,31 +615,23 @@ void AcquisitionThread::run() {
             }
         }
 
-        // Now proceed according to the current AcquisitionState
-        if(acqState==PAUSED) {
-            QThread::usleep(state->nominalFramePeriodUs);
+        // Retrieve the next image from the decode stage
+        std::shared_ptr<Imageuc> image;
+        if(!decodedFrames.tryPop(image)) {
+            // Nothing available yet
             continue;
         }
 
-        // Index into circular buffer
-        unsigned int j = (i++) % bufrequest->count;
-
-        bufferinfo->index = j;
-        bufferinfo->memory = V4L2_MEMORY_MMAP;
-
-        // Wait for this buffer to be dequeued then retrieve the image
-        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_DQBUF, bufferinfo) < 0) {
-            perror("VIDIOC_DQBUF");
-            exit(1);
+        // Now proceed according to the current AcquisitionState
+        if(acqState==PAUSED) {
+            // Discard any frames captured before streaming was turned off
+            continue;
         }
 
-        // The image is ready to be read; it is stored in the buffer with index j,
-        // which is mapped into application address space at buffer_start[j]
+        i++;
 
-        // System clock time (since startup/hibernation) of time first byte of data was captured [microseconds]
-        long long temp_us = 1000000LL * bufferinfo->timestamp.tv_sec + (long long) round(bufferinfo->timestamp.tv_usec);
-        // Translate to microseconds since 1970-01-01T00:00:00Z
-        long long epochTimeStamp_us = temp_us +  state->epochTimeDiffUs;
+        // Capture time of the image in microseconds since 1970-01-01T00:00:00Z
+        long long epochTimeStamp_us = image->epochTimeUs;
 
         string utc = TimeUtil::epochToUtcString(epochTimeStamp_us);
 
@@ -584,32 +677,6 @@ void AcquisitionThread::run() {
 
 
 
-        std::shared_ptr<Imageuc> image = make_shared<Imageuc>(state->width, state->height);
-        image->epochTimeUs = epochTimeStamp_us;
-        image->field = format->fmt.pix.field;
-
-        switch(format->fmt.pix.pixelformat) {
-            case V4L2_PIX_FMT_GREY: {
-                // Read the raw greyscale pixels to the image object
-                unsigned char * pBuf = buffer_start[j];
-                unsigned int nPix = state->width * state->height;
-                for(unsigned int p=0; p<nPix; p++) {
-                    image->rawImage[p] = *(pBuf++);
-                }
-                break;
-            }
-            case V4L2_PIX_FMT_MJPEG: {
-                // Convert the JPEG image to greyscale
-                JpgUtil::readJpeg((unsigned char *)buffer_start[j], bufferinfo->bytesused, image->rawImage);
-                break;
-            }
-            case V4L2_PIX_FMT_YUYV: {
-                // Convert the YUYV (luminance + chrominance) image to greyscale
-                JpgUtil::convertYuyv422((unsigned char *)buffer_start[j], bufferinfo->bytesused, image->rawImage);
-                break;
-            }
-        }
-
         // TODO: if the frame number i is less than the number of frames to flush, skip the rest of the
         // loop.
 
@@ -630,18 +697,13 @@ void AcquisitionThread::run() {
 
             if(state->headless) {
                 // Headless mode: print frame stats to console
-                fprintf(stderr, "+++ FPS: %06f Dropped: %06d Total: %06lu +++\n", fps, droppedFramesCounter, i);
+                fprintf(stderr, "+++ FPS: %06f Dropped: %06d Total: %06lu Queued: %02lu/%02lu +++\n", fps, droppedFramesCounter, i,
+                        capturedRawFrames.size(), decodedFrames.size());
             }
         }
         lastFrameCaptureTime = epochTimeStamp_us;
 
-        AcquisitionVideoStats stats(fps, droppedFramesCounter, i, utc);
-
-        // Re-enqueue the buffer now we've extracted all the image data
-        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, bufferinfo) < 0){
-            perror("VIDIOC_QBUF");
-            exit(1);
-        }
+        AcquisitionVideoStats stats(fps, droppedFramesCounter, i, utc, capturedRawFrames.size(), decodedFrames.size());
 
         // Retrieve the previous image...
         std::shared_ptr<Imageuc> prev = detectionHeadBuffer.back();
@@ -665,22 +727,13 @@ void AcquisitionThread::run() {
 
             // Events are detected by counting the number of pixels with significant
             // changes in brightness. If this is above a threshold then an event is detected.
-            unsigned int nChangedPixels = 0;
-
-            for(unsigned int p=0; p< state->width * state->height; p++) {
-
-                unsigned char newPixel = image->rawImage[p];
-                unsigned char oldPixel = prev->rawImage[p];
+            unsigned int nChangedPixels = FrameDiffUtil::countChangedPixels(&(image->rawImage[0]), &(prev->rawImage[0]),
+                                                                            state->width * state->height, state->pixel_difference_threshold);
 
-                if((unsigned int)abs(newPixel - oldPixel) > state->pixel_difference_threshold) {
-                    nChangedPixels++;
-                    if(newPixel - oldPixel > 0) {
-                        loc.changedPixelsPositive.push_back(p);
-                    }
-                    else {
-                        loc.changedPixelsNegative.push_back(p);
-                    }
-                }
+            // The indices of the changed pixels are only needed to draw the overlay image
+            if(!state->headless && showOverlayImage) {
+                FrameDiffUtil::getChangedPixels(&(image->rawImage[0]), &(prev->rawImage[0]), state->width * state->height,
+                                                state->pixel_difference_threshold, loc.changedPixelsPositive, loc.changedPixelsNegative);
             }
 
             if(nChangedPixels > state->n_changed_pixels_for_trigger) {
@@ -695,23 +748,56 @@ void AcquisitionThread::run() {
 
         // Process the acquisition
         if(acqState == DETECTING) {
+
+            // Update the tracked camera orientation periodically
+            bool attitudeLost = false;
+            std::shared_ptr<CalibrationInventory> cal = state->cal;
+            if(attitudeTracker && !event && cal && cal->cam && nFramesSinceLastCalibration % state->attitude_tracking_interval == 0) {
+                if(cal != trackedCal) {
+                    trackedCal = cal;
+                    attitudeTracker->setCalibration(cal->cam, cal->q_sez_cam, MathUtil::toRadians(cal->longitude), MathUtil::toRadians(cal->latitude));
+                    attitudeRecalibrationPending = false;
+                }
+                bool updated = attitudeTracker->update(*image);
+                attitudeLost = attitudeTracker->isCalibrationRequired() && !attitudeRecalibrationPending;
+                if(updated && !attitudeTracker->isCalibrationRequired() &&
+                        attitudeTracker->getAttitude().angularDistance(cal->q_sez_cam) > attitudePublishThreshold) {
+                    // Publish the refined orientation, as a copy of the calibration so that it's not modified
+                    // while in use elsewhere; the tracking continues from the same calibration
+                    fprintf(stderr, "Refined camera orientation by %.1f [arcsec] (%u stars, residual %.2f [pixels])\n",
+                            MathUtil::toDegrees(attitudeTracker->getAttitude().angularDistance(cal->q_sez_cam)) * 3600.0,
+                            attitudeTracker->getNumMeasured(), attitudeTracker->getRmsResidual());
+                    trackedCal = cal->withAttitude(attitudeTracker->getAttitude());
+                    state->cal = trackedCal;
+                }
+            }
+
             // Transition to RECORDING if we've detected an event
             if(event) {
                 transitionToState(RECORDING);
-                // Copy the detection head buffer contents to the event frames buffer
-                std::vector<std::shared_ptr<Imageuc>> detectionHeadFrames = detectionHeadBuffer.unroll();
-                eventFrames.insert(eventFrames.end(), detectionHeadFrames.begin(), detectionHeadFrames.end());
+                // Start a new clip and move the detection head buffer contents (including the current
+                // frame) to the clip writer...
+                clipWriter->beginClip(detectionHeadBuffer.front()->epochTimeUs);
+                moveHeadToClip();
+                // ...and keep the current frame for detecting changes in the next one
+                detectionHeadBuffer.push(image);
             }
 
-            // Transition to CALIBRATING if counter has reached (or passed) limit
-            else if(nFramesSinceLastCalibration >= calibration_intervals_frames) {
+            // Transition to CALIBRATING if counter has reached (or passed) limit, or the camera orientation
+            // has changed by more than the tracking can follow
+            else if(nFramesSinceLastCalibration >= calibration_intervals_frames || attitudeLost) {
+                if(attitudeLost) {
+                    fprintf(stderr, "Lost track of camera orientation (%u stars, residual %f [pixels]); calibrating early\n",
+                            attitudeTracker->getNumMeasured(), attitudeTracker->getRmsResidual());
+                    attitudeRecalibrationPending = true;
+                }
                 transitionToState(CALIBRATING);
             }
         }
         else if(acqState == RECORDING) {
 
-            // Add the image to the event frames buffer
-            eventFrames.push_back(image);
+            // Add the image to the clip
+            clipWriter->addFrame(image);
 
             // Increment the counter
             nFramesSinceLastTrigger++;
@@ -723,21 +809,26 @@ void AcquisitionThread::run() {
 
             // Stop recording if we hit the upper limit on clip length, or when enough frames have passed
             // since the last detected event.
-            if(eventFrames.size() >= max_clip_length_frames || nFramesSinceLastTrigger > state->detection_tail) {
-                // Create an AnalysisWorker to analyse the clip in a dedicated thread
-                QThread* thread = new QThread;
-                AnalysisWorker* worker = new AnalysisWorker(NULL, this->state, this->state->cal, eventFrames);
-                worker->moveToThread(thread);
-                connect(thread, SIGNAL(started()), worker, SLOT(process()));
-                connect(worker, SIGNAL(finished(std::string)), thread, SLOT(quit()));
-                connect(worker, SIGNAL(finished(std::string)), worker, SLOT(deleteLater()));
-                connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+            if(clipWriter->getFramesInClip() >= max_clip_length_frames || nFramesSinceLastTrigger > state->detection_tail) {
+                // Finish the clip; the remaining frames are written in the background
+                std::shared_ptr<ClipWriter::Clip> clip = clipWriter->endClip();
+
+                // Create an AnalysisWorker to analyse the clip on the worker pool; it reads the frames
+                // back once the clip has been written
+                AnalysisWorker* worker = new AnalysisWorker(NULL, this->state, this->state->cal, clip);
                 // Notify listeners when a new clip is available
                 connect(worker, SIGNAL(finished(std::string)), this, SIGNAL(acquiredClip(std::string)));
-                thread->start();
-
-                // Clear the event frame buffer
-                eventFrames.clear();
+                // The worker is run and deleted on a pool thread, so detach it from this one
+                worker->moveToThread(0);
+                // If the job is discarded then the raw frames are left on disk without the analysis results
+                std::string clipPath = clip->getPath();
+                state->workerPool->submit("analysis " + clip->getUtc(), [worker]() {worker->process(); delete worker;}, [worker, clipPath]() {
+                    fprintf(stderr, "Clip %s will not be analysed\n", clipPath.c_str()); delete worker;});
+
+                if(state->headless) {
+                    framePool->printStats();
+                    state->workerPool->printStats();
+                }
 
                 // Reset counter
                 nFramesSinceLastTrigger = 0;
@@ -752,33 +843,50 @@ void AcquisitionThread::run() {
                 // Abort calibration: the calibration algorithms assume the signal is stable, and are compromised
                 // by the occurence of events in the scene.
                 calibrationFrames.clear();
+                calibrationStats.reset();
+                // Allow the tracking to trigger the calibration again
+                attitudeRecalibrationPending = false;
                 // Transition to RECORDING to capture the event
                 transitionToState(RECORDING);
-                // Copy the detection head buffer contents to the event frames buffer
-                std::vector<std::shared_ptr<Imageuc>> detectionHeadFrames = detectionHeadBuffer.unroll();
-                eventFrames.insert(eventFrames.end(), detectionHeadFrames.begin(), detectionHeadFrames.end());
+                // Start a new clip and move the detection head buffer contents (including the current
+                // frame) to the clip writer...
+                clipWriter->beginClip(detectionHeadBuffer.front()->epochTimeUs);
+                moveHeadToClip();
+                // ...and keep the current frame for detecting changes in the next one
+                detectionHeadBuffer.push(image);
             }
             else {
-                // Add the frame to the calibration set
-                calibrationFrames.push_back(image);
+                // Add the frame to the per-pixel statistics; the frames themselves aren't retained. This is done on
+                // the acquisition thread rather than starting threads for every frame.
+                if(!calibrationStats) {
+                    calibrationStats = std::make_shared<PixelStatsAccumulator>(state->width, state->height, state->calibration_stack,
+                                                                               CalibrationWorker::signalTrimFraction, 1);
+                }
+                calibrationStats->addFrame(*image);
+
+                // Keep the first and most recent frames, which record the time span of the calibration
+                if(calibrationFrames.size() < 2) {
+                    calibrationFrames.push_back(image);
+                }
+                else {
+                    calibrationFrames.back() = image;
+                }
 
                 // Determine if we've recorded all the calibration frames we need
-                if(calibrationFrames.size() >= state->calibration_stack) {
-                    // Got enough frames: run calibration algorithm
-                    QThread* thread = new QThread;
-                    CalibrationWorker* worker = new CalibrationWorker(NULL, this->state, this->state->cal, calibrationFrames);
-                    worker->moveToThread(thread);
-                    connect(thread, SIGNAL(started()), worker, SLOT(process()));
-                    connect(worker, SIGNAL(finished(std::string)), thread, SLOT(quit()));
-                    connect(worker, SIGNAL(finished(std::string)), worker, SLOT(deleteLater()));
-                    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+                if(calibrationStats->getFrameCount() >= state->calibration_stack) {
+                    // Got enough frames: run calibration algorithm on the worker pool. A newer calibration
+                    // supersedes any that hasn't started yet when the queue policy is to coalesce.
+                    CalibrationWorker* worker = new CalibrationWorker(NULL, this->state, this->state->cal, calibrationStats, calibrationFrames);
                     // Notify listeners when a new calibration is available
                     connect(worker, SIGNAL(finished(std::string)), this, SIGNAL(acquiredCalibration(std::string)));
                     // Swap out the current calibration for the new one
                     connect(worker, SIGNAL(finished(std::shared_ptr<CalibrationInventory>)), this, SLOT(updateCalibration(std::shared_ptr<CalibrationInventory>)));
-                    thread->start();
+                    // The worker is run and deleted on a pool thread, so detach it from this one
+                    worker->moveToThread(0);
+                    state->workerPool->submit("calibration", [worker]() {worker->process(); delete worker;}, [worker]() {delete worker;});
 
-                    // Clear the calibration buffer, reset the counter
+                    // Hand the statistics over to the worker and clear the calibration buffer, reset the counter
+                    calibrationStats.reset();
                     calibrationFrames.clear();
                     nFramesSinceLastCalibration = 0;
 
@@ -797,4 +905,172 @@ void AcquisitionThread::run() {
         emit videoStats(stats);
     }
 
+    // Don't keep any partially recorded clip
+    clipWriter->abortClip();
+
+    // Shut down the capture and decode stages
+    stopStages = true;
+    captureThread.join();
+    decodeThread.join();
+}
+
+void AcquisitionThread::captureStage() {
+
+    // Indicates whether the camera is currently streaming
+    bool streaming = false;
+
+    struct v4l2_buffer buf;
+
+    while(!stopStages) {
+
+        bool streamingReq = streamingRequested;
+
+        if(streamingReq && !streaming) {
+            // Turn on streaming
+            fprintf(stderr, "Adding buffers to incoming queue...\n");
+            for(unsigned long k = 0; k<bufrequest->count; k++) {
+                memset(&buf, 0, sizeof(buf));
+                buf.index = k;
+                buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+                buf.memory = V4L2_MEMORY_MMAP;
+                if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, &buf) < 0){
+                    perror("VIDIOC_QBUF");
+                    exit(1);
+                }
+            }
+            fprintf(stderr, "Activating streaming...\n");
+            if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMON, &(buf.type)) < 0){
+                perror("VIDIOC_STREAMON");
+                exit(1);
+            }
+            streaming = true;
+        }
+        else if(!streamingReq && streaming) {
+            // Turn off streaming; this also removes all buffers from the incoming and outgoing queues
+            fprintf(stderr, "Deactivating streaming...\n");
+            if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(buf.type)) < 0){
+                perror("VIDIOC_STREAMOFF");
+                exit(1);
+            }
+            streaming = false;
+        }
+
+        if(!streaming) {
+            QThread::usleep(state->nominalFramePeriodUs);
+            continue;
+        }
+
+        // Wait for a frame to become available. Time out periodically so that requests to change
+        // the streaming state or shut down are handled even if the camera stops delivering frames.
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(*(this->state->fd), &fds);
+        struct timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        int r = select(*(this->state->fd) + 1, &fds, NULL, NULL, &tv);
+        if(r < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            exit(1);
+        }
+        if(r == 0) {
+            fprintf(stderr, "Timed out waiting for frame\n");
+            continue;
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+
+        // Retrieve the next filled buffer
+        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_DQBUF, &buf) < 0) {
+            perror("VIDIOC_DQBUF");
+            exit(1);
+        }
+
+        // The image is ready to be read; it is stored in the buffer with index buf.index,
+        // which is mapped into application address space at buffer_start[buf.index]
+
+        // System clock time (since startup/hibernation) of time first byte of data was captured [microseconds]
+        long long temp_us = 1000000LL * buf.timestamp.tv_sec + (long long) round(buf.timestamp.tv_usec);
+        // Translate to microseconds since 1970-01-01T00:00:00Z
+        long long epochTimeStamp_us = temp_us +  state->epochTimeDiffUs;
+
+        // Copy the data out so that the buffer can be returned to the driver straight away
+        unsigned int slot;
+        if(freeRawFrames.pop(slot)) {
+            RawFrame &raw = rawFrames[slot];
+            memcpy(&(raw.data[0]), buffer_start[buf.index], std::min<size_t>(buf.bytesused, raw.data.size()));
+            raw.bytesused = buf.bytesused;
+            raw.epochTimeUs = epochTimeStamp_us;
+            capturedRawFrames.tryPush(slot);
+        }
+        // If there are no free RawFrames then the decode stage has fallen too far behind and the frame is
+        // dropped; this is picked up by the detection stage from the gap in the frame timestamps.
+
+        // Re-enqueue the buffer now we've extracted all the image data
+        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_QBUF, &buf) < 0){
+            perror("VIDIOC_QBUF");
+            exit(1);
+        }
+    }
+
+    if(streaming) {
+        fprintf(stderr, "Deactivating streaming...\n");
+        if(IoUtil::xioctl(*(this->state->fd), VIDIOC_STREAMOFF, &(buf.type)) < 0){
+            perror("VIDIOC_STREAMOFF");
+        }
+    }
+}
+
+void AcquisitionThread::decodeStage() {
+
+    while(!stopStages) {
+
+        unsigned int slot;
+        if(!capturedRawFrames.pop(slot, 100000)) {
+            // Nothing available yet; time out periodically to check whether to stop
+            continue;
+        }
+
+        RawFrame &raw = rawFrames[slot];
+
+        // Recycled image; all pixels are overwritten below
+        std::shared_ptr<Imageuc> image = framePool->acquire();
+        image->epochTimeUs = raw.epochTimeUs;
+        image->field = format->fmt.pix.field;
+
+        switch(format->fmt.pix.pixelformat) {
+            case V4L2_PIX_FMT_GREY: {
+                // Read the raw greyscale pixels to the image object
+                unsigned int nPix = state->width * state->height;
+                memcpy(&(image->rawImage[0]), &(raw.data[0]), std::min<size_t>(nPix, raw.data.size()));
+                break;
+            }
+            case V4L2_PIX_FMT_MJPEG: {
+                // Convert the JPEG image to greyscale
+                JpgUtil::readJpeg(&(raw.data[0]), raw.bytesused, image->rawImage);
+                break;
+            }
+            case V4L2_PIX_FMT_YUYV: {
+                // Convert the YUYV (luminance + chrominance) image to greyscale
+                JpgUtil::convertYuyv422(&(raw.data[0]), raw.bytesused, image->rawImage);
+                break;
+            }
+        }
+
+        // Return the RawFrame to the capture stage
+        freeRawFrames.push(slot);
+
+        // Pass the image on to the detection stage, waiting for space in the queue if necessary
+        while(!decodedFrames.tryPush(image)) {
+            if(stopStages) {
+                return;
+            }
+            QThread::usleep(pollPeriodUs);
+        }
+    }
 }
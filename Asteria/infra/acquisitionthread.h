@@ -4,13 +4,19 @@
 #include "infra/asteriastate.h"
 #include "infra/imageuc.h"
 #include "infra/ringbuffer.h"
-#include "infra/concurrentqueue.h"
+#include "infra/lockfreequeue.h"
 #include "infra/acquisitionvideostats.h"
+#include "infra/framepool.h"
+#include "infra/spscqueue.h"
+#include "infra/clipwriter.h"
+#include "infra/pixelstatsaccumulator.h"
 
 #include <linux/videodev2.h>
 #include <vector>
 #include <memory>               // shared_ptr
 #include <string>
+#include <thread>
+#include <atomic>
 
 #include <QThread>
 #include <QMutex>
@@ -121,6 +127,86 @@ private:
      */
     unsigned char ** buffer_start;
 
+    /**
+     * @brief Stores a copy of the data from one V4L2 buffer, for handing off from the capture stage
+     * to the decode stage.
+     */
+    struct RawFrame {
+        // The raw image data; sized to the V4L2 buffer length
+        std::vector<unsigned char> data;
+        // Number of bytes of image data
+        unsigned int bytesused;
+        // Epoch time of the image capture [microseconds]
+        long long epochTimeUs;
+    };
+
+    /**
+     * @brief Number of RawFrames that can be held between the capture and decode stages.
+     */
+    static const unsigned int rawFrameQueueLength = 16;
+
+    /**
+     * @brief Number of decoded images that can be held between the decode and detection stages.
+     */
+    static const unsigned int decodedFrameQueueLength = 16;
+
+    /**
+     * @brief Change in the tracked camera orientation above which it replaces the orientation of the calibration
+     * in use [radians]
+     */
+    static constexpr double attitudePublishThreshold = 10.0 / 206264.806;
+
+    /**
+     * @brief Storage for the RawFrames; these are passed between the capture and decode stages by index.
+     */
+    std::vector<RawFrame> rawFrames;
+
+    /**
+     * @brief Indices of the RawFrames that are free to be filled by the capture stage.
+     */
+    SpscQueue<unsigned int> freeRawFrames;
+
+    /**
+     * @brief Indices of the RawFrames that have been filled by the capture stage and are waiting to be decoded.
+     */
+    LockFreeQueue<unsigned int, true> capturedRawFrames;
+
+    /**
+     * @brief Images that have been decoded and are waiting to be processed by the detection stage.
+     */
+    LockFreeQueue<std::shared_ptr<Imageuc>, true> decodedFrames;
+
+    /**
+     * @brief Thread running the capture stage.
+     */
+    std::thread captureThread;
+
+    /**
+     * @brief Thread running the decode stage.
+     */
+    std::thread decodeThread;
+
+    /**
+     * @brief Flag used to stop the capture and decode stages.
+     */
+    std::atomic<bool> stopStages;
+
+    /**
+     * @brief Indicates whether the detection stage wants the camera to be streaming; the capture
+     * stage turns streaming on and off accordingly.
+     */
+    std::atomic<bool> streamingRequested;
+
+    /**
+     * @brief Period to wait before checking a full queue again [microseconds].
+     */
+    unsigned int pollPeriodUs;
+
+    /**
+     * @brief Pool of recycled frames used to store the captured images.
+     */
+    std::shared_ptr<FramePool> framePool;
+
     /**
      * @brief detectionHeadBuffer
      * Used to buffer the acquired frames so that we have some footage from before an event.
@@ -129,17 +215,22 @@ private:
     RingBuffer<std::shared_ptr<Imageuc>> detectionHeadBuffer;
 
     /**
-     * @brief eventFrames
-     * Buffer to store the detection and 'detection tail' footage
+     * @brief Writes the detection head, detection and 'detection tail' footage to disk in the background
+     * while recording, so that clips needn't be held in memory.
      */
-    std::vector<std::shared_ptr<Imageuc>> eventFrames;
+    std::unique_ptr<ClipWriter> clipWriter;
 
     /**
      * @brief calibrationFrames
-     * Buffer to store the calibration footage
+     * The first and most recent frames of the calibration footage
      */
     std::vector<std::shared_ptr<Imageuc>> calibrationFrames;
 
+    /**
+     * @brief Per-pixel statistics of the calibration footage, accumulated as the frames arrive.
+     */
+    std::shared_ptr<PixelStatsAccumulator> calibrationStats;
+
     /**
      * @brief state
      * The current state of the acquisition thread, which determines what is done with newly
@@ -153,7 +244,12 @@ private:
      * provided within the space of one frame, and the thread should handle each in turn to avoid
      * concurrency problems.
      */
-    ConcurrentQueue<Action> actions;
+    LockFreeQueue<Action> actions;
+
+    /**
+     * @brief Maximum number of actions that can be queued.
+     */
+    static const unsigned int actionQueueLength = 16;
 
     /**
      * @brief calibration_intervals_frames
@@ -178,6 +274,30 @@ private:
      */
     QMutex mutex;
 
+    /**
+     * @brief Capture stage of the acquisition pipeline: dequeues the V4L2 buffers, copies the data out
+     * to a RawFrame and requeues the buffer. Also turns streaming on and off as requested.
+     */
+    void captureStage();
+
+    /**
+     * @brief Decode stage of the acquisition pipeline: converts the RawFrames to greyscale images.
+     */
+    void decodeStage();
+
+    /**
+     * @brief Adds an action to the queue of actions to be performed by the acquisition thread.
+     * @param action
+     *  The action to perform.
+     */
+    void queueAction(Action action);
+
+    /**
+     * @brief Moves the frames in the detection head buffer to the current clip, in order from the oldest,
+     * leaving the buffer empty.
+     */
+    void moveHeadToClip();
+
     /**
      * @brief transitionToState
      * Function used to perform state transitions internally, so we can log whenever they happen
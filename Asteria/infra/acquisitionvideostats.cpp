@@ -5,11 +5,13 @@ AcquisitionVideoStats::AcquisitionVideoStats() {
 }
 
 AcquisitionVideoStats::AcquisitionVideoStats(const AcquisitionVideoStats &copyme) :
-    fps(copyme.fps), droppedFrames(copyme.droppedFrames), totalFrames(copyme.totalFrames), utc(copyme.utc) {
+    fps(copyme.fps), droppedFrames(copyme.droppedFrames), totalFrames(copyme.totalFrames), utc(copyme.utc),
+    captureQueueDepth(copyme.captureQueueDepth), decodeQueueDepth(copyme.decodeQueueDepth) {
 
 }
 
-AcquisitionVideoStats::AcquisitionVideoStats(const double &fps, const unsigned int &droppedFrames, const unsigned int &totalFrames, const std::string &utc) :
-    fps(fps), droppedFrames(droppedFrames), totalFrames(totalFrames), utc(utc) {
+AcquisitionVideoStats::AcquisitionVideoStats(const double &fps, const unsigned int &droppedFrames, const unsigned int &totalFrames, const std::string &utc,
+                                             const unsigned int &captureQueueDepth, const unsigned int &decodeQueueDepth) :
+    fps(fps), droppedFrames(droppedFrames), totalFrames(totalFrames), utc(utc), captureQueueDepth(captureQueueDepth), decodeQueueDepth(decodeQueueDepth) {
 
 }
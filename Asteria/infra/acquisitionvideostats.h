@@ -13,7 +13,8 @@ class AcquisitionVideoStats
 public:
     AcquisitionVideoStats();
     AcquisitionVideoStats(const AcquisitionVideoStats &copyme);
-    AcquisitionVideoStats(const double &fps, const unsigned int &droppedFrames, const unsigned int &totalFrames, const std::string &utc);
+    AcquisitionVideoStats(const double &fps, const unsigned int &droppedFrames, const unsigned int &totalFrames, const std::string &utc,
+                          const unsigned int &captureQueueDepth, const unsigned int &decodeQueueDepth);
 
     /**
      * @brief fps
@@ -39,6 +40,18 @@ public:
      */
     std::string utc;
 
+    /**
+     * @brief captureQueueDepth
+     * Number of captured frames waiting to be decoded
+     */
+    unsigned int captureQueueDepth;
+
+    /**
+     * @brief decodeQueueDepth
+     * Number of decoded frames waiting to be processed by the detection stage
+     */
+    unsigned int decodeQueueDepth;
+
 };
 
 #endif // ACQUISITIONVIDEOSTATS_H
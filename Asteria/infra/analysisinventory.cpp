@@ -1,4 +1,6 @@
 #include "infra/analysisinventory.h"
+#include "infra/clipfile.h"
+#include "infra/archiveindex.h"
 #include "util/timeutil.h"
 #include "util/fileutil.h"
 #include "util/serializationutil.h"
@@ -8,7 +10,6 @@
 #include <iostream>
 #include <functional>
 #include <memory>
-#include <dirent.h>
 
 #include <boost/archive/xml_oarchive.hpp>
 #include <boost/archive/xml_iarchive.hpp>
@@ -23,21 +24,27 @@ AnalysisInventory::AnalysisInventory(const std::vector<std::shared_ptr<Imageuc>>
         locs[i].epochTimeUs = eventFrames[i]->epochTimeUs;
     }
 
-    // Read image width & height from first frame
-    unsigned int width = eventFrames[0]->width;
-    unsigned int height = eventFrames[0]->height;
-
     // Create a peak hold image
-    peakHold = std::make_shared<Imageuc>(width, height);
-    peakHold->epochTimeUs = eventFrames[0]->epochTimeUs;
     for(unsigned int i = 0; i < eventFrames.size(); ++i) {
-        Imageuc &image = *eventFrames[i];
-        // Compute peak hold image
-        for(unsigned int k=0; k<image.height; k++) {
-            for(unsigned int l=0; l<image.width; l++) {
-                unsigned int offset = k*image.width + l;
-                peakHold->rawImage[offset] = std::max(peakHold->rawImage[offset], image.rawImage[offset]);
-            }
+        updatePeakHold(*eventFrames[i]);
+    }
+}
+
+void AnalysisInventory::updatePeakHold(const Imageuc &image) {
+
+    if(!peakHold) {
+        // Read image width & height from first frame
+        unsigned int width = image.width;
+        unsigned int height = image.height;
+        peakHold = std::make_shared<Imageuc>(width, height);
+        peakHold->epochTimeUs = image.epochTimeUs;
+    }
+
+    // Compute peak hold image
+    for(unsigned int k=0; k<image.height; k++) {
+        for(unsigned int l=0; l<image.width; l++) {
+            unsigned int offset = k*image.width + l;
+            peakHold->rawImage[offset] = std::max(peakHold->rawImage[offset], image.rawImage[offset]);
         }
     }
 }
@@ -47,41 +54,14 @@ AnalysisInventory *AnalysisInventory::loadFromDir(std::string path) {
     std::string raw = path + "/raw";
     std::string processed = path + "/processed";
 
-    // Load the raw images
-    DIR *dir;
-    if ((dir = opendir (raw.c_str())) == NULL) {
-        // Couldn't open the directory!
-        return NULL;
-    }
-
     AnalysisInventory * inv = new AnalysisInventory();
 
     // Load raw data products (the captured images)
-    struct dirent *child;
-    while ((child = readdir (dir)) != NULL) {
-
-        // Skip the . and .. directories
-        if(strcmp(child->d_name,".") == 0 || strcmp(child->d_name,"..") == 0) {
-            continue;
-        }
-
-        // Match files with names starting with UTC string, e.g. 2017-06-14T19:41:09.282Z.pgm
-        // These are the raw frames from the sequence
-        if(std::regex_search(child->d_name, TimeUtil::utcRegex, std::regex_constants::match_continuous)) {
-            // Build full path to the item
-            std::string childPath = raw + "/" + child->d_name;
-            // Load the image from file and store a shared pointer to it in the vector
-            std::ifstream input(childPath);
-            auto seq = std::make_shared<Imageuc>();
-            input >> *seq;
-            inv->eventFrames.push_back(seq);
-            input.close();
-        }
+    if(!ClipFile::loadFrames(raw, inv->eventFrames)) {
+        // Couldn't open the directory!
+        delete inv;
+        return NULL;
     }
-    closedir (dir);
-
-    // Sort the image sequence into ascending order of capture time
-    std::sort(inv->eventFrames.begin(), inv->eventFrames.end(), Imageuc::comparePtrToImage);
 
     // Load derived data products
 
@@ -121,61 +101,28 @@ AnalysisInventory *AnalysisInventory::loadFromDir(std::string path) {
     return inv;
 }
 
-void AnalysisInventory::saveToDir(std::string topLevelPath) {
+void AnalysisInventory::saveToDir(std::string topLevelPath, unsigned int keyFrameInterval) {
 
     // Create new directory to store results for this clip. The path is set by the
     // date and time of the first frame
-    std::string utc = TimeUtil::epochToUtcString(eventFrames[0u]->epochTimeUs);
-    std::string yyyy = TimeUtil::extractYearFromUtcString(utc);
-    std::string mm = TimeUtil::extractMonthFromUtcString(utc);
-    std::string dd = TimeUtil::extractDayFromUtcString(utc);
-
-    std::vector<std::string> subLevels;
-    subLevels.push_back(yyyy);
-    subLevels.push_back(mm);
-    subLevels.push_back(dd);
-    subLevels.push_back(utc);
-    std::string path = topLevelPath + "/" + yyyy + "/" + mm + "/" + dd + "/" + utc;
+    std::string utc = TimeUtil::epochToUtcString(locs[0u].epochTimeUs);
+    std::string path = getClipPath(topLevelPath, utc);
 
-    if(!FileUtil::createDirs(topLevelPath, subLevels)) {
+    if(!createClipDirs(topLevelPath, utc)) {
         fprintf(stderr, "Couldn't create directory %s\n", path.c_str());
         return;
     }
 
-    // Create raw/ and processed/ subdirectories
-    FileUtil::createDir(path, "raw");
-    FileUtil::createDir(path, "processed");
     std::string raw = path + "/raw";
     std::string processed = path + "/processed";
 
-    // Write out raw images
-
-    for(unsigned int i = 0; i < eventFrames.size(); ++i) {
-
-        Imageuc &image = *eventFrames[i];
-
-        // Write the image data out to a file
-        char filename [100];
-        std::string utcFrame = TimeUtil::epochToUtcString(image.epochTimeUs);
-        sprintf(filename, "%s/%s.pgm", raw.c_str(), utcFrame.c_str());
-
-        // PGM (grey image)
-        std::ofstream out(filename);
-        out << image;
-        out.close();
+    // Write out raw images; these are only held in memory if the clip wasn't streamed to disk during acquisition
+    if(!eventFrames.empty() && !ClipFile::save(raw + "/" + ClipFile::filename, eventFrames, keyFrameInterval)) {
+        fprintf(stderr, "Couldn't write clip file in %s\n", raw.c_str());
     }
 
     // Write out processed data
 
-    // Encode a video from the raw frames, for display on the website
-    // Video can be encoded using the command:
-    // $ cat *.pgm | avconv -f image2pipe -i pipe:.pgm -vcodec libx264 -crf 0 neognc.avi
-    // ...and decoded to individual frames using the command:
-    // $ avconv -i neognc.avi -vsync 1 -r 25 -an -y out_%04d.pgm
-    char command [1000];
-    sprintf(command, "cat %s/*.pgm | avconv -f image2pipe -framerate 25 -i pipe:.pgm -vcodec libx264 -crf 0 %s/%s.avi", raw.c_str(), processed.c_str(), utc.c_str());
-    system(command);
-
     // Write out the peak hold image
     char filename [100];
     sprintf(filename, "%s/peakhold.pgm", processed.c_str());
@@ -194,6 +141,33 @@ void AnalysisInventory::saveToDir(std::string topLevelPath) {
     // write class instance to archive
     oa & BOOST_SERIALIZATION_NVP(locs);
     ofs.close();
+
+    // Record the clip in the archive index
+    ArchiveIndex::get(topLevelPath)->add(utc, locs.size(), locs.back().epochTimeUs - locs.front().epochTimeUs);
+}
+
+std::string AnalysisInventory::getClipPath(std::string topLevelPath, std::string utc) {
+    std::string yyyy = TimeUtil::extractYearFromUtcString(utc);
+    std::string mm = TimeUtil::extractMonthFromUtcString(utc);
+    std::string dd = TimeUtil::extractDayFromUtcString(utc);
+    return topLevelPath + "/" + yyyy + "/" + mm + "/" + dd + "/" + utc;
+}
+
+bool AnalysisInventory::createClipDirs(std::string topLevelPath, std::string utc) {
+
+    std::vector<std::string> subLevels;
+    subLevels.push_back(TimeUtil::extractYearFromUtcString(utc));
+    subLevels.push_back(TimeUtil::extractMonthFromUtcString(utc));
+    subLevels.push_back(TimeUtil::extractDayFromUtcString(utc));
+    subLevels.push_back(utc);
+
+    if(!FileUtil::createDirs(topLevelPath, subLevels)) {
+        return false;
+    }
+
+    // Create raw/ and processed/ subdirectories
+    std::string path = getClipPath(topLevelPath, utc);
+    return FileUtil::createDir(path, "raw") && FileUtil::createDir(path, "processed");
 }
 
 void AnalysisInventory::deleteClip() {
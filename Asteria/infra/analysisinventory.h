@@ -40,13 +40,14 @@ public slots:
           |-13/
              |-2017-08-13T01:53:58.832Z/
                 |-raw/
-                |  |-file1
-                |  |-file1
-                |  |-fileN
+                |  |-frames.clip
                 |-derived/
                    |-peakhold.pgm
       \endverbatim
      *
+     * The raw frames are stored in a single ClipFile; clips saved before this was introduced, which store
+     * each frame in a separate PGM file in raw/, are also loaded.
+     *
      * @param path
      *  Path to the directory node containing the AnalysisInventory data, e.g. in the example
      * above this would be the full path to the 2017-08-13T01:53:58.832Z/ directory.
@@ -55,7 +56,46 @@ public slots:
      */
     static AnalysisInventory * loadFromDir(std::string path);
 
-    void saveToDir(std::string topLevelPath);
+    /**
+     * @brief Save the AnalysisInventory to disk, in the file structure described in loadFromDir(...). Only
+     * the raw frames held in eventFrames are written; frames that were streamed to disk during acquisition
+     * by the ClipWriter are already in place.
+     * @param topLevelPath
+     *  The top level directory in which the clip directory is created.
+     * @param keyFrameInterval
+     *  Interval between key frames when compressing the raw frames; zero stores the frames uncompressed.
+     */
+    void saveToDir(std::string topLevelPath, unsigned int keyFrameInterval);
+
+    /**
+     * @brief Get the path to the directory that stores the data for a clip.
+     * @param topLevelPath
+     *  The top level directory, e.g. the directory containing 2017/ in the example above.
+     * @param utc
+     *  The UTC string of the first frame in the clip.
+     * @return
+     *  The full path to the clip directory.
+     */
+    static std::string getClipPath(std::string topLevelPath, std::string utc);
+
+    /**
+     * @brief Create the directory that stores the data for a clip, along with its raw/ and processed/
+     * subdirectories.
+     * @param topLevelPath
+     *  The top level directory, e.g. the directory containing 2017/ in the example above.
+     * @param utc
+     *  The UTC string of the first frame in the clip.
+     * @return
+     *  True if the directories were created (or already existed), false otherwise.
+     */
+    static bool createClipDirs(std::string topLevelPath, std::string utc);
+
+    /**
+     * @brief Update the peak hold image with the given frame, creating the peak hold image if necessary.
+     * @param image
+     *  The frame to add to the peak hold image.
+     */
+    void updatePeakHold(const Imageuc &image);
 
     void deleteClip();
 
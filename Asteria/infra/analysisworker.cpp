@@ -1,6 +1,10 @@
 #include "analysisworker.h"
 #include "util/timeutil.h"
 #include "infra/analysisinventory.h"
+#include "util/framediffutil.h"
+#include "infra/videoencoder.h"
+#include "infra/clipfile.h"
+#include "infra/eventcatalogue.h"
 
 #include <QString>
 #include <QCloseEvent>
@@ -19,6 +23,12 @@ AnalysisWorker::AnalysisWorker(QObject *parent, AsteriaState * state, const std:
 
 }
 
+AnalysisWorker::AnalysisWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> calibration,
+                               std::shared_ptr<ClipWriter::Clip> clip)
+    : QObject(parent), state(state), calibration(calibration), clip(clip) {
+
+}
+
 AnalysisWorker::~AnalysisWorker() {
 }
 
@@ -50,42 +60,81 @@ void AnalysisWorker::process() {
     //  - path deviates from model fit
     //  -
 
-    // Initialise an AnalysisInventory with the raw data
-    AnalysisInventory inv(eventFrames);
+    // Number of frames in the clip. If the clip was streamed to disk then wait for the ClipWriter
+    // to finish writing it; the frames are then read back one at a time so that only the current
+    // and previous frames are held in memory.
+    unsigned int nFrames = eventFrames.size();
+    if(clip) {
+        if(!clip->waitUntilWritten()) {
+            fprintf(stderr, "Clip %s was not written to disk; skipping analysis\n", clip->getUtc().c_str());
+            emit failed();
+            return;
+        }
+        nFrames = clip->size();
+    }
 
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
-    //                                                         //
-    // Coarse localisation: 90th percentiles of changed pixels //
-    //                                                         //
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    // Initialise an AnalysisInventory; raw frames held in memory are saved along with the results
+    AnalysisInventory inv;
+    inv.eventFrames = eventFrames;
+    inv.locs.resize(nFrames);
+
+    // The previous frame, for detecting changed pixels
+    std::shared_ptr<Imageuc> prevPtr;
+
+    for(unsigned int i = 0; i < nFrames; ++i) {
+
+        std::shared_ptr<Imageuc> imagePtr = clip ? clip->readFrame(i) : eventFrames[i];
+
+        if(!imagePtr) {
+            // Couldn't read the frame back from disk; it's already been logged
+            emit failed();
+            return;
+        }
+
+        Imageuc &image = *imagePtr;
+
+        inv.locs[i].epochTimeUs = image.epochTimeUs;
+        inv.updatePeakHold(image);
+
+        if(!prevPtr) {
+            prevPtr = imagePtr;
+            continue;
+        }
+
+        // Get the previous frame
+        Imageuc &prev = *prevPtr;
 
-    // Note that this is a combination of pixels that got brighter (that the meteor moved into)
-    // and pixels that got darker (that the meteor moved out of).
+        //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+        //                                                         //
+        // Coarse localisation: 90th percentiles of changed pixels //
+        //                                                         //
+        //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    for(unsigned int i = 1; i < eventFrames.size(); ++i) {
+        // Note that this is a combination of pixels that got brighter (that the meteor moved into)
+        // and pixels that got darker (that the meteor moved out of).
 
-        // Get the current frame and the previous one
-        Imageuc &prev = *eventFrames[i-1];
-        Imageuc &image = *eventFrames[i];
+        unsigned int nPix = state->width * state->height;
+        unsigned int nChangedPixels = FrameDiffUtil::countChangedPixels(&(image.rawImage[0]), &(prev.rawImage[0]), nPix, state->pixel_difference_threshold);
 
         // X and Y coordinates of significantly changed pixels
         std::vector<unsigned int> xs;
         std::vector<unsigned int> ys;
 
-        for(unsigned int p=0; p< state->width * state->height; p++) {
-            unsigned char newPixel = image.rawImage[p];
-            unsigned char oldPixel = prev.rawImage[p];
-            if((unsigned int)abs(newPixel - oldPixel) > state->pixel_difference_threshold) {
+        // The indices of the changed pixels are only needed for the images containing an event
+        if(nChangedPixels > state->n_changed_pixels_for_trigger) {
 
+            FrameDiffUtil::getChangedPixels(&(image.rawImage[0]), &(prev.rawImage[0]), nPix, state->pixel_difference_threshold,
+                                            inv.locs[i].changedPixelsPositive, inv.locs[i].changedPixelsNegative);
+
+            xs.reserve(nChangedPixels);
+            ys.reserve(nChangedPixels);
+            for(unsigned int p : inv.locs[i].changedPixelsPositive) {
+                xs.push_back(p % state->width);
+                ys.push_back(p / state->width);
+            }
+            for(unsigned int p : inv.locs[i].changedPixelsNegative) {
                 xs.push_back(p % state->width);
                 ys.push_back(p / state->width);
-
-                if(newPixel - oldPixel > 0) {
-                    inv.locs[i].changedPixelsPositive.push_back(p);
-                }
-                else {
-                    inv.locs[i].changedPixelsNegative.push_back(p);
-                }
             }
         }
 
@@ -105,18 +154,12 @@ void AnalysisWorker::process() {
         else {
             inv.locs[i].coarse_localisation_success = false;
         }
-    }
-
-
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
-    //                                                                   //
-    // Fine localisation: centre of flux of box enclosing changed pixels //
-    //                                                                   //
-    //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    for(unsigned int i = 1; i < eventFrames.size(); ++i) {
-
-        Imageuc &image = *eventFrames[i];
+        //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+        //                                                                   //
+        // Fine localisation: centre of flux of box enclosing changed pixels //
+        //                                                                   //
+        //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
         if(inv.locs[i].coarse_localisation_success) {
             double sum = 0.0;
@@ -135,6 +178,8 @@ void AnalysisWorker::process() {
             inv.locs[i].x_flux_centroid /= sum;
             inv.locs[i].y_flux_centroid /= sum;
         }
+
+        prevPtr = imagePtr;
     }
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
@@ -147,7 +192,7 @@ void AnalysisWorker::process() {
     // Fit a straight line (or low-order polynomial) to the i & j coordinates as a function of time
     // Include outlier rejection
     // Reprocess each image to perform PSF fitting centred on the predicted location at the time of the image
-    for(unsigned int i = 0; i < eventFrames.size(); ++i) {
+    for(unsigned int i = 0; i < nFrames; ++i) {
 
     }
 
@@ -158,9 +203,31 @@ void AnalysisWorker::process() {
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    inv.saveToDir(state->videoDirPath);
+    inv.saveToDir(state->videoDirPath, state->clip_key_frame_interval);
+
+    std::string utc = TimeUtil::epochToUtcString(inv.locs[0u].epochTimeUs);
+    std::string clipPath = AnalysisInventory::getClipPath(state->videoDirPath, utc);
+
+    // Add a summary of the results to the event catalogue
+    EventCatalogue::Event event = EventCatalogue::summarise(inv.locs, inv.peakHold.get());
+    event.clipId = utc;
+    event.station = EventCatalogue::getStationName();
+    event.path = clipPath;
+    EventCatalogue::get(state->videoDirPath)->add(event);
+
+    // Encode a video from the raw frames, for display on the website. This runs in the background on the worker
+    // pool; frames that were streamed to disk during acquisition are read back from the clip file.
+    if(state->videoEncoder) {
+        std::string videoPath = clipPath + "/processed/" + utc + ".avi";
+        if(clip) {
+            state->videoEncoder->submit(videoPath, ClipFile::load(clipPath + "/raw/" + ClipFile::filename));
+        }
+        else {
+            state->videoEncoder->submit(videoPath, eventFrames);
+        }
+    }
 
     // All done - emit signal
-    emit finished(TimeUtil::epochToUtcString(eventFrames[0u]->epochTimeUs));
+    emit finished(utc);
 }
 
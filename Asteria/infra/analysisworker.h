@@ -3,6 +3,7 @@
 
 #include "infra/asteriastate.h"
 #include "infra/imageuc.h"
+#include "infra/clipwriter.h"
 
 #include <linux/videodev2.h>
 #include <vector>               // vector
@@ -17,6 +18,13 @@ class AnalysisWorker : public QObject
 public:
     AnalysisWorker(QObject *parent = 0, AsteriaState * state = 0, const std::shared_ptr<CalibrationInventory> calibration = 0,
                    std::vector<std::shared_ptr<Imageuc>> eventFrames = std::vector<std::shared_ptr<Imageuc>>());
+
+    /**
+     * @brief Constructor for an AnalysisWorker that analyses a clip streamed to disk by the ClipWriter. The frames
+     * are read back from disk one at a time once the clip has been written.
+     */
+    AnalysisWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> calibration,
+                   std::shared_ptr<ClipWriter::Clip> clip);
     ~AnalysisWorker();
 
 public slots:
@@ -26,6 +34,8 @@ public slots:
 signals:
     // Emitted once processing is complete
     void finished(std::string utc);
+    // Emitted if the clip couldn't be read back from disk
+    void failed();
 
 private:
 
@@ -43,6 +53,11 @@ private:
      * @brief The images containing the event to be analysed.
      */
     std::vector<std::shared_ptr<Imageuc>> eventFrames;
+
+    /**
+     * @brief The clip containing the event to be analysed, if it was streamed to disk rather than held in eventFrames.
+     */
+    std::shared_ptr<ClipWriter::Clip> clip;
 };
 
 #endif // ANALYSISWORKER_H
@@ -0,0 +1,458 @@
+#include "infra/archiveindex.h"
+#include "infra/clipfile.h"
+#include "util/timeutil.h"
+
+#include <stdio.h>
+#include <cstring>
+#include <cerrno>
+#include <set>
+#include <algorithm>          // min, max
+#include <regex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+const std::string ArchiveIndex::filename = "archive.index";
+const char ArchiveIndex::magic[8] = {'A', 'S', 'T', 'R', 'A', 'R', 'C', 'H'};
+const uint32_t ArchiveIndex::version = 1;
+const unsigned int ArchiveIndex::compactThreshold = 1024;
+
+/**
+ * @brief Get the path of a clip directory relative to the top level directory, i.e. YYYY/MM/DD/UTC.
+ */
+static std::string getRelativePath(const std::string &utc) {
+    return TimeUtil::extractYearFromUtcString(utc) + "/" + TimeUtil::extractMonthFromUtcString(utc) + "/" +
+            TimeUtil::extractDayFromUtcString(utc) + "/" + utc;
+}
+
+/**
+ * @brief Get the modification time of a directory [nanoseconds], or -1 if it doesn't exist.
+ */
+static long long getModificationTime(const std::string &path) {
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return -1;
+    }
+    return info.st_mtim.tv_sec * 1000000000ll + info.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief List the subdirectories of a directory whose names match a regex.
+ */
+static std::vector<std::string> listDirs(const std::string &path, const std::regex &regex) {
+    std::vector<std::string> names;
+    DIR *dir;
+    if ((dir = opendir (path.c_str())) == NULL) {
+        return names;
+    }
+    struct dirent *child;
+    while ((child = readdir (dir)) != NULL) {
+        if(child->d_type == DT_DIR && std::regex_match (child->d_name, regex)) {
+            names.push_back(child->d_name);
+        }
+    }
+    closedir (dir);
+    return names;
+}
+
+ArchiveIndex::ArchiveIndex(const std::string &rootPath) : rootPath(rootPath), indexPath(rootPath + "/" + filename), fd(-1), nRecords(0) {
+
+    if(read()) {
+        fd = open(indexPath.c_str(), O_WRONLY | O_APPEND);
+        if(fd < 0) {
+            fprintf(stderr, "Couldn't open archive index %s for writing: %s\n", indexPath.c_str(), strerror(errno));
+        }
+        return;
+    }
+
+    // No usable index file: build it from the directory tree
+    fprintf(stderr, "Building archive index of %s\n", rootPath.c_str());
+    clips.clear();
+    days.clear();
+    compact();
+    reconcile();
+}
+
+ArchiveIndex::~ArchiveIndex() {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+std::shared_ptr<ArchiveIndex> ArchiveIndex::get(const std::string &rootPath) {
+
+    static std::mutex indicesMutex;
+    static std::map<std::string, std::shared_ptr<ArchiveIndex>> indices;
+
+    std::lock_guard<std::mutex> lock(indicesMutex);
+    std::shared_ptr<ArchiveIndex> &index = indices[rootPath];
+    if(!index) {
+        index = std::make_shared<ArchiveIndex>(rootPath);
+    }
+    return index;
+}
+
+void ArchiveIndex::add(const std::string &utc, unsigned int nFrames, long long durationUs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Record record = makeRecord(CLIP, utc, TimeUtil::utcStringToEpoch(utc), nFrames, durationUs);
+    apply(record);
+    append(std::vector<Record>(1, record));
+}
+
+void ArchiveIndex::remove(const std::string &path) {
+
+    if(path.compare(0, rootPath.size() + 1, rootPath + "/") != 0) {
+        // Not within the tree
+        return;
+    }
+    std::string relative = path.substr(rootPath.size() + 1);
+
+    // Matches the directory itself or anything within it
+    auto within = [&relative](const std::string &candidate) {
+        return candidate.compare(0, relative.size(), relative) == 0 &&
+               (candidate.size() == relative.size() || candidate[relative.size()] == '/');
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<Record> records;
+    for(const auto &clip : clips) {
+        if(within(getRelativePath(clip.second.name))) {
+            records.push_back(makeRecord(CLIP_REMOVED, clip.second.name, clip.first, 0, 0));
+        }
+    }
+    for(const auto &day : days) {
+        if(within(day.first)) {
+            records.push_back(makeRecord(DAY_REMOVED, day.first, 0, 0, 0));
+        }
+    }
+
+    for(const Record &record : records) {
+        apply(record);
+    }
+    append(records);
+}
+
+bool ArchiveIndex::getLatest(Entry &entry) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    while(!clips.empty()) {
+        const Record &latest = clips.rbegin()->second;
+        Entry candidate = toEntry(latest);
+        if(getModificationTime(candidate.path) >= 0) {
+            entry = candidate;
+            return true;
+        }
+        // The directory has been removed since it was indexed
+        fprintf(stderr, "Archive index: %s no longer exists\n", candidate.path.c_str());
+        Record record = makeRecord(CLIP_REMOVED, latest.name, latest.time, 0, 0);
+        apply(record);
+        append(std::vector<Record>(1, record));
+    }
+    return false;
+}
+
+std::vector<ArchiveIndex::Entry> ArchiveIndex::getRange(long long startUs, long long endUs) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Entry> entries;
+    for(auto it = clips.lower_bound(startUs); it != clips.end() && it->first < endUs; ++it) {
+        entries.push_back(toEntry(it->second));
+    }
+    return entries;
+}
+
+std::vector<ArchiveIndex::Entry> ArchiveIndex::getAll() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Entry> entries;
+    entries.reserve(clips.size());
+    for(const auto &clip : clips) {
+        entries.push_back(toEntry(clip.second));
+    }
+    return entries;
+}
+
+unsigned int ArchiveIndex::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return clips.size();
+}
+
+void ArchiveIndex::reconcile() {
+
+    // This regex usage relies on version 4.9 or later of the GCC
+    const std::regex yearRegex("[0-9]{4}");
+    const std::regex monthDayRegex("[0-9]{2}");
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<Record> records;
+
+    // The day directories found in the tree
+    std::set<std::string> found;
+
+    for(const std::string &yyyy : listDirs(rootPath, yearRegex)) {
+        for(const std::string &mm : listDirs(rootPath + "/" + yyyy, monthDayRegex)) {
+            for(const std::string &dd : listDirs(rootPath + "/" + yyyy + "/" + mm, monthDayRegex)) {
+
+                std::string day = yyyy + "/" + mm + "/" + dd;
+                found.insert(day);
+
+                // The modification time is read before the day is scanned, so that any clip directory created
+                // during the scan changes it again and the day is rescanned next time
+                long long mtime = getModificationTime(rootPath + "/" + day);
+                std::map<std::string, long long>::const_iterator it = days.find(day);
+                if(it != days.end() && it->second == mtime) {
+                    // Unchanged since it was last scanned
+                    continue;
+                }
+
+                scanDay(day, records);
+                records.push_back(makeRecord(DAY, day, mtime, 0, 0));
+                apply(records.back());
+            }
+        }
+    }
+
+    // Remove the days that no longer exist, along with their clips
+    std::vector<std::string> removed;
+    for(const auto &day : days) {
+        if(found.find(day.first) == found.end()) {
+            removed.push_back(day.first);
+        }
+    }
+    for(const std::string &day : removed) {
+        scanDay(day, records);
+        records.push_back(makeRecord(DAY_REMOVED, day, 0, 0, 0));
+        apply(records.back());
+    }
+
+    if(!records.empty()) {
+        fprintf(stderr, "Archive index of %s: %lu changes; %lu entries\n", rootPath.c_str(), records.size(), clips.size());
+        append(records);
+    }
+}
+
+bool ArchiveIndex::read() {
+
+    int rfd = open(indexPath.c_str(), O_RDONLY);
+    if(rfd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(rfd, &info) != 0) {
+        close(rfd);
+        return false;
+    }
+
+    size_t headerSize = sizeof(magic) + 2 * sizeof(uint32_t);
+    std::vector<char> buffer(info.st_size);
+    ssize_t n = pread(rfd, buffer.data(), buffer.size(), 0);
+    close(rfd);
+
+    if(n != (ssize_t)buffer.size() || buffer.size() < headerSize) {
+        return false;
+    }
+
+    uint32_t fileVersion, recordSize;
+    memcpy(&fileVersion, &buffer[sizeof(magic)], sizeof(uint32_t));
+    memcpy(&recordSize, &buffer[sizeof(magic) + sizeof(uint32_t)], sizeof(uint32_t));
+    if(memcmp(buffer.data(), magic, sizeof(magic)) != 0 || fileVersion != version || recordSize != sizeof(Record)) {
+        fprintf(stderr, "%s is not a compatible archive index\n", indexPath.c_str());
+        return false;
+    }
+
+    nRecords = (buffer.size() - headerSize) / sizeof(Record);
+    for(unsigned int r = 0; r < nRecords; r++) {
+        Record record;
+        memcpy(&record, &buffer[headerSize + r * sizeof(Record)], sizeof(Record));
+        record.name[sizeof(record.name) - 1] = '\0';
+        apply(record);
+    }
+
+    // A partial record at the end of the file was being appended when the application stopped; discard it
+    size_t complete = headerSize + nRecords * sizeof(Record);
+    if(complete != buffer.size() && truncate(indexPath.c_str(), complete) != 0) {
+        perror("Couldn't truncate archive index");
+    }
+
+    return true;
+}
+
+void ArchiveIndex::compact() {
+
+    std::string tmpPath = indexPath + ".tmp";
+    FILE * out = fopen(tmpPath.c_str(), "wb");
+    if(!out) {
+        fprintf(stderr, "Couldn't write archive index %s: %s\n", tmpPath.c_str(), strerror(errno));
+        return;
+    }
+
+    std::vector<Record> records;
+    records.reserve(days.size() + clips.size());
+    for(const auto &day : days) {
+        records.push_back(makeRecord(DAY, day.first, day.second, 0, 0));
+    }
+    for(const auto &clip : clips) {
+        records.push_back(clip.second);
+    }
+
+    uint32_t recordSize = sizeof(Record);
+    bool success = fwrite(magic, sizeof(magic), 1, out) == 1 &&
+                   fwrite(&version, sizeof(uint32_t), 1, out) == 1 &&
+                   fwrite(&recordSize, sizeof(uint32_t), 1, out) == 1 &&
+                   fwrite(records.data(), sizeof(Record), records.size(), out) == records.size();
+    success = (fclose(out) == 0) && success;
+
+    // Replace the existing file atomically, so that it's never left incomplete
+    if(!success || rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+        fprintf(stderr, "Couldn't write archive index %s\n", indexPath.c_str());
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    nRecords = records.size();
+
+    if(fd >= 0) {
+        close(fd);
+    }
+    fd = open(indexPath.c_str(), O_WRONLY | O_APPEND);
+}
+
+void ArchiveIndex::append(const std::vector<Record> &records) {
+
+    if(records.empty() || fd < 0) {
+        return;
+    }
+
+    size_t size = records.size() * sizeof(Record);
+    if(write(fd, records.data(), size) != (ssize_t)size) {
+        fprintf(stderr, "Couldn't append to archive index %s: %s\n", indexPath.c_str(), strerror(errno));
+        // Rewrite the whole file, to remove any partial record
+        compact();
+        return;
+    }
+    nRecords += records.size();
+
+    if(nRecords > 2 * (clips.size() + days.size()) + compactThreshold) {
+        compact();
+    }
+}
+
+void ArchiveIndex::apply(const Record &record) {
+    switch(record.type) {
+    case CLIP:
+        clips[record.time] = record;
+        break;
+    case CLIP_REMOVED:
+        clips.erase(record.time);
+        break;
+    case DAY:
+        days[record.name] = record.time;
+        break;
+    case DAY_REMOVED:
+        days.erase(record.name);
+        break;
+    default:
+        break;
+    }
+}
+
+void ArchiveIndex::scanDay(const std::string &day, std::vector<Record> &records) {
+
+    std::string dayPath = rootPath + "/" + day;
+
+    // Add the clip directories that aren't indexed yet
+    std::set<long long> found;
+    for(const std::string &utc : listDirs(dayPath, TimeUtil::utcRegex)) {
+        long long epochTimeUs = TimeUtil::utcStringToEpoch(utc);
+        found.insert(epochTimeUs);
+        if(clips.find(epochTimeUs) != clips.end()) {
+            continue;
+        }
+        unsigned int nFrames;
+        long long durationUs;
+        readSummary(dayPath + "/" + utc, nFrames, durationUs);
+        records.push_back(makeRecord(CLIP, utc, epochTimeUs, nFrames, durationUs));
+        apply(records.back());
+    }
+
+    // Remove the indexed clips that no longer exist
+    long long startUs, endUs;
+    getDayRange(day, startUs, endUs);
+    std::vector<Record> removed;
+    for(auto it = clips.lower_bound(startUs); it != clips.end() && it->first < endUs; ++it) {
+        if(found.find(it->first) == found.end()) {
+            removed.push_back(makeRecord(CLIP_REMOVED, it->second.name, it->first, 0, 0));
+        }
+    }
+    for(const Record &record : removed) {
+        apply(record);
+        records.push_back(record);
+    }
+}
+
+void ArchiveIndex::readSummary(const std::string &path, unsigned int &nFrames, long long &durationUs) {
+
+    nFrames = 0;
+    durationUs = 0;
+
+    std::string raw = path + "/raw";
+
+    std::shared_ptr<ClipFile> clip = ClipFile::load(raw + "/" + ClipFile::filename);
+    if(clip) {
+        nFrames = clip->size();
+        if(nFrames > 0) {
+            durationUs = clip->getEpochTimeUs(nFrames - 1) - clip->getEpochTimeUs(0);
+        }
+        return;
+    }
+
+    // Clips saved before the clip file was introduced: count the PGM files, which are named by the UTC of each frame
+    DIR *dir;
+    if ((dir = opendir (raw.c_str())) == NULL) {
+        return;
+    }
+    long long first = 0, last = 0;
+    struct dirent *child;
+    std::cmatch match;
+    while ((child = readdir (dir)) != NULL) {
+        if(std::regex_search(child->d_name, match, TimeUtil::utcRegex, std::regex_constants::match_continuous)) {
+            long long epochTimeUs = TimeUtil::utcStringToEpoch(match.str(0));
+            first = (nFrames == 0) ? epochTimeUs : std::min(first, epochTimeUs);
+            last = (nFrames == 0) ? epochTimeUs : std::max(last, epochTimeUs);
+            nFrames++;
+        }
+    }
+    closedir (dir);
+    durationUs = last - first;
+}
+
+ArchiveIndex::Record ArchiveIndex::makeRecord(RecordType type, const std::string &name, long long time, unsigned int nFrames, long long durationUs) {
+    Record record;
+    memset(&record, 0, sizeof(Record));
+    record.type = type;
+    record.nFrames = nFrames;
+    record.time = time;
+    record.durationUs = durationUs;
+    strncpy(record.name, name.c_str(), sizeof(record.name) - 1);
+    return record;
+}
+
+ArchiveIndex::Entry ArchiveIndex::toEntry(const Record &record) const {
+    Entry entry;
+    entry.epochTimeUs = record.time;
+    entry.utc = record.name;
+    entry.path = rootPath + "/" + getRelativePath(entry.utc);
+    entry.nFrames = record.nFrames;
+    entry.durationUs = record.durationUs;
+    return entry;
+}
+
+void ArchiveIndex::getDayRange(const std::string &day, long long &startUs, long long &endUs) {
+    // YYYY/MM/DD -> YYYY-MM-DDT00:00:00.000Z
+    std::string utc = day.substr(0, 4) + "-" + day.substr(5, 2) + "-" + day.substr(8, 2) + "T00:00:00.000Z";
+    startUs = TimeUtil::utcStringToEpoch(utc);
+    endUs = startUs + 86400000000ll;
+}
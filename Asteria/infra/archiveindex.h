@@ -0,0 +1,261 @@
+#ifndef ARCHIVEINDEX_H
+#define ARCHIVEINDEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>               // shared_ptr
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief The ArchiveIndex class is a persistent index of the clips or calibrations stored in the YYYY/MM/DD/UTC
+ * directory tree under the video or calibration directory, which replaces walking the whole tree to find the most
+ * recent calibration and to build the directory models for the GUI.
+ *
+ * The index is held in memory sorted by time, so that the most recent entry is found in constant time and the
+ * entries within a time range in O(log n). It's stored on disk in a file in the top level directory, as a log
+ * of fixed-size records that's appended to as entries are added and removed; the file is read in full when the
+ * index is opened, and compacted when most of its records are superseded.
+ *
+ * The index is updated incrementally as clips and calibrations are saved, and reconciled with the directory
+ * tree lazily:
+ *  - the directory of the most recent entry is checked when it's looked up, and removed if it no longer exists;
+ *  - reconcile() checks the tree for changes made by other means (e.g. clips copied in or deleted by hand). The
+ *    modification time of each day directory is recorded in the index, so only days in which directories have
+ *    been created or removed since they were last scanned are listed.
+ * If the index file doesn't exist or can't be read then it's rebuilt from the directory tree when opened.
+ *
+ * The binary format is:
+ *
+ * Header        : char[8] magic ("ASTRARCH"), uint32 version, uint32 record size [bytes]
+ * Records       : Record[...], applied in order when the file is read.
+ *
+ * All values are stored in the native byte order of the machine that wrote the file.
+ */
+class ArchiveIndex
+{
+
+public:
+
+    /**
+     * @brief An entry in the index, for a single clip or calibration.
+     */
+    struct Entry {
+
+        /**
+         * @brief Epoch time of the clip, from the name of its directory [microseconds]
+         */
+        long long epochTimeUs;
+
+        /**
+         * @brief The UTC string naming the directory of the clip.
+         */
+        std::string utc;
+
+        /**
+         * @brief The full path to the directory of the clip.
+         */
+        std::string path;
+
+        /**
+         * @brief Number of frames in the clip.
+         */
+        unsigned int nFrames;
+
+        /**
+         * @brief Time between the first and last frames of the clip [microseconds]
+         */
+        long long durationUs;
+    };
+
+    /**
+     * @brief Open the index of a directory tree, reading the index file or rebuilding it from the tree if it
+     * doesn't exist or can't be read.
+     * @param rootPath
+     *  The top level directory of the tree.
+     */
+    ArchiveIndex(const std::string &rootPath);
+
+    ~ArchiveIndex();
+
+    /**
+     * @brief Get the index of a directory tree, shared by all users of the tree within the application. The
+     * index is opened the first time it's requested.
+     * @param rootPath
+     *  The top level directory of the tree.
+     * @return
+     *  The index.
+     */
+    static std::shared_ptr<ArchiveIndex> get(const std::string &rootPath);
+
+    /**
+     * @brief Add a clip to the index, or update its entry if it's already present.
+     * @param utc
+     *  The UTC string naming the directory of the clip.
+     * @param nFrames
+     *  Number of frames in the clip.
+     * @param durationUs
+     *  Time between the first and last frames of the clip [microseconds]
+     */
+    void add(const std::string &utc, unsigned int nFrames, long long durationUs);
+
+    /**
+     * @brief Remove the entries within a directory of the tree, after it has been deleted.
+     * @param path
+     *  The full path to a clip directory, or a year, month or day directory, in which case all the clips within
+     *  it are removed.
+     */
+    void remove(const std::string &path);
+
+    /**
+     * @brief Get the most recent entry whose directory still exists; entries for directories that no longer
+     * exist are removed.
+     * @param entry
+     *  On exit, contains the most recent entry.
+     * @return
+     *  True if an entry was found, false if the index is empty.
+     */
+    bool getLatest(Entry &entry);
+
+    /**
+     * @brief Get the entries within a time range.
+     * @param startUs
+     *  Start of the time range, inclusive [microseconds]
+     * @param endUs
+     *  End of the time range, exclusive [microseconds]
+     * @return
+     *  The entries in order of time.
+     */
+    std::vector<Entry> getRange(long long startUs, long long endUs) const;
+
+    /**
+     * @brief Get all the entries.
+     * @return
+     *  The entries in order of time.
+     */
+    std::vector<Entry> getAll() const;
+
+    /**
+     * @brief Get the number of entries.
+     */
+    unsigned int size() const;
+
+    /**
+     * @brief Bring the index up to date with the directory tree, scanning the day directories that have changed
+     * since they were last scanned.
+     */
+    void reconcile();
+
+    /**
+     * @brief Name of the index file within the top level directory.
+     */
+    static const std::string filename;
+
+private:
+
+    // Disable copying; the index owns the file descriptor
+    ArchiveIndex(const ArchiveIndex&);
+    ArchiveIndex& operator=(const ArchiveIndex&);
+
+    /**
+     * @brief Enumerates the types of record in the index file.
+     */
+    enum RecordType : uint32_t {CLIP = 1, CLIP_REMOVED = 2, DAY = 3, DAY_REMOVED = 4};
+
+    /**
+     * @brief A record in the index file. For CLIP records the name is the UTC string naming the directory; for
+     * DAY records it's the YYYY/MM/DD path of the day directory, and the time is its modification time.
+     */
+    struct Record {
+        uint32_t type;
+        uint32_t nFrames;
+        int64_t time;
+        int64_t durationUs;
+        char name[40];
+    };
+
+    static const char magic[8];
+    static const uint32_t version;
+
+    /**
+     * @brief The index file is compacted once the number of superseded records exceeds the number of current
+     * records by this many.
+     */
+    static const unsigned int compactThreshold;
+
+    std::string rootPath;
+
+    std::string indexPath;
+
+    /**
+     * @brief Descriptor of the index file, opened for appending; -1 if it couldn't be opened.
+     */
+    int fd;
+
+    /**
+     * @brief Number of records in the index file.
+     */
+    unsigned int nRecords;
+
+    /**
+     * @brief The CLIP records, by epoch time [microseconds]
+     */
+    std::map<long long, Record> clips;
+
+    /**
+     * @brief The modification times of the day directories when they were last scanned [nanoseconds], by
+     * their YYYY/MM/DD path.
+     */
+    std::map<std::string, long long> days;
+
+    mutable std::mutex mutex;
+
+    /**
+     * @brief Read the records from the index file.
+     * @return
+     *  True if the file was read, false if it doesn't exist or isn't a valid index file.
+     */
+    bool read();
+
+    /**
+     * @brief Rewrite the index file from the records held in memory, replacing the existing file.
+     */
+    void compact();
+
+    /**
+     * @brief Append records to the index file, compacting it if most of the records have been superseded.
+     */
+    void append(const std::vector<Record> &records);
+
+    /**
+     * @brief Apply a record to the index held in memory.
+     */
+    void apply(const Record &record);
+
+    /**
+     * @brief Scan a day directory, adding the clips that aren't in the index and removing those that no longer
+     * exist.
+     * @param day
+     *  The YYYY/MM/DD path of the day directory.
+     * @param records
+     *  On exit, the records of the changes have been appended.
+     */
+    void scanDay(const std::string &day, std::vector<Record> &records);
+
+    /**
+     * @brief Read the number of frames and duration of a clip from its raw/ directory.
+     */
+    static void readSummary(const std::string &path, unsigned int &nFrames, long long &durationUs);
+
+    static Record makeRecord(RecordType type, const std::string &name, long long time, unsigned int nFrames, long long durationUs);
+
+    Entry toEntry(const Record &record) const;
+
+    /**
+     * @brief Get the range of epoch times [microseconds] covered by a day, given its YYYY/MM/DD path.
+     */
+    static void getDayRange(const std::string &day, long long &startUs, long long &endUs);
+};
+
+#endif // ARCHIVEINDEX_H
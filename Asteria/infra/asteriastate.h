@@ -9,6 +9,10 @@
 #include <memory>
 
 class CalibrationInventory;
+class WorkerPool;
+class VideoEncoder;
+class ReferenceStarCatalogue;
+class AsterismIndex;
 
 using namespace std;
 
@@ -73,6 +77,18 @@ public:
      */
     std::shared_ptr<CalibrationInventory> cal;
 
+    /**
+     * @brief Pool of threads shared by the analysis and calibration jobs. Created along with the AcquisitionThread,
+     * once the processing parameters are known.
+     */
+    std::shared_ptr<WorkerPool> workerPool;
+
+    /**
+     * @brief Encodes the videos of clips on the worker pool. Created along with the worker pool, or NULL if video
+     * encoding is disabled or not available.
+     */
+    std::shared_ptr<VideoEncoder> videoEncoder;
+
     // Cannot be loaded from config file: must be created programmatically,
     // either by user selection or automated selection of default camera.
 
@@ -165,9 +181,15 @@ public:
     string refStarCataloguePath;
 
     /**
-     * @brief The loaded contents of the reference star catalogue.
+     * @brief The loaded reference star catalogue.
+     */
+    std::shared_ptr<ReferenceStarCatalogue> refStarCatalogue;
+
+    /**
+     * @brief The asterism index of the bright reference stars, used for blind solutions of the calibration. This is
+     * built in the background, so must be accessed with std::atomic_load and std::atomic_store.
      */
-    vector<ReferenceStar> refStarCatalogue;
+    std::shared_ptr<AsterismIndex> asterismIndex;
 
     /**
      * @brief Path to the JPL Earth ephemeris.
@@ -229,6 +251,17 @@ public:
      */
     unsigned int n_changed_pixels_for_trigger;
 
+    /**
+     * @brief Maximum number of frames of a clip that may be held in memory waiting to be written to disk.
+     */
+    unsigned int clip_writer_window;
+
+    /**
+     * @brief Interval between key frames in the stored clips, which are compressed losslessly by predicting each
+     * frame from the previous one. Zero stores the frames uncompressed.
+     */
+    unsigned int clip_key_frame_interval;
+
     //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                              //
     //                     Analysis parameters                      //
@@ -267,17 +300,101 @@ public:
      */
     unsigned int bkg_median_filter_half_width;
 
+    /**
+     * @brief Name of the algorithm used for the background median filter; one of MedianFilterUtil::algorithmNames.
+     */
+    string bkg_median_filter_algorithm;
+
     /**
      * @brief Threshold for detection of significant sources, in terms of the number of standard deviations
      * that the integrated flux lies above the background level [dimensionless].
      */
     double source_detection_threshold_sigmas;
 
+    /**
+     * @brief Threshold for inclusion of individual pixels in sources, in terms of the number of standard deviations
+     * that the pixel lies above the background level [dimensionless]. Values of 2-3 are typical; lower values
+     * admit many noise pixels, which can then combine into spurious significant sources.
+     */
+    double source_pixel_threshold_sigmas;
+
     /**
      * @brief Faint visual magnitude limit for reference stars used in the calibration [mags]
      */
     double ref_star_faint_mag_limit;
 
+    /**
+     * @brief Number of bright reference stars used to track the camera orientation between calibrations; zero
+     * disables the tracking.
+     */
+    unsigned int attitude_tracking_stars;
+
+    /**
+     * @brief Number of frames between updates of the tracked camera orientation [frames]
+     */
+    unsigned int attitude_tracking_interval;
+
+    /**
+     * @brief Half-width of the region of interest used to measure each tracked star [pixels]. The full size
+     * region is (2N+1)x(2N+1).
+     */
+    unsigned int attitude_tracking_roi_half_width;
+
+    /**
+     * @brief RMS residual of the tracked star positions above which a full calibration is run early [pixels]
+     */
+    double attitude_tracking_residual_threshold;
+
+    /**
+     * @brief Number of reference stars cross-matched using the initial calibration below which the camera orientation
+     * and focal length are solved for blindly; zero disables the blind solution.
+     */
+    unsigned int blind_solve_min_xms;
+
+    /**
+     * @brief Faint visual magnitude limit for the reference stars in the asterism index used for blind solutions [mags]
+     */
+    double blind_solve_mag_limit;
+
+    //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+    //                                                              //
+    //                    Processing parameters                     //
+    //                                                              //
+    //++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++//
+
+    /**
+     * @brief Number of threads in the pool that runs the analysis and calibration jobs.
+     */
+    unsigned int worker_threads;
+
+    /**
+     * @brief Nice level of the analysis and calibration threads; positive values lower their priority
+     * relative to acquisition.
+     */
+    int worker_nice;
+
+    /**
+     * @brief Maximum number of analysis and calibration jobs that can be waiting for a thread.
+     */
+    unsigned int worker_queue_depth;
+
+    /**
+     * @brief Name of the action to take when an analysis or calibration job is submitted while the queue
+     * is full; one of WorkerPool::fullQueuePolicyNames.
+     */
+    string worker_queue_policy;
+
+    /**
+     * @brief Maximum number of analysis and calibration jobs that can be deferred while the queue is full; further
+     * jobs are dropped.
+     */
+    unsigned int worker_max_deferred;
+
+    /**
+     * @brief Maximum number of clips whose videos can be waiting to be encoded; zero disables video encoding.
+     */
+    unsigned int video_queue_depth;
+
 };
 
 #endif // ASTERIASTATE_H
@@ -0,0 +1,312 @@
+#include "infra/asterismindex.h"
+#include "infra/referencestarcatalogue.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+const char AsterismIndex::magic[8] = {'A', 'S', 'T', 'R', 'S', 'I', 'D', 'X'};
+const uint32_t AsterismIndex::version = 2;
+const uint32_t AsterismIndex::hashBins = 100;
+constexpr double AsterismIndex::minSide;
+constexpr double AsterismIndex::maxSide;
+constexpr double AsterismIndex::minRatioSeparation;
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~((size_t)7);
+}
+
+AsterismIndex::AsterismIndex() : mapping(0), mappingSize(0), nStars(0), nTriangles(0), nBins(0), magLimit(0.0), catalogueStars(0), catalogueChecksum(0), binStart(0),
+    x(0), y(0), z(0), triangles(0) {
+
+}
+
+AsterismIndex::~AsterismIndex() {
+    if(mapping) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+std::shared_ptr<AsterismIndex> AsterismIndex::load(const std::string &path) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return std::shared_ptr<AsterismIndex>();
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return std::shared_ptr<AsterismIndex>();
+    }
+
+    void * mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        perror(("Couldn't map asterism index " + path).c_str());
+        return std::shared_ptr<AsterismIndex>();
+    }
+
+    std::shared_ptr<AsterismIndex> index(new AsterismIndex());
+    index->mapping = mapping;
+    index->mappingSize = st.st_size;
+
+    if(!index->attach((const char *)mapping, st.st_size)) {
+        fprintf(stderr, "Invalid asterism index %s\n", path.c_str());
+        return std::shared_ptr<AsterismIndex>();
+    }
+
+    return index;
+}
+
+std::shared_ptr<AsterismIndex> AsterismIndex::build(const ReferenceStarCatalogue &catalogue, double magLimit) {
+
+    // All stars brighter than the magnitude limit
+    std::vector<ReferenceStar> stars;
+    catalogue.getStars(Eigen::Vector3d(0.0, 0.0, 1.0), M_PI, magLimit, stars);
+    uint32_t n = stars.size();
+
+    // For each star, the later stars within the range of side lengths
+    double cosMinSide = std::cos(minSide);
+    double cosMaxSide = std::cos(maxSide);
+    std::vector<std::vector<uint32_t>> neighbours(n);
+    for(uint32_t s1=0; s1<n; s1++) {
+        for(uint32_t s2=s1+1; s2<n; s2++) {
+            double cosSep = stars[s1].r.dot(stars[s2].r);
+            if(cosSep <= cosMinSide && cosSep >= cosMaxSide) {
+                neighbours[s1].push_back(s2);
+            }
+        }
+    }
+
+    // Form the triangles; each is found once, from its first star
+    std::vector<Triangle> unsorted;
+    std::vector<uint32_t> bins;
+    for(uint32_t s1=0; s1<n; s1++) {
+        const std::vector<uint32_t> &nb = neighbours[s1];
+        for(unsigned int p=0; p<nb.size(); p++) {
+            for(unsigned int q=p+1; q<nb.size(); q++) {
+
+                uint32_t s2 = nb[p];
+                uint32_t s3 = nb[q];
+
+                double cosSep = stars[s2].r.dot(stars[s3].r);
+                if(cosSep > cosMinSide || cosSep < cosMaxSide) {
+                    continue;
+                }
+
+                // Each side paired with the star opposite it, ordered by increasing length
+                std::pair<double, uint32_t> sides[3] = {
+                    std::make_pair(std::acos(std::min(1.0, cosSep)), s1),
+                    std::make_pair(std::acos(std::min(1.0, stars[s1].r.dot(stars[s3].r))), s2),
+                    std::make_pair(std::acos(std::min(1.0, stars[s1].r.dot(stars[s2].r))), s3)};
+                std::sort(sides, sides + 3);
+
+                double ratioA = sides[0].first / sides[2].first;
+                double ratioB = sides[1].first / sides[2].first;
+
+                // Omit triangles for which the ordering of the stars is ambiguous
+                if(ratioB - ratioA < minRatioSeparation || 1.0 - ratioB < minRatioSeparation) {
+                    continue;
+                }
+
+                Triangle triangle;
+                triangle.stars[0] = sides[0].second;
+                triangle.stars[1] = sides[1].second;
+                triangle.stars[2] = sides[2].second;
+                triangle.ratioA = (float)ratioA;
+                triangle.ratioB = (float)ratioB;
+                triangle.side = (float)sides[2].first;
+                unsorted.push_back(triangle);
+                bins.push_back(getBin(ratioB, hashBins) * hashBins + getBin(ratioA, hashBins));
+            }
+        }
+    }
+    uint32_t nTriangles = unsorted.size();
+
+    size_t binOffset, xOffset, triangleOffset;
+    size_t size = getLayout(n, nTriangles, hashBins, binOffset, xOffset, triangleOffset);
+
+    std::shared_ptr<AsterismIndex> index(new AsterismIndex());
+    std::vector<char> &buffer = index->buffer;
+    buffer.assign(size, 0);
+
+    Header * header = (Header *)&buffer[0];
+    memcpy(header->magic, magic, sizeof(magic));
+    header->version = version;
+    header->nStars = n;
+    header->nTriangles = nTriangles;
+    header->nBins = hashBins;
+    header->magLimit = (float)magLimit;
+    header->minSide = (float)minSide;
+    header->maxSide = (float)maxSide;
+    header->catalogueStars = catalogue.size();
+    header->catalogueChecksum = catalogue.getChecksum();
+
+    uint32_t * binStart = (uint32_t *)&buffer[binOffset];
+    double * x = (double *)&buffer[xOffset];
+    double * y = x + n;
+    double * z = y + n;
+    Triangle * triangles = (Triangle *)&buffer[triangleOffset];
+
+    for(uint32_t s=0; s<n; s++) {
+        x[s] = stars[s].r[0];
+        y[s] = stars[s].r[1];
+        z[s] = stars[s].r[2];
+    }
+
+    // Counting sort of the triangles by bin
+    for(uint32_t t=0; t<nTriangles; t++) {
+        binStart[bins[t] + 1]++;
+    }
+    for(uint32_t b=0; b<hashBins * hashBins; b++) {
+        binStart[b + 1] += binStart[b];
+    }
+    std::vector<uint32_t> next(binStart, binStart + hashBins * hashBins);
+    for(uint32_t t=0; t<nTriangles; t++) {
+        triangles[next[bins[t]]++] = unsorted[t];
+    }
+
+    index->attach(&buffer[0], size);
+
+    return index;
+}
+
+std::shared_ptr<AsterismIndex> AsterismIndex::loadOrBuild(const std::string &path, const ReferenceStarCatalogue &catalogue, double magLimit) {
+
+    std::shared_ptr<AsterismIndex> index = load(path);
+    if(index && index->magLimit == (float)magLimit && index->catalogueStars == catalogue.size() &&
+            index->catalogueChecksum == catalogue.getChecksum()) {
+        return index;
+    }
+    if(index) {
+        fprintf(stderr, "Asterism index %s doesn't match the reference star catalogue or magnitude limit; rebuilding\n", path.c_str());
+    }
+
+    index = build(catalogue, magLimit);
+    fprintf(stderr, "Built asterism index of %u triangles from %u stars\n", index->nTriangles, index->nStars);
+    index->save(path);
+    return index;
+}
+
+bool AsterismIndex::save(const std::string &path) const {
+
+    size_t binOffset, xOffset, triangleOffset;
+    size_t size = getLayout(nStars, nTriangles, nBins, binOffset, xOffset, triangleOffset);
+
+    // The header is at the start of the data, whether it's held in memory or mapped
+    const char * data = mapping ? (const char *)mapping : &buffer[0];
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(data, size);
+    out.close();
+
+    if(out.fail()) {
+        fprintf(stderr, "Couldn't write asterism index %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+unsigned int AsterismIndex::getNumStars() const {
+    return nStars;
+}
+
+unsigned int AsterismIndex::getNumTriangles() const {
+    return nTriangles;
+}
+
+double AsterismIndex::getMagLimit() const {
+    return magLimit;
+}
+
+Eigen::Vector3d AsterismIndex::getStar(unsigned int s) const {
+    return Eigen::Vector3d(x[s], y[s], z[s]);
+}
+
+const AsterismIndex::Triangle & AsterismIndex::getTriangle(unsigned int t) const {
+    return triangles[t];
+}
+
+void AsterismIndex::query(double ratioA, double ratioB, double tolerance, std::vector<unsigned int> &matches) const {
+
+    matches.clear();
+
+    int a0 = getBin(ratioA - tolerance, nBins);
+    int a1 = getBin(ratioA + tolerance, nBins);
+    int b0 = getBin(ratioB - tolerance, nBins);
+    int b1 = getBin(ratioB + tolerance, nBins);
+
+    for(int b = b0; b <= b1; b++) {
+        for(uint32_t t = binStart[b * nBins + a0]; t < binStart[b * nBins + a1 + 1]; t++) {
+            if(std::abs(triangles[t].ratioA - ratioA) <= tolerance && std::abs(triangles[t].ratioB - ratioB) <= tolerance) {
+                matches.push_back(t);
+            }
+        }
+    }
+}
+
+bool AsterismIndex::attach(const char * data, size_t size) {
+
+    if(size < sizeof(Header)) {
+        return false;
+    }
+    const Header * header = (const Header *)data;
+    if(memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version || header->nBins == 0 ||
+            header->minSide != (float)minSide || header->maxSide != (float)maxSide) {
+        return false;
+    }
+
+    size_t binOffset, xOffset, triangleOffset;
+    if(size < getLayout(header->nStars, header->nTriangles, header->nBins, binOffset, xOffset, triangleOffset)) {
+        return false;
+    }
+
+    nStars = header->nStars;
+    nTriangles = header->nTriangles;
+    nBins = header->nBins;
+    magLimit = header->magLimit;
+    catalogueStars = header->catalogueStars;
+    catalogueChecksum = header->catalogueChecksum;
+    binStart = (const uint32_t *)(data + binOffset);
+    x = (const double *)(data + xOffset);
+    y = x + nStars;
+    z = y + nStars;
+    triangles = (const Triangle *)(data + triangleOffset);
+
+    // The triangles in each bin must lie within the index, and refer to stars within the index
+    size_t nCells = (size_t)nBins * nBins;
+    if(binStart[0] != 0 || binStart[nCells] != nTriangles) {
+        return false;
+    }
+    for(size_t b=0; b<nCells; b++) {
+        if(binStart[b + 1] < binStart[b]) {
+            return false;
+        }
+    }
+    for(uint32_t t=0; t<nTriangles; t++) {
+        for(unsigned int k=0; k<3; k++) {
+            if(triangles[t].stars[k] >= nStars) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+size_t AsterismIndex::getLayout(uint32_t nStars, uint32_t nTriangles, uint32_t nBins, size_t &binOffset, size_t &xOffset, size_t &triangleOffset) {
+    binOffset = sizeof(Header);
+    xOffset = align8(binOffset + ((size_t)nBins * nBins + 1) * sizeof(uint32_t));
+    triangleOffset = xOffset + 3 * (size_t)nStars * sizeof(double);
+    return align8(triangleOffset + (size_t)nTriangles * sizeof(Triangle));
+}
+
+int AsterismIndex::getBin(double ratio, uint32_t nBins) {
+    return std::min(std::max((int)std::floor(ratio * nBins), 0), (int)nBins - 1);
+}
@@ -0,0 +1,242 @@
+#ifndef ASTERISMINDEX_H
+#define ASTERISMINDEX_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+
+#include <Eigen/Dense>
+
+class ReferenceStarCatalogue;
+
+/**
+ * @brief The AsterismIndex is a geometric hash index of triangles of bright reference stars, used by the
+ * PlateSolver to identify the stars in an image without any prior knowledge of the camera orientation.
+ *
+ * Each triangle is formed from three stars brighter than the magnitude limit whose mutual separations all lie
+ * within [minSide:maxSide]. The sides are ordered a <= b <= c, and the triangle is hashed by the ratios (a/c, b/c)
+ * which are invariant to the orientation of the camera and (for small triangles) its focal length. The stars of
+ * each triangle are ordered by the side opposite them, so that the correspondence with the stars of a matching
+ * triangle in the image is known. Triangles that are close to isosceles, for which the ordering is ambiguous, are
+ * omitted.
+ *
+ * The hash space [0:1]x[0:1] is divided into nBins x nBins cells, and the triangles are stored sorted by cell so
+ * that a query only visits the cells within the matching tolerance. The index is built once from the reference
+ * star catalogue and saved to a binary file, which is memory-mapped on loading. The binary format is:
+ *
+ * Header        : char[8] magic ("ASTRSIDX"), uint32 version, uint32 number of stars N, uint32 number of triangles T,
+ *                 uint32 nBins, float magLimit [mags], float minSide [radians], float maxSide [radians],
+ *                 uint32 number of stars in the catalogue, uint64 checksum of the catalogue
+ * Bin offsets   : uint32[nBins*nBins + 1]; the triangles in bin b are [offset[b]:offset[b+1]). Padded to 8 bytes.
+ * x, y, z       : double[N] each; BCRF unit vectors towards the stars
+ * Triangles     : Triangle[T]
+ *
+ * All values are stored in the native byte order of the machine that built the index.
+ */
+class AsterismIndex
+{
+
+public:
+
+    /**
+     * @brief A triangle of stars in the index.
+     */
+    struct Triangle {
+        /**
+         * @brief Indices of the stars opposite the shortest, middle and longest sides.
+         */
+        uint32_t stars[3];
+
+        /**
+         * @brief The hash code: ratios of the shortest and middle sides to the longest side.
+         */
+        float ratioA;
+        float ratioB;
+
+        /**
+         * @brief Length of the longest side [radians]
+         */
+        float side;
+    };
+
+    ~AsterismIndex();
+
+    /**
+     * @brief Load an index from a binary file, by memory-mapping it.
+     * @param path
+     *  The path to the index file.
+     * @return
+     *  The index, or an empty pointer if it couldn't be loaded.
+     */
+    static std::shared_ptr<AsterismIndex> load(const std::string &path);
+
+    /**
+     * @brief Build the index from the stars in the reference star catalogue.
+     * @param catalogue
+     *  The reference star catalogue.
+     * @param magLimit
+     *  Faint magnitude limit for the stars in the index [mags]
+     * @return
+     *  The index.
+     */
+    static std::shared_ptr<AsterismIndex> build(const ReferenceStarCatalogue &catalogue, double magLimit);
+
+    /**
+     * @brief Load the index from a file if it exists and was built from the same catalogue with the same magnitude
+     * limit, otherwise build it from the catalogue and save it to the file for next time. The catalogue is identified
+     * by its number of stars and checksum.
+     * @param path
+     *  The path to the index file.
+     * @param catalogue
+     *  The reference star catalogue.
+     * @param magLimit
+     *  Faint magnitude limit for the stars in the index [mags]
+     * @return
+     *  The index.
+     */
+    static std::shared_ptr<AsterismIndex> loadOrBuild(const std::string &path, const ReferenceStarCatalogue &catalogue, double magLimit);
+
+    /**
+     * @brief Write the index to a binary file.
+     * @param path
+     *  The path to write the index to.
+     * @return
+     *  True if the index was written successfully.
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * @brief Get the number of stars in the index.
+     */
+    unsigned int getNumStars() const;
+
+    /**
+     * @brief Get the number of triangles in the index.
+     */
+    unsigned int getNumTriangles() const;
+
+    /**
+     * @brief Get the faint magnitude limit of the stars in the index [mags]
+     */
+    double getMagLimit() const;
+
+    /**
+     * @brief Get the BCRF unit vector towards a star in the index.
+     */
+    Eigen::Vector3d getStar(unsigned int s) const;
+
+    /**
+     * @brief Get a triangle in the index.
+     */
+    const Triangle & getTriangle(unsigned int t) const;
+
+    /**
+     * @brief Find the triangles whose hash code lies within a given distance of a hash code.
+     * @param ratioA, ratioB
+     *  The hash code: ratios of the shortest and middle sides to the longest side.
+     * @param tolerance
+     *  The matching tolerance on each ratio.
+     * @param triangles
+     *  On exit, contains the indices of the matching triangles.
+     */
+    void query(double ratioA, double ratioB, double tolerance, std::vector<unsigned int> &triangles) const;
+
+    /**
+     * @brief Range of the side lengths of the triangles in the index [radians]
+     */
+    static constexpr double minSide = 2.0 * M_PI / 180.0;
+    static constexpr double maxSide = 15.0 * M_PI / 180.0;
+
+    /**
+     * @brief Minimum difference between the ratios (a/c, b/c, 1) of the sides of the triangles in the index;
+     * queries should use a tolerance below half of this so that the ordering of the stars is unambiguous.
+     */
+    static constexpr double minRatioSeparation = 0.02;
+
+private:
+
+    AsterismIndex();
+
+    // Disable copying; the index may own a memory mapping
+    AsterismIndex(const AsterismIndex&);
+    AsterismIndex& operator=(const AsterismIndex&);
+
+    /**
+     * @brief Header of the binary index.
+     */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t nStars;
+        uint32_t nTriangles;
+        uint32_t nBins;
+        float magLimit;
+        float minSide;
+        float maxSide;
+        uint32_t catalogueStars;
+        uint64_t catalogueChecksum;
+    };
+
+    static const char magic[8];
+    static const uint32_t version;
+
+    /**
+     * @brief Number of bins along each axis of the hash space.
+     */
+    static const uint32_t hashBins;
+
+    /**
+     * @brief Set up the pointers to the arrays within the index data.
+     * @param data
+     *  The index data, in the binary format.
+     * @param size
+     *  The size of the data [bytes]
+     * @return
+     *  True if the data is a valid index.
+     */
+    bool attach(const char * data, size_t size);
+
+    /**
+     * @brief Get the size of the index data, and the offsets of the arrays within it.
+     */
+    static size_t getLayout(uint32_t nStars, uint32_t nTriangles, uint32_t nBins, size_t &binOffset, size_t &xOffset, size_t &triangleOffset);
+
+    /**
+     * @brief Get the bin along one axis of the hash space containing a ratio.
+     */
+    static int getBin(double ratio, uint32_t nBins);
+
+    /**
+     * @brief The index data, if it's held in memory rather than memory-mapped.
+     */
+    std::vector<char> buffer;
+
+    /**
+     * @brief The memory mapping of the index file, if any.
+     */
+    void * mapping;
+    size_t mappingSize;
+
+    /**
+     * @brief Header fields.
+     */
+    uint32_t nStars;
+    uint32_t nTriangles;
+    uint32_t nBins;
+    double magLimit;
+    uint32_t catalogueStars;
+    uint64_t catalogueChecksum;
+
+    /**
+     * @brief Pointers to the arrays within the index data.
+     */
+    const uint32_t * binStart;
+    const double * x;
+    const double * y;
+    const double * z;
+    const Triangle * triangles;
+};
+
+#endif // ASTERISMINDEX_H
@@ -0,0 +1,239 @@
+#include "infra/attitudetracker.h"
+#include "util/coordinateutil.h"
+#include "util/timeutil.h"
+
+#include <algorithm>            // sort
+#include <cmath>
+
+const unsigned int AttitudeTracker::minStars;
+const unsigned int AttitudeTracker::maxLostUpdates;
+const long long AttitudeTracker::reselectionPeriodUs;
+constexpr double AttitudeTracker::detectionThresholdSigmas;
+
+AttitudeTracker::AttitudeTracker(std::shared_ptr<ReferenceStarCatalogue> catalogue, unsigned int nStars, unsigned int roiHalfWidth,
+                                 double magLimit, double residualThreshold) :
+    catalogue(catalogue), nStars(nStars), roiHalfWidth(roiHalfWidth), magLimit(magLimit), residualThreshold(residualThreshold),
+    cam(NULL), lon(0.0), lat(0.0), selectionEpochTimeUs(0ll), rmsResidual(0.0), nLostUpdates(0), calibrationRequired(false) {
+    r_bcrf.reserve(nStars);
+    r_sez.reserve(nStars);
+    measured.reserve(nStars);
+}
+
+void AttitudeTracker::setCalibration(const CameraModelBase * cam, const Eigen::Quaterniond & q_sez_cam, const double &lon, const double &lat) {
+    this->cam = cam;
+    this->q_cal = q_sez_cam.normalized();
+    this->q_sez_cam = q_cal;
+    this->lon = lon;
+    this->lat = lat;
+    r_bcrf.clear();
+    measured.clear();
+    rmsResidual = 0.0;
+    nLostUpdates = 0;
+    calibrationRequired = false;
+}
+
+const Eigen::Quaterniond & AttitudeTracker::getAttitude() const {
+    return q_sez_cam;
+}
+
+double AttitudeTracker::getDrift() const {
+    return q_sez_cam.angularDistance(q_cal);
+}
+
+double AttitudeTracker::getRmsResidual() const {
+    return rmsResidual;
+}
+
+unsigned int AttitudeTracker::getNumMeasured() const {
+    return measured.size();
+}
+
+bool AttitudeTracker::isCalibrationRequired() const {
+    return calibrationRequired;
+}
+
+void AttitudeTracker::selectStars(const Eigen::Matrix3d &r_bcrf_sez, const Imageuc &image) {
+
+    r_bcrf.clear();
+
+    std::vector<ReferenceStar> visible;
+    catalogue->getVisibleStars(q_sez_cam.toRotationMatrix() * r_bcrf_sez, *cam, magLimit, visible);
+
+    std::sort(visible.begin(), visible.end(), [](const ReferenceStar &a, const ReferenceStar &b) {return a.mag < b.mag;});
+
+    // Take the brightest stars whose ROIs lie within the image, rejecting any with another star close enough to
+    // bias the centroid. Margin of one ROI width to allow for motion of the stars before reselection.
+    double margin = 2.0 * roiHalfWidth + 1.0;
+    for(unsigned int s=0; s<visible.size() && r_bcrf.size() < nStars; s++) {
+        const ReferenceStar &star = visible[s];
+        if(star.i < margin || star.i > image.width - 1 - margin || star.j < margin || star.j > image.height - 1 - margin) {
+            continue;
+        }
+        bool isolated = true;
+        for(unsigned int t=0; t<visible.size() && isolated; t++) {
+            isolated = (t == s) || std::abs(visible[t].i - star.i) >= margin || std::abs(visible[t].j - star.j) >= margin;
+        }
+        if(isolated) {
+            Eigen::Vector3d r;
+            CoordinateUtil::sphericalToCartesian(r, 1.0, star.ra, star.dec);
+            r_bcrf.push_back(r);
+        }
+    }
+
+    selectionEpochTimeUs = image.epochTimeUs;
+}
+
+bool AttitudeTracker::measureCentroid(const Imageuc &image, const double &ip, const double &jp, Eigen::Vector2d &centroid) const {
+
+    int h = roiHalfWidth;
+    int i0 = std::lround(ip) - h;
+    int j0 = std::lround(jp) - h;
+    int i1 = i0 + 2 * h;
+    int j1 = j0 + 2 * h;
+
+    if(i0 < 0 || j0 < 0 || i1 >= (int)image.width || j1 >= (int)image.height) {
+        return false;
+    }
+
+    // Estimate the background level and noise from the pixels around the edge of the ROI
+    double s = 0.0;
+    double s2 = 0.0;
+    unsigned int n = 0;
+    for(int j = j0; j <= j1; j++) {
+        for(int i = i0; i <= i1; i += (j == j0 || j == j1) ? 1 : 2 * h) {
+            double value = image.rawImage[j * image.width + i];
+            s += value;
+            s2 += value * value;
+            n++;
+        }
+    }
+    double bkg = s / n;
+    // Lower limit reflects the quantisation of the pixel values
+    double sigma = std::max(std::sqrt(std::max(s2 / n - bkg * bkg, 0.0)), 1.0);
+
+    // Centre-of-flux of the pixels significantly above the background
+    double threshold = bkg + 2.0 * sigma;
+    double adu = 0.0;
+    double sx = 0.0;
+    double sy = 0.0;
+    unsigned int nPix = 0;
+    for(int j = j0 + 1; j < j1; j++) {
+        for(int i = i0 + 1; i < i1; i++) {
+            double value = image.rawImage[j * image.width + i];
+            if(value > threshold) {
+                double signal = value - bkg;
+                adu += signal;
+                sx += i * signal;
+                sy += j * signal;
+                nPix++;
+            }
+        }
+    }
+
+    if(nPix == 0 || adu < detectionThresholdSigmas * sigma * std::sqrt(nPix)) {
+        return false;
+    }
+
+    centroid << sx / adu, sy / adu;
+    return true;
+}
+
+bool AttitudeTracker::update(const Imageuc &image) {
+
+    if(!cam) {
+        return false;
+    }
+
+    // Rotation from BCRF to SEZ at the time of the frame
+    double gmst = TimeUtil::epochToGmst(image.epochTimeUs);
+    Eigen::Matrix3d r_bcrf_sez = CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+    if(r_bcrf.empty() || image.epochTimeUs - selectionEpochTimeUs > reselectionPeriodUs) {
+        selectStars(r_bcrf_sez, image);
+    }
+
+    // Measure the stars in ROIs around their predicted positions
+    Eigen::Matrix3d r_sez_cam = q_sez_cam.toRotationMatrix();
+    r_sez.clear();
+    measured.clear();
+    for(const Eigen::Vector3d &r : r_bcrf) {
+        Eigen::Vector3d rs = r_bcrf_sez * r;
+        double ip, jp;
+        Eigen::Vector2d centroid;
+        if(cam->projectVector(r_sez_cam * rs, ip, jp) && measureCentroid(image, ip, jp, centroid)) {
+            r_sez.push_back(rs);
+            measured.push_back(centroid);
+        }
+    }
+
+    if(measured.size() < minStars) {
+        // Not enough stars: the camera may have been bumped so that the stars lie outside their ROIs, or the
+        // sky is cloudy. Don't update the orientation, and if this persists then the tracking is lost.
+        nLostUpdates++;
+        if(nLostUpdates >= maxLostUpdates) {
+            calibrationRequired = true;
+        }
+        return false;
+    }
+    nLostUpdates = 0;
+
+    // Gauss-Newton refinement of the orientation. The update is parameterised as a small rotation dtheta of the
+    // CAM frame, q -> dq * q with dq = [1, dtheta/2], which avoids the degeneracy of the quaternion norm.
+    for(unsigned int iteration = 0; iteration < 3; iteration++) {
+
+        // Partial derivatives of the quaternion elements with respect to the small rotation
+        Eigen::Vector3d u = q_sez_cam.vec();
+        Eigen::Matrix<double, 4, 3> dq_dtheta;
+        dq_dtheta.row(0) = -0.5 * u.transpose();
+        dq_dtheta.bottomRows<3>() << 0.5 * q_sez_cam.w(),  0.5 * u[2], -0.5 * u[1],
+                                    -0.5 * u[2],  0.5 * q_sez_cam.w(),  0.5 * u[0],
+                                     0.5 * u[1], -0.5 * u[0],  0.5 * q_sez_cam.w();
+
+        r_sez_cam = q_sez_cam.toRotationMatrix();
+
+        Eigen::Matrix3d JTJ = Eigen::Matrix3d::Zero();
+        Eigen::Vector3d JTR = Eigen::Vector3d::Zero();
+        for(unsigned int s = 0; s < measured.size(); s++) {
+            double ip, jp;
+            cam->projectVector(r_sez_cam * r_sez[s], ip, jp);
+            Eigen::Vector2d residual = measured[s] - Eigen::Vector2d(ip, jp);
+
+            // The derivatives are packed as [di/dq0, dj/dq0, di/dq1, ...], matching a column-major 2x4 matrix
+            Eigen::Matrix<double, 2, 4> dij_dq;
+            cam->getExtrinsicPartialDerivatives(dij_dq.data(), r_sez[s], q_sez_cam);
+            Eigen::Matrix<double, 2, 3> J = dij_dq * dq_dtheta;
+
+            JTJ.noalias() += J.transpose() * J;
+            JTR.noalias() += J.transpose() * residual;
+        }
+
+        Eigen::Vector3d dtheta = JTJ.ldlt().solve(JTR);
+        if(!dtheta.allFinite()) {
+            break;
+        }
+
+        Eigen::Quaterniond dq(1.0, 0.5 * dtheta[0], 0.5 * dtheta[1], 0.5 * dtheta[2]);
+        q_sez_cam = (dq * q_sez_cam).normalized();
+
+        // Converged once the update is well below a pixel
+        if(dtheta.norm() < 1E-7) {
+            break;
+        }
+    }
+
+    // RMS residual at the updated orientation
+    r_sez_cam = q_sez_cam.toRotationMatrix();
+    double sumSq = 0.0;
+    for(unsigned int s = 0; s < measured.size(); s++) {
+        double ip, jp;
+        cam->projectVector(r_sez_cam * r_sez[s], ip, jp);
+        sumSq += (measured[s] - Eigen::Vector2d(ip, jp)).squaredNorm();
+    }
+    rmsResidual = std::sqrt(sumSq / measured.size());
+
+    if(rmsResidual > residualThreshold) {
+        calibrationRequired = true;
+    }
+
+    return true;
+}
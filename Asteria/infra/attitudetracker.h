@@ -0,0 +1,177 @@
+#ifndef ATTITUDETRACKER_H
+#define ATTITUDETRACKER_H
+
+#include "infra/imageuc.h"
+#include "infra/referencestar.h"
+#include "infra/referencestarcatalogue.h"
+#include "optics/cameramodelbase.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The AttitudeTracker class tracks the orientation of the camera between full calibrations, using a
+ * small number of bright reference stars. Starting from the orientation of the current calibration, it predicts
+ * the positions of the brightest visible stars in each frame it's given, measures their centroids in small
+ * regions of interest (ROIs) around the predicted positions, and refines the orientation with a 3x3 Gauss-Newton
+ * solve for a small rotation of the camera frame. The camera intrinsics are held fixed.
+ *
+ * The RMS residual of the measured star positions, and the number of stars that could be measured, indicate
+ * whether the camera has been bumped or has drifted by more than the tracking can follow, in which case a full
+ * calibration is required.
+ */
+class AttitudeTracker
+{
+public:
+
+    /**
+     * @brief Main constructor for the AttitudeTracker.
+     * @param catalogue
+     *  The reference star catalogue.
+     * @param nStars
+     *  The maximum number of stars to track.
+     * @param roiHalfWidth
+     *  Half-width of the ROI used to measure each star [pixels]; the full size is (2N+1)x(2N+1).
+     * @param magLimit
+     *  Faint magnitude limit for the tracked stars [mags]
+     * @param residualThreshold
+     *  RMS residual of the measured star positions above which a full calibration is required [pixels]
+     */
+    AttitudeTracker(std::shared_ptr<ReferenceStarCatalogue> catalogue, unsigned int nStars, unsigned int roiHalfWidth,
+                    double magLimit, double residualThreshold);
+
+    /**
+     * @brief Start tracking from a new calibration. This resets the tracked orientation and the stars.
+     * @param cam
+     *  The camera model of the calibration; this must remain valid while it's being tracked.
+     * @param q_sez_cam
+     *  The orientation of the CAM frame with respect to the SEZ frame from the calibration.
+     * @param lon
+     *  Longitude of the observing site [radians]
+     * @param lat
+     *  Latitude of the observing site [radians]
+     */
+    void setCalibration(const CameraModelBase * cam, const Eigen::Quaterniond & q_sez_cam, const double &lon, const double &lat);
+
+    /**
+     * @brief Measure the tracked stars in the image and refine the orientation.
+     * @param image
+     *  The image.
+     * @return
+     *  True if enough stars were measured to update the orientation.
+     */
+    bool update(const Imageuc &image);
+
+    /**
+     * @brief Get the tracked orientation of the CAM frame with respect to the SEZ frame.
+     */
+    const Eigen::Quaterniond & getAttitude() const;
+
+    /**
+     * @brief Get the angle between the tracked orientation and the orientation of the calibration [radians]
+     */
+    double getDrift() const;
+
+    /**
+     * @brief Get the RMS residual of the star positions measured in the most recent update [pixels]
+     */
+    double getRmsResidual() const;
+
+    /**
+     * @brief Get the number of stars measured in the most recent update.
+     */
+    unsigned int getNumMeasured() const;
+
+    /**
+     * @brief Indicates whether the residuals have exceeded the threshold, or too few stars could be measured in
+     * consecutive updates, such that a full calibration is required.
+     */
+    bool isCalibrationRequired() const;
+
+    /**
+     * @brief Minimum number of stars that must be measured to update the orientation.
+     */
+    static const unsigned int minStars = 4;
+
+    /**
+     * @brief Number of consecutive updates with too few stars measured after which the tracking is considered
+     * lost, and a full calibration is required.
+     */
+    static const unsigned int maxLostUpdates = 5;
+
+    /**
+     * @brief Period after which the tracked stars are selected again, as stars rise and set [microseconds]
+     */
+    static const long long reselectionPeriodUs = 60000000ll;
+
+    /**
+     * @brief Detection threshold for the measured stars, in terms of the number of standard deviations that
+     * the integrated signal in the ROI lies above the background level.
+     */
+    static constexpr double detectionThresholdSigmas = 5.0;
+
+private:
+
+    std::shared_ptr<ReferenceStarCatalogue> catalogue;
+
+    unsigned int nStars;
+
+    unsigned int roiHalfWidth;
+
+    double magLimit;
+
+    double residualThreshold;
+
+    /**
+     * @brief The camera model of the calibration being tracked, or NULL if there isn't one.
+     */
+    const CameraModelBase * cam;
+
+    /**
+     * @brief The orientation of the calibration, and the tracked orientation.
+     */
+    Eigen::Quaterniond q_cal;
+    Eigen::Quaterniond q_sez_cam;
+
+    /**
+     * @brief Site longitude and latitude [radians]
+     */
+    double lon, lat;
+
+    /**
+     * @brief BCRF unit vectors towards the tracked stars, and the epoch time of the frame in which they were
+     * selected [microseconds]
+     */
+    std::vector<Eigen::Vector3d> r_bcrf;
+    long long selectionEpochTimeUs;
+
+    /**
+     * @brief SEZ frame unit vectors towards the stars measured in the current frame, and the measured image
+     * coordinates [pixels]. Reused between updates.
+     */
+    std::vector<Eigen::Vector3d> r_sez;
+    std::vector<Eigen::Vector2d> measured;
+
+    double rmsResidual;
+
+    unsigned int nLostUpdates;
+
+    bool calibrationRequired;
+
+    /**
+     * @brief Select the brightest stars visible with the tracked orientation whose ROIs lie within the image
+     * and contain no other catalogue star brighter than the magnitude limit.
+     */
+    void selectStars(const Eigen::Matrix3d &r_bcrf_sez, const Imageuc &image);
+
+    /**
+     * @brief Measure the centroid of a star in the ROI centred on the predicted position.
+     * @return
+     *  True if the ROI lies within the image and a significant signal is detected in it.
+     */
+    bool measureCentroid(const Imageuc &image, const double &ip, const double &jp, Eigen::Vector2d &centroid) const;
+};
+
+#endif // ATTITUDETRACKER_H
@@ -1,4 +1,6 @@
 #include "infra/calibrationinventory.h"
+#include "infra/clipfile.h"
+#include "infra/archiveindex.h"
 #include "util/timeutil.h"
 #include "util/fileutil.h"
 #include "util/renderutil.h"
@@ -6,8 +8,6 @@
 #include "optics/pinholecamera.h"
 #include "optics/pinholecamerawithradialdistortion.h"
 
-#include <dirent.h>
-#include <regex>
 #include <fstream>
 #include <functional>
 
@@ -21,46 +21,35 @@ CalibrationInventory::~CalibrationInventory() {
     fprintf(stderr, "Freeing memory for CalibrationInventory %s\n", TimeUtil::epochToUtcString(calibrationFrames[0u]->epochTimeUs).c_str());
 }
 
+std::shared_ptr<CalibrationInventory> CalibrationInventory::withAttitude(const Eigen::Quaterniond &q_sez_cam) const {
+    auto inv = std::make_shared<CalibrationInventory>(calibrationFrames);
+    inv->epochTimeUs = epochTimeUs;
+    inv->signal = signal;
+    inv->noise = noise;
+    inv->background = background;
+    inv->sources = sources;
+    inv->xms = xms;
+    inv->readNoiseAdu = readNoiseAdu;
+    inv->q_sez_cam = q_sez_cam;
+    inv->cam = cam;
+    inv->longitude = longitude;
+    inv->latitude = latitude;
+    inv->altitude = altitude;
+    return inv;
+}
+
 std::shared_ptr<CalibrationInventory> CalibrationInventory::loadFromDir(std::string path) {
 
     std::string raw = path + "/raw";
     std::string processed = path + "/processed";
 
-    // Load the raw images
-    DIR *dir;
-    if ((dir = opendir (raw.c_str())) == NULL) {
-        // Couldn't open the directory!
-        return NULL;
-    }
-
     auto inv = std::make_shared<CalibrationInventory>();
 
-    // Loop over the contents of the directory
-    struct dirent *child;
-    while ((child = readdir (dir)) != NULL) {
-
-        // Skip the . and .. directories
-        if(strcmp(child->d_name,".") == 0 || strcmp(child->d_name,"..") == 0) {
-            continue;
-        }
-
-        // Match files with names starting with UTC string, e.g. 2017-06-14T19:41:09.282Z.pgm
-        // These are the raw calibration frames
-        if(std::regex_search(child->d_name, TimeUtil::utcRegex, std::regex_constants::match_continuous)) {
-            // Build full path to the item
-            std::string childPath = raw + "/" + child->d_name;
-            // Load the image from file and store a shared pointer to it in the vector
-            std::ifstream input(childPath);
-            auto seq = std::make_shared<Imageuc>();
-            input >> *seq;
-            inv->calibrationFrames.push_back(seq);
-            input.close();
-        }
+    // Load the raw calibration frames
+    if(!ClipFile::loadFrames(raw, inv->calibrationFrames)) {
+        // Couldn't open the directory!
+        return NULL;
     }
-    closedir (dir);
-
-    // Sort the calibration image sequence into ascending order of capture time
-    std::sort(inv->calibrationFrames.begin(), inv->calibrationFrames.end(), Imageuc::comparePtrToImage);
 
     // Load the signal, background and noise images
 
@@ -110,12 +99,15 @@ std::shared_ptr<CalibrationInventory> CalibrationInventory::loadFromDir(std::str
         ia & BOOST_SERIALIZATION_NVP(inv->latitude);
         ia & BOOST_SERIALIZATION_NVP(inv->altitude);
         ifs.close();
+
+        // The camera model is fixed from now on, so tabulate the inverse distortion for fast deprojection
+        inv->cam->buildInverseDistortionMap();
     }
 
     return inv;
 }
 
-void CalibrationInventory::saveToDir(std::string topLevelPath) {
+void CalibrationInventory::saveToDir(std::string topLevelPath, unsigned int keyFrameInterval) {
 
     // Create new directory to store results for this clip. The path is set by the
     // date and time of the first frame
@@ -143,14 +135,8 @@ void CalibrationInventory::saveToDir(std::string topLevelPath) {
     std::string processed = path + "/processed";
 
     // Write out the raw calibration frames
-    for(unsigned int i = 0; i < calibrationFrames.size(); ++i) {
-        Imageuc &image = *calibrationFrames[i];
-        char filename [100];
-        std::string utcFrame = TimeUtil::epochToUtcString(image.epochTimeUs);
-        sprintf(filename, "%s/%s.pgm", raw.c_str(), utcFrame.c_str());
-        std::ofstream out(filename);
-        out << image;
-        out.close();
+    if(!ClipFile::save(raw + "/" + ClipFile::filename, calibrationFrames, keyFrameInterval)) {
+        fprintf(stderr, "Couldn't write clip file in %s\n", raw.c_str());
     }
 
     // Write out processed data
@@ -274,6 +260,9 @@ void CalibrationInventory::saveToDir(std::string topLevelPath) {
     char command [100];
     sprintf(command, "gnuplot < %s", tmpFileName.c_str());
     system(command);
+
+    // Record the calibration in the archive index
+    ArchiveIndex::get(topLevelPath)->add(utc, calibrationFrames.size(), calibrationFrames.back()->epochTimeUs - calibrationFrames.front()->epochTimeUs);
 }
 
 void CalibrationInventory::deleteCalibration() {
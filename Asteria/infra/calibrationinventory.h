@@ -52,7 +52,9 @@ public:
     std::shared_ptr<Imaged> background;
 
     /**
-     * @brief A vector containing the individual frames used in the calibration, stored in ascending time order.
+     * @brief A vector containing frames used in the calibration, stored in ascending time order. Calibrations made
+     * during acquisition retain only the first and last frames, since the stack is reduced to per-pixel statistics
+     * as it's captured; these are preserved in the signal and noise images, which are reused on recalibration.
      */
     std::vector<std::shared_ptr<Imageuc>> calibrationFrames;
 
@@ -97,11 +99,28 @@ public:
      */
     double altitude;
 
+    /**
+     * @brief Get a copy of the calibration with a different camera orientation, e.g. one refined by the attitude
+     * tracking. The copy shares the images, frames and camera model with this calibration.
+     * @param q_sez_cam
+     *  The orientation of the CAM frame with respect to the SEZ frame.
+     * @return
+     *  The copy.
+     */
+    std::shared_ptr<CalibrationInventory> withAttitude(const Eigen::Quaterniond &q_sez_cam) const;
+
 public slots:
 
     static std::shared_ptr<CalibrationInventory> loadFromDir(std::string path);
 
-    void saveToDir(std::string topLevelPath);
+    /**
+     * @brief Save the CalibrationInventory to disk.
+     * @param topLevelPath
+     *  The top level directory in which the calibration directory is created.
+     * @param keyFrameInterval
+     *  Interval between key frames when compressing the raw frames; zero stores the frames uncompressed.
+     */
+    void saveToDir(std::string topLevelPath, unsigned int keyFrameInterval);
 
     void deleteCalibration();
 
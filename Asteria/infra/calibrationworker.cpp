@@ -6,10 +6,15 @@
 #include "util/renderutil.h"
 #include "util/coordinateutil.h"
 #include "util/mathutil.h"
+#include "util/medianfilterutil.h"
+#include "infra/pixelstatsaccumulator.h"
 #include "infra/calibrationinventory.h"
+#include "infra/spatialgrid.h"
+#include "infra/referencestarcatalogue.h"
 #include "optics/pinholecamerawithradialdistortion.h"
 #include "optics/pinholecamerawithsipdistortion.h"
 #include "math/geocalfitter.h"
+#include "infra/platesolver.h"
 
 #include "infra/image.h"
 
@@ -27,12 +32,21 @@
 #include <QGridLayout>
 #include <QThread>
 
+constexpr double CalibrationWorker::signalTrimFraction;
+constexpr double CalibrationWorker::crossMatchGridCellSize;
+
 CalibrationWorker::CalibrationWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> initial,
                                      std::vector<std::shared_ptr<Imageuc>> calibrationFrames)
     : QObject(parent), state(state), initial(initial), calibrationFrames(calibrationFrames) {
 
 }
 
+CalibrationWorker::CalibrationWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> initial,
+                                     std::shared_ptr<PixelStatsAccumulator> pixelStats, std::vector<std::shared_ptr<Imageuc>> calibrationFrames)
+    : QObject(parent), state(state), initial(initial), calibrationFrames(calibrationFrames), pixelStats(pixelStats) {
+
+}
+
 CalibrationWorker::~CalibrationWorker() {
 }
 
@@ -44,8 +58,6 @@ void CalibrationWorker::process() {
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    fprintf(stderr, "Got %lu frames for calibration\n", calibrationFrames.size());
-
     // The calibration data is assigned to fields of the CalibrationInventory for storage
     auto calInv = std::make_shared<CalibrationInventory>(calibrationFrames);
 
@@ -68,26 +80,32 @@ void CalibrationWorker::process() {
     // by using the trimmed mean. The median is quantized and will not be as accurate as the mean given the limited
     // range of values.
 
-    std::vector<double> signal(width * height);
-    std::vector<double> noise(width * height);
-
-    // Loop over the pixels
-    for(unsigned int p=0; p<width * height; p++) {
+    // The statistics are accumulated in a single pass over the frames, without sorting the values of each pixel;
+    // see PixelStatsAccumulator. Normally this is done as the frames are captured.
+    std::vector<double> signal;
+    std::vector<double> noise;
 
-        // Extract the pixel value in each of the calibration frames
-        std::vector<double> pixels(calibrationFrames.size());
-        for(unsigned int f = 0; f < calibrationFrames.size(); f++) {
-            double pixel = static_cast<double>(calibrationFrames[f]->rawImage[p]);
-            pixels[f] = pixel;
+    if(pixelStats || calibrationFrames.size() >= state->calibration_stack) {
+        if(!pixelStats) {
+            pixelStats = std::make_shared<PixelStatsAccumulator>(width, height, calibrationFrames.size(), signalTrimFraction);
+            for(const std::shared_ptr<Imageuc> &frame : calibrationFrames) {
+                pixelStats->addFrame(*frame);
+            }
         }
-
-        // Now compute the trimmed mean & sample standard deviation
-        double trimmed_mean = 0.0;
-        double trimmed_std = 0.0;
-        MathUtil::getTrimmedMeanStd(pixels, trimmed_mean, trimmed_std, 0.05);
-
-        signal[p] = trimmed_mean;
-        noise[p] = trimmed_std;
+        fprintf(stderr, "Got %d frames for calibration\n", pixelStats->getFrameCount());
+        pixelStats->getTrimmedMeanStd(signal, noise);
+    }
+    else if(initial && initial->signal && initial->noise && initial->signal->width == width && initial->signal->height == height &&
+            initial->noise->width == width && initial->noise->height == height) {
+        // Recalibrating a calibration made during acquisition, which retains only the first and last frames: these
+        // are too few to estimate the signal and noise, so reuse the images estimated from the full stack.
+        fprintf(stderr, "Got %lu frames for calibration; reusing the stored signal and noise images\n", calibrationFrames.size());
+        signal = initial->signal->rawImage;
+        noise = initial->noise->rawImage;
+    }
+    else {
+        fprintf(stderr, "Got %lu frames for calibration but need %d; aborting\n", calibrationFrames.size(), state->calibration_stack);
+        return;
     }
 
     // Now post-process the signal value to get an estimate of the source-free background level in each pixel
@@ -96,32 +114,9 @@ void CalibrationWorker::process() {
     // Algorithm for background calculation: each pixel is the median value of the pixels surrounding it in
     // a window of some particular width.
     // Sliding window extends out to this many pixels on each side of the central pixel
-    int hw = (int)state->bkg_median_filter_half_width;
-    for(unsigned int k=0; k<height; k++) {
-        for(unsigned int l=0; l<width; l++) {
-
-            // Compute the boundary of the window region
-            unsigned int k_min = std::max((int)k - hw, 0);
-            unsigned int k_max = std::min((int)k + hw, (int)height);
-            unsigned int l_min = std::max((int)l - hw, 0);
-            unsigned int l_max = std::min((int)l + hw, (int)width);
-
-            // Pixels within the window
-            std::vector<double> pixels;
-            for(unsigned int kp=k_min; kp<k_max; kp++) {
-                for(unsigned int lp=l_min; lp<l_max; lp++) {
-                    unsigned int pixIdx = kp*width + lp;
-                    pixels.push_back(signal[pixIdx]);
-                }
-            }
-
-            // Get the median value in the window
-            double median = MathUtil::getMedian(pixels);
-
-            unsigned int pixIdx = k*width + l;
-            background[pixIdx] = median;
-        }
-    }
+    unsigned int hw = state->bkg_median_filter_half_width;
+    MedianFilterUtil::Algorithm algorithm = MedianFilterUtil::getAlgorithmFromName(state->bkg_median_filter_algorithm);
+    MedianFilterUtil::medianFilter(signal, background, width, height, hw, algorithm);
 
     calInv->noise = make_shared<Imaged>(width, height);
     calInv->noise->epochTimeUs = midTimeStamp;
@@ -142,7 +137,8 @@ void CalibrationWorker::process() {
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
     calInv->sources = SourceDetector::getSources(calInv->signal->rawImage, calInv->background->rawImage, calInv->noise->rawImage,
-                                                             width, height, state->source_detection_threshold_sigmas);
+                                                             width, height, state->source_detection_threshold_sigmas,
+                                                             state->source_pixel_threshold_sigmas);
 
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
@@ -166,89 +162,50 @@ void CalibrationWorker::process() {
     // Full transformation BCRF->CAM
     Matrix3d r_bcrf_cam = r_sez_cam * r_ecef_sez * r_bcrf_ecef;
 
-    std::vector<ReferenceStar> visibleReferenceStars;
-
-    for(ReferenceStar &star : state->refStarCatalogue) {
-
-        // Reject stars fainter than faint mag limit
-        if(star.mag > state->ref_star_faint_mag_limit) {
-            continue;
-        }
-
-        CoordinateUtil::projectReferenceStar(star, r_bcrf_cam, *initial->cam);
-
-        if(star.visible) {
-            // Star is visible in image!
-            visibleReferenceStars.push_back(star);
-        }
-    }
-
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
     //    Cross-match reference stars and observed sources   //
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    // The cross matching is done purely spatially. The algorithm is as follows:
-    // For each Source find the closest ReferenceStar
-    // If there are no Sources closer to the ReferenceStar than this one, and the
-    // separation is below a threshold, then the Source and ReferenceStar are a match.
-
-    // TODO: make robust to hot pixels. Include a hot pixel determination step that operates
-    //       over multiple executions.
-    // TODO: allow cross-matches to be specified manually somehow; maybe a field of the constructor.
+    crossMatch(r_bcrf_cam, *initial->cam, calInv->sources, calInv->xms);
 
-    // Minimum separation for acceptable cross match in sigmas
-    double minSepThreshold = 20.0;
+    fprintf(stderr, "Cross-matched %d reference stars using the initial calibration\n", (int)calInv->xms.size());
 
-    // Compute the covariance-weighted separations of all pairs of sources and reference stars
-    double covWeightedSep[calInv->sources.size()][visibleReferenceStars.size()];
-    for(unsigned int s1=0; s1<calInv->sources.size(); s1++) {
+    // If too few reference stars were cross-matched then the initial calibration may be far from the truth, for example
+    // if the camera has been remounted. In that case, solve for the camera orientation and focal length from scratch, and
+    // if that gives more cross-matches then use it as the initial calibration instead.
+    const CameraModelBase * initialCam = initial->cam;
+    Eigen::Quaterniond initialQ = initial->q_sez_cam;
+    std::unique_ptr<PinholeCamera> blindSolvedCam;
 
-        Source * source = &(calInv->sources[s1]);
-        Matrix2d s;
-        s << source->c_ii, source->c_ij, source->c_ij, source->c_jj;
+    // The index is built in the background, and is unavailable until it's ready
+    std::shared_ptr<AsterismIndex> asterismIndex = std::atomic_load(&state->asterismIndex);
 
-        for(unsigned int s2=0; s2<visibleReferenceStars.size(); s2++) {
+    if(calInv->xms.size() < state->blind_solve_min_xms && asterismIndex) {
 
-            ReferenceStar * testStar = &(visibleReferenceStars[s2]);
-            MatrixXd r(2,1);
-            r << source->i - testStar->i, source->j - testStar->j;
+        PlateSolver solver(asterismIndex);
+        Matrix3d r_bcrf_cam_blind;
+        double f;
 
-            covWeightedSep[s1][s2] = std::sqrt((r.transpose() * s.colPivHouseholderQr().solve(r))(0,0));
-        }
-    }
+        if(solver.solve(calInv->sources, width, height, r_bcrf_cam_blind, f)) {
 
-    for(unsigned int s1=0; s1<calInv->sources.size(); s1++) {
+            blindSolvedCam.reset(new PinholeCamera(width, height, f, f, width / 2.0, height / 2.0));
 
-        // Locate the closest reference star to source s1
-        unsigned int closestStarIdx;
-        double minSep = 2.0 * minSepThreshold;
-        for(unsigned int s2=0; s2<visibleReferenceStars.size(); s2++) {
-            if(covWeightedSep[s1][s2] < minSep) {
-                minSep = covWeightedSep[s1][s2];
-                closestStarIdx = s2;
-            }
-        }
+            std::vector<std::pair<Source, ReferenceStar>> blindXms;
+            crossMatch(r_bcrf_cam_blind, *blindSolvedCam, calInv->sources, blindXms);
 
-        if(minSep > minSepThreshold) {
-            // The closest reference star is too far away to be a positive match
-            continue;
-        }
+            fprintf(stderr, "Blind solution matched %d index stars; focal length = %f [pixels]; cross-matched %d reference stars\n",
+                    solver.getNumMatched(), f, (int)blindXms.size());
 
-        // Find the closest source to this reference star
-        minSep = 2.0 * minSepThreshold;
-        unsigned int closestSourceIdx;
-        for(unsigned int s2=0; s2<calInv->sources.size(); s2++) {
-            if(covWeightedSep[s2][closestStarIdx] < minSep) {
-                minSep = covWeightedSep[s2][closestStarIdx];
-                closestSourceIdx = s2;
+            if(blindXms.size() > calInv->xms.size()) {
+                calInv->xms.swap(blindXms);
+                initialCam = blindSolvedCam.get();
+                initialQ = Quaterniond(r_bcrf_cam_blind * (r_ecef_sez * r_bcrf_ecef).transpose());
             }
         }
-
-        // If the closest source to this reference star is the original source, then we have a match
-        if(closestSourceIdx == s1) {
-            calInv->xms.push_back(pair<Source, ReferenceStar>(calInv->sources[closestSourceIdx], visibleReferenceStars[closestStarIdx]));
+        else {
+            fprintf(stderr, "Blind solution failed\n");
         }
     }
 
@@ -260,9 +217,9 @@ void CalibrationWorker::process() {
 
 
     fprintf(stderr, "Initial camera parameters = \n");
-    double camPar[initial->cam->getNumParameters()];
-    initial->cam->getParameters(camPar);
-    for(unsigned int n=0; n<initial->cam->getNumParameters(); n++) {
+    std::vector<double> camPar(initialCam->getNumParameters());
+    initialCam->getParameters(camPar.data());
+    for(unsigned int n=0; n<camPar.size(); n++) {
         fprintf(stderr, "%.10f\t", camPar[n]);
     }
 
@@ -271,20 +228,20 @@ void CalibrationWorker::process() {
     // would be different.
 
     if(this->state->camera_model_type.compare("PinholeCamera") == 0) {
-        calInv->cam = initial->cam->convertToPinholeCamera();
-        if(initial->cam->getModelName().compare("PinholeCamera") != 0) {
+        calInv->cam = initialCam->convertToPinholeCamera();
+        if(initialCam->getModelName().compare("PinholeCamera") != 0) {
             // TODO: Changing camera model - need to reset running calibration...?
         }
     }
     else if(this->state->camera_model_type.compare("PinholeCameraWithRadialDistortion") == 0) {
-        calInv->cam = initial->cam->convertToPinholeCameraWithRadialDistortion();
-        if(initial->cam->getModelName().compare("PinholeCameraWithRadialDistortion") != 0) {
+        calInv->cam = initialCam->convertToPinholeCameraWithRadialDistortion();
+        if(initialCam->getModelName().compare("PinholeCameraWithRadialDistortion") != 0) {
             // TODO: Changing camera model - need to reset running calibration...?
         }
     }
     else if(this->state->camera_model_type.compare("PinholeCameraWithSipDistortion") == 0) {
-        calInv->cam = initial->cam->convertToPinholeCameraWithSipDistortion();
-        if(initial->cam->getModelName().compare("PinholeCameraWithSipDistortion") != 0) {
+        calInv->cam = initialCam->convertToPinholeCameraWithSipDistortion();
+        if(initialCam->getModelName().compare("PinholeCameraWithSipDistortion") != 0) {
             // TODO: Changing camera model - need to reset running calibration...?
         }
     }
@@ -293,16 +250,17 @@ void CalibrationWorker::process() {
         return;
     }
 
-    calInv->q_sez_cam = initial->q_sez_cam;
+    calInv->q_sez_cam = initialQ;
 
     fprintf(stderr, "Initial quaternion normalisation = %f\n", calInv->q_sez_cam.norm());
     calInv->q_sez_cam.normalize();
 
     fprintf(stderr, "Initial parameters = \nIntrinsic = ");
-    camPar[calInv->cam->getNumParameters()];
-    calInv->cam->getParameters(camPar);
-    for(unsigned int n=0; n<calInv->cam->getNumParameters(); n++) {
-        fprintf(stderr, "%f\t", camPar[n]);
+    // The configured camera model may have more parameters than the initial one
+    std::vector<double> calPar(calInv->cam->getNumParameters());
+    calInv->cam->getParameters(calPar.data());
+    for(unsigned int n=0; n<calPar.size(); n++) {
+        fprintf(stderr, "%f\t", calPar[n]);
     }
     fprintf(stderr, "\nExtrinsic = %f\t%f\t%f\t%f\n", calInv->q_sez_cam.w(), calInv->q_sez_cam.x(), calInv->q_sez_cam.y(), calInv->q_sez_cam.z());
 
@@ -312,12 +270,15 @@ void CalibrationWorker::process() {
     fprintf(stderr, "Final quaternion normalisation = %f\n", calInv->q_sez_cam.norm());
 
     fprintf(stderr, "Fitted parameters = \nIntrinsic = ");
-    calInv->cam->getParameters(camPar);
-    for(unsigned int n=0; n<calInv->cam->getNumParameters(); n++) {
-        fprintf(stderr, "%f\t", camPar[n]);
+    calInv->cam->getParameters(calPar.data());
+    for(unsigned int n=0; n<calPar.size(); n++) {
+        fprintf(stderr, "%f\t", calPar[n]);
     }
     fprintf(stderr, "\nExtrinsic = %f\t%f\t%f\t%f\n", calInv->q_sez_cam.w(), calInv->q_sez_cam.x(), calInv->q_sez_cam.y(), calInv->q_sez_cam.z());
 
+    // The camera model is fixed from now on, so tabulate the inverse distortion for fast deprojection
+    calInv->cam->buildInverseDistortionMap();
+
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
     //                                                       //
     //             Compute the readout noise                 //
@@ -344,9 +305,105 @@ void CalibrationWorker::process() {
     //                                                       //
     //+++++++++++++++++++++++++++++++++++++++++++++++++++++++//
 
-    calInv->saveToDir(state->calibrationDirPath);
+    calInv->saveToDir(state->calibrationDirPath, state->clip_key_frame_interval);
 
     // All done - emit signals
     emit finished(TimeUtil::epochToUtcString(calInv->epochTimeUs));
     emit finished(calInv);
 }
+
+void CalibrationWorker::crossMatch(const Matrix3d &r_bcrf_cam, const CameraModelBase &cam, const std::vector<Source> &sources,
+                                   std::vector<std::pair<Source, ReferenceStar>> &xms) const {
+
+    // Get the stars brighter than the faint mag limit that are visible in the image
+    std::vector<ReferenceStar> visibleReferenceStars;
+    xms.clear();
+    if(state->refStarCatalogue) {
+        state->refStarCatalogue->getVisibleStars(r_bcrf_cam, cam, state->ref_star_faint_mag_limit, visibleReferenceStars);
+    }
+
+    // The cross matching is done purely spatially. The algorithm is as follows:
+    // For each Source find the closest ReferenceStar
+    // If there are no Sources closer to the ReferenceStar than this one, and the
+    // separation is below a threshold, then the Source and ReferenceStar are a match.
+
+    // TODO: make robust to hot pixels. Include a hot pixel determination step that operates
+    //       over multiple executions.
+    // TODO: allow cross-matches to be specified manually somehow; maybe a field of the constructor.
+
+    // Minimum separation for acceptable cross match in sigmas
+    double minSepThreshold = 20.0;
+
+    // Spatial index of the reference stars, so that each source is only compared to the stars near it
+    std::vector<double> refStarI, refStarJ;
+    for(ReferenceStar &star : visibleReferenceStars) {
+        refStarI.push_back(star.i);
+        refStarJ.push_back(star.j);
+    }
+    SpatialGrid refStarGrid(refStarI, refStarJ, crossMatchGridCellSize);
+
+    // Compute the covariance-weighted separations of the pairs of sources and reference stars that are closer
+    // than 2*minSepThreshold; more distant pairs can never be matched. For each source, the list of nearby
+    // stars and their separations; for each star, the list of nearby sources and their separations.
+    std::vector<std::vector<std::pair<unsigned int, double>>> starsNearSource(sources.size());
+    std::vector<std::vector<std::pair<unsigned int, double>>> sourcesNearStar(visibleReferenceStars.size());
+    std::vector<unsigned int> candidates;
+    for(unsigned int s1=0; s1<sources.size(); s1++) {
+
+        const Source * source = &(sources[s1]);
+
+        // The covariance-weighted separation is at least the Euclidean separation divided by the square root of
+        // the largest eigenvalue of the dispersion matrix, which bounds the search radius
+        refStarGrid.query(source->i, source->j, 2.0 * minSepThreshold * std::sqrt(source->l1), candidates);
+
+        // Inverse of the dispersion matrix [a b; b c] is [c -b; -b a]/det
+        double det = source->c_ii * source->c_jj - source->c_ij * source->c_ij;
+
+        for(unsigned int s2 : candidates) {
+
+            ReferenceStar * testStar = &(visibleReferenceStars[s2]);
+            double di = source->i - testStar->i;
+            double dj = source->j - testStar->j;
+
+            double sep = std::sqrt((source->c_jj * di * di - 2.0 * source->c_ij * di * dj + source->c_ii * dj * dj) / det);
+
+            if(sep < 2.0 * minSepThreshold) {
+                starsNearSource[s1].push_back(std::make_pair(s2, sep));
+                sourcesNearStar[s2].push_back(std::make_pair(s1, sep));
+            }
+        }
+    }
+
+    for(unsigned int s1=0; s1<sources.size(); s1++) {
+
+        // Locate the closest reference star to source s1
+        unsigned int closestStarIdx;
+        double minSep = 2.0 * minSepThreshold;
+        for(const std::pair<unsigned int, double> &star : starsNearSource[s1]) {
+            if(star.second < minSep) {
+                minSep = star.second;
+                closestStarIdx = star.first;
+            }
+        }
+
+        if(minSep > minSepThreshold) {
+            // The closest reference star is too far away to be a positive match
+            continue;
+        }
+
+        // Find the closest source to this reference star
+        minSep = 2.0 * minSepThreshold;
+        unsigned int closestSourceIdx;
+        for(const std::pair<unsigned int, double> &src : sourcesNearStar[closestStarIdx]) {
+            if(src.second < minSep) {
+                minSep = src.second;
+                closestSourceIdx = src.first;
+            }
+        }
+
+        // If the closest source to this reference star is the original source, then we have a match
+        if(closestSourceIdx == s1) {
+            xms.push_back(pair<Source, ReferenceStar>(sources[closestSourceIdx], visibleReferenceStars[closestStarIdx]));
+        }
+    }
+}
@@ -4,6 +4,10 @@
 #include "infra/asteriastate.h"
 #include "infra/imageuc.h"
 #include "infra/calibrationinventory.h"
+#include "infra/pixelstatsaccumulator.h"
+#include "infra/source.h"
+#include "infra/referencestar.h"
+#include "optics/cameramodelbase.h"
 
 #include <linux/videodev2.h>
 #include <vector>               // vector
@@ -26,12 +30,42 @@ public:
      *  Pointer to the initial CalibrationInventory which will provide initial guess solution and be used to
      * propagate certain calibrations in time.
      * @param calibrationFrames
-     *  Vector of frames to be used to determine calibration.
+     *  Vector of frames to be used to determine calibration. If there are fewer than the calibration stack size,
+     * the signal and noise images of the initial calibration are reused, if present, and otherwise the calibration
+     * is abandoned.
      */
     CalibrationWorker(QObject *parent = 0, AsteriaState * state = 0, const std::shared_ptr<CalibrationInventory> initial = 0,
                       std::vector<std::shared_ptr<Imageuc>> calibrationFrames = std::vector<std::shared_ptr<Imageuc>>());
+
+    /**
+     * @brief Constructor for the CalibrationWorker, for use when the per-pixel statistics of the calibration frames
+     * have been accumulated as the frames were captured.
+     * @param parent
+     *  The parent widget, if it exists.
+     * @param state
+     *  Pointer to the AsteriaState object that contains various parameters of the calibration algorithms.
+     * @param initial
+     *  Pointer to the initial CalibrationInventory which will provide initial guess solution and be used to
+     * propagate certain calibrations in time.
+     * @param pixelStats
+     *  The accumulated per-pixel statistics of the calibration frames.
+     * @param calibrationFrames
+     *  The first and last calibration frames, which record the time span of the calibration.
+     */
+    CalibrationWorker(QObject *parent, AsteriaState * state, const std::shared_ptr<CalibrationInventory> initial,
+                      std::shared_ptr<PixelStatsAccumulator> pixelStats, std::vector<std::shared_ptr<Imageuc>> calibrationFrames);
     ~CalibrationWorker();
 
+    /**
+     * @brief The fraction of the highest and lowest values of each pixel that are excluded from the signal and noise estimates.
+     */
+    static constexpr double signalTrimFraction = 0.05;
+
+    /**
+     * @brief Size of the cells in the spatial index of reference stars used for cross-matching [pixels].
+     */
+    static constexpr double crossMatchGridCellSize = 32.0;
+
 public slots:
 
     /**
@@ -71,6 +105,25 @@ private:
      * @brief Vector of frames to be used to determine calibration.
      */
     std::vector<std::shared_ptr<Imageuc>> calibrationFrames;
+
+    /**
+     * @brief Per-pixel statistics of the calibration frames; if not set, these are computed from calibrationFrames.
+     */
+    std::shared_ptr<PixelStatsAccumulator> pixelStats;
+
+    /**
+     * @brief Cross-match the observed sources with the reference stars projected into the image.
+     * @param r_bcrf_cam
+     *  Rotation from the BCRF to the camera frame.
+     * @param cam
+     *  The camera model used to project the reference stars.
+     * @param sources
+     *  The observed sources.
+     * @param xms
+     *  On exit, contains the Source / ReferenceStar cross-matches.
+     */
+    void crossMatch(const Eigen::Matrix3d &r_bcrf_cam, const CameraModelBase &cam, const std::vector<Source> &sources,
+                    std::vector<std::pair<Source, ReferenceStar>> &xms) const;
 };
 
 #endif // CALIBRATIONWORKER_H
@@ -0,0 +1,416 @@
+#include "infra/clipfile.h"
+#include "util/timeutil.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <regex>
+#include <algorithm>
+#include <dirent.h>
+
+const char ClipFile::magic[8] = {'A', 'S', 'T', 'R', 'C', 'L', 'I', 'P'};
+const uint32_t ClipFile::version = 1;
+const uint32_t ClipFile::alignment = 4096;
+const uint32_t ClipFile::keyFrame;
+const std::string ClipFile::filename = "frames.clip";
+
+static uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+    return ((offset + alignment - 1) / alignment) * alignment;
+}
+
+/**
+ * @brief Write a buffer to a file at the given offset, retrying after partial writes.
+ */
+static bool writeAt(int fd, const void * data, size_t size, uint64_t offset) {
+    const char * pointer = (const char *)data;
+    while(size > 0) {
+        ssize_t written = pwrite(fd, pointer, size, offset);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pointer += written;
+        offset += written;
+        size -= written;
+    }
+    return true;
+}
+
+ClipFile::Writer::Writer() : fd(-1), width(0), height(0), keyFrameInterval(0), offset(0), failed(false), payloadSize(0) {
+
+}
+
+ClipFile::Writer::~Writer() {
+    if(fd >= 0) {
+        close();
+    }
+}
+
+bool ClipFile::Writer::open(const std::string &path, unsigned int width, unsigned int height, unsigned int keyFrameInterval) {
+
+    if(fd >= 0) {
+        close();
+    }
+
+    this->path = path;
+    this->width = width;
+    this->height = height;
+    this->keyFrameInterval = keyFrameInterval;
+    index.clear();
+    failed = false;
+    payloadSize = 0;
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        perror(("Couldn't create clip file " + path).c_str());
+        return false;
+    }
+
+    // The header is completed when the file is closed; until then the index offset is zero, marking it incomplete
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.width = width;
+    header.height = height;
+    header.alignment = alignment;
+    header.keyFrameInterval = keyFrameInterval;
+
+    if(!writeAt(fd, &header, sizeof(header), 0)) {
+        perror(("Couldn't write clip file " + path).c_str());
+        failed = true;
+        return false;
+    }
+
+    offset = alignment;
+    return true;
+}
+
+bool ClipFile::Writer::append(const Imageuc &frame) {
+
+    if(fd < 0 || failed) {
+        return false;
+    }
+
+    if(frame.width != width || frame.height != height) {
+        fprintf(stderr, "Frame size %dx%d doesn't match clip file %s (%dx%d)\n", frame.width, frame.height, path.c_str(), width, height);
+        failed = true;
+        return false;
+    }
+
+    unsigned int nPix = width * height;
+
+    IndexEntry entry;
+    entry.epochTimeUs = frame.epochTimeUs;
+    entry.field = frame.field;
+    entry.flags = 0;
+    entry.offset = offset;
+
+    const unsigned char * payload = &frame.rawImage[0];
+
+    if(keyFrameInterval > 0) {
+        bool key = (index.size() % keyFrameInterval == 0);
+        if(key) {
+            entry.flags |= keyFrame;
+        }
+        codec.encode(payload, key, nPix, width, encoded);
+        payload = &encoded[0];
+        entry.length = encoded.size();
+    }
+    else {
+        entry.length = nPix;
+    }
+
+    if(!writeAt(fd, payload, entry.length, entry.offset)) {
+        perror(("Couldn't write frame to clip file " + path).c_str());
+        failed = true;
+        return false;
+    }
+
+    index.push_back(entry);
+    payloadSize += entry.length;
+    offset = alignUp(offset + entry.length, keyFrameInterval > 0 ? 8 : alignment);
+    return true;
+}
+
+bool ClipFile::Writer::close() {
+
+    if(fd < 0) {
+        return false;
+    }
+
+    bool success = !failed;
+
+    if(success) {
+        // Append the index, then point the header to it
+        uint64_t indexOffset = offset;
+        if(!index.empty() && !writeAt(fd, &index[0], index.size() * sizeof(IndexEntry), indexOffset)) {
+            success = false;
+        }
+
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.width = width;
+        header.height = height;
+        header.alignment = alignment;
+        header.nFrames = index.size();
+        header.keyFrameInterval = keyFrameInterval;
+        header.indexOffset = indexOffset;
+
+        if(success && !writeAt(fd, &header, sizeof(header), 0)) {
+            success = false;
+        }
+        if(!success) {
+            perror(("Couldn't complete clip file " + path).c_str());
+        }
+    }
+
+    if(::close(fd) != 0) {
+        success = false;
+    }
+    fd = -1;
+    return success;
+}
+
+unsigned int ClipFile::Writer::size() const {
+    return index.size();
+}
+
+double ClipFile::Writer::getCompressionRatio() const {
+    return payloadSize > 0 ? (double)index.size() * width * height / payloadSize : 1.0;
+}
+
+ClipFile::ClipFile() : mapping(0), mappingSize(0), width(0), height(0), nFrames(0), keyFrameInterval(0), index(0), decodedFrame(-1) {
+
+}
+
+ClipFile::~ClipFile() {
+    if(mapping) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+std::shared_ptr<ClipFile> ClipFile::load(const std::string &path) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return std::shared_ptr<ClipFile>();
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return std::shared_ptr<ClipFile>();
+    }
+
+    void * mapping = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        perror(("Couldn't map clip file " + path).c_str());
+        return std::shared_ptr<ClipFile>();
+    }
+
+    // Frames are usually read in order of capture
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    std::shared_ptr<ClipFile> clip(new ClipFile());
+    clip->mapping = mapping;
+    clip->mappingSize = st.st_size;
+
+    const char * data = (const char *)mapping;
+    const Header * header = (const Header *)data;
+    uint64_t size = st.st_size;
+
+    if(memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version) {
+        fprintf(stderr, "Invalid clip file %s\n", path.c_str());
+        return std::shared_ptr<ClipFile>();
+    }
+    if(header->indexOffset == 0 || header->indexOffset % 8 != 0 || header->indexOffset + (uint64_t)header->nFrames * sizeof(IndexEntry) > size) {
+        fprintf(stderr, "Clip file %s is incomplete\n", path.c_str());
+        return std::shared_ptr<ClipFile>();
+    }
+
+    clip->width = header->width;
+    clip->height = header->height;
+    clip->nFrames = header->nFrames;
+    clip->keyFrameInterval = header->keyFrameInterval;
+    clip->index = (const IndexEntry *)(data + header->indexOffset);
+
+    for(unsigned int i=0; i<clip->nFrames; i++) {
+        const IndexEntry &entry = clip->index[i];
+        // Compressed frames vary in length, and decoding must be able to start from the first frame
+        bool validLength = clip->isCompressed() ? (i > 0 || (entry.flags & keyFrame)) : (entry.length == (uint64_t)clip->width * clip->height);
+        if(!validLength || entry.offset + entry.length > header->indexOffset) {
+            fprintf(stderr, "Invalid index entry for frame %d in clip file %s\n", i, path.c_str());
+            return std::shared_ptr<ClipFile>();
+        }
+    }
+
+    return clip;
+}
+
+unsigned int ClipFile::size() const {
+    return nFrames;
+}
+
+unsigned int ClipFile::getWidth() const {
+    return width;
+}
+
+unsigned int ClipFile::getHeight() const {
+    return height;
+}
+
+long long ClipFile::getEpochTimeUs(unsigned int i) const {
+    return index[i].epochTimeUs;
+}
+
+unsigned int ClipFile::getField(unsigned int i) const {
+    return index[i].field;
+}
+
+bool ClipFile::isCompressed() const {
+    return keyFrameInterval > 0;
+}
+
+const unsigned char * ClipFile::getPixels(unsigned int i) const {
+    if(isCompressed()) {
+        return NULL;
+    }
+    return (const unsigned char *)mapping + index[i].offset;
+}
+
+std::shared_ptr<Imageuc> ClipFile::readFrame(unsigned int i) const {
+
+    unsigned int w = width;
+    unsigned int h = height;
+    auto image = std::make_shared<Imageuc>(w, h);
+    image->epochTimeUs = index[i].epochTimeUs;
+    image->field = index[i].field;
+
+    if(!isCompressed()) {
+        memcpy(&(image->rawImage[0]), getPixels(i), index[i].length);
+        return image;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(decodedFrame != (int)i) {
+
+        // Decode forwards from the nearest key frame, or from the frame decoded last if that's nearer; the codec
+        // holds the background from the frames decoded since the key frame
+        unsigned int start = i;
+        while(!(index[start].flags & keyFrame) && (int)start != decodedFrame + 1) {
+            start--;
+        }
+
+        decoded.resize(w * h);
+        for(unsigned int f = start; f <= i; f++) {
+            const unsigned char * data = (const unsigned char *)mapping + index[f].offset;
+            if(!codec.decode(data, index[f].length, w * h, w, &decoded[0])) {
+                fprintf(stderr, "Couldn't decode frame %d of clip file\n", f);
+                decodedFrame = -1;
+                return std::shared_ptr<Imageuc>();
+            }
+            decodedFrame = f;
+        }
+    }
+
+    memcpy(&(image->rawImage[0]), &decoded[0], w * h);
+    return image;
+}
+
+bool ClipFile::readFrames(std::vector<std::shared_ptr<Imageuc>> &frames) const {
+    frames.clear();
+    frames.reserve(nFrames);
+    for(unsigned int i=0; i<nFrames; i++) {
+        std::shared_ptr<Imageuc> frame = readFrame(i);
+        if(!frame) {
+            return false;
+        }
+        frames.push_back(frame);
+    }
+    return true;
+}
+
+bool ClipFile::exportPgm(const std::string &dir) const {
+
+    for(unsigned int i=0; i<nFrames; i++) {
+        std::string framePath = dir + "/" + TimeUtil::epochToUtcString(index[i].epochTimeUs) + ".pgm";
+        std::shared_ptr<Imageuc> frame = readFrame(i);
+        if(!frame) {
+            return false;
+        }
+        std::ofstream out(framePath);
+        out << *frame;
+        out.close();
+        if(out.fail()) {
+            fprintf(stderr, "Couldn't write frame %s\n", framePath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ClipFile::save(const std::string &path, const std::vector<std::shared_ptr<Imageuc>> &frames, unsigned int keyFrameInterval) {
+
+    if(frames.empty()) {
+        return false;
+    }
+
+    Writer writer;
+    if(!writer.open(path, frames[0]->width, frames[0]->height, keyFrameInterval)) {
+        return false;
+    }
+    for(const std::shared_ptr<Imageuc> &frame : frames) {
+        if(!writer.append(*frame)) {
+            break;
+        }
+    }
+    return writer.close();
+}
+
+bool ClipFile::loadFrames(const std::string &dir, std::vector<std::shared_ptr<Imageuc>> &frames) {
+
+    frames.clear();
+
+    std::shared_ptr<ClipFile> clip = load(dir + "/" + filename);
+    if(clip) {
+        return clip->readFrames(frames);
+    }
+
+    // No clip file: fall back to the individual PGM files
+    DIR *d;
+    if ((d = opendir (dir.c_str())) == NULL) {
+        // Couldn't open the directory!
+        return false;
+    }
+
+    struct dirent *child;
+    while ((child = readdir (d)) != NULL) {
+
+        // Match files with names starting with UTC string, e.g. 2017-06-14T19:41:09.282Z.pgm
+        if(std::regex_search(child->d_name, TimeUtil::utcRegex, std::regex_constants::match_continuous)) {
+            std::ifstream input(dir + "/" + child->d_name);
+            auto frame = std::make_shared<Imageuc>();
+            input >> *frame;
+            frames.push_back(frame);
+            input.close();
+        }
+    }
+    closedir (d);
+
+    // Sort the frames into ascending order of capture time
+    std::sort(frames.begin(), frames.end(), Imageuc::comparePtrToImage);
+
+    return true;
+}
@@ -0,0 +1,317 @@
+#ifndef CLIPFILE_H
+#define CLIPFILE_H
+
+#include "infra/imageuc.h"
+#include "infra/framecodec.h"
+
+#include <string>
+#include <vector>
+#include <memory>               // shared_ptr
+#include <cstdint>
+#include <mutex>
+
+/**
+ * @brief The ClipFile class provides access to the frames of a clip stored in a single indexed container file,
+ * which replaces the directory of one PGM file per frame. Opening a clip is a single memory mapping of the file,
+ * and the pixels of each frame can be accessed directly in the mapping without copying or parsing.
+ *
+ * The frames may optionally be compressed losslessly by the FrameCodec, which predicts each frame from the
+ * frames before it. Every keyFrameInterval frames a key frame is coded without reference to the earlier frames,
+ * so that any frame can be decoded starting from the nearest key frame before it. Frames are usually read in order,
+ * in which case each is decoded from the previous frame.
+ *
+ * The file is written sequentially by the ClipFile::Writer: the header is written first, then each frame is
+ * appended as it arrives, and the index is appended when the clip is closed, after which the header is updated
+ * to point to it. A file that wasn't closed (e.g. due to a crash during acquisition) has no index and can't be
+ * read. The binary format is:
+ *
+ * Header        : char[8] magic ("ASTRCLIP"), uint32 version, uint32 width, uint32 height, uint32 alignment,
+ *                 uint32 number of frames N, uint32 key frame interval (zero if the frames are uncompressed),
+ *                 uint64 index offset [bytes]. Padded to the alignment.
+ * Frames        : Uncompressed: unsigned char[width*height] per frame, each starting on a multiple of the
+ *                 alignment so that the payloads are page-aligned in the mapping.
+ *                 Compressed: the encoded frames, each starting on a multiple of 8 bytes.
+ * Index         : IndexEntry[N], in order of capture; starts on a multiple of 8 bytes.
+ *
+ * All values are stored in the native byte order of the machine that wrote the file.
+ */
+class ClipFile
+{
+
+public:
+
+    /**
+     * @brief An entry in the frame index.
+     */
+    struct IndexEntry {
+        int64_t epochTimeUs;
+        uint32_t field;
+        uint32_t flags;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    /**
+     * @brief Flag set in IndexEntry::flags for key frames.
+     */
+    static const uint32_t keyFrame = 1;
+
+    /**
+     * @brief Writes the frames of a clip to a container file.
+     */
+    class Writer
+    {
+
+    public:
+
+        Writer();
+
+        /**
+         * @brief Destructor; closes the file if it's open.
+         */
+        ~Writer();
+
+        /**
+         * @brief Create the file and write the header. Any existing file at the path is replaced.
+         * @param path
+         *  The path to the clip file.
+         * @param width
+         *  Width of the frames [pixels]
+         * @param height
+         *  Height of the frames [pixels]
+         * @param keyFrameInterval
+         *  Interval between key frames when compressing the frames; zero stores the frames uncompressed.
+         * @return
+         *  True if the file was created.
+         */
+        bool open(const std::string &path, unsigned int width, unsigned int height, unsigned int keyFrameInterval);
+
+        /**
+         * @brief Append a frame to the file.
+         * @param frame
+         *  The frame to append; this must have the dimensions given to open(...).
+         * @return
+         *  True if the frame was written.
+         */
+        bool append(const Imageuc &frame);
+
+        /**
+         * @brief Write the index and update the header, then close the file.
+         * @return
+         *  True if the file was completed successfully.
+         */
+        bool close();
+
+        /**
+         * @brief Get the number of frames appended so far.
+         */
+        unsigned int size() const;
+
+        /**
+         * @brief Get the ratio of the size of the frames appended so far to the size of their payloads in the file.
+         */
+        double getCompressionRatio() const;
+
+    private:
+
+        // Disable copying; the writer owns the file descriptor
+        Writer(const Writer&);
+        Writer& operator=(const Writer&);
+
+        std::string path;
+
+        int fd;
+
+        unsigned int width, height;
+
+        unsigned int keyFrameInterval;
+
+        /**
+         * @brief Offset at which the next frame will be written [bytes]
+         */
+        uint64_t offset;
+
+        /**
+         * @brief Indicates that a write has failed, in which case the file isn't completed.
+         */
+        bool failed;
+
+        std::vector<IndexEntry> index;
+
+        /**
+         * @brief Total size of the frame payloads written [bytes]
+         */
+        uint64_t payloadSize;
+
+        /**
+         * @brief The codec and the encoded frame, when compressing.
+         */
+        FrameCodec codec;
+        std::vector<unsigned char> encoded;
+    };
+
+    ~ClipFile();
+
+    /**
+     * @brief Open a clip file, by memory-mapping it.
+     * @param path
+     *  The path to the clip file.
+     * @return
+     *  The clip file, or an empty pointer if it couldn't be opened or isn't complete.
+     */
+    static std::shared_ptr<ClipFile> load(const std::string &path);
+
+    /**
+     * @brief Get the number of frames in the clip.
+     */
+    unsigned int size() const;
+
+    /**
+     * @brief Get the width of the frames [pixels]
+     */
+    unsigned int getWidth() const;
+
+    /**
+     * @brief Get the height of the frames [pixels]
+     */
+    unsigned int getHeight() const;
+
+    /**
+     * @brief Get the epoch time of capture of a frame [microseconds]
+     */
+    long long getEpochTimeUs(unsigned int i) const;
+
+    /**
+     * @brief Get the v4l2_field value of a frame.
+     */
+    unsigned int getField(unsigned int i) const;
+
+    /**
+     * @brief Indicates whether the frames are compressed.
+     */
+    bool isCompressed() const;
+
+    /**
+     * @brief Get the pixels of a frame, within the mapping; these remain valid while the ClipFile exists. Only
+     * available for uncompressed clips.
+     * @return
+     *  Pointer to the pixels, or NULL if the clip is compressed.
+     */
+    const unsigned char * getPixels(unsigned int i) const;
+
+    /**
+     * @brief Read a frame from the clip into a new image, decoding it if the clip is compressed.
+     * @param i
+     *  Index of the frame within the clip.
+     * @return
+     *  Pointer to the frame, or an empty pointer if it couldn't be decoded.
+     */
+    std::shared_ptr<Imageuc> readFrame(unsigned int i) const;
+
+    /**
+     * @brief Read all the frames from the clip into new images.
+     * @param frames
+     *  On exit, contains the frames in order of capture.
+     * @return
+     *  True if all the frames were read successfully.
+     */
+    bool readFrames(std::vector<std::shared_ptr<Imageuc>> &frames) const;
+
+    /**
+     * @brief Write the frames out as individual PGM files named by the UTC of each frame, in the layout used
+     * before the clip file was introduced.
+     * @param dir
+     *  The directory to write the PGM files to; this must exist.
+     * @return
+     *  True if all frames were written successfully.
+     */
+    bool exportPgm(const std::string &dir) const;
+
+    /**
+     * @brief Write a vector of frames to a clip file.
+     * @param path
+     *  The path to the clip file.
+     * @param frames
+     *  The frames to write; these must all have the same dimensions.
+     * @param keyFrameInterval
+     *  Interval between key frames when compressing the frames; zero stores the frames uncompressed.
+     * @return
+     *  True if the file was written successfully.
+     */
+    static bool save(const std::string &path, const std::vector<std::shared_ptr<Imageuc>> &frames, unsigned int keyFrameInterval);
+
+    /**
+     * @brief Load the frames stored in a raw/ directory, either from the clip file or, for clips saved before
+     * the clip file was introduced, from the individual PGM files.
+     * @param dir
+     *  Path to the raw/ directory.
+     * @param frames
+     *  On exit, contains the frames in order of capture.
+     * @return
+     *  True if the frames were loaded, false if the directory couldn't be opened.
+     */
+    static bool loadFrames(const std::string &dir, std::vector<std::shared_ptr<Imageuc>> &frames);
+
+    /**
+     * @brief Name of the clip file within the raw/ subdirectory of the clip and calibration directories.
+     */
+    static const std::string filename;
+
+private:
+
+    ClipFile();
+
+    // Disable copying; the clip file owns a memory mapping
+    ClipFile(const ClipFile&);
+    ClipFile& operator=(const ClipFile&);
+
+    /**
+     * @brief Header of the clip file.
+     */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t alignment;
+        uint32_t nFrames;
+        uint32_t keyFrameInterval;
+        uint64_t indexOffset;
+    };
+
+    static const char magic[8];
+    static const uint32_t version;
+
+    /**
+     * @brief Alignment of the frame payloads within the file [bytes]
+     */
+    static const uint32_t alignment;
+
+    /**
+     * @brief The memory mapping of the clip file.
+     */
+    void * mapping;
+    size_t mappingSize;
+
+    unsigned int width, height;
+
+    unsigned int nFrames;
+
+    unsigned int keyFrameInterval;
+
+    /**
+     * @brief Pointer to the index within the mapping.
+     */
+    const IndexEntry * index;
+
+    /**
+     * @brief The most recently decoded frame of a compressed clip and its index (-1 if none), from which the
+     * next frame is decoded when reading in order. Guarded by the mutex.
+     */
+    mutable FrameCodec codec;
+    mutable std::vector<unsigned char> decoded;
+    mutable int decodedFrame;
+    mutable std::mutex mutex;
+};
+
+#endif // CLIPFILE_H
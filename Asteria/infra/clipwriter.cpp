@@ -0,0 +1,227 @@
+#include "infra/clipwriter.h"
+#include "infra/analysisinventory.h"
+#include "util/timeutil.h"
+#include "util/fileutil.h"
+
+#include <stdio.h>
+
+ClipWriter::Clip::Clip(std::string topLevelPath, long long epochTimeUs)
+    : utc(TimeUtil::epochToUtcString(epochTimeUs)), dirsCreated(false), failed(false), complete(false), success(false) {
+    path = AnalysisInventory::getClipPath(topLevelPath, utc);
+}
+
+std::string ClipWriter::Clip::getUtc() const {
+    return utc;
+}
+
+std::string ClipWriter::Clip::getPath() const {
+    return path;
+}
+
+bool ClipWriter::Clip::waitUntilWritten() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!complete) {
+        completed.wait(lock);
+    }
+    return success;
+}
+
+unsigned int ClipWriter::Clip::size() const {
+    return file ? file->size() : 0;
+}
+
+std::shared_ptr<Imageuc> ClipWriter::Clip::readFrame(unsigned int i) const {
+    if(!file || i >= file->size()) {
+        fprintf(stderr, "Couldn't read frame %d of clip %s\n", i, utc.c_str());
+        return std::shared_ptr<Imageuc>();
+    }
+    return file->readFrame(i);
+}
+
+void ClipWriter::Clip::setComplete(bool success) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->success = success;
+    complete = true;
+    completed.notify_all();
+}
+
+ClipWriter::ClipWriter(std::string topLevelPath, unsigned int window, unsigned int keyFrameInterval)
+    : topLevelPath(topLevelPath), window(window > 0 ? window : 1), keyFrameInterval(keyFrameInterval), framesInClip(0), stalls(0), jobs(this->window + 2),
+      inFlight(0), stop(false) {
+    thread = std::thread(&ClipWriter::run, this);
+}
+
+ClipWriter::~ClipWriter() {
+    if(current) {
+        // The clip wasn't ended so is incomplete; don't leave it on disk
+        abortClip();
+    }
+    stop = true;
+    thread.join();
+}
+
+std::shared_ptr<ClipWriter::Clip> ClipWriter::beginClip(long long epochTimeUs) {
+    if(current) {
+        fprintf(stderr, "Aborting clip %s that wasn't ended\n", current->getUtc().c_str());
+        abortClip();
+    }
+    current = std::make_shared<Clip>(topLevelPath, epochTimeUs);
+    framesInClip = 0;
+    stalls = 0;
+    return current;
+}
+
+void ClipWriter::addFrame(const std::shared_ptr<Imageuc> &frame) {
+    addFrame(std::shared_ptr<Imageuc>(frame));
+}
+
+void ClipWriter::addFrame(std::shared_ptr<Imageuc> &&frame) {
+    if(!current) {
+        frame.reset();
+        return;
+    }
+    Job job;
+    job.type = Job::FRAME;
+    job.clip = current;
+    job.frame = std::move(frame);
+    pushJob(job);
+    framesInClip++;
+}
+
+std::shared_ptr<ClipWriter::Clip> ClipWriter::endClip() {
+    std::shared_ptr<Clip> clip = current;
+    if(!clip) {
+        return clip;
+    }
+    if(stalls > 0) {
+        fprintf(stderr, "Clip %s: waited for the clip writer %d times; consider increasing clip_writer_window\n", clip->getUtc().c_str(), stalls);
+    }
+    Job job;
+    job.type = Job::END;
+    job.clip = clip;
+    pushJob(job);
+    current.reset();
+    return clip;
+}
+
+void ClipWriter::abortClip() {
+    if(!current) {
+        return;
+    }
+    Job job;
+    job.type = Job::ABORT;
+    job.clip = current;
+    pushJob(job);
+    current.reset();
+}
+
+unsigned int ClipWriter::getFramesInClip() const {
+    return framesInClip;
+}
+
+unsigned int ClipWriter::getFramesInFlight() const {
+    return inFlight;
+}
+
+void ClipWriter::pushJob(const Job &job) {
+
+    bool stalled = false;
+
+    for(;;) {
+        // Frames are limited by the in-flight window; the queue has space for the END or ABORT job even when it's full
+        if(job.type != Job::FRAME || inFlight < window) {
+            if(job.type == Job::FRAME) {
+                inFlight++;
+            }
+            if(jobs.tryPush(job)) {
+                break;
+            }
+            if(job.type == Job::FRAME) {
+                inFlight--;
+            }
+        }
+        stalled = true;
+        // Wait for the writer thread to complete a job; the timeout guards against a lost wakeup
+        jobDone.wait(100000);
+        jobDone.clear();
+    }
+
+    if(stalled) {
+        stalls++;
+    }
+}
+
+void ClipWriter::run() {
+
+    Job job;
+
+    // Finish writing any queued jobs before stopping
+    while(!stop || jobs.size() > 0) {
+
+        if(!jobs.pop(job, 100000)) {
+            continue;
+        }
+
+        Clip &clip = *job.clip;
+
+        switch(job.type) {
+        case Job::FRAME:
+            if(!clip.failed) {
+                writeFrame(clip, *job.frame);
+            }
+            // Release the frame as soon as it's been written so it can be recycled
+            job.frame.reset();
+            inFlight--;
+            break;
+        case Job::END: {
+            bool success = !clip.failed && clip.writer.size() > 0;
+            if(clip.dirsCreated) {
+                if(keyFrameInterval > 0) {
+                    fprintf(stderr, "Clip %s: compression ratio %.2f\n", clip.utc.c_str(), clip.writer.getCompressionRatio());
+                }
+                // Writes the index; the clip file can't be read until this is done
+                success = clip.writer.close() && success;
+            }
+            if(success) {
+                clip.file = ClipFile::load(clip.path + "/raw/" + ClipFile::filename);
+                success = (bool)clip.file;
+            }
+            clip.setComplete(success);
+            break;
+        }
+        case Job::ABORT:
+            // Don't keep the partial results
+            if(clip.dirsCreated) {
+                clip.writer.close();
+                FileUtil::deleteFilePath(clip.path);
+            }
+            clip.setComplete(false);
+            break;
+        }
+
+        job.clip.reset();
+        jobDone.signal();
+    }
+}
+
+void ClipWriter::writeFrame(Clip &clip, const Imageuc &frame) {
+
+    if(!clip.dirsCreated) {
+        if(!AnalysisInventory::createClipDirs(topLevelPath, clip.utc)) {
+            fprintf(stderr, "Couldn't create directory %s\n", clip.path.c_str());
+            clip.failed = true;
+            return;
+        }
+        clip.dirsCreated = true;
+
+        // The frame size is fixed for the clip by the first frame
+        if(!clip.writer.open(clip.path + "/raw/" + ClipFile::filename, frame.width, frame.height, keyFrameInterval)) {
+            clip.failed = true;
+            return;
+        }
+    }
+
+    if(!clip.writer.append(frame)) {
+        clip.failed = true;
+    }
+}
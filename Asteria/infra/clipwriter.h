@@ -0,0 +1,298 @@
+#ifndef CLIPWRITER_H
+#define CLIPWRITER_H
+
+#include "infra/imageuc.h"
+#include "infra/clipfile.h"
+#include "infra/lockfreequeue.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Writes the frames of a clip to disk in a background thread while the clip is still being recorded,
+ * so that the frames don't need to be held in memory until the end of the clip.
+ *
+ * Frames are handed over with addFrame(...) as soon as they're acquired and are released once they've been
+ * written. The number of frames that are waiting to be written at any time is bounded by the in-flight window;
+ * if the writer falls that far behind then addFrame(...) blocks until it catches up. The frames are appended
+ * to the ClipFile in the raw/ subdirectory of the clip directory, using the same layout as
+ * AnalysisInventory::saveToDir(...), and can be read back one at a time through the Clip handle returned by
+ * beginClip(...).
+ *
+ * The beginClip(...), addFrame(...), endClip() and abortClip() functions must all be called from the same thread.
+ */
+class ClipWriter
+{
+
+public:
+
+    /**
+     * @brief Handle to a clip that is being written to disk, used to read the frames back once writing is complete.
+     */
+    class Clip
+    {
+
+    public:
+
+        Clip(std::string topLevelPath, long long epochTimeUs);
+
+        /**
+         * @brief Get the UTC string of the first frame in the clip, which also names the clip directory.
+         * @return
+         *  The UTC string.
+         */
+        std::string getUtc() const;
+
+        /**
+         * @brief Get the path to the clip directory.
+         * @return
+         *  The full path to the clip directory.
+         */
+        std::string getPath() const;
+
+        /**
+         * @brief Wait until all frames in the clip have been written to disk.
+         * @return
+         *  True if the clip was written successfully, false if it was aborted or couldn't be written.
+         */
+        bool waitUntilWritten();
+
+        /**
+         * @brief Get the number of frames in the clip. Only valid once waitUntilWritten() has returned true.
+         * @return
+         *  The number of frames in the clip.
+         */
+        unsigned int size() const;
+
+        /**
+         * @brief Read a frame back from the clip file. Only valid once waitUntilWritten() has returned true.
+         * @param i
+         *  Index of the frame within the clip.
+         * @return
+         *  Pointer to the frame, or an empty pointer if it couldn't be read.
+         */
+        std::shared_ptr<Imageuc> readFrame(unsigned int i) const;
+
+    private:
+
+        friend class ClipWriter;
+
+        /**
+         * @brief Mark the clip as complete and wake any threads waiting for it.
+         * @param success
+         *  Whether all frames were written successfully.
+         */
+        void setComplete(bool success);
+
+        /**
+         * @brief UTC string of the first frame in the clip.
+         */
+        std::string utc;
+
+        /**
+         * @brief Full path to the clip directory.
+         */
+        std::string path;
+
+        /**
+         * @brief Writer for the clip file; only accessed by the writer thread.
+         */
+        ClipFile::Writer writer;
+
+        /**
+         * @brief The clip file, opened for reading once all frames have been written successfully.
+         */
+        std::shared_ptr<ClipFile> file;
+
+        /**
+         * @brief Indicates whether the clip directories have been created; only accessed by the writer thread.
+         */
+        bool dirsCreated;
+
+        /**
+         * @brief Indicates whether writing the clip has failed; only accessed by the writer thread.
+         */
+        bool failed;
+
+        /**
+         * @brief Indicates that no more frames will be written to the clip.
+         */
+        bool complete;
+
+        /**
+         * @brief Indicates that all frames were written successfully.
+         */
+        bool success;
+
+        std::mutex mutex;
+        std::condition_variable completed;
+    };
+
+    /**
+     * @brief Constructor for the ClipWriter; starts the writer thread.
+     * @param topLevelPath
+     *  The top level directory in which clip directories are created.
+     * @param window
+     *  The maximum number of frames that may be waiting to be written at any time.
+     * @param keyFrameInterval
+     *  Interval between key frames when compressing the frames; zero stores the frames uncompressed.
+     */
+    ClipWriter(std::string topLevelPath, unsigned int window, unsigned int keyFrameInterval);
+
+    /**
+     * @brief Destructor for the ClipWriter; writes any frames still in flight then stops the writer thread.
+     * A clip that hasn't been ended is marked as failed.
+     */
+    ~ClipWriter();
+
+    /**
+     * @brief Start a new clip. Any clip that is currently being recorded is aborted.
+     * @param epochTimeUs
+     *  Epoch time of the first frame in the clip [microseconds]; this sets the clip directory.
+     * @return
+     *  Handle to the new clip.
+     */
+    std::shared_ptr<Clip> beginClip(long long epochTimeUs);
+
+    /**
+     * @brief Add a frame to the current clip, to be written in the background. Blocks while the in-flight
+     * window is full. Frames are discarded if there's no current clip.
+     * @param frame
+     *  The frame to add.
+     */
+    void addFrame(const std::shared_ptr<Imageuc> &frame);
+
+    /**
+     * @brief Add a frame to the current clip, taking over the caller's reference to it.
+     * @param frame
+     *  The frame to add; empty on return.
+     */
+    void addFrame(std::shared_ptr<Imageuc> &&frame);
+
+    /**
+     * @brief End the current clip; the handle's waitUntilWritten() returns once the remaining frames have
+     * been written.
+     * @return
+     *  Handle to the clip that was ended, or an empty pointer if there's no current clip.
+     */
+    std::shared_ptr<Clip> endClip();
+
+    /**
+     * @brief Abort the current clip; any frames already written are deleted.
+     */
+    void abortClip();
+
+    /**
+     * @brief Get the number of frames in the current clip.
+     * @return
+     *  The number of frames added to the current clip so far.
+     */
+    unsigned int getFramesInClip() const;
+
+    /**
+     * @brief Get the number of frames waiting to be written.
+     * @return
+     *  The number of frames in flight.
+     */
+    unsigned int getFramesInFlight() const;
+
+private:
+
+    // Disable copying; the writer thread is owned by this object
+    ClipWriter(const ClipWriter&);
+    ClipWriter& operator=(const ClipWriter&);
+
+    /**
+     * @brief A unit of work for the writer thread.
+     */
+    struct Job {
+        enum Type {FRAME, END, ABORT};
+        Type type;
+        std::shared_ptr<Clip> clip;
+        // The frame to write; only set for FRAME jobs
+        std::shared_ptr<Imageuc> frame;
+    };
+
+    /**
+     * @brief Main loop of the writer thread.
+     */
+    void run();
+
+    /**
+     * @brief Add a job to the queue, waiting for space if necessary.
+     * @param job
+     *  The job to add.
+     */
+    void pushJob(const Job &job);
+
+    /**
+     * @brief Append one frame to the clip file.
+     * @param clip
+     *  The clip that the frame belongs to.
+     * @param frame
+     *  The frame to write.
+     */
+    void writeFrame(Clip &clip, const Imageuc &frame);
+
+    /**
+     * @brief The top level directory in which clip directories are created.
+     */
+    std::string topLevelPath;
+
+    /**
+     * @brief The maximum number of frames that may be waiting to be written at any time.
+     */
+    unsigned int window;
+
+    /**
+     * @brief Interval between key frames when compressing the frames; zero stores the frames uncompressed.
+     */
+    unsigned int keyFrameInterval;
+
+    /**
+     * @brief The clip currently being recorded, if any.
+     */
+    std::shared_ptr<Clip> current;
+
+    /**
+     * @brief Number of frames added to the current clip.
+     */
+    unsigned int framesInClip;
+
+    /**
+     * @brief Number of times addFrame(...) had to wait for the writer during the current clip.
+     */
+    unsigned int stalls;
+
+    /**
+     * @brief Jobs waiting for the writer thread.
+     */
+    LockFreeQueue<Job, true> jobs;
+
+    /**
+     * @brief Number of frames waiting to be written.
+     */
+    std::atomic<unsigned int> inFlight;
+
+    /**
+     * @brief Signalled by the writer thread each time it completes a job, to wake a blocked producer.
+     */
+    QueueWakeup jobDone;
+
+    /**
+     * @brief Flag used to stop the writer thread.
+     */
+    std::atomic<bool> stop;
+
+    /**
+     * @brief The writer thread.
+     */
+    std::thread thread;
+};
+
+#endif // CLIPWRITER_H
@@ -0,0 +1,336 @@
+#include "infra/eventcatalogue.h"
+#include "util/timeutil.h"
+
+#include <stdio.h>
+#include <cmath>
+#include <map>
+#include <algorithm>            // min, max
+#include <unistd.h>             // gethostname
+
+#include <sqlite3.h>
+
+const std::string EventCatalogue::filename = "events.sqlite";
+
+/**
+ * @brief The columns of the events table, in the order they're read into an Event.
+ */
+static const char * const eventColumns = "clip_id, station, path, start_us, end_us, n_frames, n_localised, "
+                                         "bb_xmin, bb_xmax, bb_ymin, bb_ymax, x_start, y_start, x_end, y_end, motion, peak";
+
+EventCatalogue::Query::Query() : startUs(LLONG_MIN), endUs(LLONG_MAX), minMotion(0.0), limit(0) {
+
+}
+
+EventCatalogue::EventCatalogue(const std::string &path) : path(path), db(NULL) {
+
+    if(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Couldn't open event catalogue %s: %s\n", path.c_str(), db ? sqlite3_errmsg(db) : "out of memory");
+        sqlite3_close(db);
+        db = NULL;
+        return;
+    }
+
+    // Wait for other processes (e.g. a query from the command line) rather than failing immediately
+    sqlite3_busy_timeout(db, 5000);
+
+    // Write-ahead logging lets the catalogue be queried while events are being added
+    bool created = exec("PRAGMA journal_mode = WAL;"
+                        "CREATE TABLE IF NOT EXISTS events ("
+                        "  clip_id TEXT NOT NULL,"
+                        "  station TEXT NOT NULL,"
+                        "  path TEXT NOT NULL,"
+                        "  start_us INTEGER NOT NULL,"
+                        "  end_us INTEGER NOT NULL,"
+                        "  n_frames INTEGER NOT NULL,"
+                        "  n_localised INTEGER NOT NULL,"
+                        "  bb_xmin INTEGER NOT NULL,"
+                        "  bb_xmax INTEGER NOT NULL,"
+                        "  bb_ymin INTEGER NOT NULL,"
+                        "  bb_ymax INTEGER NOT NULL,"
+                        "  x_start REAL NOT NULL,"
+                        "  y_start REAL NOT NULL,"
+                        "  x_end REAL NOT NULL,"
+                        "  y_end REAL NOT NULL,"
+                        "  motion REAL NOT NULL,"
+                        "  peak INTEGER NOT NULL,"
+                        "  PRIMARY KEY (station, clip_id));"
+                        "CREATE INDEX IF NOT EXISTS events_time ON events (start_us);"
+                        "CREATE INDEX IF NOT EXISTS events_station_time ON events (station, start_us);");
+
+    if(!created) {
+        sqlite3_close(db);
+        db = NULL;
+    }
+}
+
+EventCatalogue::~EventCatalogue() {
+    sqlite3_close(db);
+}
+
+std::shared_ptr<EventCatalogue> EventCatalogue::get(const std::string &dir) {
+
+    static std::mutex cataloguesMutex;
+    static std::map<std::string, std::shared_ptr<EventCatalogue>> catalogues;
+
+    std::lock_guard<std::mutex> lock(cataloguesMutex);
+    std::shared_ptr<EventCatalogue> &catalogue = catalogues[dir];
+    if(!catalogue) {
+        catalogue = std::make_shared<EventCatalogue>(dir + "/" + filename);
+    }
+    return catalogue;
+}
+
+bool EventCatalogue::isOpen() const {
+    return db != NULL;
+}
+
+bool EventCatalogue::add(const Event &event) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(!db) {
+        return false;
+    }
+
+    std::string sql = std::string("INSERT OR REPLACE INTO events (") + eventColumns + ") "
+            "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17)";
+
+    sqlite3_stmt * stmt;
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Event catalogue: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, event.clipId.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, event.station.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, event.path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 4, event.startUs);
+    sqlite3_bind_int64(stmt, 5, event.endUs);
+    sqlite3_bind_int64(stmt, 6, event.nFrames);
+    sqlite3_bind_int64(stmt, 7, event.nLocalised);
+    sqlite3_bind_int64(stmt, 8, event.bbXmin);
+    sqlite3_bind_int64(stmt, 9, event.bbXmax);
+    sqlite3_bind_int64(stmt, 10, event.bbYmin);
+    sqlite3_bind_int64(stmt, 11, event.bbYmax);
+    sqlite3_bind_double(stmt, 12, event.xStart);
+    sqlite3_bind_double(stmt, 13, event.yStart);
+    sqlite3_bind_double(stmt, 14, event.xEnd);
+    sqlite3_bind_double(stmt, 15, event.yEnd);
+    sqlite3_bind_double(stmt, 16, event.motion);
+    sqlite3_bind_int64(stmt, 17, event.peak);
+
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if(!success) {
+        fprintf(stderr, "Couldn't add event %s to the catalogue: %s\n", event.clipId.c_str(), sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+bool EventCatalogue::remove(const std::string &path) {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(!db) {
+        return false;
+    }
+
+    // The directory itself, or anything within it
+    sqlite3_stmt * stmt;
+    if(sqlite3_prepare_v2(db, "DELETE FROM events WHERE path = ?1 OR substr(path, 1, length(?1) + 1) = ?1 || '/'", -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Event catalogue: %s\n", sqlite3_errmsg(db));
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, path.c_str(), -1, SQLITE_TRANSIENT);
+
+    bool success = sqlite3_step(stmt) == SQLITE_DONE;
+    if(!success) {
+        fprintf(stderr, "Couldn't remove events in %s from the catalogue: %s\n", path.c_str(), sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+    return success;
+}
+
+std::vector<EventCatalogue::Event> EventCatalogue::query(const Query &query) const {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<Event> events;
+
+    sqlite3_stmt * stmt = prepare(query, std::string("SELECT ") + eventColumns, true);
+    if(!stmt) {
+        return events;
+    }
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        Event event;
+        event.clipId = (const char *)sqlite3_column_text(stmt, 0);
+        event.station = (const char *)sqlite3_column_text(stmt, 1);
+        event.path = (const char *)sqlite3_column_text(stmt, 2);
+        event.startUs = sqlite3_column_int64(stmt, 3);
+        event.endUs = sqlite3_column_int64(stmt, 4);
+        event.nFrames = sqlite3_column_int64(stmt, 5);
+        event.nLocalised = sqlite3_column_int64(stmt, 6);
+        event.bbXmin = sqlite3_column_int64(stmt, 7);
+        event.bbXmax = sqlite3_column_int64(stmt, 8);
+        event.bbYmin = sqlite3_column_int64(stmt, 9);
+        event.bbYmax = sqlite3_column_int64(stmt, 10);
+        event.xStart = sqlite3_column_double(stmt, 11);
+        event.yStart = sqlite3_column_double(stmt, 12);
+        event.xEnd = sqlite3_column_double(stmt, 13);
+        event.yEnd = sqlite3_column_double(stmt, 14);
+        event.motion = sqlite3_column_double(stmt, 15);
+        event.peak = sqlite3_column_int64(stmt, 16);
+        events.push_back(event);
+    }
+    if(rc != SQLITE_DONE) {
+        fprintf(stderr, "Event catalogue query failed: %s\n", sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+
+    return events;
+}
+
+unsigned int EventCatalogue::count(const Query &query) const {
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    sqlite3_stmt * stmt = prepare(query, "SELECT COUNT(*)", false);
+    if(!stmt) {
+        return 0;
+    }
+
+    unsigned int n = 0;
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        n = sqlite3_column_int64(stmt, 0);
+    }
+    else {
+        fprintf(stderr, "Event catalogue query failed: %s\n", sqlite3_errmsg(db));
+    }
+    sqlite3_finalize(stmt);
+
+    return n;
+}
+
+EventCatalogue::Event EventCatalogue::summarise(const std::vector<MeteorImageLocationMeasurement> &locs, const Imageuc * peakHold) {
+
+    Event event;
+    event.startUs = locs.empty() ? 0 : locs.front().epochTimeUs;
+    event.endUs = locs.empty() ? 0 : locs.back().epochTimeUs;
+    event.nFrames = locs.size();
+    event.nLocalised = 0;
+    event.bbXmin = event.bbXmax = event.bbYmin = event.bbYmax = 0;
+    event.xStart = event.yStart = event.xEnd = event.yEnd = 0.0;
+    event.motion = 0.0;
+    event.peak = 0;
+
+    for(const MeteorImageLocationMeasurement &loc : locs) {
+        if(!loc.coarse_localisation_success) {
+            continue;
+        }
+        if(event.nLocalised == 0) {
+            event.bbXmin = loc.bb_xmin;
+            event.bbXmax = loc.bb_xmax;
+            event.bbYmin = loc.bb_ymin;
+            event.bbYmax = loc.bb_ymax;
+            event.xStart = loc.x_flux_centroid;
+            event.yStart = loc.y_flux_centroid;
+        }
+        else {
+            event.bbXmin = std::min(event.bbXmin, loc.bb_xmin);
+            event.bbXmax = std::max(event.bbXmax, loc.bb_xmax);
+            event.bbYmin = std::min(event.bbYmin, loc.bb_ymin);
+            event.bbYmax = std::max(event.bbYmax, loc.bb_ymax);
+        }
+        event.xEnd = loc.x_flux_centroid;
+        event.yEnd = loc.y_flux_centroid;
+        event.nLocalised++;
+    }
+
+    if(event.nLocalised > 0) {
+        event.motion = std::hypot(event.xEnd - event.xStart, event.yEnd - event.yStart);
+    }
+
+    if(peakHold && peakHold->width > 0 && peakHold->height > 0) {
+        unsigned int xmin = 0, xmax = peakHold->width - 1, ymin = 0, ymax = peakHold->height - 1;
+        if(event.nLocalised > 0) {
+            xmin = std::min(event.bbXmin, xmax);
+            ymin = std::min(event.bbYmin, ymax);
+            xmax = std::min(event.bbXmax, xmax);
+            ymax = std::min(event.bbYmax, ymax);
+        }
+        for(unsigned int y = ymin; y <= ymax; y++) {
+            for(unsigned int x = xmin; x <= xmax; x++) {
+                event.peak = std::max(event.peak, (unsigned int)peakHold->rawImage[y * peakHold->width + x]);
+            }
+        }
+    }
+
+    return event;
+}
+
+std::string EventCatalogue::getStationName() {
+    char name[256];
+    if(gethostname(name, sizeof(name)) != 0) {
+        return "unknown";
+    }
+    name[sizeof(name) - 1] = '\0';
+    return std::string(name);
+}
+
+void EventCatalogue::print(FILE * fp, const std::vector<Event> &events) {
+    fprintf(fp, "%-24s %-16s %8s %9s %11s %5s  %s\n", "clip", "station", "frames", "localised", "motion [px]", "peak", "bounding box [px]");
+    for(const Event &event : events) {
+        fprintf(fp, "%-24s %-16s %8d %9d %11.1f %5d  [%d:%d, %d:%d]\n", event.clipId.c_str(), event.station.c_str(), event.nFrames,
+                event.nLocalised, event.motion, event.peak, event.bbXmin, event.bbXmax, event.bbYmin, event.bbYmax);
+    }
+    fprintf(fp, "%lu events\n", events.size());
+}
+
+bool EventCatalogue::exec(const char * sql) const {
+    char * error = NULL;
+    if(sqlite3_exec(db, sql, NULL, NULL, &error) != SQLITE_OK) {
+        fprintf(stderr, "Event catalogue %s: %s\n", path.c_str(), error ? error : "unknown error");
+        sqlite3_free(error);
+        return false;
+    }
+    return true;
+}
+
+sqlite3_stmt * EventCatalogue::prepare(const Query &query, const std::string &select, bool order) const {
+
+    if(!db) {
+        return NULL;
+    }
+
+    // The station condition is only included when it's set so that the station/time index can be used
+    std::string sql = select + " FROM events WHERE start_us >= ?1 AND start_us < ?2 AND motion >= ?3";
+    if(!query.station.empty()) {
+        sql += " AND station = ?4";
+    }
+    if(order) {
+        sql += " ORDER BY start_us";
+        if(query.limit > 0) {
+            sql += " LIMIT ?5";
+        }
+    }
+
+    sqlite3_stmt * stmt;
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        fprintf(stderr, "Event catalogue: %s\n", sqlite3_errmsg(db));
+        return NULL;
+    }
+
+    sqlite3_bind_int64(stmt, 1, query.startUs);
+    sqlite3_bind_int64(stmt, 2, query.endUs);
+    sqlite3_bind_double(stmt, 3, query.minMotion);
+    if(!query.station.empty()) {
+        sqlite3_bind_text(stmt, 4, query.station.c_str(), -1, SQLITE_TRANSIENT);
+    }
+    if(order && query.limit > 0) {
+        sqlite3_bind_int64(stmt, 5, query.limit);
+    }
+
+    return stmt;
+}
@@ -0,0 +1,234 @@
+#ifndef EVENTCATALOGUE_H
+#define EVENTCATALOGUE_H
+
+#include "infra/imageuc.h"
+#include "infra/meteorimagelocationmeasurement.h"
+
+#include <string>
+#include <vector>
+#include <memory>               // shared_ptr
+#include <mutex>
+#include <climits>
+#include <cstdio>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+/**
+ * @brief The EventCatalogue class is a catalogue of the detected events, with a summary of the analysis results
+ * of each, stored in an embedded SQLite database in the video directory. It allows the events to be selected by
+ * time, station and properties of the track without deserialising the localisation.xml file of each clip.
+ *
+ * Each event is identified by the station and the UTC of the first frame of the clip, which names the clip
+ * directory. The station is the host name of the machine that analysed the clip, so that the catalogues of
+ * several stations can be merged. The events table is indexed on time and on station and time.
+ *
+ * The catalogue is populated by the AnalysisWorker as each clip is analysed. Access is serialised by a mutex,
+ * so a single EventCatalogue can be shared by all threads.
+ */
+class EventCatalogue
+{
+
+public:
+
+    /**
+     * @brief Summary of the analysis of a single clip.
+     */
+    struct Event {
+
+        /**
+         * @brief The UTC of the first frame of the clip, which names the clip directory.
+         */
+        std::string clipId;
+
+        /**
+         * @brief Name of the station that recorded the clip.
+         */
+        std::string station;
+
+        /**
+         * @brief Full path to the clip directory.
+         */
+        std::string path;
+
+        /**
+         * @brief Epoch times of the first and last frames of the clip [microseconds]
+         */
+        long long startUs, endUs;
+
+        /**
+         * @brief Number of frames in the clip.
+         */
+        unsigned int nFrames;
+
+        /**
+         * @brief Number of frames in which the event was localised.
+         */
+        unsigned int nLocalised;
+
+        /**
+         * @brief Bounding box of the event over all frames in which it was localised [pixels]; only valid if
+         * nLocalised > 0.
+         */
+        unsigned int bbXmin, bbXmax, bbYmin, bbYmax;
+
+        /**
+         * @brief Flux centroid of the event in the first and last frames in which it was localised [pixels];
+         * only valid if nLocalised > 0.
+         */
+        double xStart, yStart, xEnd, yEnd;
+
+        /**
+         * @brief Distance moved by the flux centroid between the first and last frames in which the event was
+         * localised [pixels]
+         */
+        double motion;
+
+        /**
+         * @brief Peak brightness of the event: the maximum of the peak hold image within the bounding box, or
+         * over the whole image if the event wasn't localised [ADU]
+         */
+        unsigned int peak;
+    };
+
+    /**
+     * @brief Selection criteria for querying the catalogue.
+     */
+    struct Query {
+
+        Query();
+
+        /**
+         * @brief Select events that start within [startUs:endUs) [microseconds]
+         */
+        long long startUs, endUs;
+
+        /**
+         * @brief Select events recorded by this station; empty to select all stations.
+         */
+        std::string station;
+
+        /**
+         * @brief Select events whose centroid motion is at least this [pixels]
+         */
+        double minMotion;
+
+        /**
+         * @brief Maximum number of events to return; zero for no limit.
+         */
+        unsigned int limit;
+    };
+
+    /**
+     * @brief Open the catalogue, creating the database and its tables if they don't exist.
+     * @param path
+     *  Path to the database file.
+     */
+    EventCatalogue(const std::string &path);
+
+    ~EventCatalogue();
+
+    /**
+     * @brief Get the catalogue in a directory, shared by all users of the directory within the application. The
+     * catalogue is opened the first time it's requested.
+     * @param dir
+     *  The directory containing the catalogue, i.e. the video directory.
+     * @return
+     *  The catalogue.
+     */
+    static std::shared_ptr<EventCatalogue> get(const std::string &dir);
+
+    /**
+     * @brief Indicates whether the database was opened successfully.
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Add an event to the catalogue, replacing any existing event with the same clip ID and station.
+     * @return
+     *  True if the event was added.
+     */
+    bool add(const Event &event);
+
+    /**
+     * @brief Remove the events within a directory of the video directory tree, after it has been deleted.
+     * @param path
+     *  The full path to a clip directory, or a year, month or day directory, in which case all the events within
+     *  it are removed.
+     * @return
+     *  True if the events were removed.
+     */
+    bool remove(const std::string &path);
+
+    /**
+     * @brief Get the events that match a query.
+     * @param query
+     *  The selection criteria.
+     * @return
+     *  The events in order of start time.
+     */
+    std::vector<Event> query(const Query &query) const;
+
+    /**
+     * @brief Count the events that match a query, without retrieving them.
+     */
+    unsigned int count(const Query &query) const;
+
+    /**
+     * @brief Summarise the analysis results of a clip.
+     * @param locs
+     *  The localisation of the event in each frame of the clip.
+     * @param peakHold
+     *  The peak hold image of the clip; may be NULL.
+     * @return
+     *  The event, with the clip ID, station and path unset.
+     */
+    static Event summarise(const std::vector<MeteorImageLocationMeasurement> &locs, const Imageuc * peakHold);
+
+    /**
+     * @brief Get the name of this station, i.e. the host name.
+     */
+    static std::string getStationName();
+
+    /**
+     * @brief Print a table of events.
+     */
+    static void print(FILE * fp, const std::vector<Event> &events);
+
+    /**
+     * @brief Name of the database file within the video directory.
+     */
+    static const std::string filename;
+
+private:
+
+    // Disable copying; the catalogue owns the database connection
+    EventCatalogue(const EventCatalogue&);
+    EventCatalogue& operator=(const EventCatalogue&);
+
+    std::string path;
+
+    sqlite3 * db;
+
+    mutable std::mutex mutex;
+
+    /**
+     * @brief Execute SQL statements that return no results, logging any error.
+     */
+    bool exec(const char * sql) const;
+
+    /**
+     * @brief Prepare a SELECT statement for the events that match a query.
+     * @param query
+     *  The selection criteria.
+     * @param select
+     *  The SELECT clause.
+     * @param order
+     *  Indicates whether to order the events by start time and apply the limit of the query.
+     * @return
+     *  The statement, which must be finalised by the caller; NULL on error.
+     */
+    sqlite3_stmt * prepare(const Query &query, const std::string &select, bool order) const;
+};
+
+#endif // EVENTCATALOGUE_H
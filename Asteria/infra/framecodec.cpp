@@ -0,0 +1,329 @@
+#include "infra/framecodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+const unsigned int FrameCodec::blockSize;
+const unsigned int FrameCodec::backgroundShift;
+const unsigned int FrameCodec::zeroBlock;
+const unsigned int FrameCodec::escapeQuotient;
+
+/**
+ * @brief Map a residual (modulo 256) to an unsigned value, interleaving the positive and negative residuals
+ * so that small residuals of either sign map to small values.
+ */
+static inline unsigned char zigzag(unsigned char residual) {
+    int d = (signed char)residual;
+    return (unsigned char)((d << 1) ^ (d >> 7));
+}
+
+static inline unsigned char unzigzag(unsigned char z) {
+    return (unsigned char)((z >> 1) ^ -(int)(z & 1));
+}
+
+/**
+ * @brief The median edge detector predictor of LOCO-I, from the pixels to the left, above and above-left.
+ */
+static inline unsigned char medPredict(int a, int b, int c) {
+    if(c >= std::max(a, b)) {
+        return (unsigned char)std::min(a, b);
+    }
+    if(c <= std::min(a, b)) {
+        return (unsigned char)std::max(a, b);
+    }
+    return (unsigned char)(a + b - c);
+}
+
+/**
+ * @brief Spatial prediction of a pixel from its neighbours: the median edge detector in the interior of the
+ * frame, and the single available neighbour along the first row and column.
+ */
+static inline unsigned char predict(const unsigned char * frame, unsigned int p, unsigned int width) {
+    if(p < width) {
+        return (p == 0) ? 0 : frame[p - 1];
+    }
+    if(p % width == 0) {
+        return frame[p - width];
+    }
+    return medPredict(frame[p - 1], frame[p - width], frame[p - width - 1]);
+}
+
+namespace {
+
+/**
+ * @brief Packs bits into a byte buffer, least significant first. Values of up to 32 bits can be written at once.
+ */
+class BitWriter {
+public:
+    BitWriter(unsigned char * out) : out(out), acc(0), n(0) {}
+
+    inline void put(uint32_t bits, unsigned int len) {
+        acc |= (uint64_t)bits << n;
+        n += len;
+        if(n >= 32) {
+            out[0] = (unsigned char)acc;
+            out[1] = (unsigned char)(acc >> 8);
+            out[2] = (unsigned char)(acc >> 16);
+            out[3] = (unsigned char)(acc >> 24);
+            out += 4;
+            acc >>= 32;
+            n -= 32;
+        }
+    }
+
+    /**
+     * @brief Write out any remaining bits.
+     * @return
+     *  Pointer to the end of the data written.
+     */
+    unsigned char * flush() {
+        while(n > 0) {
+            *out++ = (unsigned char)acc;
+            acc >>= 8;
+            n = n > 8 ? n - 8 : 0;
+        }
+        return out;
+    }
+
+private:
+    unsigned char * out;
+    uint64_t acc;
+    unsigned int n;
+};
+
+/**
+ * @brief Reads bits packed by the BitWriter. Reading past the end of the data returns zeros; this is detected
+ * by overrun() once decoding is complete.
+ */
+class BitReader {
+public:
+    BitReader(const unsigned char * data, size_t size) : data(data), size(size), pos(0), acc(0), n(0) {}
+
+    /**
+     * @brief Ensure that at least 56 bits are available.
+     */
+    inline void refill() {
+        while(n <= 56) {
+            acc |= (uint64_t)(pos < size ? data[pos] : 0) << n;
+            pos++;
+            n += 8;
+        }
+    }
+
+    inline uint64_t peek() const {
+        return acc;
+    }
+
+    inline void consume(unsigned int len) {
+        acc >>= len;
+        n -= len;
+    }
+
+    inline uint32_t get(unsigned int len) {
+        uint32_t bits = (uint32_t)(acc & ((1ull << len) - 1));
+        consume(len);
+        return bits;
+    }
+
+    inline unsigned int available() const {
+        return n;
+    }
+
+    bool overrun() const {
+        return pos * 8 - n > size * 8;
+    }
+
+private:
+    const unsigned char * data;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    unsigned int n;
+};
+
+}
+
+FrameCodec::FrameCodec() : hasBackground(false) {
+
+}
+
+void FrameCodec::encode(const unsigned char * frame, bool key, unsigned int nPix, unsigned int width, std::vector<unsigned char> &out) {
+
+    residuals.resize(nPix);
+    unsigned char * z = residuals.data();
+
+    bool temporal = !key && hasBackground && background.size() == nPix;
+
+    if(temporal) {
+        const uint16_t * b = background.data();
+        for(unsigned int p = 0; p < nPix; p++) {
+            z[p] = zigzag((unsigned char)(frame[p] - ((b[p] + 128) >> 8)));
+        }
+    }
+    else {
+        getSpatialResiduals(frame, nPix, width);
+    }
+
+    // Worst case: every residual escaped, plus the block headers and the mode byte; padded for the final flush
+    unsigned int nBlocks = (nPix + blockSize - 1) / blockSize;
+    out.resize(1 + ((size_t)nPix * (escapeQuotient + 8) + (size_t)nBlocks * 4) / 8 + 8);
+    out[0] = temporal ? TEMPORAL : SPATIAL;
+
+    BitWriter writer(&out[1]);
+
+    for(unsigned int b = 0; b < nPix; b += blockSize) {
+
+        unsigned int n = std::min(blockSize, nPix - b);
+        const unsigned char * block = z + b;
+
+        unsigned int sum = 0;
+        for(unsigned int i = 0; i < n; i++) {
+            sum += block[i];
+        }
+
+        if(sum == 0) {
+            writer.put(zeroBlock, 4);
+            continue;
+        }
+
+        // Rice parameter approximately log2 of the mean residual
+        unsigned int k = 0;
+        while(k < 7 && (n << k) < sum) {
+            k++;
+        }
+        writer.put(k, 4);
+
+        uint32_t mask = (1u << k) - 1;
+        for(unsigned int i = 0; i < n; i++) {
+            uint32_t q = block[i] >> k;
+            if(q < escapeQuotient) {
+                // Unary coded quotient (q ones and a zero), then the k-bit remainder
+                writer.put(((1u << q) - 1) | ((block[i] & mask) << (q + 1)), q + 1 + k);
+            }
+            else {
+                writer.put(((1u << escapeQuotient) - 1) | ((uint32_t)block[i] << escapeQuotient), escapeQuotient + 8);
+            }
+        }
+    }
+
+    size_t size = writer.flush() - &out[0];
+
+    if(size >= 1 + (size_t)nPix) {
+        // Incompressible; store the pixels instead. These also reset the background, like key frames.
+        out.resize(1 + nPix);
+        out[0] = STORED;
+        memcpy(&out[1], frame, nPix);
+        temporal = false;
+    }
+    else {
+        out.resize(size);
+    }
+
+    updateBackground(frame, nPix, !temporal);
+}
+
+bool FrameCodec::decode(const unsigned char * data, size_t size, unsigned int nPix, unsigned int width, unsigned char * frame) {
+
+    if(size < 1) {
+        return false;
+    }
+
+    unsigned char mode = data[0];
+
+    if(mode == STORED) {
+        if(size != 1 + (size_t)nPix) {
+            return false;
+        }
+        memcpy(frame, data + 1, nPix);
+        updateBackground(frame, nPix, true);
+        return true;
+    }
+
+    if(mode != SPATIAL && (mode != TEMPORAL || !hasBackground || background.size() != nPix)) {
+        return false;
+    }
+
+    residuals.resize(nPix);
+    unsigned char * z = residuals.data();
+
+    BitReader reader(data + 1, size - 1);
+
+    for(unsigned int b = 0; b < nPix; b += blockSize) {
+
+        unsigned int n = std::min(blockSize, nPix - b);
+        unsigned char * block = z + b;
+
+        reader.refill();
+        unsigned int k = reader.get(4);
+
+        if(k == zeroBlock) {
+            memset(block, 0, n);
+            continue;
+        }
+        if(k > 7) {
+            return false;
+        }
+
+        for(unsigned int i = 0; i < n; i++) {
+            if(reader.available() < escapeQuotient + 8) {
+                reader.refill();
+            }
+            // Length of the run of ones, capped at the escape
+            unsigned int q = __builtin_ctzll(~reader.peek() | (1ull << escapeQuotient));
+            if(q < escapeQuotient) {
+                reader.consume(q + 1);
+                block[i] = (unsigned char)((q << k) | reader.get(k));
+            }
+            else {
+                reader.consume(escapeQuotient);
+                block[i] = (unsigned char)reader.get(8);
+            }
+        }
+    }
+
+    if(reader.overrun()) {
+        return false;
+    }
+
+    if(mode == TEMPORAL) {
+        const uint16_t * b = background.data();
+        for(unsigned int p = 0; p < nPix; p++) {
+            frame[p] = (unsigned char)(((b[p] + 128) >> 8) + unzigzag(z[p]));
+        }
+    }
+    else {
+        // Spatial prediction from the pixels already decoded
+        for(unsigned int p = 0; p < nPix; p++) {
+            frame[p] = (unsigned char)(predict(frame, p, width) + unzigzag(z[p]));
+        }
+    }
+
+    updateBackground(frame, nPix, mode != TEMPORAL);
+    return true;
+}
+
+void FrameCodec::getSpatialResiduals(const unsigned char * frame, unsigned int nPix, unsigned int width) {
+    unsigned char * z = residuals.data();
+    for(unsigned int p = 0; p < nPix; p++) {
+        z[p] = zigzag((unsigned char)(frame[p] - predict(frame, p, width)));
+    }
+}
+
+void FrameCodec::updateBackground(const unsigned char * frame, unsigned int nPix, bool reset) {
+
+    if(reset) {
+        background.resize(nPix);
+        uint16_t * b = background.data();
+        for(unsigned int p = 0; p < nPix; p++) {
+            b[p] = (uint16_t)(frame[p] << 8);
+        }
+        hasBackground = true;
+        return;
+    }
+
+    uint16_t * b = background.data();
+    for(unsigned int p = 0; p < nPix; p++) {
+        int diff = ((int)frame[p] << 8) - (int)b[p];
+        b[p] = (uint16_t)((int)b[p] + (diff >> backgroundShift));
+    }
+}
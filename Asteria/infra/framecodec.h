@@ -0,0 +1,125 @@
+#ifndef FRAMECODEC_H
+#define FRAMECODEC_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief The FrameCodec class implements a fast lossless codec for 8-bit frames, used to compress the frames of
+ * clips as they're written to disk.
+ *
+ * Each pixel is predicted either from the same pixel of a running background (temporal prediction), or for key
+ * frames, which can be decoded without reference to any other frame, from the neighbouring pixels (spatial
+ * prediction). The background is an exponential moving average of the frames since the last key frame, which
+ * is reset to the key frame itself. The sky is mostly static between frames, so the temporal residuals are
+ * dominated by the noise and are small; averaging the background reduces its noise compared to predicting from
+ * the previous frame alone. The residuals are mapped to unsigned values by zig-zag coding and are entropy
+ * coded by Rice coding, with the Rice parameter chosen for each block of blockSize pixels from the mean residual
+ * in the block. Blocks in which all residuals are zero are coded by the block header alone. Frames that would not
+ * be reduced in size are stored uncompressed.
+ *
+ * The encoded frame consists of a one byte mode (stored, spatial or temporal) followed by the coded blocks; each
+ * block starts with a 4 bit code giving the Rice parameter, or indicating a block of zero residuals. Bits are
+ * packed least significant first.
+ *
+ * A FrameCodec object holds the background, so the frames of a sequence must be encoded in order, and decoded
+ * in the same order starting from a key frame. It isn't safe to use the same object from multiple threads.
+ */
+class FrameCodec
+{
+
+public:
+
+    FrameCodec();
+
+    /**
+     * @brief Encode the next frame of a sequence, and update the background.
+     * @param frame
+     *  The pixels of the frame.
+     * @param key
+     *  True to encode a key frame. The first frame of a sequence must be a key frame.
+     * @param nPix
+     *  Number of pixels in the frame.
+     * @param width
+     *  Width of the frame [pixels]; used for the spatial prediction of key frames.
+     * @param out
+     *  On exit, contains the encoded frame.
+     */
+    void encode(const unsigned char * frame, bool key, unsigned int nPix, unsigned int width, std::vector<unsigned char> &out);
+
+    /**
+     * @brief Decode the next frame of a sequence, and update the background.
+     * @param data
+     *  The encoded frame.
+     * @param size
+     *  Size of the encoded frame [bytes]
+     * @param nPix
+     *  Number of pixels in the frame.
+     * @param width
+     *  Width of the frame [pixels]
+     * @param frame
+     *  On exit, contains the pixels of the frame; must have space for nPix pixels.
+     * @return
+     *  True if the frame was decoded successfully; false if the data is corrupt or it isn't a key frame and no
+     *  key frame has been decoded before it.
+     */
+    bool decode(const unsigned char * data, size_t size, unsigned int nPix, unsigned int width, unsigned char * frame);
+
+    /**
+     * @brief Number of pixels in each block that shares a Rice parameter.
+     */
+    static const unsigned int blockSize = 16;
+
+    /**
+     * @brief The background is updated by 2^-backgroundShift of the difference between each frame and the
+     * background.
+     */
+    static const unsigned int backgroundShift = 2;
+
+private:
+
+    /**
+     * @brief Encoding modes, stored in the first byte of the encoded frame.
+     */
+    enum Mode : unsigned char {STORED = 0, SPATIAL = 1, TEMPORAL = 2};
+
+    /**
+     * @brief Block header code indicating that all residuals in the block are zero.
+     */
+    static const unsigned int zeroBlock = 8;
+
+    /**
+     * @brief Residuals whose Rice quotient reaches this value are escaped and stored in 8 bits, which bounds
+     * the length of the unary code.
+     */
+    static const unsigned int escapeQuotient = 12;
+
+    /**
+     * @brief Zig-zag coded residuals of the current frame.
+     */
+    std::vector<unsigned char> residuals;
+
+    /**
+     * @brief The running background, in 8.8 fixed point so that the averaging is exact integer arithmetic that
+     * the encoder and decoder reproduce identically.
+     */
+    std::vector<uint16_t> background;
+
+    /**
+     * @brief Indicates that the background has been initialised from a key frame.
+     */
+    bool hasBackground;
+
+    /**
+     * @brief Compute the spatial prediction residuals of a frame.
+     */
+    void getSpatialResiduals(const unsigned char * frame, unsigned int nPix, unsigned int width);
+
+    /**
+     * @brief Update the background with a frame, or reset it to the frame.
+     */
+    void updateBackground(const unsigned char * frame, unsigned int nPix, bool reset);
+};
+
+#endif // FRAMECODEC_H
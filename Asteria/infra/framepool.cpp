@@ -0,0 +1,107 @@
+#include "infra/framepool.h"
+
+#include <stdio.h>
+#include <functional>
+#include <algorithm>
+
+std::shared_ptr<FramePool> FramePool::create(unsigned int width, unsigned int height, unsigned int capacity, unsigned int nPreallocate) {
+
+    std::shared_ptr<FramePool> pool(new FramePool(width, height, capacity));
+
+    nPreallocate = std::min(nPreallocate, capacity);
+    pool->freeFrames.reserve(capacity);
+    for(unsigned int f = 0; f < nPreallocate; f++) {
+        pool->freeFrames.push_back(new Imageuc(width, height));
+    }
+
+    return pool;
+}
+
+FramePool::FramePool(unsigned int width, unsigned int height, unsigned int capacity) :
+    width(width), height(height), capacity(capacity), inUse(0u), hits(0ull), misses(0ull), highWaterMark(0u) {
+
+}
+
+FramePool::~FramePool() {
+    for(Imageuc * frame : freeFrames) {
+        delete frame;
+    }
+    freeFrames.clear();
+}
+
+std::shared_ptr<Imageuc> FramePool::acquire() {
+
+    Imageuc * frame = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if(!freeFrames.empty()) {
+            frame = freeFrames.back();
+            freeFrames.pop_back();
+            hits++;
+        }
+        else {
+            misses++;
+        }
+        inUse++;
+        highWaterMark = std::max(highWaterMark, inUse);
+    }
+
+    if(!frame) {
+        // Pool is empty: allocate outside of the lock
+        frame = new Imageuc(width, height);
+    }
+
+    // Reset the fields that aren't necessarily overwritten by the caller. Clearing the annotated
+    // image retains the storage for reuse by Imageuc::generateAnnotatedImage(...)
+    frame->epochTimeUs = 0ll;
+    frame->field = 0u;
+    frame->annotatedImage.clear();
+
+    std::weak_ptr<FramePool> pool = shared_from_this();
+    return std::shared_ptr<Imageuc>(frame, std::bind(&FramePool::recycle, pool, std::placeholders::_1));
+}
+
+void FramePool::recycle(std::weak_ptr<FramePool> pool, Imageuc * frame) {
+    std::shared_ptr<FramePool> p = pool.lock();
+    if(p) {
+        p->release(frame);
+    }
+    else {
+        // The pool has been destroyed
+        delete frame;
+    }
+}
+
+void FramePool::release(Imageuc * frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        inUse--;
+        if(freeFrames.size() < capacity) {
+            freeFrames.push_back(frame);
+            return;
+        }
+    }
+    // Pool is full
+    delete frame;
+}
+
+void FramePool::printStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    fprintf(stderr, "Frame pool: capacity = %u, hits = %llu, misses = %llu, high-water mark = %u\n", capacity, hits, misses, highWaterMark);
+}
+
+unsigned long long FramePool::getHits() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+unsigned long long FramePool::getMisses() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+unsigned int FramePool::getHighWaterMark() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return highWaterMark;
+}
@@ -0,0 +1,124 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include "infra/imageuc.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+#include <mutex>
+
+/**
+ * @brief Pool of recycled Imageuc frames, used by the AcquisitionThread to avoid allocating a new
+ * image (and overlay image) for every frame captured from the camera.
+ *
+ * Frames are handed out as shared_ptrs with a custom deleter: when the last holder of a frame (the
+ * detection head buffer, the event or calibration frames, a worker thread, the GUI etc) releases it,
+ * the frame is returned to the pool for reuse rather than being deleted. The pool retains at most
+ * capacity frames; if all retained frames are in use then a new frame is allocated (a pool miss), and
+ * frames released while the pool is full are deleted as normal.
+ *
+ * The pool must be created with FramePool::create(...); frames that outlive the pool are deleted
+ * on release.
+ */
+class FramePool : public std::enable_shared_from_this<FramePool>
+{
+
+public:
+
+    /**
+     * @brief Creates a new FramePool.
+     * @param width
+     *  Width of the frames [pixels]
+     * @param height
+     *  Height of the frames [pixels]
+     * @param capacity
+     *  The maximum number of frames to retain in the pool.
+     * @param nPreallocate
+     *  The number of frames to allocate up front; further frames up to the capacity are allocated on demand.
+     * @return
+     *  A shared_ptr to the new FramePool.
+     */
+    static std::shared_ptr<FramePool> create(unsigned int width, unsigned int height, unsigned int capacity, unsigned int nPreallocate);
+
+    ~FramePool();
+
+    /**
+     * @brief Get a frame from the pool. The contents of the raw image are undefined and must be
+     * overwritten by the caller; the annotated image is empty.
+     * @return
+     *  Shared pointer to the frame; the frame is returned to the pool when the last reference is released.
+     */
+    std::shared_ptr<Imageuc> acquire();
+
+    /**
+     * @brief Prints the pool hits, misses and high-water mark to stderr.
+     */
+    void printStats();
+
+    /**
+     * @brief Number of requests for frames that were served from the pool.
+     */
+    unsigned long long getHits();
+
+    /**
+     * @brief Number of requests for frames that required a new allocation because the pool was empty.
+     */
+    unsigned long long getMisses();
+
+    /**
+     * @brief The maximum number of frames that have been in use simultaneously.
+     */
+    unsigned int getHighWaterMark();
+
+private:
+
+    FramePool(unsigned int width, unsigned int height, unsigned int capacity);
+
+    /**
+     * @brief Returns a frame to the pool, or deletes it if the pool is full.
+     * @param frame
+     *  The frame being released.
+     */
+    void release(Imageuc * frame);
+
+    /**
+     * @brief Custom deleter attached to each frame handed out by the pool.
+     */
+    static void recycle(std::weak_ptr<FramePool> pool, Imageuc * frame);
+
+    /**
+     * @brief The frame width [pixels]
+     */
+    unsigned int width;
+
+    /**
+     * @brief The frame height [pixels]
+     */
+    unsigned int height;
+
+    /**
+     * @brief The maximum number of frames retained by the pool.
+     */
+    unsigned int capacity;
+
+    /**
+     * @brief The frames currently available for reuse.
+     */
+    std::vector<Imageuc *> freeFrames;
+
+    /**
+     * @brief The number of frames currently in use.
+     */
+    unsigned int inUse;
+
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned int highWaterMark;
+
+    /**
+     * @brief Mutex used to protect the free list and counters; frames are released from other threads.
+     */
+    std::mutex mutex;
+};
+
+#endif // FRAMEPOOL_H
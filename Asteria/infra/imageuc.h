@@ -13,7 +13,7 @@
  * representing images captured by a camera. The class contains additional functions and fields designed
  * specifically for handling captured images.
  */
-class Imageuc : public Image<unsigned char>
+class Imageuc final : public Image<unsigned char>
 {
 
 public:
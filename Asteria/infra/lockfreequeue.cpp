@@ -0,0 +1,62 @@
+#include "infra/lockfreequeue.h"
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+QueueWakeup::QueueWakeup() {
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(fd < 0) {
+        perror("eventfd");
+        exit(1);
+    }
+}
+
+QueueWakeup::~QueueWakeup() {
+    ::close(fd);
+}
+
+int QueueWakeup::getFd() const {
+    return fd;
+}
+
+void QueueWakeup::signal() {
+    uint64_t one = 1;
+    // Can only fail if the counter would overflow, in which case the fd is already readable
+    ssize_t n = ::write(fd, &one, sizeof(one));
+    (void)n;
+}
+
+void QueueWakeup::clear() {
+    uint64_t count;
+    // Reading resets the counter to zero; fails harmlessly with EAGAIN if it's already zero
+    ssize_t n = ::read(fd, &count, sizeof(count));
+    (void)n;
+}
+
+bool QueueWakeup::wait(long long timeoutUs) {
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    // Round up to whole milliseconds so that short timeouts don't turn into busy waits
+    int timeoutMs = (timeoutUs < 0) ? -1 : (int)((timeoutUs + 999) / 1000);
+
+    for(;;) {
+        int r = ::poll(&pfd, 1, timeoutMs);
+        if(r < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return false;
+        }
+        return r > 0;
+    }
+}
@@ -0,0 +1,197 @@
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include "infra/mpmcqueue.h"
+#include "infra/spscqueue.h"
+
+#include <type_traits>          // conditional
+#include <chrono>
+#include <cstddef>
+
+/**
+ * @brief Wakeup handle used to signal consumers waiting on a LockFreeQueue. It wraps a Linux eventfd,
+ * so in addition to blocking in wait(...) a consumer can include the file descriptor in a poll() loop
+ * alongside other file descriptors; it becomes readable when items may be available.
+ */
+class QueueWakeup
+{
+
+public:
+    QueueWakeup();
+    ~QueueWakeup();
+
+    /**
+     * @brief Get the file descriptor, for use with poll()/select().
+     * @return
+     *  The eventfd file descriptor.
+     */
+    int getFd() const;
+
+    /**
+     * @brief Make the file descriptor readable, waking any waiting consumers.
+     */
+    void signal();
+
+    /**
+     * @brief Reset the file descriptor to non-readable.
+     */
+    void clear();
+
+    /**
+     * @brief Wait for the file descriptor to become readable.
+     * @param timeoutUs
+     *  The maximum time to wait [microseconds]; negative to wait indefinitely.
+     * @return
+     *  True if the file descriptor became readable, false on timeout.
+     */
+    bool wait(long long timeoutUs);
+
+private:
+
+    // Disable copying; the eventfd is owned by this object
+    QueueWakeup(const QueueWakeup&);
+    QueueWakeup& operator=(const QueueWakeup&);
+
+    /**
+     * @brief The eventfd file descriptor.
+     */
+    int fd;
+};
+
+/**
+ * @brief Bounded lock-free queue with non-blocking tryPush/tryPop, a blocking pop with timeout and a
+ * wakeup file descriptor that can be integrated into a poll() loop.
+ *
+ * By default the queue may be used by any number of producer and consumer threads. If it will only ever be
+ * used by exactly one producer thread and one consumer thread then setting the spsc template parameter
+ * selects a cheaper ring that needs no compare-and-swap operations.
+ *
+ * Consumers that use the wakeup file descriptor directly should call clearWakeup() once it becomes readable
+ * and then call tryPop(...) until the queue is empty.
+ */
+template<typename T, bool spsc = false>
+class LockFreeQueue
+{
+
+public:
+
+    /**
+     * @brief Constructor for the LockFreeQueue.
+     * @param cap
+     *  The minimum number of items that the queue can hold.
+     */
+    LockFreeQueue(std::size_t cap) : ring(cap) {
+
+    }
+
+    /**
+     * @brief Add an item to the queue without blocking, and wake any waiting consumer.
+     * @param item
+     *  The item to add.
+     * @return
+     *  True if the item was added, false if the queue is full.
+     */
+    bool tryPush(const T& item) {
+        if(!ring.push(item)) {
+            return false;
+        }
+        wakeup.signal();
+        return true;
+    }
+
+    /**
+     * @brief Remove the item at the front of the queue without blocking.
+     * @param item
+     *  On exit, contains the item removed from the queue (if any).
+     * @return
+     *  True if an item was removed, false if the queue is empty.
+     */
+    bool tryPop(T& item) {
+        return ring.pop(item);
+    }
+
+    /**
+     * @brief Remove the item at the front of the queue, waiting for one to become available if necessary.
+     * @param item
+     *  On exit, contains the item removed from the queue (if any).
+     * @param timeoutUs
+     *  The maximum time to wait [microseconds]; negative to wait indefinitely.
+     * @return
+     *  True if an item was removed, false if the wait timed out.
+     */
+    bool pop(T& item, long long timeoutUs) {
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+        for(;;) {
+            if(ring.pop(item)) {
+                if(ring.size() > 0) {
+                    // Make sure any other waiting consumer sees the remaining items
+                    wakeup.signal();
+                }
+                return true;
+            }
+            long long remainingUs = -1;
+            if(timeoutUs >= 0) {
+                remainingUs = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+                if(remainingUs <= 0) {
+                    return false;
+                }
+            }
+            if(!wakeup.wait(remainingUs)) {
+                // Timed out; one last check in case an item arrived at the deadline
+                return ring.pop(item);
+            }
+            // Reset the wakeup before checking the queue again; items are always pushed before the
+            // wakeup is signalled, so any item whose signal is reset here will be found by the check.
+            wakeup.clear();
+        }
+    }
+
+    /**
+     * @brief Get the file descriptor that becomes readable when items are pushed onto the queue.
+     * @return
+     *  The wakeup file descriptor.
+     */
+    int getWakeupFd() const {
+        return wakeup.getFd();
+    }
+
+    /**
+     * @brief Reset the wakeup file descriptor; for consumers that poll() the file descriptor directly.
+     */
+    void clearWakeup() {
+        wakeup.clear();
+    }
+
+    /**
+     * @brief Get the number of items in the queue; approximate if the queue is being modified concurrently.
+     * @return
+     *  The number of items in the queue.
+     */
+    std::size_t size() const {
+        return ring.size();
+    }
+
+    /**
+     * @brief Get the maximum number of items that the queue can hold.
+     * @return
+     *  The capacity of the queue.
+     */
+    std::size_t capacity() const {
+        return ring.capacity();
+    }
+
+private:
+
+    /**
+     * @brief The underlying ring.
+     */
+    typename std::conditional<spsc, SpscQueue<T>, MpmcQueue<T>>::type ring;
+
+    /**
+     * @brief Used to wake consumers when items are pushed.
+     */
+    QueueWakeup wakeup;
+
+};
+
+#endif // LOCKFREEQUEUE_H
@@ -0,0 +1,163 @@
+#ifndef MPMCQUEUE_H
+#define MPMCQUEUE_H
+
+#include <atomic>
+#include <memory>               // unique_ptr
+#include <cstddef>
+#include <utility>              // move
+#include <algorithm>            // min
+
+/**
+ * @brief Bounded lock-free queue that may be used by any number of producer and consumer threads.
+ * Neither push(...) nor pop(...) block; they return false if the queue is full or empty respectively.
+ *
+ * Each slot in the ring carries a sequence number that records whether it is ready to be written or
+ * read for the current lap of the ring; producers and consumers claim slots by advancing the shared
+ * write and read positions with a compare-and-swap. See D. Vyukov's bounded MPMC queue:
+ * http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * The capacity is rounded up to a power of two so that the ring can be indexed with a bitmask.
+ */
+template<typename T>
+class MpmcQueue
+{
+
+public:
+
+    /**
+     * @brief Constructor for the MpmcQueue.
+     * @param cap
+     *  The minimum number of items that the queue can hold.
+     */
+    MpmcQueue(std::size_t cap) : cap(roundUpToPowerOfTwo(cap)), mask(this->cap - 1), cells(new Cell[this->cap]), readPos(0), writePos(0) {
+        for(std::size_t i = 0; i < this->cap; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Add an item to the queue.
+     * @param item
+     *  The item to add.
+     * @return
+     *  True if the item was added, false if the queue is full.
+     */
+    bool push(const T& item) {
+        Cell * cell;
+        std::size_t pos = writePos.load(std::memory_order_relaxed);
+        for(;;) {
+            cell = &cells[pos & mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if(diff == 0) {
+                // Slot is free on this lap: try to claim it
+                if(writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(diff < 0) {
+                // Slot still holds an item from the previous lap: full
+                return false;
+            }
+            else {
+                // Another producer claimed the slot; try again
+                pos = writePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = item;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the item at the front of the queue.
+     * @param item
+     *  On exit, contains the item removed from the queue (if any).
+     * @return
+     *  True if an item was removed, false if the queue is empty.
+     */
+    bool pop(T& item) {
+        Cell * cell;
+        std::size_t pos = readPos.load(std::memory_order_relaxed);
+        for(;;) {
+            cell = &cells[pos & mask];
+            std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+            if(diff == 0) {
+                // Slot has been written on this lap: try to claim it
+                if(readPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(diff < 0) {
+                // Slot not yet written: empty
+                return false;
+            }
+            else {
+                // Another consumer claimed the slot; try again
+                pos = readPos.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        // Mark the slot as free for the next lap
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get the number of items in the queue. This is approximate if the queue is being
+     * modified concurrently, which is fine for monitoring purposes.
+     * @return
+     *  The number of items in the queue.
+     */
+    std::size_t size() const {
+        // Consumers may overtake the write position loaded here, and producers the read position,
+        // so clamp the difference to [0:capacity]
+        std::size_t w = writePos.load(std::memory_order_acquire);
+        std::size_t r = readPos.load(std::memory_order_acquire);
+        return (w > r) ? std::min(w - r, cap) : 0;
+    }
+
+    /**
+     * @brief Get the maximum number of items that the queue can hold.
+     * @return
+     *  The capacity of the queue.
+     */
+    std::size_t capacity() const {
+        return cap;
+    }
+
+private:
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+        std::size_t p = 2;
+        while(p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // Number of slots in the ring
+    const std::size_t cap;
+
+    // Bitmask used to convert read/write positions to indices into the ring
+    const std::size_t mask;
+
+    // The slots
+    std::unique_ptr<Cell[]> cells;
+
+    // Position of the next item to be read. Kept on separate cache lines to avoid false
+    // sharing between producers and consumers.
+    alignas(64) std::atomic<std::size_t> readPos;
+
+    // Position of the next item to be written
+    alignas(64) std::atomic<std::size_t> writePos;
+
+};
+
+#endif // MPMCQUEUE_H
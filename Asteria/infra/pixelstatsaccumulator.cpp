@@ -0,0 +1,111 @@
+#include "infra/pixelstatsaccumulator.h"
+#include "util/parallelutil.h"
+
+#include <cmath>
+#include <algorithm>            // min, max, fill
+#include <stdio.h>
+
+PixelStatsAccumulator::PixelStatsAccumulator(unsigned int width, unsigned int height, unsigned int nFrames, double trimFraction, unsigned int nThreads)
+    : width(width), height(height), nFrames(nFrames), trimFraction(trimFraction), nTrim(static_cast<unsigned int>(trimFraction * nFrames)), nThreads(nThreads), count(0),
+      sum(width * height, 0), sumSq(width * height, 0), lowest(width * height * nTrim), highest(width * height * nTrim) {
+
+}
+
+void PixelStatsAccumulator::addFrame(const Imageuc &frame) {
+
+    if(count >= nFrames) {
+        return;
+    }
+
+    if(frame.width != width || frame.height != height) {
+        fprintf(stderr, "PixelStatsAccumulator: frame size %dx%d doesn't match accumulator size %dx%d\n", frame.width, frame.height, width, height);
+        return;
+    }
+
+    ParallelUtil::forEachRowBand(height, nThreads, [this, &frame](unsigned int rowStart, unsigned int rowEnd) {
+        addRows(frame, rowStart, rowEnd);
+    });
+
+    count++;
+}
+
+void PixelStatsAccumulator::addRows(const Imageuc &frame, unsigned int rowStart, unsigned int rowEnd) {
+
+    // Number of lowest & highest values recorded so far for each pixel
+    const unsigned int nRecorded = std::min(count, nTrim);
+
+    for(unsigned int p = rowStart * width; p < rowEnd * width; p++) {
+
+        const uint8_t value = frame.rawImage[p];
+
+        sum[p] += value;
+        sumSq[p] += value * value;
+
+        if(nTrim == 0) {
+            continue;
+        }
+
+        // Insert the value into the sorted list of the lowest values, if it belongs there
+        uint8_t * low = &lowest[p * nTrim];
+        if(nRecorded < nTrim || value < low[nTrim - 1]) {
+            unsigned int i = (nRecorded < nTrim) ? nRecorded : nTrim - 1;
+            while(i > 0 && low[i - 1] > value) {
+                low[i] = low[i - 1];
+                i--;
+            }
+            low[i] = value;
+        }
+
+        // Same for the highest values
+        uint8_t * high = &highest[p * nTrim];
+        if(nRecorded < nTrim || value > high[nTrim - 1]) {
+            unsigned int i = (nRecorded < nTrim) ? nRecorded : nTrim - 1;
+            while(i > 0 && high[i - 1] < value) {
+                high[i] = high[i - 1];
+                i--;
+            }
+            high[i] = value;
+        }
+    }
+}
+
+unsigned int PixelStatsAccumulator::getFrameCount() const {
+    return count;
+}
+
+void PixelStatsAccumulator::getTrimmedMeanStd(std::vector<double> &mean, std::vector<double> &std, unsigned int nThreads) const {
+
+    mean.assign(width * height, 0.0);
+    std.assign(width * height, 0.0);
+
+    // The values are trimmed according to the number of frames actually added, in case the stack is incomplete
+    const unsigned int trim = std::min(nTrim, static_cast<unsigned int>(trimFraction * count));
+    if(count <= 2 * trim) {
+        return;
+    }
+    const double inliers = static_cast<double>(count - 2 * trim);
+
+    ParallelUtil::forEachRowBand(height, nThreads, [&](unsigned int rowStart, unsigned int rowEnd) {
+        for(unsigned int p = rowStart * width; p < rowEnd * width; p++) {
+            // Remove the outliers from the sums
+            uint32_t s = sum[p];
+            uint64_t s2 = sumSq[p];
+            for(unsigned int i = 0; i < trim; i++) {
+                uint32_t low = lowest[p * nTrim + i];
+                uint32_t high = highest[p * nTrim + i];
+                s -= low + high;
+                s2 -= low * low + high * high;
+            }
+            double m = s / inliers;
+            mean[p] = m;
+            // Clamp tiny negative values that arise from rounding when all inliers are equal
+            std[p] = std::sqrt(std::max(s2 / inliers - m * m, 0.0));
+        }
+    });
+}
+
+void PixelStatsAccumulator::reset() {
+    count = 0;
+    std::fill(sum.begin(), sum.end(), 0);
+    std::fill(sumSq.begin(), sumSq.end(), 0);
+}
@@ -0,0 +1,129 @@
+#ifndef PIXELSTATSACCUMULATOR_H
+#define PIXELSTATSACCUMULATOR_H
+
+#include "infra/imageuc.h"
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * @brief Accumulates the trimmed mean and standard deviation of each pixel over a stack of frames, one frame
+ * at a time, so that the frames needn't be retained.
+ *
+ * The trimmed statistics exclude the lowest and highest trimFraction of the values in each pixel. Because the
+ * number of frames in the stack is known in advance, so is the number of values to exclude from each end, and
+ * since the pixels are 8-bit only that many of the lowest and highest values need to be tracked per pixel
+ * alongside exact integer sums of the values and their squares. The result is identical to sorting the values
+ * of each pixel and averaging the inliers, as done by MathUtil::getTrimmedMeanStd(...), but the memory and
+ * work are proportional to the number of pixels rather than pixels times frames.
+ *
+ * The per-frame update and the final computation are parallelised over bands of image rows. The threads are
+ * started per call, so when frames are added in real time the update should be run on the calling thread.
+ */
+class PixelStatsAccumulator
+{
+
+public:
+
+    /**
+     * @brief Constructor for the PixelStatsAccumulator.
+     * @param width
+     *  Width of the frames [pixels]
+     * @param height
+     *  Height of the frames [pixels]
+     * @param nFrames
+     *  The number of frames in the stack; used to determine the number of values excluded from each end.
+     * @param trimFraction
+     *  The fraction of the values excluded from each end of the range.
+     * @param nThreads
+     *  The number of threads used to add each frame; 0 to use one per hardware thread.
+     */
+    PixelStatsAccumulator(unsigned int width, unsigned int height, unsigned int nFrames, double trimFraction, unsigned int nThreads = 0);
+
+    /**
+     * @brief Add a frame to the stack. Frames added beyond the number given on construction are ignored.
+     * @param frame
+     *  The frame to add; must have the same dimensions as the accumulator.
+     */
+    void addFrame(const Imageuc &frame);
+
+    /**
+     * @brief Get the number of frames added so far.
+     * @return
+     *  The number of frames added.
+     */
+    unsigned int getFrameCount() const;
+
+    /**
+     * @brief Compute the trimmed mean and standard deviation of each pixel over the frames added so far.
+     * @param mean
+     *  On exit, contains the trimmed mean of each pixel.
+     * @param std
+     *  On exit, contains the trimmed standard deviation of each pixel.
+     * @param nThreads
+     *  The number of threads to use; 0 to use one per hardware thread.
+     */
+    void getTrimmedMeanStd(std::vector<double> &mean, std::vector<double> &std, unsigned int nThreads = 0) const;
+
+    /**
+     * @brief Discard all frames added so far.
+     */
+    void reset();
+
+private:
+
+    /**
+     * @brief Add a band of rows of a frame to the stack.
+     */
+    void addRows(const Imageuc &frame, unsigned int rowStart, unsigned int rowEnd);
+
+    unsigned int width;
+    unsigned int height;
+
+    /**
+     * @brief The number of frames in the stack.
+     */
+    unsigned int nFrames;
+
+    /**
+     * @brief The fraction of the values excluded from each end of the range.
+     */
+    double trimFraction;
+
+    /**
+     * @brief The number of values excluded from each end of the range of each pixel, for a full stack.
+     */
+    unsigned int nTrim;
+
+    /**
+     * @brief The number of threads used to add each frame.
+     */
+    unsigned int nThreads;
+
+    /**
+     * @brief The number of frames added so far.
+     */
+    unsigned int count;
+
+    /**
+     * @brief The sum of the values of each pixel.
+     */
+    std::vector<uint32_t> sum;
+
+    /**
+     * @brief The sum of the squared values of each pixel.
+     */
+    std::vector<uint64_t> sumSq;
+
+    /**
+     * @brief The nTrim lowest values of each pixel, in ascending order; pixel p occupies elements [p*nTrim:(p+1)*nTrim).
+     */
+    std::vector<uint8_t> lowest;
+
+    /**
+     * @brief The nTrim highest values of each pixel, in descending order; pixel p occupies elements [p*nTrim:(p+1)*nTrim).
+     */
+    std::vector<uint8_t> highest;
+};
+
+#endif // PIXELSTATSACCUMULATOR_H
@@ -0,0 +1,249 @@
+#include "infra/platesolver.h"
+
+#include <algorithm>            // sort
+#include <numeric>              // iota
+#include <cmath>
+
+const unsigned int PlateSolver::maxTriangleSources;
+const unsigned int PlateSolver::maxVerificationSources;
+const unsigned int PlateSolver::minMatches;
+constexpr double PlateSolver::minMatchFraction;
+constexpr double PlateSolver::maxSourcesPerStar;
+constexpr double PlateSolver::minFieldOfView;
+constexpr double PlateSolver::maxFieldOfView;
+constexpr double PlateSolver::focalLengthStep;
+constexpr double PlateSolver::ratioTolerance;
+constexpr double PlateSolver::sideTolerance;
+constexpr double PlateSolver::matchRadiusFraction;
+
+PlateSolver::PlateSolver(std::shared_ptr<AsterismIndex> index) : index(index), nMatched(0), r_bcrf(3, index->getNumStars()),
+    r_cam(3, index->getNumStars()), width(0), height(0), pi(0.0), pj(0.0), matchRadius(0.0) {
+    for(unsigned int s=0; s<index->getNumStars(); s++) {
+        r_bcrf.col(s) = index->getStar(s);
+    }
+}
+
+unsigned int PlateSolver::getNumMatched() const {
+    return nMatched;
+}
+
+bool PlateSolver::solve(const std::vector<Source> &sources, unsigned int width, unsigned int height, Eigen::Matrix3d &r_bcrf_cam, double &f) {
+
+    this->width = width;
+    this->height = height;
+    pi = width / 2.0;
+    pj = height / 2.0;
+    matchRadius = matchRadiusFraction * std::sqrt((double)width * width + (double)height * height);
+    nMatched = 0;
+
+    // Order the sources by decreasing brightness
+    std::vector<unsigned int> order(sources.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&sources](unsigned int a, unsigned int b) {return sources[a].adu > sources[b].adu;});
+
+    unsigned int nVerify = std::min((unsigned int)order.size(), maxVerificationSources);
+    unsigned int nTriangle = std::min(nVerify, maxTriangleSources);
+    if(nTriangle < 3) {
+        return false;
+    }
+
+    std::vector<double> sourceI(nVerify), sourceJ(nVerify);
+    for(unsigned int s=0; s<nVerify; s++) {
+        sourceI[s] = sources[order[s]].i;
+        sourceJ[s] = sources[order[s]].j;
+    }
+    SpatialGrid grid(sourceI, sourceJ, matchRadius);
+
+    // Trial focal lengths spanning the range of fields of view, and the unit vectors towards the brightest
+    // sources for each
+    std::vector<double> trialF;
+    double fMax = (width / 2.0) / std::tan(minFieldOfView / 2.0);
+    for(double trial = (width / 2.0) / std::tan(maxFieldOfView / 2.0); trial < fMax * focalLengthStep; trial *= focalLengthStep) {
+        trialF.push_back(trial);
+    }
+    std::vector<Eigen::Matrix3Xd> r_source(trialF.size(), Eigen::Matrix3Xd(3, nTriangle));
+    for(unsigned int t=0; t<trialF.size(); t++) {
+        for(unsigned int s=0; s<nTriangle; s++) {
+            r_source[t].col(s) = Eigen::Vector3d((sourceI[s] - pi) / trialF[t], (sourceJ[s] - pj) / trialF[t], 1.0).normalized();
+        }
+    }
+
+    std::vector<unsigned int> candidates;
+    std::vector<std::pair<unsigned int, unsigned int>> matches;
+    Eigen::Matrix3Xd from(3, 3), to(3, 3);
+
+    // Triangles are formed from the brightest sources first, since these are the most likely to be in the index
+    for(unsigned int s3=2; s3<nTriangle; s3++) {
+        for(unsigned int s2=1; s2<s3; s2++) {
+            for(unsigned int s1=0; s1<s2; s1++) {
+                for(unsigned int t=0; t<trialF.size(); t++) {
+
+                    const Eigen::Matrix3Xd &r = r_source[t];
+
+                    // Each side paired with the source opposite it, ordered by increasing length
+                    std::pair<double, unsigned int> sides[3] = {
+                        std::make_pair(std::acos(std::min(1.0, r.col(s2).dot(r.col(s3)))), s1),
+                        std::make_pair(std::acos(std::min(1.0, r.col(s1).dot(r.col(s3)))), s2),
+                        std::make_pair(std::acos(std::min(1.0, r.col(s1).dot(r.col(s2)))), s3)};
+                    std::sort(sides, sides + 3);
+
+                    if(sides[0].first < AsterismIndex::minSide * (1.0 - sideTolerance) || sides[2].first > AsterismIndex::maxSide * (1.0 + sideTolerance)) {
+                        continue;
+                    }
+
+                    index->query(sides[0].first / sides[2].first, sides[1].first / sides[2].first, ratioTolerance, candidates);
+
+                    for(unsigned int v=0; v<3; v++) {
+                        to.col(v) = r.col(sides[v].second);
+                    }
+                    double handedness = to.col(0).dot(to.col(1).cross(to.col(2)));
+
+                    for(unsigned int c : candidates) {
+
+                        const AsterismIndex::Triangle &triangle = index->getTriangle(c);
+
+                        if(std::abs(sides[2].first - triangle.side) > sideTolerance * triangle.side) {
+                            continue;
+                        }
+
+                        for(unsigned int v=0; v<3; v++) {
+                            from.col(v) = index->getStar(triangle.stars[v]);
+                        }
+
+                        // A rotation preserves the handedness of the triangle; this rejects mirror images
+                        if(from.col(0).dot(from.col(1).cross(from.col(2))) * handedness <= 0.0) {
+                            continue;
+                        }
+
+                        Eigen::Matrix3d r_hyp = getRotation(from, to);
+                        double f_hyp = trialF[t];
+
+                        if(!match(r_hyp, f_hyp, sourceI, sourceJ, grid, matches)) {
+                            continue;
+                        }
+
+                        // Verified: refine, then repeat with any further stars matched by the refined solution
+                        refine(r_hyp, f_hyp, sourceI, sourceJ, matches);
+                        if(!match(r_hyp, f_hyp, sourceI, sourceJ, grid, matches)) {
+                            continue;
+                        }
+                        refine(r_hyp, f_hyp, sourceI, sourceJ, matches);
+
+                        r_bcrf_cam = r_hyp;
+                        f = f_hyp;
+                        nMatched = matches.size();
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool PlateSolver::match(const Eigen::Matrix3d &r_bcrf_cam, const double &f, const std::vector<double> &sourceI, const std::vector<double> &sourceJ,
+                        const SpatialGrid &grid, std::vector<std::pair<unsigned int, unsigned int>> &matches) {
+
+    matches.clear();
+
+    // Project the index stars into the image
+    r_cam.noalias() = r_bcrf_cam * r_bcrf;
+    projected.clear();
+    for(unsigned int s=0; s<r_cam.cols(); s++) {
+        if(r_cam(2, s) <= 0.0) {
+            continue;
+        }
+        double i = f * r_cam(0, s) / r_cam(2, s) + pi;
+        double j = f * r_cam(1, s) / r_cam(2, s) + pj;
+        if(i >= 0.0 && i <= width && j >= 0.0 && j <= height) {
+            projected.push_back(std::make_pair(s, Eigen::Vector2d(i, j)));
+        }
+    }
+
+    // The index contains the brightest stars, so they should be matched to the brightest sources; matching them
+    // to fainter sources only increases the chance matches
+    unsigned int nSources = std::min((unsigned int)sourceI.size(), (unsigned int)(maxSourcesPerStar * projected.size()));
+
+    used.assign(nSources, false);
+
+    // Stop as soon as too many stars are unmatched for the solution to be accepted
+    unsigned int maxMisses = (unsigned int)((1.0 - minMatchFraction) * projected.size());
+    unsigned int nMisses = 0;
+
+    for(const std::pair<unsigned int, Eigen::Vector2d> &star : projected) {
+
+        // Match to the closest unused source within the match radius
+        double i = star.second[0];
+        double j = star.second[1];
+        grid.query(i, j, matchRadius, nearby);
+        double minSep2 = matchRadius * matchRadius;
+        int closest = -1;
+        for(unsigned int n : nearby) {
+            if(n >= nSources) {
+                continue;
+            }
+            double sep2 = (sourceI[n] - i) * (sourceI[n] - i) + (sourceJ[n] - j) * (sourceJ[n] - j);
+            if(!used[n] && sep2 <= minSep2) {
+                minSep2 = sep2;
+                closest = n;
+            }
+        }
+        if(closest >= 0) {
+            used[closest] = true;
+            matches.push_back(std::make_pair((unsigned int)closest, star.first));
+        }
+        else if(++nMisses > maxMisses) {
+            return false;
+        }
+    }
+
+    return matches.size() >= minMatches && matches.size() >= minMatchFraction * projected.size();
+}
+
+void PlateSolver::refine(Eigen::Matrix3d &r_bcrf_cam, double &f, const std::vector<double> &sourceI, const std::vector<double> &sourceJ,
+                         const std::vector<std::pair<unsigned int, unsigned int>> &matches) const {
+
+    unsigned int n = matches.size();
+    Eigen::Matrix3Xd r_star(3, n), r_source(3, n);
+    for(unsigned int m=0; m<n; m++) {
+        r_star.col(m) = r_bcrf.col(matches[m].second);
+    }
+
+    // Alternate between the rotation for fixed focal length and the focal length for fixed rotation, each of
+    // which has a closed form solution
+    for(unsigned int iteration=0; iteration<3; iteration++) {
+
+        for(unsigned int m=0; m<n; m++) {
+            unsigned int s = matches[m].first;
+            r_source.col(m) = Eigen::Vector3d((sourceI[s] - pi) / f, (sourceJ[s] - pj) / f, 1.0).normalized();
+        }
+        r_bcrf_cam = getRotation(r_star, r_source);
+
+        // The projected coordinates relative to the principal point are linear in the focal length
+        double num = 0.0;
+        double den = 0.0;
+        for(unsigned int m=0; m<n; m++) {
+            unsigned int s = matches[m].first;
+            Eigen::Vector3d r = r_bcrf_cam * r_star.col(m);
+            double gi = r[0] / r[2];
+            double gj = r[1] / r[2];
+            num += gi * (sourceI[s] - pi) + gj * (sourceJ[s] - pj);
+            den += gi * gi + gj * gj;
+        }
+        if(den > 0.0) {
+            f = num / den;
+        }
+    }
+}
+
+Eigen::Matrix3d PlateSolver::getRotation(const Eigen::Matrix3Xd &from, const Eigen::Matrix3Xd &to) {
+
+    Eigen::Matrix3d b = to * from.transpose();
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(b, Eigen::ComputeFullU | Eigen::ComputeFullV);
+
+    // Correct for a reflection, so that the result is a proper rotation
+    Eigen::Vector3d d(1.0, 1.0, (svd.matrixU() * svd.matrixV().transpose()).determinant() < 0.0 ? -1.0 : 1.0);
+
+    return svd.matrixU() * d.asDiagonal() * svd.matrixV().transpose();
+}
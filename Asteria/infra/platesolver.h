@@ -0,0 +1,181 @@
+#ifndef PLATESOLVER_H
+#define PLATESOLVER_H
+
+#include "infra/asterismindex.h"
+#include "infra/source.h"
+#include "infra/spatialgrid.h"
+
+#include <vector>
+#include <memory>               // shared_ptr
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The PlateSolver class performs a blind astrometric solution of an image: it finds the orientation and
+ * approximate focal length of the camera from the sources detected in the image, without any prior knowledge
+ * of either. This is used to recover the calibration when the camera has been remounted, or when the initial
+ * calibration is otherwise too far from the truth for the reference stars to be cross-matched.
+ *
+ * The camera is modelled as a pinhole with equal focal lengths in each direction and the principal point at
+ * the centre of the image; distortion is neglected. The focal length is searched over a geometric sequence
+ * spanning the range of fields of view. For each trial focal length, the brightest sources are deprojected to
+ * unit vectors and triangles formed from them are looked up in the AsterismIndex by the ratios of their angular
+ * sides. Each matching index triangle of consistent size and handedness gives a hypothesis for the orientation,
+ * which is verified by projecting the index stars into the image and counting those that land on a source.
+ * The first hypothesis verified by enough stars is refined by least squares using all the matched stars.
+ */
+class PlateSolver
+{
+public:
+
+    /**
+     * @brief Main constructor for the PlateSolver.
+     * @param index
+     *  The asterism index.
+     */
+    PlateSolver(std::shared_ptr<AsterismIndex> index);
+
+    /**
+     * @brief Solve for the orientation and focal length of the camera.
+     * @param sources
+     *  The sources detected in the image.
+     * @param width
+     *  Width of the image [pixels]
+     * @param height
+     *  Height of the image [pixels]
+     * @param r_bcrf_cam
+     *  On exit, the rotation from the BCRF to the camera frame, if a solution was found.
+     * @param f
+     *  On exit, the focal length [pixels], if a solution was found.
+     * @return
+     *  True if a solution was found.
+     */
+    bool solve(const std::vector<Source> &sources, unsigned int width, unsigned int height, Eigen::Matrix3d &r_bcrf_cam, double &f);
+
+    /**
+     * @brief Get the number of index stars matched to sources in the most recent solution.
+     */
+    unsigned int getNumMatched() const;
+
+    /**
+     * @brief Number of the brightest sources used to form triangles.
+     */
+    static const unsigned int maxTriangleSources = 30;
+
+    /**
+     * @brief Number of the brightest sources that the index stars are matched to when verifying a solution.
+     */
+    static const unsigned int maxVerificationSources = 100;
+
+    /**
+     * @brief Minimum number of index stars matched to sources for a solution to be accepted.
+     */
+    static const unsigned int minMatches = 8;
+
+    /**
+     * @brief Minimum fraction of the index stars projected into the image that are matched to sources for a
+     * solution to be accepted. This rejects the chance matches that occur when many stars are projected into
+     * an image with many sources.
+     */
+    static constexpr double minMatchFraction = 0.5;
+
+    /**
+     * @brief When verifying a solution, the index stars projected into the image are matched to this many times
+     * as many of the brightest sources, allowing for spurious sources and the scatter in brightness.
+     */
+    static constexpr double maxSourcesPerStar = 2.0;
+
+    /**
+     * @brief Range of the horizontal field of view searched [radians]
+     */
+    static constexpr double minFieldOfView = 20.0 * M_PI / 180.0;
+    static constexpr double maxFieldOfView = 140.0 * M_PI / 180.0;
+
+    /**
+     * @brief Ratio between consecutive trial focal lengths.
+     */
+    static constexpr double focalLengthStep = 1.1;
+
+    /**
+     * @brief Tolerance on the ratios of the sides of matching triangles.
+     */
+    static constexpr double ratioTolerance = 0.5 * AsterismIndex::minRatioSeparation;
+
+    /**
+     * @brief Fractional tolerance on the length of the longest side of matching triangles; this must allow for
+     * the spacing of the trial focal lengths.
+     */
+    static constexpr double sideTolerance = 0.1;
+
+    /**
+     * @brief Radius within which an index star is matched to a source, as a fraction of the image diagonal. This
+     * must allow for the distortion neglected by the pinhole model.
+     */
+    static constexpr double matchRadiusFraction = 0.015;
+
+private:
+
+    std::shared_ptr<AsterismIndex> index;
+
+    unsigned int nMatched;
+
+    /**
+     * @brief BCRF unit vectors towards the index stars (3xN), and the workspace for their CAM frame unit vectors
+     * for a hypothesised orientation.
+     */
+    Eigen::Matrix3Xd r_bcrf;
+    Eigen::Matrix3Xd r_cam;
+
+    /**
+     * @brief Workspace used when matching the index stars to the sources: the index stars projected into the
+     * image and their coordinates, the sources that have been matched, and the sources near a star.
+     */
+    std::vector<std::pair<unsigned int, Eigen::Vector2d>> projected;
+    std::vector<bool> used;
+    std::vector<unsigned int> nearby;
+
+    /**
+     * @brief Match the index stars to the sources for a hypothesised orientation and focal length.
+     * @param r_bcrf_cam
+     *  The rotation from the BCRF to the camera frame.
+     * @param f
+     *  The focal length [pixels]
+     * @param sourceI, sourceJ
+     *  Image coordinates of the sources [pixels]
+     * @param grid
+     *  Spatial index of the sources.
+     * @param matches
+     *  On exit, contains pairs of matched (source, index star) indices.
+     * @return
+     *  True if enough of the index stars projected into the image are matched to accept the solution.
+     */
+    bool match(const Eigen::Matrix3d &r_bcrf_cam, const double &f, const std::vector<double> &sourceI, const std::vector<double> &sourceJ,
+               const SpatialGrid &grid, std::vector<std::pair<unsigned int, unsigned int>> &matches);
+
+    /**
+     * @brief Refine the orientation and focal length by least squares using the matched stars.
+     */
+    void refine(Eigen::Matrix3d &r_bcrf_cam, double &f, const std::vector<double> &sourceI, const std::vector<double> &sourceJ,
+                const std::vector<std::pair<unsigned int, unsigned int>> &matches) const;
+
+    /**
+     * @brief Find the rotation that best maps a set of unit vectors onto another (the solution of Wahba's problem).
+     * @param from
+     *  The unit vectors in the original frame, one per column.
+     * @param to
+     *  The unit vectors in the rotated frame, one per column.
+     * @return
+     *  The rotation matrix R minimising sum |to - R * from|^2
+     */
+    static Eigen::Matrix3d getRotation(const Eigen::Matrix3Xd &from, const Eigen::Matrix3Xd &to);
+
+    /**
+     * @brief Image width and height, and the principal point [pixels]
+     */
+    unsigned int width, height;
+    double pi, pj;
+
+    double matchRadius;
+};
+
+#endif // PLATESOLVER_H
@@ -0,0 +1,457 @@
+#include "infra/referencestarcatalogue.h"
+#include "optics/cameramodelbase.h"
+#include "util/coordinateutil.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <numeric>              // iota
+
+const char ReferenceStarCatalogue::magic[8] = {'A', 'S', 'T', 'R', 'S', 'C', 'A', 'T'};
+const uint32_t ReferenceStarCatalogue::version = 1;
+
+// Number of points along each edge of the image used to find the extent of the field of view
+static const unsigned int fieldOfViewEdgePoints = 16;
+
+// Margin added to the radius of the field of view, to allow for the distortion between the sampled points [radians]
+static const double fieldOfViewMargin = M_PI / 180.0;
+
+// Target mean number of stars per tile when choosing nside automatically, and the upper limit on nside
+static const unsigned int targetStarsPerTile = 32;
+static const unsigned int maxNside = 256;
+
+// Margin added to the radius of a region when finding the tiles it covers, to allow for rounding errors [radians]
+static const double tileRangeMargin = 1e-9;
+
+static size_t align8(size_t size) {
+    return (size + 7) & ~((size_t)7);
+}
+
+/**
+ * @brief Get the range of the angle atan2(r[p], sign * r[q]) over the points within a circular region of the sky,
+ * clipped to the range [-pi/4:pi/4] spanned by a cube face. The angle is the longitude about the third axis, and
+ * the range is found from the latitude of the centre of the region with respect to that axis.
+ * @return
+ *  False if the clipped range is empty.
+ */
+static bool getFaceAngleRange(const Eigen::Vector3d &r_bcrf, double radius, unsigned int p, unsigned int q, double sign, double &lower, double &upper) {
+
+    const double faceLimit = M_PI / 4.0;
+
+    double cosLat = std::sqrt(r_bcrf[p] * r_bcrf[p] + r_bcrf[q] * r_bcrf[q]);
+    double lat = std::atan2(std::abs(r_bcrf[3 - p - q]), cosLat);
+
+    // The region contains the pole, so spans all longitudes
+    if(radius + lat >= M_PI / 2.0) {
+        lower = -faceLimit;
+        upper = faceLimit;
+        return true;
+    }
+
+    double centre = std::atan2(r_bcrf[p], sign * r_bcrf[q]);
+    double halfWidth = std::asin(std::sin(radius) / cosLat);
+
+    // The range is less than pi wide, so at most one of its images overlaps the face
+    for(int m=-1; m<=1; m++) {
+        lower = std::max(centre - halfWidth + 2.0 * M_PI * m, -faceLimit);
+        upper = std::min(centre + halfWidth + 2.0 * M_PI * m, faceLimit);
+        if(lower <= upper) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Get the column or row of the tile containing an angle on a cube face, as in ReferenceStarCatalogue::getTile(...)
+ */
+static unsigned int getFaceCell(double angle, unsigned int nside) {
+    double a = angle * 4.0 / M_PI;
+    return std::min(std::max((int)std::floor((a + 1.0) / 2.0 * nside), 0), (int)nside - 1);
+}
+
+ReferenceStarCatalogue::ReferenceStarCatalogue() : mapping(0), mappingSize(0), nStars(0), nside(0), nTiles(0), tileStart(0),
+    x(0), y(0), z(0), ra(0), dec(0), mag(0) {
+
+}
+
+ReferenceStarCatalogue::~ReferenceStarCatalogue() {
+    if(mapping) {
+        munmap(mapping, mappingSize);
+    }
+}
+
+std::shared_ptr<ReferenceStarCatalogue> ReferenceStarCatalogue::load(const std::string &path) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        perror(("Couldn't open reference star catalogue " + path).c_str());
+        return std::shared_ptr<ReferenceStarCatalogue>();
+    }
+
+    struct stat st;
+    char fileMagic[sizeof(magic)];
+    bool binary = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header) &&
+                  read(fd, fileMagic, sizeof(magic)) == (ssize_t)sizeof(magic) && memcmp(fileMagic, magic, sizeof(magic)) == 0;
+
+    if(!binary) {
+        close(fd);
+        // Text catalogue: parse and index it in memory
+        std::string textPath(path);
+        std::vector<ReferenceStar> stars = ReferenceStar::loadCatalogue(textPath);
+        fprintf(stderr, "Indexing text reference star catalogue %s; convert it to binary with --convert-catalogue for faster loading\n", path.c_str());
+        return build(stars);
+    }
+
+    void * mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        perror(("Couldn't map reference star catalogue " + path).c_str());
+        return std::shared_ptr<ReferenceStarCatalogue>();
+    }
+
+    std::shared_ptr<ReferenceStarCatalogue> catalogue(new ReferenceStarCatalogue());
+    catalogue->mapping = mapping;
+    catalogue->mappingSize = st.st_size;
+
+    if(!catalogue->attach((const char *)mapping, st.st_size)) {
+        fprintf(stderr, "Invalid reference star catalogue %s\n", path.c_str());
+        return std::shared_ptr<ReferenceStarCatalogue>();
+    }
+
+    return catalogue;
+}
+
+std::shared_ptr<ReferenceStarCatalogue> ReferenceStarCatalogue::build(const std::vector<ReferenceStar> &stars, unsigned int nside) {
+
+    uint32_t n = stars.size();
+
+    if(nside == 0) {
+        nside = (unsigned int)std::round(std::sqrt((double)n / (6.0 * targetStarsPerTile)));
+        nside = std::min(std::max(nside, 1u), maxNside);
+    }
+
+    // Unit vectors and tiles of the stars
+    std::vector<Eigen::Vector3d> r_bcrf(n);
+    std::vector<unsigned int> tiles(n);
+    for(uint32_t s=0; s<n; s++) {
+        CoordinateUtil::sphericalToCartesian(r_bcrf[s], 1.0, stars[s].ra, stars[s].dec);
+        tiles[s] = getTile(r_bcrf[s], nside);
+    }
+
+    // Sort by tile then by increasing magnitude
+    std::vector<uint32_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return tiles[a] < tiles[b] || (tiles[a] == tiles[b] && stars[a].mag < stars[b].mag);
+    });
+
+    size_t tileOffset, xOffset, magOffset;
+    size_t size = getLayout(n, nside, tileOffset, xOffset, magOffset);
+
+    std::shared_ptr<ReferenceStarCatalogue> catalogue(new ReferenceStarCatalogue());
+    std::vector<char> &buffer = catalogue->buffer;
+    buffer.assign(size, 0);
+
+    Header * header = (Header *)&buffer[0];
+    memcpy(header->magic, magic, sizeof(magic));
+    header->version = version;
+    header->nStars = n;
+    header->nside = nside;
+
+    unsigned int nTiles = 6 * nside * nside;
+    uint32_t * tileStart = (uint32_t *)&buffer[tileOffset];
+    double * x = (double *)&buffer[xOffset];
+    double * y = x + n;
+    double * z = y + n;
+    double * ra = z + n;
+    double * dec = ra + n;
+    float * mag = (float *)&buffer[magOffset];
+
+    for(uint32_t s=0; s<n; s++) {
+        uint32_t idx = order[s];
+        x[s] = r_bcrf[idx][0];
+        y[s] = r_bcrf[idx][1];
+        z[s] = r_bcrf[idx][2];
+        ra[s] = stars[idx].ra;
+        dec[s] = stars[idx].dec;
+        mag[s] = (float)stars[idx].mag;
+        tileStart[tiles[idx] + 1]++;
+    }
+    for(unsigned int t=0; t<nTiles; t++) {
+        tileStart[t + 1] += tileStart[t];
+    }
+
+    catalogue->attach(&buffer[0], size);
+
+    return catalogue;
+}
+
+bool ReferenceStarCatalogue::convert(const std::string &textPath, const std::string &binaryPath, unsigned int nside) {
+
+    std::string path(textPath);
+    std::vector<ReferenceStar> stars = ReferenceStar::loadCatalogue(path);
+    if(stars.empty()) {
+        fprintf(stderr, "No reference stars found in %s\n", textPath.c_str());
+        return false;
+    }
+
+    std::shared_ptr<ReferenceStarCatalogue> catalogue = build(stars, nside);
+    if(!catalogue->save(binaryPath)) {
+        return false;
+    }
+
+    fprintf(stderr, "Wrote %u reference stars in %u tiles to %s\n", catalogue->nStars, catalogue->nTiles, binaryPath.c_str());
+    return true;
+}
+
+bool ReferenceStarCatalogue::save(const std::string &path) const {
+
+    size_t tileOffset, xOffset, magOffset;
+    size_t size = getLayout(nStars, nside, tileOffset, xOffset, magOffset);
+
+    // The header is at the start of the data, whether it's held in memory or mapped
+    const char * data = mapping ? (const char *)mapping : &buffer[0];
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(data, size);
+    out.close();
+
+    if(out.fail()) {
+        fprintf(stderr, "Couldn't write reference star catalogue %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+unsigned int ReferenceStarCatalogue::size() const {
+    return nStars;
+}
+
+uint64_t ReferenceStarCatalogue::getChecksum() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto accumulate = [&hash](const char * data, size_t size) {
+        for(size_t i=0; i<size; i++) {
+            hash = (hash ^ (unsigned char)data[i]) * 1099511628211ull;
+        }
+    };
+    // The x, y, z, ra and dec arrays are contiguous
+    accumulate((const char *)x, 5 * (size_t)nStars * sizeof(double));
+    accumulate((const char *)mag, (size_t)nStars * sizeof(float));
+    return hash;
+}
+
+void ReferenceStarCatalogue::getStars(const Eigen::Vector3d &r_bcrf, double radius, double magLimit, std::vector<ReferenceStar> &stars) const {
+
+    stars.clear();
+
+    radius = std::min(radius, M_PI);
+    double cosRadius = std::cos(radius);
+    double sinRadius = std::sin(radius);
+
+    for(unsigned int face=0; face<6; face++) {
+
+        // Find the range of columns and rows of tiles on this face that the region covers, if any
+        unsigned int axis = face / 2;
+        double sign = (face % 2 == 0) ? 1.0 : -1.0;
+        double aMin, aMax, bMin, bMax;
+        if(!getFaceAngleRange(r_bcrf, radius + tileRangeMargin, (axis + 1) % 3, axis, sign, aMin, aMax) ||
+           !getFaceAngleRange(r_bcrf, radius + tileRangeMargin, (axis + 2) % 3, axis, sign, bMin, bMax)) {
+            continue;
+        }
+
+        for(unsigned int b = getFaceCell(bMin, nside); b <= getFaceCell(bMax, nside); b++) {
+            for(unsigned int a = getFaceCell(aMin, nside); a <= getFaceCell(aMax, nside); a++) {
+
+                unsigned int t = face * nside * nside + b * nside + a;
+
+                if(tileStart[t] == tileStart[t + 1]) {
+                    continue;
+                }
+
+                // Skip tiles in the corners of the range that don't overlap the region, i.e. where the separation
+                // of the centres exceeds the sum of the radii
+                if(radius + tileRadius[t] < M_PI &&
+                   tileCentre[t].dot(r_bcrf) < cosRadius * tileCosRadius[t] - sinRadius * tileSinRadius[t]) {
+                    continue;
+                }
+
+                // Stars are sorted by increasing magnitude within each tile
+                for(uint32_t s = tileStart[t]; s < tileStart[t + 1] && mag[s] <= magLimit; s++) {
+                    if(x[s] * r_bcrf[0] + y[s] * r_bcrf[1] + z[s] * r_bcrf[2] >= cosRadius) {
+                        stars.push_back(ReferenceStar(ra[s], dec[s], mag[s]));
+                        stars.back().r = Eigen::Vector3d(x[s], y[s], z[s]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void ReferenceStarCatalogue::getVisibleStars(const Eigen::Matrix3d &r_bcrf_cam, const CameraModelBase &cam, double magLimit,
+                                             std::vector<ReferenceStar> &stars) const {
+
+    Eigen::Vector3d r_bcrf;
+    double radius;
+    getFieldOfView(r_bcrf_cam, cam, r_bcrf, radius);
+
+    std::vector<ReferenceStar> candidates;
+    getStars(r_bcrf, radius, magLimit, candidates);
+
+    // Transform the BCRF unit vectors to the CAM frame and project into image coordinates
+    unsigned int n = candidates.size();
+    Eigen::Matrix3Xd r_cam(3, n);
+    for(unsigned int s=0; s<n; s++) {
+        r_cam.col(s) = candidates[s].r;
+    }
+    r_cam = r_bcrf_cam * r_cam;
+
+    Eigen::ArrayXd i, j;
+    CameraModelBase::ArrayXb visible;
+    cam.projectVectors(r_cam, i, j, visible, 0);
+
+    stars.clear();
+    for(unsigned int s=0; s<n; s++) {
+        if(visible[s]) {
+            ReferenceStar &star = candidates[s];
+            star.r = r_cam.col(s);
+            star.i = i[s];
+            star.j = j[s];
+            star.visible = true;
+            stars.push_back(star);
+        }
+    }
+}
+
+void ReferenceStarCatalogue::getFieldOfView(const Eigen::Matrix3d &r_bcrf_cam, const CameraModelBase &cam, Eigen::Vector3d &r_bcrf, double &radius) {
+
+    // Centre the region on the camera boresight
+    double pi, pj;
+    cam.getPrincipalPoint(pi, pj);
+    Eigen::Vector3d boresight = cam.deprojectPixel(pi, pj);
+
+    // Find the largest angle between the boresight and the edge of the image
+    double minCosSep = 1.0;
+    for(unsigned int p=0; p<=fieldOfViewEdgePoints; p++) {
+        double fi = (double)cam.width * p / fieldOfViewEdgePoints;
+        double fj = (double)cam.height * p / fieldOfViewEdgePoints;
+        Eigen::Vector3d edges[4] = {cam.deprojectPixel(fi, 0.0), cam.deprojectPixel(fi, cam.height),
+                                    cam.deprojectPixel(0.0, fj), cam.deprojectPixel(cam.width, fj)};
+        for(const Eigen::Vector3d &edge : edges) {
+            minCosSep = std::min(minCosSep, boresight.dot(edge));
+        }
+    }
+
+    r_bcrf = r_bcrf_cam.transpose() * boresight;
+    radius = std::acos(std::max(-1.0, minCosSep)) + fieldOfViewMargin;
+}
+
+bool ReferenceStarCatalogue::attach(const char * data, size_t size) {
+
+    if(size < sizeof(Header)) {
+        return false;
+    }
+    const Header * header = (const Header *)data;
+    if(memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version || header->nside == 0 || header->nside > maxNside) {
+        return false;
+    }
+
+    size_t tileOffset, xOffset, magOffset;
+    if(size < getLayout(header->nStars, header->nside, tileOffset, xOffset, magOffset)) {
+        return false;
+    }
+
+    nStars = header->nStars;
+    nside = header->nside;
+    nTiles = 6 * nside * nside;
+    tileStart = (const uint32_t *)(data + tileOffset);
+    x = (const double *)(data + xOffset);
+    y = x + nStars;
+    z = y + nStars;
+    ra = z + nStars;
+    dec = ra + nStars;
+    mag = (const float *)(data + magOffset);
+
+    // The stars in each tile must lie within the catalogue
+    if(tileStart[0] != 0 || tileStart[nTiles] != nStars) {
+        return false;
+    }
+    for(unsigned int t=0; t<nTiles; t++) {
+        if(tileStart[t + 1] < tileStart[t]) {
+            return false;
+        }
+    }
+
+    // Find the centre and extent of each tile; the tile edges are great circles, so the point furthest from
+    // the centre is one of the corners
+    tileCentre.resize(nTiles);
+    tileRadius.resize(nTiles);
+    tileCosRadius.resize(nTiles);
+    tileSinRadius.resize(nTiles);
+    for(unsigned int t=0; t<nTiles; t++) {
+        unsigned int face = t / (nside * nside);
+        unsigned int b = (t / nside) % nside;
+        unsigned int a = t % nside;
+        double a0 = 2.0 * a / nside - 1.0;
+        double b0 = 2.0 * b / nside - 1.0;
+        double step = 2.0 / nside;
+        tileCentre[t] = getFaceVector(face, a0 + step / 2.0, b0 + step / 2.0);
+        double minCosSep = 1.0;
+        for(unsigned int c=0; c<4; c++) {
+            Eigen::Vector3d corner = getFaceVector(face, a0 + (c % 2) * step, b0 + (c / 2) * step);
+            minCosSep = std::min(minCosSep, tileCentre[t].dot(corner));
+        }
+        tileRadius[t] = std::acos(std::max(-1.0, minCosSep));
+        tileCosRadius[t] = std::cos(tileRadius[t]);
+        tileSinRadius[t] = std::sin(tileRadius[t]);
+    }
+
+    return true;
+}
+
+size_t ReferenceStarCatalogue::getLayout(uint32_t nStars, uint32_t nside, size_t &tileOffset, size_t &xOffset, size_t &magOffset) {
+    size_t nTiles = 6 * (size_t)nside * nside;
+    tileOffset = sizeof(Header);
+    xOffset = align8(tileOffset + (nTiles + 1) * sizeof(uint32_t));
+    magOffset = xOffset + 5 * (size_t)nStars * sizeof(double);
+    return align8(magOffset + (size_t)nStars * sizeof(float));
+}
+
+unsigned int ReferenceStarCatalogue::getTile(const Eigen::Vector3d &r, unsigned int nside) {
+
+    // The cube face is determined by the largest component of the vector
+    unsigned int axis = 0;
+    if(std::abs(r[1]) > std::abs(r[axis])) {
+        axis = 1;
+    }
+    if(std::abs(r[2]) > std::abs(r[axis])) {
+        axis = 2;
+    }
+    unsigned int face = 2 * axis + (r[axis] < 0.0 ? 1 : 0);
+
+    // Gnomonic coordinates on the face, converted to angles so that the tiles are of similar size
+    double u = r[(axis + 1) % 3] / std::abs(r[axis]);
+    double v = r[(axis + 2) % 3] / std::abs(r[axis]);
+    double a = std::atan(u) * 4.0 / M_PI;
+    double b = std::atan(v) * 4.0 / M_PI;
+
+    int ia = std::min(std::max((int)std::floor((a + 1.0) / 2.0 * nside), 0), (int)nside - 1);
+    int ib = std::min(std::max((int)std::floor((b + 1.0) / 2.0 * nside), 0), (int)nside - 1);
+
+    return face * nside * nside + ib * nside + ia;
+}
+
+Eigen::Vector3d ReferenceStarCatalogue::getFaceVector(unsigned int face, double a, double b) {
+    unsigned int axis = face / 2;
+    Eigen::Vector3d r;
+    r[axis] = (face % 2 == 0) ? 1.0 : -1.0;
+    r[(axis + 1) % 3] = std::tan(a * M_PI / 4.0);
+    r[(axis + 2) % 3] = std::tan(b * M_PI / 4.0);
+    return r.normalized();
+}
@@ -0,0 +1,238 @@
+#ifndef REFERENCESTARCATALOGUE_H
+#define REFERENCESTARCATALOGUE_H
+
+#include "infra/referencestar.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <Eigen/Dense>
+
+class CameraModelBase;
+
+/**
+ * @brief The catalogue of ReferenceStars, indexed by position on the sky so that the stars visible to the
+ * camera can be found without examining the whole catalogue.
+ *
+ * The sky is divided into tiles by projecting it onto the faces of a cube and dividing each face into
+ * nside x nside cells, equally spaced in angle. The stars are stored sorted by tile, and by increasing
+ * magnitude within each tile, so that queries only visit the tiles that overlap the region of interest
+ * (found from the range of angles it spans on each face) and stop at the magnitude limit in each tile.
+ * The positions are stored as precomputed BCRF unit vectors.
+ *
+ * The catalogue can be compiled to a binary file, which is memory-mapped on loading so that large catalogues
+ * are available immediately and only the parts that are used are read from disk. The binary format is:
+ *
+ * Header        : char[8] magic ("ASTRSCAT"), uint32 version, uint32 number of stars N, uint32 nside, uint32 padding
+ * Tile offsets  : uint32[6*nside*nside + 1]; the stars in tile t are [offset[t]:offset[t+1]). Padded to 8 bytes.
+ * x, y, z       : double[N] each; BCRF unit vectors towards the stars
+ * ra, dec       : double[N] each; right ascension and declination [radians]
+ * mag           : float[N]; magnitude [mags]. Padded to 8 bytes.
+ *
+ * All values are stored in the native byte order of the machine that compiled the catalogue.
+ */
+class ReferenceStarCatalogue
+{
+
+public:
+
+    ~ReferenceStarCatalogue();
+
+    /**
+     * @brief Load a reference star catalogue. Binary catalogues are memory-mapped; text catalogues (as read by
+     * ReferenceStar::loadCatalogue(...)) are parsed and indexed in memory.
+     * @param path
+     *  The path to the catalogue file.
+     * @return
+     *  The catalogue, or an empty pointer if it couldn't be loaded.
+     */
+    static std::shared_ptr<ReferenceStarCatalogue> load(const std::string &path);
+
+    /**
+     * @brief Index a set of ReferenceStars in memory.
+     * @param stars
+     *  The ReferenceStars.
+     * @param nside
+     *  The number of tiles along each side of each cube face; 0 to choose according to the number of stars.
+     * @return
+     *  The catalogue.
+     */
+    static std::shared_ptr<ReferenceStarCatalogue> build(const std::vector<ReferenceStar> &stars, unsigned int nside = 0);
+
+    /**
+     * @brief Convert a text catalogue to the binary format.
+     * @param textPath
+     *  The path to the text catalogue.
+     * @param binaryPath
+     *  The path to write the binary catalogue to.
+     * @param nside
+     *  The number of tiles along each side of each cube face; 0 to choose according to the number of stars.
+     * @return
+     *  True if the catalogue was converted successfully.
+     */
+    static bool convert(const std::string &textPath, const std::string &binaryPath, unsigned int nside = 0);
+
+    /**
+     * @brief Write the catalogue to a binary file.
+     * @param path
+     *  The path to write the catalogue to.
+     * @return
+     *  True if the catalogue was written successfully.
+     */
+    bool save(const std::string &path) const;
+
+    /**
+     * @brief Get the number of stars in the catalogue.
+     * @return
+     *  The number of stars.
+     */
+    unsigned int size() const;
+
+    /**
+     * @brief Get a checksum of the star positions and magnitudes, in the order they're stored. This identifies
+     * the catalogue contents for files derived from it, such as the AsterismIndex.
+     * @return
+     *  The 64-bit FNV-1a hash of the star data.
+     */
+    uint64_t getChecksum() const;
+
+    /**
+     * @brief Get the stars brighter than a magnitude limit that lie within a circular region of the sky.
+     * @param r_bcrf
+     *  BCRF unit vector towards the centre of the region.
+     * @param radius
+     *  Angular radius of the region [radians]
+     * @param magLimit
+     *  Faint magnitude limit [mags]
+     * @param stars
+     *  On exit, contains the stars within the region, with their BCRF unit vectors in the r field.
+     */
+    void getStars(const Eigen::Vector3d &r_bcrf, double radius, double magLimit, std::vector<ReferenceStar> &stars) const;
+
+    /**
+     * @brief Get the stars brighter than a magnitude limit that are visible to the camera, projected into the image.
+     * @param r_bcrf_cam
+     *  Rotation from the BCRF to the camera frame.
+     * @param cam
+     *  The camera model.
+     * @param magLimit
+     *  Faint magnitude limit [mags]
+     * @param stars
+     *  On exit, contains the visible stars with their camera frame unit vectors and image coordinates set.
+     */
+    void getVisibleStars(const Eigen::Matrix3d &r_bcrf_cam, const CameraModelBase &cam, double magLimit, std::vector<ReferenceStar> &stars) const;
+
+    /**
+     * @brief Get the region of the sky covered by the camera field of view.
+     * @param r_bcrf_cam
+     *  Rotation from the BCRF to the camera frame.
+     * @param cam
+     *  The camera model.
+     * @param r_bcrf
+     *  On exit, the BCRF unit vector towards the centre of the region.
+     * @param radius
+     *  On exit, the angular radius of the region [radians]
+     */
+    static void getFieldOfView(const Eigen::Matrix3d &r_bcrf_cam, const CameraModelBase &cam, Eigen::Vector3d &r_bcrf, double &radius);
+
+private:
+
+    ReferenceStarCatalogue();
+
+    // Disable copying; the catalogue may own a memory mapping
+    ReferenceStarCatalogue(const ReferenceStarCatalogue&);
+    ReferenceStarCatalogue& operator=(const ReferenceStarCatalogue&);
+
+    /**
+     * @brief Header of the binary catalogue.
+     */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t nStars;
+        uint32_t nside;
+        uint32_t padding;
+    };
+
+    static const char magic[8];
+    static const uint32_t version;
+
+    /**
+     * @brief Set up the pointers to the arrays within the catalogue data, and the extent of each tile.
+     * @param data
+     *  The catalogue data, in the binary format.
+     * @param size
+     *  The size of the data [bytes]
+     * @return
+     *  True if the data is a valid catalogue.
+     */
+    bool attach(const char * data, size_t size);
+
+    /**
+     * @brief Get the size of the catalogue data, and the offsets of the arrays within it.
+     */
+    static size_t getLayout(uint32_t nStars, uint32_t nside, size_t &tileOffset, size_t &xOffset, size_t &magOffset);
+
+    /**
+     * @brief Get the tile containing a unit vector.
+     */
+    static unsigned int getTile(const Eigen::Vector3d &r, unsigned int nside);
+
+    /**
+     * @brief Get the unit vector towards a point on a cube face.
+     * @param face
+     *  The cube face.
+     * @param a, b
+     *  Angular coordinates on the face, in the range [-1:1]
+     */
+    static Eigen::Vector3d getFaceVector(unsigned int face, double a, double b);
+
+    /**
+     * @brief The catalogue data, if it's held in memory rather than memory-mapped.
+     */
+    std::vector<char> buffer;
+
+    /**
+     * @brief The memory mapping of the catalogue file, if any.
+     */
+    void * mapping;
+    size_t mappingSize;
+
+    /**
+     * @brief Number of stars and tiles.
+     */
+    uint32_t nStars;
+    uint32_t nside;
+    uint32_t nTiles;
+
+    /**
+     * @brief Pointers to the arrays within the catalogue data.
+     */
+    const uint32_t * tileStart;
+    const double * x;
+    const double * y;
+    const double * z;
+    const double * ra;
+    const double * dec;
+    const float * mag;
+
+    /**
+     * @brief Unit vector towards the centre of each tile.
+     */
+    std::vector<Eigen::Vector3d> tileCentre;
+
+    /**
+     * @brief Angular radius of each tile about its centre [radians]
+     */
+    std::vector<double> tileRadius;
+
+    /**
+     * @brief Cosine and sine of the angular radius of each tile, for testing the overlap with a region without acos
+     */
+    std::vector<double> tileCosRadius;
+    std::vector<double> tileSinRadius;
+};
+
+#endif // REFERENCESTARCATALOGUE_H
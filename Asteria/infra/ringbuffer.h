@@ -1,22 +1,71 @@
 #ifndef RINGBUFFER_H
 #define RINGBUFFER_H
 
-#include "infra/imageuc.h"
-
 #include <vector>
-#include <memory>               // shared_ptr
-
-#include <QDebug>
+#include <cstddef>
+#include <iterator>
+#include <algorithm>            // min
+#include <utility>              // pair, move, forward, swap
 
 /**
- * @brief The RingBuffer class
- * http://www.cplusplus.com/forum/beginner/176072/
+ * @brief Fixed-capacity ring buffer that retains the most recent elements pushed onto it; once full,
+ * each new element overwrites the oldest one.
+ *
+ * The storage is rounded up to a power of two so that positions can be converted to indices with a bitmask;
+ * the capacity (the number of elements retained) is exactly as requested. Slots are reused in place, and the
+ * contents can be accessed without copying through the iterators or as two contiguous spans.
  */
 template<class T> class RingBuffer
 {
 
 public:
-    RingBuffer(std::size_t cap): buffer(cap) {
+
+    /**
+     * @brief A contiguous range of elements in the ring buffer.
+     */
+    struct Span {
+        T * data;
+        std::size_t size;
+        T * begin() const { return data; }
+        T * end() const { return data + size; }
+    };
+
+    /**
+     * @brief Bidirectional iterator over the elements, from the oldest to the most recent.
+     */
+    template<class R, class V> class Iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef V value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef V* pointer;
+        typedef V& reference;
+        Iterator(R * ring, std::size_t pos) : ring(ring), pos(pos) {}
+        V& operator*() const { return (*ring)[pos]; }
+        V* operator->() const { return &(*ring)[pos]; }
+        Iterator& operator++() { ++pos; return *this; }
+        Iterator operator++(int) { Iterator tmp(*this); ++pos; return tmp; }
+        Iterator& operator--() { --pos; return *this; }
+        Iterator operator--(int) { Iterator tmp(*this); --pos; return tmp; }
+        bool operator==(const Iterator& other) const { return ring == other.ring && pos == other.pos; }
+        bool operator!=(const Iterator& other) const { return !(*this == other); }
+    private:
+        R * ring;
+        // Position relative to the oldest element
+        std::size_t pos;
+    };
+
+    typedef Iterator<RingBuffer<T>, T> iterator;
+    typedef Iterator<const RingBuffer<T>, const T> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    /**
+     * @brief Constructor for the RingBuffer.
+     * @param cap
+     *  The number of elements to retain.
+     */
+    RingBuffer(std::size_t cap) : cap(cap > 0 ? cap : 1), buffer(roundUpToPowerOfTwo(this->cap)), mask(buffer.size() - 1), first(0), sz(0) {
 
     }
 
@@ -25,92 +74,188 @@ public:
     }
 
     bool full() const {
-        return sz == buffer.size();
+        return sz == cap;
     }
 
     std::size_t size() const {
         return sz;
     }
 
-    void push(T str) {
+    std::size_t capacity() const {
+        return cap;
+    }
 
-        // TODO: can do this increment more intelligently like for 'first'
-        ++last;
-        if( last >= buffer.size() ) {
-            // Wrap around
-            last = 0 ;
-        }
-        buffer[last] = str;
+    /**
+     * @brief Add an element to the back of the ring buffer, overwriting the oldest element if it's full.
+     * @param t
+     *  The element to add.
+     */
+    void push(const T& t) {
+        overwrite() = t;
+    }
+
+    /**
+     * @brief Add an element to the back of the ring buffer, overwriting the oldest element if it's full.
+     * @param t
+     *  The element to add.
+     */
+    void push(T&& t) {
+        overwrite() = std::move(t);
+    }
 
+    /**
+     * @brief Construct an element at the back of the ring buffer from the given arguments, overwriting the
+     * oldest element if it's full.
+     * @return
+     *  Reference to the new element.
+     */
+    template<class... Args> T& emplace(Args&&... args) {
+        T& slot = overwrite();
+        slot = T(std::forward<Args>(args)...);
+        return slot;
+    }
+
+    /**
+     * @brief Advance the back of the ring buffer by one slot, dropping the oldest element if it's full, and
+     * return a reference to the new back slot so that it can be overwritten in place. If the ring buffer was
+     * full the slot holds the dropped element, which allows its resources to be reused; otherwise it holds a
+     * default-constructed element.
+     * @return
+     *  Reference to the new back slot.
+     */
+    T& overwrite() {
         if(full()) {
-            first = (first+1) %  buffer.size();
-        }
-        else {
-            ++sz;
+            // The storage may be larger than the capacity, in which case the new back slot isn't the slot of
+            // the dropped element; swap the dropped element into it so that slots outside the live range only
+            // ever hold default-constructed elements and don't keep resources alive.
+            T& dropped = buffer[first];
+            first = (first + 1) & mask;
+            T& slot = buffer[(first + sz - 1) & mask];
+            if(&slot != &dropped) {
+                std::swap(slot, dropped);
+            }
+            return slot;
         }
+        ++sz;
+        return buffer[(first + sz - 1) & mask];
     }
 
+    /**
+     * @brief Remove all elements, releasing any resources they hold.
+     */
     void clear() {
-        // NOTE: don't clear the underlying vector otherwise
-        // it will remove all the ring buffer elements.
+        for(std::size_t i = 0; i < buffer.size(); ++i) {
+            buffer[i] = T();
+        }
         first = 0;
-        last = -1;
         sz = 0;
     }
 
-    T front() {
+    /**
+     * @brief Get the oldest element.
+     * @return
+     *  The oldest element, or a default-constructed element if the ring buffer is empty.
+     */
+    T front() const {
         if(empty()) {
             return T();
         }
         return buffer[first];
     }
 
-    T back() {
+    /**
+     * @brief Get the most recent element.
+     * @return
+     *  The most recent element, or a default-constructed element if the ring buffer is empty.
+     */
+    T back() const {
         if(empty()) {
             return T();
         }
-        return buffer[last];
+        return buffer[(first + sz - 1) & mask];
     }
 
-    T& operator[] ( std::size_t pos ) {
-        auto p = ( first + pos ) % buffer.size() ;
-        return buffer[p];
+    /**
+     * @brief Access elements by position relative to the oldest element.
+     */
+    T& operator[](std::size_t pos) {
+        return buffer[(first + pos) & mask];
     }
 
-    std::vector<T> unroll() {
+    const T& operator[](std::size_t pos) const {
+        return buffer[(first + pos) & mask];
+    }
 
-        std::vector<T> unrolled;
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, sz); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, sz); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
 
-        if( first < last ) {
-            for( std::size_t i = first ; i < last ; ++i ) {
-                unrolled.push_back(buffer[i]);
-            }
-        }
-        else
-        {
-            for( std::size_t i = first ; i < buffer.size() ; ++i ) {
-                unrolled.push_back(buffer[i]);
-            }
-            for( std::size_t i = 0 ; i < last ; ++i ) {
-                unrolled.push_back(buffer[i]);
-            }
-        }
-        return unrolled;
+    /**
+     * @brief Get the elements as two contiguous spans, which together hold the elements in order from
+     * the oldest to the most recent. The second span is empty if the elements don't wrap around the end
+     * of the storage.
+     * @return
+     *  The pair of spans.
+     */
+    std::pair<Span, Span> spans() {
+        std::size_t n1 = std::min(sz, buffer.size() - first);
+        Span s1 = {buffer.data() + first, n1};
+        Span s2 = {buffer.data(), sz - n1};
+        return std::make_pair(s1, s2);
+    }
+
+    /**
+     * @brief Move all elements onto the end of the given vector, in order from the oldest to the most
+     * recent, and clear the ring buffer. No copies of the elements are made.
+     * @param out
+     *  The vector to append the elements to.
+     */
+    void moveTo(std::vector<T> &out) {
+        std::pair<Span, Span> s = spans();
+        out.reserve(out.size() + sz);
+        out.insert(out.end(), std::make_move_iterator(s.first.begin()), std::make_move_iterator(s.first.end()));
+        out.insert(out.end(), std::make_move_iterator(s.second.begin()), std::make_move_iterator(s.second.end()));
+        clear();
+    }
+
+    /**
+     * @brief Copy the elements to a new vector, in order from the oldest to the most recent.
+     * @return
+     *  Vector containing copies of the elements.
+     */
+    std::vector<T> unroll() const {
+        return std::vector<T>(begin(), end());
     }
 
 private:
 
-    // The ring buffer data packaged in a vector
+    static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+        std::size_t p = 1;
+        while(p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // The number of elements retained
+    std::size_t cap;
+
+    // The ring buffer data packaged in a vector; the size is a power of two
     std::vector<T> buffer;
 
-    // Index of the first element in the ring
-    std::size_t first = 0;
+    // Bitmask used to convert positions to indices into the buffer
+    std::size_t mask;
 
-    // Stores the index of the last (most recent) element to be added
-    std::size_t last = -1;
+    // Index of the first (oldest) element in the ring
+    std::size_t first;
 
     // Number of elements in the ring buffer currently
-    std::size_t sz = 0;
+    std::size_t sz;
 
 };
 
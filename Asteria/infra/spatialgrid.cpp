@@ -0,0 +1,144 @@
+#include "infra/spatialgrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Limit on the number of cells, in case the points are very widely spread
+static const double maxCells = 1 << 20;
+
+SpatialGrid::SpatialGrid(const std::vector<double> &i, const std::vector<double> &j, double cellSize)
+    : pointI(i), pointJ(j), cellSize(cellSize > 0.0 ? cellSize : 1.0), minI(0.0), minJ(0.0), nI(1), nJ(1) {
+
+    unsigned int n = pointI.size();
+
+    if(n > 0) {
+        minI = *std::min_element(pointI.begin(), pointI.end());
+        minJ = *std::min_element(pointJ.begin(), pointJ.end());
+        double rangeI = *std::max_element(pointI.begin(), pointI.end()) - minI;
+        double rangeJ = *std::max_element(pointJ.begin(), pointJ.end()) - minJ;
+
+        // Enlarge the cells if necessary to limit the memory used
+        while((std::floor(rangeI / this->cellSize) + 1) * (std::floor(rangeJ / this->cellSize) + 1) > maxCells) {
+            this->cellSize *= 2.0;
+        }
+        nI = (int)std::floor(rangeI / this->cellSize) + 1;
+        nJ = (int)std::floor(rangeJ / this->cellSize) + 1;
+    }
+
+    // Counting sort of the points by cell
+    std::vector<unsigned int> pointCell(n);
+    cellStart.assign(nI * nJ + 1, 0);
+    for(unsigned int p=0; p<n; p++) {
+        pointCell[p] = getCell(pointJ[p], minJ, nJ) * nI + getCell(pointI[p], minI, nI);
+        cellStart[pointCell[p] + 1]++;
+    }
+    for(int c=0; c<nI * nJ; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+    points.resize(n);
+    std::vector<unsigned int> next(cellStart.begin(), cellStart.end() - 1);
+    for(unsigned int p=0; p<n; p++) {
+        points[next[pointCell[p]]++] = p;
+    }
+}
+
+void SpatialGrid::query(double i, double j, double radius, std::vector<unsigned int> &indices) const {
+
+    indices.clear();
+
+    if(points.empty() || !(radius >= 0.0)) {
+        return;
+    }
+
+    int i0 = getCell(i - radius, minI, nI);
+    int i1 = getCell(i + radius, minI, nI);
+    int j0 = getCell(j - radius, minJ, nJ);
+    int j1 = getCell(j + radius, minJ, nJ);
+
+    double radius2 = radius * radius;
+
+    for(int cj = j0; cj <= j1; cj++) {
+        for(int ci = i0; ci <= i1; ci++) {
+            int c = cj * nI + ci;
+            for(unsigned int p = cellStart[c]; p < cellStart[c + 1]; p++) {
+                unsigned int idx = points[p];
+                double di = pointI[idx] - i;
+                double dj = pointJ[idx] - j;
+                if(di * di + dj * dj <= radius2) {
+                    indices.push_back(idx);
+                }
+            }
+        }
+    }
+
+    std::sort(indices.begin(), indices.end());
+}
+
+int SpatialGrid::nearest(double i, double j) const {
+
+    if(points.empty()) {
+        return -1;
+    }
+
+    int ci0 = getCell(i, minI, nI);
+    int cj0 = getCell(j, minJ, nJ);
+
+    int nearestIdx = -1;
+    double minDist2 = std::numeric_limits<double>::max();
+
+    // Search rings of cells of increasing size around the cell containing the position. Points in ring r+1
+    // lie at least r cells away from the position, so the search can stop once the nearest point found so
+    // far is closer than that.
+    int maxRing = std::max(nI, nJ);
+    for(int r = 0; r <= maxRing; r++) {
+
+        for(int cj = cj0 - r; cj <= cj0 + r; cj++) {
+            if(cj < 0 || cj >= nJ) {
+                continue;
+            }
+            for(int ci = ci0 - r; ci <= ci0 + r; ci++) {
+                if(ci < 0 || ci >= nI) {
+                    continue;
+                }
+                // Only the cells on the edge of the ring
+                if(std::abs(ci - ci0) != r && std::abs(cj - cj0) != r) {
+                    continue;
+                }
+                int c = cj * nI + ci;
+                for(unsigned int p = cellStart[c]; p < cellStart[c + 1]; p++) {
+                    unsigned int idx = points[p];
+                    double di = pointI[idx] - i;
+                    double dj = pointJ[idx] - j;
+                    double dist2 = di * di + dj * dj;
+                    if(dist2 < minDist2 || (dist2 == minDist2 && (int)idx < nearestIdx)) {
+                        minDist2 = dist2;
+                        nearestIdx = idx;
+                    }
+                }
+            }
+        }
+
+        double ringDist = r * cellSize;
+        if(nearestIdx >= 0 && minDist2 < ringDist * ringDist) {
+            break;
+        }
+    }
+
+    return nearestIdx;
+}
+
+unsigned int SpatialGrid::size() const {
+    return points.size();
+}
+
+int SpatialGrid::getCell(double x, double min, int n) const {
+    double cell = std::floor((x - min) / cellSize);
+    if(!(cell >= 0.0)) {
+        return 0;
+    }
+    if(cell >= n) {
+        return n - 1;
+    }
+    return (int)cell;
+}
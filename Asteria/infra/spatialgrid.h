@@ -0,0 +1,108 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include <vector>
+
+/**
+ * @brief Uniform grid index over a set of points in the image plane, used to find the points lying near a
+ * given position without testing every point. This is used to find the reference stars near each observed
+ * source during cross-matching, and the reference star nearest to a mouse click.
+ *
+ * The points are identified by their index in the coordinate vectors passed to the constructor. The points
+ * are stored in cell order in a single array, with the cells indexing into it.
+ */
+class SpatialGrid
+{
+
+public:
+
+    /**
+     * @brief Constructor for the SpatialGrid.
+     * @param i
+     *  The i (horizontal) coordinates of the points [pixels]
+     * @param j
+     *  The j (vertical) coordinates of the points [pixels]
+     * @param cellSize
+     *  The size of the grid cells [pixels]; this should be comparable to the typical search radius.
+     */
+    SpatialGrid(const std::vector<double> &i, const std::vector<double> &j, double cellSize);
+
+    /**
+     * @brief Find all points within a given distance of a position.
+     * @param i
+     *  The i coordinate of the position [pixels]
+     * @param j
+     *  The j coordinate of the position [pixels]
+     * @param radius
+     *  The search radius [pixels]
+     * @param indices
+     *  On exit, contains the indices of the points within the search radius, in increasing order.
+     */
+    void query(double i, double j, double radius, std::vector<unsigned int> &indices) const;
+
+    /**
+     * @brief Find the point nearest to a position.
+     * @param i
+     *  The i coordinate of the position [pixels]
+     * @param j
+     *  The j coordinate of the position [pixels]
+     * @return
+     *  The index of the nearest point, or -1 if there are no points.
+     */
+    int nearest(double i, double j) const;
+
+    /**
+     * @brief Get the number of points in the grid.
+     * @return
+     *  The number of points.
+     */
+    unsigned int size() const;
+
+private:
+
+    /**
+     * @brief Get the cell containing a coordinate, clamped to the extent of the grid.
+     * @param x
+     *  The coordinate [pixels]
+     * @param min
+     *  The minimum coordinate of the grid [pixels]
+     * @param n
+     *  The number of cells along this axis
+     * @return
+     *  The cell index along this axis.
+     */
+    int getCell(double x, double min, int n) const;
+
+    /**
+     * @brief Coordinates of the points [pixels]
+     */
+    std::vector<double> pointI, pointJ;
+
+    /**
+     * @brief Size of the grid cells [pixels]
+     */
+    double cellSize;
+
+    /**
+     * @brief Coordinates of the corner of the first cell [pixels]
+     */
+    double minI, minJ;
+
+    /**
+     * @brief Number of cells along each axis.
+     */
+    int nI, nJ;
+
+    /**
+     * @brief Offset of the first point in each cell within the points array; the final element gives the
+     * total number of points, so the points in cell c are at [cellStart[c]:cellStart[c+1]).
+     */
+    std::vector<unsigned int> cellStart;
+
+    /**
+     * @brief Indices of the points, sorted by cell.
+     */
+    std::vector<unsigned int> points;
+};
+
+#endif // SPATIALGRID_H
@@ -0,0 +1,120 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <utility>              // move
+#include <algorithm>            // min
+
+/**
+ * @brief Bounded lock-free queue for passing items between exactly one producer thread and exactly
+ * one consumer thread, e.g. between stages of the acquisition pipeline. Neither push(...) nor pop(...)
+ * block; they return false if the queue is full or empty respectively.
+ *
+ * The capacity is rounded up to a power of two so that the ring can be indexed with a bitmask. The read
+ * and write positions increase monotonically and are only ever written by the consumer and producer
+ * respectively, so no locking is required.
+ */
+template<typename T>
+class SpscQueue
+{
+
+public:
+
+    /**
+     * @brief Constructor for the SpscQueue.
+     * @param cap
+     *  The minimum number of items that the queue can hold.
+     */
+    SpscQueue(std::size_t cap) : buffer(roundUpToPowerOfTwo(cap)), mask(buffer.size() - 1), readPos(0), writePos(0) {
+
+    }
+
+    /**
+     * @brief Add an item to the queue. Must only be called from the producer thread.
+     * @param item
+     *  The item to add.
+     * @return
+     *  True if the item was added, false if the queue is full.
+     */
+    bool push(const T& item) {
+        const std::size_t w = writePos.load(std::memory_order_relaxed);
+        if(w - readPos.load(std::memory_order_acquire) == buffer.size()) {
+            // Full
+            return false;
+        }
+        buffer[w & mask] = item;
+        writePos.store(w + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Remove the item at the front of the queue. Must only be called from the consumer thread.
+     * @param item
+     *  On exit, contains the item removed from the queue (if any).
+     * @return
+     *  True if an item was removed, false if the queue is empty.
+     */
+    bool pop(T& item) {
+        const std::size_t r = readPos.load(std::memory_order_relaxed);
+        if(r == writePos.load(std::memory_order_acquire)) {
+            // Empty
+            return false;
+        }
+        // Move out of the slot so that (e.g.) shared_ptrs are not held on to by the queue
+        item = std::move(buffer[r & mask]);
+        readPos.store(r + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Get the number of items in the queue. This is approximate if the queue is being
+     * modified concurrently, which is fine for monitoring purposes.
+     * @return
+     *  The number of items in the queue.
+     */
+    std::size_t size() const {
+        // Read the consumer position first: it never overtakes the producer position, so
+        // the difference can't underflow when called from a thread other than the consumer.
+        // The producer may refill the queue between the two loads, so clamp to the capacity.
+        std::size_t r = readPos.load(std::memory_order_acquire);
+        std::size_t w = writePos.load(std::memory_order_acquire);
+        return (w > r) ? std::min(w - r, buffer.size()) : 0;
+    }
+
+    /**
+     * @brief Get the maximum number of items that the queue can hold.
+     * @return
+     *  The capacity of the queue.
+     */
+    std::size_t capacity() const {
+        return buffer.size();
+    }
+
+private:
+
+    static std::size_t roundUpToPowerOfTwo(std::size_t n) {
+        std::size_t p = 1;
+        while(p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // The queue data packaged in a vector
+    std::vector<T> buffer;
+
+    // Bitmask used to convert read/write positions to indices into the buffer
+    const std::size_t mask;
+
+    // Position of the next item to be read; written only by the consumer. Kept on
+    // separate cache lines to avoid false sharing between producer and consumer.
+    alignas(64) std::atomic<std::size_t> readPos;
+
+    // Position of the next item to be written; written only by the producer
+    alignas(64) std::atomic<std::size_t> writePos;
+
+};
+
+#endif // SPSCQUEUE_H
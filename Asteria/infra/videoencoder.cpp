@@ -0,0 +1,274 @@
+#include "infra/videoencoder.h"
+#include "infra/workerpool.h"
+
+#include <stdio.h>
+#include <cstring>
+#include <chrono>
+
+#ifdef ASTERIA_WITH_LIBAV
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+#include <mutex>                // call_once
+#endif
+
+const char * const VideoEncoder::codecName = "libx264";
+const unsigned int VideoEncoder::frameRate;
+
+#ifdef ASTERIA_WITH_LIBAV
+
+namespace {
+
+/**
+ * @brief Register the codecs and formats; only needed by library versions before this became automatic.
+ */
+void registerAll() {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 9, 100)
+    static std::once_flag registered;
+    std::call_once(registered, []() {av_register_all();});
+#endif
+}
+
+/**
+ * @brief The libav objects used to encode a video, which are released when it goes out of scope.
+ */
+struct Encoding {
+
+    AVFormatContext * format = NULL;
+    AVStream * stream = NULL;
+    AVCodecContext * context = NULL;
+    AVFrame * picture = NULL;
+    AVPacket * packet = NULL;
+
+    ~Encoding() {
+        av_packet_free(&packet);
+        av_frame_free(&picture);
+        avcodec_free_context(&context);
+        if(format) {
+            if(!(format->oformat->flags & AVFMT_NOFILE)) {
+                avio_closep(&format->pb);
+            }
+            avformat_free_context(format);
+        }
+    }
+
+    /**
+     * @brief Send a frame to the encoder, or NULL to flush it, and write out the packets that are ready.
+     */
+    bool write(AVFrame * frame) {
+        if(avcodec_send_frame(context, frame) < 0) {
+            return false;
+        }
+        for(;;) {
+            int ret = avcodec_receive_packet(context, packet);
+            if(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                return true;
+            }
+            if(ret < 0) {
+                return false;
+            }
+            av_packet_rescale_ts(packet, context->time_base, stream->time_base);
+            packet->stream_index = stream->index;
+            // Takes ownership of the packet data
+            if(av_interleaved_write_frame(format, packet) < 0) {
+                return false;
+            }
+        }
+    }
+};
+
+bool encodeWithLibav(const std::string &path, unsigned int nFrames, const VideoEncoder::FrameSource &source) {
+
+    registerAll();
+
+    std::shared_ptr<Imageuc> frame = source(0);
+    if(!frame) {
+        return false;
+    }
+
+    // 4:2:0 chroma subsampling requires even dimensions
+    unsigned int width = frame->width & ~1u;
+    unsigned int height = frame->height & ~1u;
+
+    Encoding enc;
+
+    if(avformat_alloc_output_context2(&enc.format, NULL, NULL, path.c_str()) < 0 || !enc.format) {
+        fprintf(stderr, "Couldn't determine the video format for %s\n", path.c_str());
+        return false;
+    }
+
+    const AVCodec * codec = avcodec_find_encoder_by_name(VideoEncoder::codecName);
+    if(!codec) {
+        fprintf(stderr, "Video encoder %s is not available\n", VideoEncoder::codecName);
+        return false;
+    }
+
+    enc.stream = avformat_new_stream(enc.format, NULL);
+    enc.context = avcodec_alloc_context3(codec);
+    enc.picture = av_frame_alloc();
+    enc.packet = av_packet_alloc();
+    if(!enc.stream || !enc.context || !enc.picture || !enc.packet) {
+        return false;
+    }
+
+    enc.context->width = width;
+    enc.context->height = height;
+    enc.context->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc.context->time_base = AVRational{1, (int)VideoEncoder::frameRate};
+    enc.context->framerate = AVRational{(int)VideoEncoder::frameRate, 1};
+    if(enc.format->oformat->flags & AVFMT_GLOBALHEADER) {
+        enc.context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    // Lossless
+    av_opt_set(enc.context->priv_data, "crf", "0", 0);
+
+    if(avcodec_open2(enc.context, codec, NULL) < 0) {
+        fprintf(stderr, "Couldn't open video encoder %s\n", VideoEncoder::codecName);
+        return false;
+    }
+    if(avcodec_parameters_from_context(enc.stream->codecpar, enc.context) < 0) {
+        return false;
+    }
+    enc.stream->time_base = enc.context->time_base;
+
+    if(!(enc.format->oformat->flags & AVFMT_NOFILE) && avio_open(&enc.format->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) {
+        fprintf(stderr, "Couldn't open %s\n", path.c_str());
+        return false;
+    }
+    if(avformat_write_header(enc.format, NULL) < 0) {
+        return false;
+    }
+
+    enc.picture->format = enc.context->pix_fmt;
+    enc.picture->width = width;
+    enc.picture->height = height;
+    if(av_frame_get_buffer(enc.picture, 0) < 0) {
+        return false;
+    }
+
+    for(unsigned int i = 0; i < nFrames; ++i) {
+
+        if(i > 0) {
+            frame = source(i);
+        }
+        if(!frame || frame->width < width || frame->height < height) {
+            fprintf(stderr, "Couldn't read frame %d for video %s\n", i, path.c_str());
+            return false;
+        }
+
+        // The encoder may still hold a reference to the previous picture
+        if(av_frame_make_writable(enc.picture) < 0) {
+            return false;
+        }
+
+        // Greyscale: the frame is the luma plane and the chroma planes are neutral
+        for(unsigned int y = 0; y < height; ++y) {
+            memcpy(enc.picture->data[0] + y * enc.picture->linesize[0], &frame->rawImage[y * frame->width], width);
+        }
+        for(unsigned int y = 0; y < height / 2; ++y) {
+            memset(enc.picture->data[1] + y * enc.picture->linesize[1], 128, width / 2);
+            memset(enc.picture->data[2] + y * enc.picture->linesize[2], 128, width / 2);
+        }
+        enc.picture->pts = i;
+
+        if(!enc.write(enc.picture)) {
+            return false;
+        }
+    }
+
+    // Flush the frames buffered in the encoder
+    if(!enc.write(NULL)) {
+        return false;
+    }
+
+    return av_write_trailer(enc.format) == 0;
+}
+
+}
+
+#endif
+
+VideoEncoder::VideoEncoder(std::shared_ptr<WorkerPool> pool, unsigned int maxPending)
+    : pool(pool), maxPending(maxPending), nPending(std::make_shared<std::atomic<unsigned int>>(0)) {
+
+}
+
+bool VideoEncoder::submit(const std::string &path, const std::vector<std::shared_ptr<Imageuc>> &frames) {
+    // The job holds references to the frames until the video is encoded
+    return submit(path, frames.size(), [frames](unsigned int i) {return frames[i];});
+}
+
+bool VideoEncoder::submit(const std::string &path, std::shared_ptr<ClipFile> clip) {
+    if(!clip) {
+        return false;
+    }
+    return submit(path, clip->size(), [clip](unsigned int i) {return clip->readFrame(i);});
+}
+
+bool VideoEncoder::submit(const std::string &path, unsigned int nFrames, FrameSource source) {
+
+    if(nFrames == 0) {
+        return false;
+    }
+
+    std::shared_ptr<std::atomic<unsigned int>> pending = nPending;
+
+    // Reserve a place among the pending encodes
+    unsigned int n = pending->load();
+    do {
+        if(n >= maxPending) {
+            fprintf(stderr, "Video encoding queue full: no video for %s\n", path.c_str());
+            return false;
+        }
+    } while(!pending->compare_exchange_weak(n, n + 1));
+
+    std::function<void()> task = [path, nFrames, source, pending]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool success = VideoEncoder::encode(path, nFrames, source);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(success) {
+            fprintf(stderr, "Encoded video %s: %d frames in %.2f s (%.1f frames/s)\n", path.c_str(), nFrames, seconds, nFrames / seconds);
+        }
+        else {
+            fprintf(stderr, "Failed to encode video %s after %.2f s\n", path.c_str(), seconds);
+        }
+        (*pending)--;
+    };
+
+    // Called instead of the task if the job is discarded by the pool
+    std::function<void()> cancel = [pending]() {
+        (*pending)--;
+    };
+
+    return pool->submit("video " + path, task, cancel);
+}
+
+bool VideoEncoder::encode(const std::string &path, unsigned int nFrames, const FrameSource &source) {
+#ifdef ASTERIA_WITH_LIBAV
+    if(nFrames == 0) {
+        return false;
+    }
+    if(!encodeWithLibav(path, nFrames, source)) {
+        remove(path.c_str());
+        return false;
+    }
+    return true;
+#else
+    (void)path;
+    (void)nFrames;
+    (void)source;
+    fprintf(stderr, "Video encoding is not available: built without the libav libraries\n");
+    return false;
+#endif
+}
+
+bool VideoEncoder::isAvailable() {
+#ifdef ASTERIA_WITH_LIBAV
+    registerAll();
+    return avcodec_find_encoder_by_name(codecName) != NULL;
+#else
+    return false;
+#endif
+}
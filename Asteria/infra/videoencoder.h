@@ -0,0 +1,118 @@
+#ifndef VIDEOENCODER_H
+#define VIDEOENCODER_H
+
+#include "infra/imageuc.h"
+#include "infra/clipfile.h"
+
+#include <string>
+#include <vector>
+#include <memory>               // shared_ptr
+#include <functional>
+#include <atomic>
+
+class WorkerPool;
+
+/**
+ * @brief The VideoEncoder class encodes the frames of a clip to a video, for display on the website. Encoding
+ * is done in-process with libavcodec (libx264, lossless) from the frames held in memory or in the clip file, and
+ * runs as a job on the WorkerPool so that the analysis isn't held up waiting for it.
+ *
+ * Each pending encode may hold all the frames of a clip in memory, so the number of encodes waiting for a thread
+ * is bounded; clips submitted while the limit is reached are logged and get no video.
+ *
+ * Encoding is only available if the application was built with the libav libraries (ASTERIA_WITH_LIBAV); it can
+ * be left out of builds for headless stations that don't publish videos. The videos can be decoded to individual
+ * frames using the command:
+ * $ avconv -i neognc.avi -vsync 1 -r 25 -an -y out_%04d.pgm
+ */
+class VideoEncoder
+{
+
+public:
+
+    /**
+     * @brief Function that reads the frame with the given index, returning an empty pointer if it can't be read.
+     */
+    typedef std::function<std::shared_ptr<Imageuc>(unsigned int)> FrameSource;
+
+    /**
+     * @brief Constructor for the VideoEncoder.
+     * @param pool
+     *  The worker pool on which to run the encoding.
+     * @param maxPending
+     *  The maximum number of encodes that can be waiting for or running on a pool thread.
+     */
+    VideoEncoder(std::shared_ptr<WorkerPool> pool, unsigned int maxPending);
+
+    /**
+     * @brief Queue the encoding of a video from frames held in memory.
+     * @param path
+     *  The path to the video file; the container format is determined by the extension.
+     * @param frames
+     *  The frames to encode, in order of capture.
+     * @return
+     *  True if the encoding was queued; false if too many encodes are pending or the job was dropped.
+     */
+    bool submit(const std::string &path, const std::vector<std::shared_ptr<Imageuc>> &frames);
+
+    /**
+     * @brief Queue the encoding of a video from the frames in a clip file. The frames are read from the
+     * file one at a time as they're encoded.
+     * @param path
+     *  The path to the video file; the container format is determined by the extension.
+     * @param clip
+     *  The clip file.
+     * @return
+     *  True if the encoding was queued; false if too many encodes are pending or the job was dropped.
+     */
+    bool submit(const std::string &path, std::shared_ptr<ClipFile> clip);
+
+    /**
+     * @brief Encode a video, on the calling thread.
+     * @param path
+     *  The path to the video file; the container format is determined by the extension.
+     * @param nFrames
+     *  The number of frames to encode.
+     * @param source
+     *  Provides the frames to encode, in order of capture. These must all have the same dimensions; for 4:2:0
+     *  chroma subsampling, an odd final row or column is left out of the video.
+     * @return
+     *  True if the video was encoded successfully. On failure any partially written file is removed.
+     */
+    static bool encode(const std::string &path, unsigned int nFrames, const FrameSource &source);
+
+    /**
+     * @brief Indicates whether videos can be encoded, i.e. the application was built with the libav libraries
+     * and they provide the encoder.
+     */
+    static bool isAvailable();
+
+    /**
+     * @brief Name of the libavcodec encoder used to encode the videos.
+     */
+    static const char * const codecName;
+
+    /**
+     * @brief Frame rate of the videos [frames/s]
+     */
+    static const unsigned int frameRate = 25;
+
+private:
+
+    /**
+     * @brief Queue the encoding of a video on the worker pool.
+     */
+    bool submit(const std::string &path, unsigned int nFrames, FrameSource source);
+
+    std::shared_ptr<WorkerPool> pool;
+
+    unsigned int maxPending;
+
+    /**
+     * @brief Number of encodes waiting for or running on a pool thread. Shared with the jobs so that it remains
+     * valid if the pool outlives the VideoEncoder.
+     */
+    std::shared_ptr<std::atomic<unsigned int>> nPending;
+};
+
+#endif // VIDEOENCODER_H
@@ -0,0 +1,209 @@
+#include "infra/workerpool.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>              // max
+
+const std::vector<std::string> WorkerPool::fullQueuePolicyNames = {"defer", "coalesce", "drop"};
+
+WorkerPool::FullQueuePolicy WorkerPool::getFullQueuePolicyFromName(const std::string &name) {
+    if(name.compare(fullQueuePolicyNames[COALESCE]) == 0) {
+        return COALESCE;
+    }
+    if(name.compare(fullQueuePolicyNames[DROP]) == 0) {
+        return DROP;
+    }
+    return DEFER;
+}
+
+WorkerPool::WorkerPool(unsigned int nThreads, int niceLevel, unsigned int queueDepth, FullQueuePolicy policy, unsigned int maxDeferred)
+    : niceLevel(niceLevel), queueDepth(queueDepth > 0 ? queueDepth : 1), policy(policy), maxDeferred(maxDeferred), stop(false), nSubmitted(0), nCompleted(0),
+      nDeferred(0), nCoalesced(0), nDropped(0), totalWaitUs(0), maxWaitUs(0), nStarted(0) {
+
+    if(nThreads == 0) {
+        nThreads = 1;
+    }
+    for(unsigned int t = 0; t < nThreads; t++) {
+        threads.push_back(std::thread(&WorkerPool::run, this));
+    }
+}
+
+WorkerPool::~WorkerPool() {
+
+    std::deque<Job> unstarted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        unstarted.swap(queue);
+        unstarted.insert(unstarted.end(), deferred.begin(), deferred.end());
+        deferred.clear();
+    }
+    jobQueued.notify_all();
+
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for(Job &job : unstarted) {
+        fprintf(stderr, "Worker pool shutting down: cancelling job %s\n", job.key.c_str());
+        discard(job);
+    }
+}
+
+bool WorkerPool::submit(const std::string &key, std::function<void()> task, std::function<void()> cancel) {
+
+    Job job;
+    job.key = key;
+    job.task = task;
+    job.cancel = cancel;
+    job.submitted = std::chrono::steady_clock::now();
+
+    // Job that's been displaced from the queue, if any; discarded outside the lock
+    Job displaced;
+    bool dropped = false;
+    bool deferredFull = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        nSubmitted++;
+
+        if(queue.size() < queueDepth && deferred.empty()) {
+            queue.push_back(job);
+        }
+        else {
+            bool defer = false;
+            switch(policy) {
+            case COALESCE: {
+                std::deque<Job>::iterator it = queue.begin();
+                while(it != queue.end() && it->key.compare(key) != 0) {
+                    ++it;
+                }
+                if(it != queue.end()) {
+                    // Replace the oldest queued job with the same key; the new job takes its place in the queue
+                    displaced = *it;
+                    *it = job;
+                    nCoalesced++;
+                    break;
+                }
+                // No job to coalesce with: defer
+                defer = true;
+                break;
+            }
+            case DROP:
+                dropped = true;
+                break;
+            case DEFER:
+            default:
+                defer = true;
+                break;
+            }
+
+            if(defer) {
+                if(deferred.size() < maxDeferred) {
+                    deferred.push_back(job);
+                    nDeferred++;
+                }
+                else {
+                    dropped = true;
+                    deferredFull = true;
+                }
+            }
+            if(dropped) {
+                nDropped++;
+            }
+        }
+    }
+
+    if(displaced.task) {
+        fprintf(stderr, "Worker pool queue full: job %s superseded by newer job\n", displaced.key.c_str());
+        discard(displaced);
+        jobQueued.notify_one();
+        return true;
+    }
+
+    if(dropped) {
+        if(deferredFull) {
+            fprintf(stderr, "Worker pool queue full and %d jobs deferred: dropping job %s\n", maxDeferred, key.c_str());
+        }
+        else {
+            fprintf(stderr, "Worker pool queue full: dropping job %s\n", key.c_str());
+        }
+        discard(job);
+        return false;
+    }
+
+    jobQueued.notify_one();
+    return true;
+}
+
+unsigned int WorkerPool::getWaitingJobs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size() + deferred.size();
+}
+
+double WorkerPool::getMeanWaitUs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nStarted > 0 ? (double)totalWaitUs / nStarted : 0.0;
+}
+
+long long WorkerPool::getMaxWaitUs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxWaitUs;
+}
+
+void WorkerPool::printStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    double meanWaitUs = nStarted > 0 ? (double)totalWaitUs / nStarted : 0.0;
+    fprintf(stderr, "Worker pool: %llu submitted, %llu completed, %lu waiting, %llu deferred, %llu coalesced, %llu dropped; "
+                    "queue wait mean %.1f ms, max %.1f ms\n", nSubmitted, nCompleted, queue.size() + deferred.size(), nDeferred,
+                    nCoalesced, nDropped, meanWaitUs / 1000.0, maxWaitUs / 1000.0);
+}
+
+void WorkerPool::run() {
+
+    // Set the priority of this thread only; on Linux, setpriority acts on individual threads when given the thread ID
+    if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), niceLevel) != 0) {
+        perror("Worker pool setpriority");
+    }
+
+    for(;;) {
+
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(!stop && queue.empty()) {
+                jobQueued.wait(lock);
+            }
+            if(stop) {
+                return;
+            }
+            job = queue.front();
+            queue.pop_front();
+
+            // Make room for the oldest deferred job
+            if(!deferred.empty()) {
+                queue.push_back(deferred.front());
+                deferred.pop_front();
+            }
+
+            long long waitUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job.submitted).count();
+            totalWaitUs += waitUs;
+            maxWaitUs = std::max(maxWaitUs, waitUs);
+            nStarted++;
+        }
+
+        job.task();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        nCompleted++;
+    }
+}
+
+void WorkerPool::discard(Job &job) {
+    if(job.cancel) {
+        job.cancel();
+    }
+}
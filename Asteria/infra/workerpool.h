@@ -0,0 +1,233 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/**
+ * @brief Fixed-size pool of persistent threads that run the heavy processing jobs (analysis of clips and
+ * calibration) so that the number of such jobs running at once is bounded and they can't starve the
+ * acquisition threads of CPU.
+ *
+ * Jobs are queued in order of submission. The queue holds at most queueDepth jobs that are waiting for a
+ * thread; the FullQueuePolicy determines what happens to jobs submitted while it's full:
+ *
+ * DEFER    - the job is held back and added to the queue once there's space.
+ * COALESCE - the new job replaces the oldest queued job with the same key, which is discarded (e.g. a newer
+ *            calibration supersedes an older one that hasn't started yet). If there's no such job then the
+ *            new job is deferred.
+ * DROP     - the new job is discarded and logged.
+ *
+ * At most maxDeferred jobs can be deferred; jobs that would be deferred beyond that are dropped and logged, so
+ * that the total number of waiting jobs is bounded whatever the policy.
+ *
+ * Each job consists of a task, which is run on one of the pool threads, and an optional cancel function,
+ * which is called instead if the job is discarded so that any resources held by the job can be released.
+ */
+class WorkerPool
+{
+
+public:
+
+    /**
+     * @brief Enumerates the actions that can be taken when a job is submitted while the queue is full.
+     */
+    enum FullQueuePolicy{DEFER, COALESCE, DROP};
+    static const std::vector<std::string> fullQueuePolicyNames;
+
+    /**
+     * @brief Get the FullQueuePolicy with the given name.
+     * @param name
+     *  The name of the policy, as listed in fullQueuePolicyNames.
+     * @return
+     *  The FullQueuePolicy; DEFER if the name isn't recognised.
+     */
+    static FullQueuePolicy getFullQueuePolicyFromName(const std::string &name);
+
+    /**
+     * @brief Constructor for the WorkerPool; starts the pool threads.
+     * @param nThreads
+     *  The number of pool threads.
+     * @param niceLevel
+     *  The nice level of the pool threads; positive values lower their priority relative to acquisition.
+     * @param queueDepth
+     *  The maximum number of jobs that can be waiting for a thread.
+     * @param policy
+     *  The action to take when a job is submitted while the queue is full.
+     * @param maxDeferred
+     *  The maximum number of jobs that can be deferred while the queue is full.
+     */
+    WorkerPool(unsigned int nThreads, int niceLevel, unsigned int queueDepth, FullQueuePolicy policy, unsigned int maxDeferred);
+
+    /**
+     * @brief Destructor for the WorkerPool; waits for the running jobs to complete then stops the pool
+     * threads. Jobs that haven't started are cancelled.
+     */
+    ~WorkerPool();
+
+    /**
+     * @brief Submit a job to the pool.
+     * @param key
+     *  Identifies the job, for logging, and for coalescing with queued jobs that have the same key.
+     * @param task
+     *  The function to run on a pool thread.
+     * @param cancel
+     *  The function to call if the job is discarded without being run; may be empty.
+     * @return
+     *  True if the job was queued or deferred, false if it was dropped.
+     */
+    bool submit(const std::string &key, std::function<void()> task, std::function<void()> cancel = std::function<void()>());
+
+    /**
+     * @brief Get the number of jobs waiting for a thread, including any deferred jobs.
+     * @return
+     *  The number of waiting jobs.
+     */
+    unsigned int getWaitingJobs();
+
+    /**
+     * @brief Get the mean time that jobs have waited between submission and starting to run.
+     * @return
+     *  The mean queue wait time [microseconds].
+     */
+    double getMeanWaitUs();
+
+    /**
+     * @brief Get the longest time that a job has waited between submission and starting to run.
+     * @return
+     *  The maximum queue wait time [microseconds].
+     */
+    long long getMaxWaitUs();
+
+    /**
+     * @brief Prints the job counts and queue wait times to stderr.
+     */
+    void printStats();
+
+private:
+
+    // Disable copying; the pool threads are owned by this object
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    /**
+     * @brief A job submitted to the pool.
+     */
+    struct Job {
+        std::string key;
+        std::function<void()> task;
+        std::function<void()> cancel;
+        // Time of submission, for measuring the queue wait time
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    /**
+     * @brief Main loop of each pool thread.
+     */
+    void run();
+
+    /**
+     * @brief Discard a job without running it.
+     * @param job
+     *  The job to discard.
+     */
+    static void discard(Job &job);
+
+    /**
+     * @brief The nice level of the pool threads.
+     */
+    const int niceLevel;
+
+    /**
+     * @brief The maximum number of jobs in the queue.
+     */
+    const unsigned int queueDepth;
+
+    /**
+     * @brief The action to take when a job is submitted while the queue is full.
+     */
+    const FullQueuePolicy policy;
+
+    /**
+     * @brief The maximum number of deferred jobs.
+     */
+    const unsigned int maxDeferred;
+
+    /**
+     * @brief Jobs waiting for a thread.
+     */
+    std::deque<Job> queue;
+
+    /**
+     * @brief Jobs submitted while the queue was full, which are added to the queue as space becomes available.
+     */
+    std::deque<Job> deferred;
+
+    /**
+     * @brief Flag used to stop the pool threads.
+     */
+    bool stop;
+
+    /**
+     * @brief Number of jobs that have been submitted.
+     */
+    unsigned long long nSubmitted;
+
+    /**
+     * @brief Number of jobs that have been run to completion.
+     */
+    unsigned long long nCompleted;
+
+    /**
+     * @brief Number of jobs that were deferred because the queue was full.
+     */
+    unsigned long long nDeferred;
+
+    /**
+     * @brief Number of queued jobs that were replaced by newer jobs with the same key.
+     */
+    unsigned long long nCoalesced;
+
+    /**
+     * @brief Number of jobs that were dropped because the queue was full, or the queue and deferred jobs were full.
+     */
+    unsigned long long nDropped;
+
+    /**
+     * @brief Total time that started jobs waited between submission and starting to run [microseconds].
+     */
+    long long totalWaitUs;
+
+    /**
+     * @brief Longest time that a job waited between submission and starting to run [microseconds].
+     */
+    long long maxWaitUs;
+
+    /**
+     * @brief Number of jobs that have started to run.
+     */
+    unsigned long long nStarted;
+
+    /**
+     * @brief Protects the queues, flags and statistics.
+     */
+    std::mutex mutex;
+
+    /**
+     * @brief Signalled when a job is queued or the pool is stopped.
+     */
+    std::condition_variable jobQueued;
+
+    /**
+     * @brief The pool threads.
+     */
+    std::vector<std::thread> threads;
+};
+
+#endif // WORKERPOOL_H
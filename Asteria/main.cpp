@@ -12,6 +12,12 @@
 #include "infra/analysisvideostats.h"
 #include "util/testutil.h"
 #include "infra/calibrationinventory.h"
+#include "infra/referencestarcatalogue.h"
+#include "infra/clipfile.h"
+#include "infra/eventcatalogue.h"
+#include "infra/archiveindex.h"
+#include "math/multiepochgeocalfitter.h"
+#include "util/fileutil.h"
 
 #include <Eigen/Dense>
 
@@ -19,6 +25,7 @@
 #include <getopt.h>
 #include <string.h>
 #include <unistd.h>
+#include <regex>
 
 #include <QApplication>
 #include <QCoreApplication>
@@ -30,6 +37,8 @@ static void usage(FILE *fp, char **argv);
 
 static void catchUnixSignals();
 
+static int fitCalibrations(AsteriaState * state, long long startUs, long long endUs);
+
 int main(int argc, char **argv)
 {
     QApplication app (argc, argv);
@@ -39,6 +48,25 @@ int main(int argc, char **argv)
 //    TestUtil::testRandomVector();
 //    TestUtil::testRaDecAzElConversion();
 //    TestUtil::testImagedReadWrite();
+//    TestUtil::testFrameDifferenceKernels();
+//    TestUtil::testLockFreeQueue();
+//    TestUtil::testRingBuffer();
+//    TestUtil::testPixelStatsAccumulator();
+//    TestUtil::testMedianFilter();
+//    TestUtil::testSourceDetector();
+//    TestUtil::testReferenceStarCatalogue();
+//    TestUtil::testProjectVectors();
+//    TestUtil::testInverseDistortionMap();
+//    TestUtil::testGeoCalFitterKernels();
+//    TestUtil::testFiniteDifferencesJacobian();
+//    TestUtil::testMultiEpochGeoCalFitter();
+//    TestUtil::testAttitudeTracker();
+//    TestUtil::testPlateSolver();
+//    TestUtil::testClipFile();
+//    TestUtil::testFrameCodec();
+//    TestUtil::testVideoEncoder();
+//    TestUtil::testArchiveIndex();
+//    TestUtil::testEventCatalogue();
 //    exit(0);
 
     catchUnixSignals();
@@ -69,6 +97,14 @@ int main(int argc, char **argv)
           /* These options don’t set a flag.  We distinguish them by their indices. */
           {"camera",    required_argument, NULL,              'b'},
           {"config",    required_argument, NULL,              'c'},
+          {"convert-catalogue", required_argument, NULL,      'x'},
+          {"export-pgm", required_argument, NULL,             'e'},
+          {"events",    required_argument, NULL,              'q'},
+          {"from",      required_argument, NULL,              'f'},
+          {"to",        required_argument, NULL,              't'},
+          {"station",   required_argument, NULL,              's'},
+          {"min-motion", required_argument, NULL,             'm'},
+          {"joint-fit", no_argument,       NULL,              'j'},
           {0,           0,                 NULL,               0}
     };
 
@@ -79,9 +115,16 @@ int main(int argc, char **argv)
     char * camera = NULL;
     char * config = NULL;
 
+    // Path to the event catalogue to query, and the selection criteria
+    char * events = NULL;
+    EventCatalogue::Query eventQuery;
+
+    // Indicates that the calibrations selected by the --from and --to options are to be refitted jointly
+    bool jointFit = false;
+
     int c;
     // The colon after the character indicates that an argument follows
-    while ((c = getopt_long (argc, argv, "hab:c:", long_options, &option_index)) != -1) {
+    while ((c = getopt_long (argc, argv, "hab:c:x:e:q:f:t:s:m:j", long_options, &option_index)) != -1) {
 
         switch (c) {
             case 0: {
@@ -115,6 +158,63 @@ int main(int argc, char **argv)
                 fprintf(stderr, "Config = %s\n", config);
                 break;
             }
+            case 'x': {
+                // Write the binary catalogue alongside the text one, replacing the extension
+                string textPath = string(optarg);
+                string binaryPath = textPath;
+                size_t dot = binaryPath.find_last_of('.');
+                if(dot != string::npos && (binaryPath.find_last_of('/') == string::npos || dot > binaryPath.find_last_of('/'))) {
+                    binaryPath = binaryPath.substr(0, dot);
+                }
+                binaryPath += ".bin";
+                exit(ReferenceStarCatalogue::convert(textPath, binaryPath) ? 0 : 1);
+                break;
+            }
+            case 'e': {
+                // Write the frames out as PGM files in the directory containing the clip file
+                string clipPath = string(optarg);
+                size_t slash = clipPath.find_last_of('/');
+                string dir = (slash == string::npos) ? "." : clipPath.substr(0, slash);
+                shared_ptr<ClipFile> clip = ClipFile::load(clipPath);
+                if(!clip) {
+                    fprintf(stderr, "Couldn't load clip file %s\n", clipPath.c_str());
+                    exit(1);
+                }
+                exit(clip->exportPgm(dir) ? 0 : 1);
+                break;
+            }
+            case 'q': {
+                events = optarg;
+                break;
+            }
+            case 'f': {
+                if(!std::regex_match(optarg, TimeUtil::utcRegex)) {
+                    fprintf(stderr, "Couldn't parse UTC %s\n", optarg);
+                    exit(1);
+                }
+                eventQuery.startUs = TimeUtil::utcStringToEpoch(optarg);
+                break;
+            }
+            case 't': {
+                if(!std::regex_match(optarg, TimeUtil::utcRegex)) {
+                    fprintf(stderr, "Couldn't parse UTC %s\n", optarg);
+                    exit(1);
+                }
+                eventQuery.endUs = TimeUtil::utcStringToEpoch(optarg);
+                break;
+            }
+            case 's': {
+                eventQuery.station = optarg;
+                break;
+            }
+            case 'm': {
+                eventQuery.minMotion = atof(optarg);
+                break;
+            }
+            case 'j': {
+                jointFit = true;
+                break;
+            }
             case '?': {
                 // getopt_long already printed an option
                 break;
@@ -126,6 +226,31 @@ int main(int argc, char **argv)
         }
     }
 
+    // Query the event catalogue and print the selected events
+    if(events) {
+        if(!FileUtil::fileExists(events)) {
+            fprintf(stderr, "Couldn't find event catalogue %s\n", events);
+            exit(1);
+        }
+        EventCatalogue catalogue(events);
+        if(!catalogue.isOpen()) {
+            exit(1);
+        }
+        EventCatalogue::print(stdout, catalogue.query(eventQuery));
+        exit(0);
+    }
+
+    // Refit the camera model jointly to the calibrations in the calibration directory
+    if(jointFit) {
+        if(!config) {
+            fprintf(stderr, "Joint fit: the config file must be specified!\n");
+            exit(1);
+        }
+        ConfigStore store(state);
+        store.loadFromFile(string(config));
+        exit(fitCalibrations(state, eventQuery.startUs, eventQuery.endUs));
+    }
+
     // Consistency checks on the arguments
     if(state->headless && !config) {
         fprintf(stderr, "Headless mode: the config file must be specified!\n");
@@ -233,10 +358,78 @@ static void usage(FILE *fp, char **argv)
                  "    --gui           Operate in GUI mode\n"
                  "-b, --camera PATH   Use the camera located at PATH (e.g. /dev/video0)\n"
                  "-c, --config PATH   Use the asteria.config file located at PATH\n"
+                 "-x, --convert-catalogue PATH\n"
+                 "                    Convert the text reference star catalogue at PATH to the binary\n"
+                 "                    format, written to the same path with the extension .bin\n"
+                 "-e, --export-pgm PATH\n"
+                 "                    Export the frames of the clip file at PATH to individual PGM files,\n"
+                 "                    written to the same directory\n"
+                 "-q, --events PATH   Print the events in the event catalogue at PATH, selected by the options:\n"
+                 "-f, --from UTC      Events starting at or after UTC (e.g. 2018-03-13T02:00:00.000Z)\n"
+                 "-t, --to UTC        Events starting before UTC\n"
+                 "-s, --station NAME  Events recorded by the station NAME\n"
+                 "-m, --min-motion PX Events whose centroid moved at least PX pixels\n"
+                 "-j, --joint-fit     Fit the camera model jointly to the calibrations in the calibration directory\n"
+                 "                    of the config file (-c) made within the --from and --to times, and save it\n"
+                 "                    with the most recent of them so that it's used for acquisition\n"
                  "",
                  argv[0]);
 }
 
+/**
+ * @brief Fit the intrinsic parameters of the camera jointly to the cross-matches from a set of calibrations, which
+ * constrains the camera model (particularly the distortion) far better than any single calibration. The camera model
+ * of the most recent calibration is the starting point; it's replaced with the joint fit, along with the fitted
+ * orientation, and the calibration saved again. The other calibrations are left unchanged.
+ * @param state
+ *  The state, with the calibration directory set from the config file.
+ * @param startUs
+ *  Start of the time range of the calibrations to fit, inclusive [microseconds]
+ * @param endUs
+ *  End of the time range of the calibrations to fit, exclusive [microseconds]
+ * @return
+ *  The exit status; zero on success.
+ */
+static int fitCalibrations(AsteriaState * state, long long startUs, long long endUs) {
+
+    std::vector<std::shared_ptr<CalibrationInventory>> cals;
+    for(const ArchiveIndex::Entry &entry : ArchiveIndex::get(state->calibrationDirPath)->getRange(startUs, endUs)) {
+        std::shared_ptr<CalibrationInventory> cal = CalibrationInventory::loadFromDir(entry.path);
+        if(!cal || !cal->cam) {
+            fprintf(stderr, "Couldn't load calibration from %s; skipping\n", entry.path.c_str());
+            continue;
+        }
+        cals.push_back(cal);
+    }
+
+    if(cals.empty()) {
+        fprintf(stderr, "Joint fit: no calibrations found in %s\n", state->calibrationDirPath.c_str());
+        return 1;
+    }
+
+    // Calibrations without any cross-matches aren't included in the fit
+    std::shared_ptr<CalibrationInventory> latest = cals.back();
+    MultiEpochGeoCalFitter fitter(latest->cam);
+    for(const std::shared_ptr<CalibrationInventory> &cal : cals) {
+        fitter.addEpoch(*cal);
+    }
+    if(fitter.getNumEpochs() < 2 || latest->xms.empty()) {
+        fprintf(stderr, "Joint fit: %d of %lu calibrations have cross-matches; at least two, including the most recent, are needed\n",
+                fitter.getNumEpochs(), cals.size());
+        return 1;
+    }
+
+    fprintf(stderr, "Joint fit of %d calibrations from %s to %s\n", fitter.getNumEpochs(), TimeUtil::epochToUtcString(cals.front()->epochTimeUs).c_str(),
+            TimeUtil::epochToUtcString(latest->epochTimeUs).c_str());
+    fitter.fit(500, true);
+    fprintf(stderr, "Joint fit: reduced chi-square = %f\n", fitter.getReducedChi2());
+
+    latest->saveToDir(state->calibrationDirPath, state->clip_key_frame_interval);
+    fprintf(stderr, "Saved the joint fit with calibration %s\n", TimeUtil::epochToUtcString(latest->epochTimeUs).c_str());
+
+    return 0;
+}
+
 /**
  * Intercept and handle UNIX terminal signals. See https://gist.github.com/azadkuh/a2ac6869661ebd3f8588.
  * @brief catchUnixSignals
@@ -3,9 +3,11 @@
 #include "util/coordinateutil.h"
 #include "infra/referencestar.h"
 #include "infra/source.h"
+#include "optics/cameramodelkernels.h"
 
 GeoCalFitter::GeoCalFitter(CameraModelBase *cam, Eigen::Quaterniond *q_sez_cam, std::vector<std::pair<Source, ReferenceStar> > *xms, const double &gmst, const double &lon, const double &lat) :
-     LevenbergMarquardtSolver(cam->getNumParameters() + 4, xms->size()*2), cam(cam), q_sez_cam(q_sez_cam), xms(xms), gmst(gmst), lon(lon), lat(lat) {
+     LevenbergMarquardtSolver(cam->getNumParameters() + 4, xms->size()*2), cam(cam), q_sez_cam(q_sez_cam), xms(xms), gmst(gmst), lon(lon), lat(lat),
+     useCameraModelKernels(true), useFiniteDifferencesJacobian(false) {
 
     // The data consists of the (i,j) coordinates of the extracted sources
     double data[N];
@@ -41,11 +43,31 @@ GeoCalFitter::GeoCalFitter(CameraModelBase *cam, Eigen::Quaterniond *q_sez_cam,
     initial_params[3] = q_sez_cam->z();
     cam->getParameters(&initial_params[4]);
     this->setParameters(initial_params);
+
+    // Precompute the SEZ frame unit vectors towards the reference stars
+    Matrix3d r_bcrf_sez = CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+    r_sez.reserve(xms->size());
+    for(std::pair<Source, ReferenceStar> &xm : *xms) {
+        Vector3d r_bcrf;
+        CoordinateUtil::sphericalToCartesian(r_bcrf, 1.0, xm.second.ra, xm.second.dec);
+        r_sez.push_back(r_bcrf_sez * r_bcrf);
+    }
 }
 
-void GeoCalFitter::getModel(double *model) {
+void GeoCalFitter::fit(unsigned int maxIterations, bool verbose) {
 
-    // The model consists of the (i,j) coordinates of the reference stars
+    LevenbergMarquardtSolver::fit(maxIterations, verbose);
+
+    // The kernels don't modify the camera model or the reference stars, so update them with the solution
+    applyParameters();
+
+    Matrix3d r_bcrf_cam = q_sez_cam->toRotationMatrix() * CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+    for(std::pair<Source, ReferenceStar> &xm : *xms) {
+        CoordinateUtil::projectReferenceStar(xm.second, r_bcrf_cam, *cam);
+    }
+}
+
+void GeoCalFitter::applyParameters() {
 
     // Read out the current quaternion elements from the parameters
     q_sez_cam->w() = params[0];
@@ -56,6 +78,49 @@ void GeoCalFitter::getModel(double *model) {
     // Set the parameters of the camera (advance pointer past the first four elements, which
     // contain the elements of the orientation quaternion)
     cam->setParameters(&params[4]);
+}
+
+template <class Kernel>
+void GeoCalFitter::getModelWithKernel(const Kernel &kernel, const double * params, double * model) const {
+
+    Matrix3d r_sez_cam = Quaterniond(params[0], params[1], params[2], params[3]).normalized().toRotationMatrix();
+
+    for(unsigned int idx=0; idx<r_sez.size(); idx++) {
+        Vector3d r_cam = r_sez_cam * r_sez[idx];
+        kernel.projectVector(r_cam, model[2*idx], model[2*idx + 1]);
+    }
+}
+
+template <class Kernel>
+void GeoCalFitter::getJacobianWithKernel(const Kernel &kernel, double * jac) {
+
+    Quaterniond q(params[0], params[1], params[2], params[3]);
+    Matrix3d r_sez_cam = q.toRotationMatrix();
+
+    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
+
+    typename Kernel::IntrinsicPartials intrinsic;
+    typename Kernel::ExtrinsicPartials extrinsic;
+    Matrix<double, 3, 4> dr_cam_dq;
+
+    for(unsigned int idx=0; idx<r_sez.size(); idx++) {
+        Vector3d r_cam = r_sez_cam * r_sez[idx];
+        Kernel::getSezToCamPartials(r_sez[idx], q, dr_cam_dq);
+        kernel.getPartialDerivatives(r_cam, dr_cam_dq, intrinsic, extrinsic);
+        J.template block<2, 4>(2*idx, 0) = extrinsic;
+        J.template block<2, Kernel::numParameters>(2*idx, 4) = intrinsic;
+    }
+}
+
+void GeoCalFitter::getModel(double *model) {
+
+    // The model consists of the (i,j) coordinates of the reference stars
+
+    if(useCameraModelKernels && getModelUsingKernels(params, model)) {
+        return;
+    }
+
+    applyParameters();
 
     // Rotation matrices
     Matrix3d r_bcrf_ecef = CoordinateUtil::getBcrfToEcefRot(gmst);
@@ -83,17 +148,71 @@ void GeoCalFitter::postParameterUpdateCallback() {
     params[3] /= norm;
 }
 
+void GeoCalFitter::getModelAt(const double * params, double * model) {
+
+    // The kernels don't modify the camera model, so can be used concurrently
+    if(useCameraModelKernels && getModelUsingKernels(params, model)) {
+        return;
+    }
+
+    LevenbergMarquardtSolver::getModelAt(params, model);
+}
+
+bool GeoCalFitter::hasCameraModelKernel() const {
+    return cam->getModelName().compare("PinholeCamera") == 0 ||
+           cam->getModelName().compare("PinholeCameraWithRadialDistortion") == 0 ||
+           cam->getModelName().compare("PinholeCameraWithSipDistortion") == 0;
+}
+
+bool GeoCalFitter::getModelUsingKernels(const double * params, double * model) const {
+
+    // The camera model parameters are taken directly from the given parameters (advance pointer past the
+    // first four elements, which contain the elements of the orientation quaternion)
+    if(cam->getModelName().compare("PinholeCamera") == 0) {
+        getModelWithKernel(PinholeCameraKernel(cam->width, cam->height, &params[4]), params, model);
+        return true;
+    }
+    if(cam->getModelName().compare("PinholeCameraWithRadialDistortion") == 0) {
+        getModelWithKernel(PinholeCameraWithRadialDistortionKernel(cam->width, cam->height, &params[4]), params, model);
+        return true;
+    }
+    if(cam->getModelName().compare("PinholeCameraWithSipDistortion") == 0) {
+        getModelWithKernel(PinholeCameraWithSipDistortionKernel(cam->width, cam->height, &params[4]), params, model);
+        return true;
+    }
+    return false;
+}
+
+bool GeoCalFitter::getJacobianUsingKernels(double * jac) {
+    if(cam->getModelName().compare("PinholeCamera") == 0) {
+        getJacobianWithKernel(PinholeCameraKernel(cam->width, cam->height, &params[4]), jac);
+        return true;
+    }
+    if(cam->getModelName().compare("PinholeCameraWithRadialDistortion") == 0) {
+        getJacobianWithKernel(PinholeCameraWithRadialDistortionKernel(cam->width, cam->height, &params[4]), jac);
+        return true;
+    }
+    if(cam->getModelName().compare("PinholeCameraWithSipDistortion") == 0) {
+        getJacobianWithKernel(PinholeCameraWithSipDistortionKernel(cam->width, cam->height, &params[4]), jac);
+        return true;
+    }
+    return false;
+}
+
 void GeoCalFitter::getJacobian(double * jac) {
 
-    // Read out the current quaternion elements from the parameters
-    q_sez_cam->w() = params[0];
-    q_sez_cam->x() = params[1];
-    q_sez_cam->y() = params[2];
-    q_sez_cam->z() = params[3];
+    if(useFiniteDifferencesJacobian) {
+        // The perturbations can be evaluated in parallel if the model is computed by a kernel
+        reentrantModel = useCameraModelKernels && hasCameraModelKernel();
+        LevenbergMarquardtSolver::getJacobian(jac);
+        return;
+    }
 
-    // Set the parameters of the camera (advance pointer past the first four elements, which
-    // contain the elements of the orientation quaternion)
-    cam->setParameters(&params[4]);
+    if(useCameraModelKernels && getJacobianUsingKernels(jac)) {
+        return;
+    }
+
+    applyParameters();
 
     // Rotation matrices
     Matrix3d r_bcrf_ecef = CoordinateUtil::getBcrfToEcefRot(gmst);
@@ -164,18 +283,18 @@ void GeoCalFitter::getJacobian(double * jac) {
 
 }
 
-//void GeoCalFitter::finiteDifferencesStepSizePerParam(double * steps) {
-//    // Don't implement this: the camera model provides the jacobian, plus we don't know what
-//    // type of camera model we're dealing with so don't know the appropriate step sizes to choose.
-
-//    // Quaternion elements
-//    steps[0] = 0.000001;
-//    steps[1] = 0.000001;
-//    steps[2] = 0.000001;
-//    steps[3] = 0.000001;
-//    // Camera intrinsics
-//    steps[4] = 1.0;
-//    steps[5] = 1.0;
-//    steps[6] = 0.1;
-//    steps[7] = 0.1;
-//}
+void GeoCalFitter::finiteDifferencesStepSizePerParam(double * steps) {
+
+    // Quaternion elements
+    steps[0] = 0.000001;
+    steps[1] = 0.000001;
+    steps[2] = 0.000001;
+    steps[3] = 0.000001;
+
+    // Camera intrinsics; we don't know what type of camera model we're dealing with, so use steps relative to
+    // the parameter values. The model is close to linear in the focal lengths & principal point, and linear in
+    // the distortion coefficients, so the step size isn't critical.
+    for(unsigned int m=4; m<M; m++) {
+        steps[m] = 0.000001 * std::max(std::abs(params[m]), 1.0);
+    }
+}
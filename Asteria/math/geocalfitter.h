@@ -5,6 +5,8 @@
 #include "math/levenbergmarquardtsolver.h"
 #include "optics/cameramodelbase.h"
 
+#include <vector>
+
 class GeoCalFitter : public LevenbergMarquardtSolver
 {
 public:
@@ -49,13 +51,86 @@ public:
      */
     const double lat;
 
+    /**
+     * @brief Flag indicating whether to evaluate the model and Jacobian using the compile-time specialised
+     * camera model kernels (see cameramodelkernels.h) where the type of camera model permits, rather than
+     * through the virtual functions of the CameraModelBase. The results are the same up to rounding; this
+     * is exposed mainly for benchmarking the two.
+     */
+    bool useCameraModelKernels;
+
+    /**
+     * @brief Flag indicating whether to use the finite differences approximation to the Jacobian rather than the
+     * analytic partial derivatives of the camera model. This is useful when prototyping new camera models. When the
+     * model is computed by a kernel the parameter perturbations are evaluated in parallel.
+     */
+    bool useFiniteDifferencesJacobian;
+
     void getModel(double * model);
 
+    void getModelAt(const double * params, double * model);
+
     void postParameterUpdateCallback();
 
-    // One or the other of these should be implemented:
+    // The analytic Jacobian is used unless useFiniteDifferencesJacobian is set
     void getJacobian(double * jac);
-//    void finiteDifferencesStepSizePerParam(double *steps);
+    void finiteDifferencesStepSizePerParam(double *steps);
+
+    /**
+     * @brief Perform the fit, then write the fitted parameters to the camera model and quaternion and
+     * update the projected positions of the cross-matched reference stars.
+     * @param maxIterations  Maximum number of allowed iteration before convergence.
+     * @param verbose        Enables verbose logging
+     */
+    void fit(unsigned int maxIterations, bool verbose);
+
+private:
+
+    // The joint fit uses a GeoCalFitter for each epoch to compute the per-epoch normal equations
+    friend class MultiEpochGeoCalFitter;
+
+    /**
+     * @brief Unit vectors towards the cross-matched reference stars in the SEZ frame. These don't depend
+     * on the fitted parameters so are computed once on construction.
+     */
+    std::vector<Eigen::Vector3d> r_sez;
+
+    /**
+     * @brief Write the current parameters to the camera model and quaternion.
+     */
+    void applyParameters();
+
+    /**
+     * @brief Check whether there is a kernel for the type of camera model.
+     */
+    bool hasCameraModelKernel() const;
+
+    /**
+     * @brief Compute the model for the given parameters using the kernel for the type of camera model. This
+     * doesn't modify any state so is re-entrant.
+     * @return
+     *  True if there is a kernel for the type of camera model; otherwise the model is not computed.
+     */
+    bool getModelUsingKernels(const double * params, double * model) const;
+
+    /**
+     * @brief Compute the Jacobian for the current parameters using the kernel for the type of camera model.
+     * @return
+     *  True if there is a kernel for the type of camera model; otherwise the Jacobian is not computed.
+     */
+    bool getJacobianUsingKernels(double * jac);
+
+    /**
+     * @brief Implementation of getModelAt(const double *, double *) using a camera model kernel.
+     */
+    template <class Kernel>
+    void getModelWithKernel(const Kernel &kernel, const double * params, double * model) const;
+
+    /**
+     * @brief Implementation of getJacobian(double *) using a camera model kernel.
+     */
+    template <class Kernel>
+    void getJacobianWithKernel(const Kernel &kernel, double * jac);
 
 };
 
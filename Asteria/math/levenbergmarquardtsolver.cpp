@@ -1,8 +1,18 @@
 #include "levenbergmarquardtsolver.h"
 
+#include "util/parallelutil.h"
+
 #include <iostream>
+#include <limits>
+#include <algorithm>            // min, max
+
+// Minimum number of model values to give each thread in getJacobianParallel(...); below this the cost of
+// starting the threads outweighs the gain, so small problems are evaluated on the calling thread.
+static const unsigned int minModelValuesPerThread = 16384;
 
-LevenbergMarquardtSolver::LevenbergMarquardtSolver(unsigned int M, unsigned int N) : M(M), N(N) {
+LevenbergMarquardtSolver::LevenbergMarquardtSolver(unsigned int M, unsigned int N) : M(M), N(N),
+    jacobian(N, M), residuals(N), weightedJacobian(N, M), weightedResiduals(N), JTWJ(M, M), RHS(M), LHS(M, M),
+    delta(M), initParams(M), ldlt(M), qr(M, M) {
     data = new double[N];
     model = new double[N];
     params = new double[M];
@@ -12,13 +22,14 @@ LevenbergMarquardtSolver::LevenbergMarquardtSolver(unsigned int M, unsigned int
     for(unsigned int n=0; n<N; n++) {
         covariance [n] = 1.0;
     }
+    inverseSigma = VectorXd::Ones(N);
 }
 
 LevenbergMarquardtSolver::~LevenbergMarquardtSolver() {
-    delete data;
-    delete model;
-    delete params;
-    delete covariance;
+    delete[] data;
+    delete[] model;
+    delete[] params;
+    delete[] covariance;
 }
 
 
@@ -30,20 +41,35 @@ void LevenbergMarquardtSolver::setData(const double * data) {
 
 void LevenbergMarquardtSolver::setCovariance(const double * covariance) {
     covarianceIsDiagonal = false;
-    delete this->covariance;
+    delete[] this->covariance;
     this->covariance = new double[N*N];
     for(unsigned int idx=0; idx<N*N; idx++) {
         this->covariance[idx] = covariance[idx];
     }
+
+    // Factorise the covariance matrix once, rather than on every iteration
+    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> C(this->covariance, N, N);
+    LLT<MatrixXd> llt(C);
+    if(llt.info() != Success) {
+        // Not positive definite; regularise by raising the small or negative eigenvalues
+        fprintf(stderr, "LMA: Covariance matrix is not positive definite; regularising\n");
+        SelfAdjointEigenSolver<MatrixXd> eig(C);
+        double minEigenvalue = std::max(eig.eigenvalues().maxCoeff() * 1E-12, std::numeric_limits<double>::min());
+        VectorXd eigenvalues = eig.eigenvalues().cwiseMax(minEigenvalue);
+        llt.compute(eig.eigenvectors() * eigenvalues.asDiagonal() * eig.eigenvectors().transpose());
+    }
+    covarianceCholesky = llt.matrixL();
 }
 
 void LevenbergMarquardtSolver::setVariance(const double * variance) {
     covarianceIsDiagonal = true;
-    delete covariance;
+    delete[] covariance;
     covariance = new double[N];
     for(unsigned int idx=0; idx<N; idx++) {
         this->covariance[idx] = variance[idx];
+        inverseSigma[idx] = 1.0 / std::sqrt(variance[idx]);
     }
+    covarianceCholesky.resize(0, 0);
 }
 
 void LevenbergMarquardtSolver::setParameters(const double *params) {
@@ -70,6 +96,15 @@ void LevenbergMarquardtSolver::setMaxDamping(double maxDamping) {
     this->maxDamping = maxDamping;
 }
 
+void LevenbergMarquardtSolver::setFiniteDifferencesThreads(unsigned int nThreads) {
+    this->finiteDifferencesThreads = nThreads;
+}
+
+void LevenbergMarquardtSolver::getModelAt(const double * params, double * model) {
+    std::copy(&params[0], &params[M], this->params);
+    getModel(model);
+}
+
 void LevenbergMarquardtSolver::finiteDifferencesStepSizePerParam(double * steps) {
 
     for (unsigned int m=0; m<M; m++) {
@@ -91,7 +126,10 @@ void LevenbergMarquardtSolver::finiteDifferencesStepSizePerParam(double * steps)
  */
 void LevenbergMarquardtSolver::getJacobian(double * jac) {
 
-    fprintf(stderr, "Using finite difference Jacobian\n");
+    if(reentrantModel) {
+        getJacobianParallel(jac);
+        return;
+    }
 
     // Get finite step sizes to use for each parameter
     double steps[M];
@@ -147,6 +185,47 @@ void LevenbergMarquardtSolver::getJacobian(double * jac) {
     }
 }
 
+void LevenbergMarquardtSolver::getJacobianParallel(double * jac) {
+
+    if(finiteDifferencesParams.cols() != (long)M) {
+        finiteDifferencesSteps.resize(M);
+        finiteDifferencesParams.resize(M, M);
+        finiteDifferencesModelPlus.resize(N, M);
+        finiteDifferencesModelMinus.resize(N, M);
+    }
+
+    // Get finite step sizes to use for each parameter
+    finiteDifferencesStepSizePerParam(finiteDifferencesSteps.data());
+
+    // Two model evaluations of N values for each of the M parameters
+    unsigned int nThreads = finiteDifferencesThreads;
+    if(nThreads == 0) {
+        nThreads = ParallelUtil::getDefaultThreads();
+    }
+    nThreads = std::max(1u, std::min(nThreads, (2u * N * M) / minModelValuesPerThread));
+
+    // Evaluate the model values for the advanced and retarded parameter sets: f(x+h) and f(x-h). Each
+    // parameter is perturbed in a separate copy of the parameters, so these can be computed in parallel.
+    ParallelUtil::forEachRowBand(M, nThreads, [this](unsigned int start, unsigned int end) {
+        for(unsigned int m=start; m<end; m++) {
+            double * perturbedParams = finiteDifferencesParams.col(m).data();
+            std::copy(&params[0], &params[M], perturbedParams);
+
+            perturbedParams[m] = params[m] + finiteDifferencesSteps[m];
+            getModelAt(perturbedParams, finiteDifferencesModelPlus.col(m).data());
+
+            perturbedParams[m] = params[m] - finiteDifferencesSteps[m];
+            getModelAt(perturbedParams, finiteDifferencesModelMinus.col(m).data());
+        }
+    });
+
+    // Build Jacobian by finite difference (f(x+h) - f(x-h))/2h, with row-major packing
+    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
+    for (unsigned int m=0; m<M; m++) {
+        J.col(m) = (finiteDifferencesModelPlus.col(m) - finiteDifferencesModelMinus.col(m)) / (2.0 * finiteDifferencesSteps[m]);
+    }
+}
+
 void LevenbergMarquardtSolver::postParameterUpdateCallback() {
     // Default implementation does nothing.
 }
@@ -166,25 +245,7 @@ void LevenbergMarquardtSolver::fit(unsigned int maxIterations, bool verbose) {
 
     // Get suitable starting value for damping parameter, from 10^{-3}
     // times the average of the diagonal elements of JTWJ:
-    double jac[N*M];
-    getJacobian(jac);
-
-    // Load the Jacobian elements into an Eigen Matrix for linear algebra operations
-    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
-
-    // Compute W*J, where W is the inverse of the covariance matrix
-    MatrixXd WJ(N, M);
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            WJ.row(n) = J.row(n) / covariance[n];
-        }
-    }
-    else {
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> W(covariance, N, N);
-        WJ = W.colPivHouseholderQr().solve(J);
-    }
-    MatrixXd JTWJ = J.transpose() * WJ;
+    computeNormalEquations();
 
     double lambda = JTWJ.trace()/(M*1000.0);
     double maxLambda = lambda*maxDamping;
@@ -211,82 +272,85 @@ void LevenbergMarquardtSolver::fit(unsigned int maxIterations, bool verbose) {
     return;
 }
 
-bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda, bool verbose) {
+void LevenbergMarquardtSolver::computeWeightedResiduals() {
 
-    // Compute model
-    getModel(model);
+    getResiduals(residuals.data());
 
-    // Compute chi-square prior to parameter update
-    double chi2prev = getChi2();
-
-    // Now get Jacobian matrix for current parameters
-    double jac[N*M];
-    getJacobian(jac);
-    // Load the Jacobian elements into an Eigen Matrix for linear algebra operations
-    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
+    if(covarianceIsDiagonal) {
+        weightedResiduals = residuals.cwiseProduct(inverseSigma);
+    }
+    else {
+        weightedResiduals = residuals;
+        covarianceCholesky.triangularView<Lower>().solveInPlace(weightedResiduals);
+    }
+}
 
-    // Compute RHS of LM update equation:
-    // (J^T*W*J + diag(J^T*W*J))*delta = J^T*W*(residuals)
-    MatrixXd WJ(N, M);
-    MatrixXd WR(N, 1);
+void LevenbergMarquardtSolver::computeNormalEquations() {
 
-    // Get residuals array
-    double residuals[N];
-    getResiduals(residuals);
+    getJacobian(jacobian.data());
+    computeWeightedResiduals();
 
+    // Weight the Jacobian: with W = C^{-1} = L^{-T}*L^{-1}, J^T*W*J = (L^{-1}*J)^T*(L^{-1}*J)
     if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            WJ.row(n) = J.row(n) / covariance[n];
-            WR(n, 0) = residuals[n] / covariance[n];
-        }
+        weightedJacobian.noalias() = inverseSigma.asDiagonal() * jacobian;
     }
     else {
-        // Load covariance elements into a Matrix
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> C(covariance, N, N);
-        // Load residuals into a Matrix
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> R(residuals, N, 1);
-
-        ColPivHouseholderQR<Matrix<double, Dynamic, Dynamic, RowMajor>> W = C.colPivHouseholderQr();
-        WR = W.solve(R);
-        WJ = W.solve(J);
+        weightedJacobian = jacobian;
+        covarianceCholesky.triangularView<Lower>().solveInPlace(weightedJacobian);
+    }
+
+    JTWJ.noalias() = weightedJacobian.transpose() * weightedJacobian;
+    RHS.noalias() = weightedJacobian.transpose() * weightedResiduals;
+}
+
+void LevenbergMarquardtSolver::solveDampedNormalEquations(const double &lambda) {
+
+    // Add the diagonal elements of JTWJ multiplied by damping factor to the Grammian
+    LHS = JTWJ;
+    LHS.diagonal() += lambda * JTWJ.diagonal();
+
+    // The damped normal matrix is symmetric and positive definite unless the Jacobian is (numerically) rank
+    // deficient, in which case fall back to the slower but more robust QR decomposition
+    ldlt.compute(LHS);
+    if(ldlt.info() == Success && ldlt.isPositive()) {
+        delta = ldlt.solve(RHS);
+        if(delta.allFinite()) {
+            return;
+        }
     }
+    qr.compute(LHS);
+    delta = qr.solve(RHS);
+}
 
-    // Get J^T*W*(residuals)
-    MatrixXd RHS = J.transpose() * WR;
+bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda, bool verbose) {
 
-    // Get J^T*W*J
-    MatrixXd JTWJ = J.transpose() * WJ;
+    // Compute model
+    getModel(model);
+
+    // Compute chi-square prior to parameter update
+    double chi2prev = getChi2();
+
+    // Now get Jacobian matrix for current parameters, and compute the terms of the LM update equation:
+    // (J^T*W*J + diag(J^T*W*J))*delta = J^T*W*(residuals)
+    computeNormalEquations();
 
     // Change in chi-square from one iteration to the next
     double rrise = 0;
 
     // Copy initial parameters so we can restore them if necessary
-    double initParam[M];
-    std::copy(&params[0], &params[M], initParam);
+    std::copy(&params[0], &params[M], initParams.data());
 
     // Exit status
     bool done = true;
 
     // Search for a good step:
     do {
-        // Make damping matrix
-        MatrixXd L = MatrixXd::Constant(M, M, 0.0);
-        // Insert diagonal elements of JTWJ multiplied by damping factor
-        for(unsigned int m=0; m<M; m++) {
-            // Diagonal element
-            L(m, m) = JTWJ(m, m) * lambda;
-        }
-
-        // Add this to Grammian
-        MatrixXd LHS = JTWJ + L;
-
         // Compute parameter adjustment vector
-        MatrixXd delta = LHS.colPivHouseholderQr().solve(RHS);
+        solveDampedNormalEquations(lambda);
 
         // Adjust parameters...
         for(unsigned int m=0; m<M; m++) {
-            params[m] += delta(m, 0);
+            params[m] += delta[m];
         }
 
         postParameterUpdateCallback();
@@ -315,7 +379,7 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
         // parameters and quit loop. Algorithm cannot find a better value.
         else if (fabs(rrise) < exitTolerance) {
 
-            std::copy(&initParam[0], &initParam[M], params);
+            std::copy(initParams.data(), initParams.data() + M, params);
 
             // Reset the model
             getModel(model);
@@ -330,7 +394,7 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
 
             // Bad step (residuals increased)! Try again with larger damping.
             // Reset parameters to values before previous nudge.
-            std::copy(&initParam[0], &initParam[M], params);
+            std::copy(initParams.data(), initParams.data() + M, params);
 
             // Reset the model
             getModel(model);
@@ -352,27 +416,10 @@ bool LevenbergMarquardtSolver::iteration(double &lambda, const double &maxLambda
 
 double LevenbergMarquardtSolver::getChi2() {
 
-    // Get residuals array
-    double residuals[N];
-    getResiduals(residuals);
-
-    double chi2 = 0.0;
-
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            chi2 += (residuals[n] * residuals[n]) / covariance[n];
-        }
-    }
-    else {
-        // Load residuals into a Matrix for full covariance weighted chi-square
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> R(residuals, N, 1);
-        // Load covariance array into a Matrix
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> C(covariance, N, N);
+    // With W = C^{-1} = L^{-T}*L^{-1}, the chi-square is the squared norm of the weighted residuals L^{-1}*R
+    computeWeightedResiduals();
 
-        chi2 = (R.transpose() * C.jacobiSvd(ComputeThinU | ComputeThinV).solve(R))(0, 0);
-    }
-    return chi2;
+    return weightedResiduals.squaredNorm();
 }
 
 void LevenbergMarquardtSolver::getResiduals(double * residuals) {
@@ -392,25 +439,9 @@ double LevenbergMarquardtSolver::getDOF() {
 
 MatrixXd LevenbergMarquardtSolver::getParameterCovariance() {
 
-    // Get Jacobian matrix for current parameter set
-    double jac[N*M];
-    getJacobian(jac);
-    // Load the Jacobian elements into an Eigen Matrix for linear algebra operations
-    Map<Matrix<double, Dynamic, Dynamic, RowMajor>> J(jac, N, M);
-
-    // Compute W*J, where W is the inverse of the covariance matrix
-    MatrixXd WJ(N, M);
-    if(covarianceIsDiagonal) {
-        // Manually divide each row of J by the inverse of the corresponding variance term
-        for(unsigned int n=0; n<N; n++) {
-            WJ.row(n) = J.row(n) / covariance[n];
-        }
-    }
-    else {
-        Map<Matrix<double, Dynamic, Dynamic, RowMajor>> W(covariance, N, N);
-        WJ = W.colPivHouseholderQr().solve(J);
-    }
-    MatrixXd JTWJ = J.transpose() * WJ;
+    // Get J^T*W*J for current parameter set
+    computeNormalEquations();
+    MatrixXd JTWJ = this->JTWJ;
 
     // This step is thrown in to make results match Gnuplot. Without this scaling, the function
     // gives the same results as the getFourthOrderCovariance() function.
@@ -130,6 +130,23 @@ public:
      */
     virtual void getModel(double * model) =0;
 
+    /**
+     * @brief Get f(X,P) for the given parameter set, rather than the current parameters.
+     *
+     * This is used by the parallel finite differences Jacobian approximation, which calls it concurrently from
+     * several threads with different parameter sets and model arrays. Derived classes that want to use that
+     * should override this with an implementation that doesn't modify any shared state, and set reentrantModel
+     * to true. Note that the parameter sets are not passed through postParameterUpdateCallback(), so any
+     * normalisation of the parameters should be applied here. The default implementation loads the parameters
+     * and calls getModel(double *), so it is NOT re-entrant.
+     *
+     * @param params
+     *  Pointer to an M-element array of parameters
+     * @param model
+     *  Pointer to an N-element array that on exit will contain the model values
+     */
+    virtual void getModelAt(const double * params, double * model);
+
     /**
      * @brief Get the Jacobian matrix -> the matrix of partial derivatives of the
      * model values with respect to the parameters, given the current parameter set.
@@ -142,7 +159,8 @@ public:
      * A[r][c] has r rows and c columns.
      *
      * This function MAY be overridden in the derived class if an analytic Jacobian is possible.
-     * A default implementation based on finite differences is provided.
+     * A default implementation based on finite differences is provided; if reentrantModel is set then
+     * the parameters are perturbed concurrently in several threads.
      *
      * @param jac
      *  NxM element array that on exit will contain the Jacobian values, packed in a one
@@ -229,6 +247,14 @@ public:
      */
     void setBoostShrinkFactor(double boostShrinkFactor);
 
+    /**
+     * @brief Set the maximum number of threads used by the parallel finite differences Jacobian approximation.
+     * Fewer threads are used for small problems, which are evaluated on the calling thread alone.
+     * @param nThreads
+     *  The maximum number of threads, including the calling thread; 0 selects the number of hardware threads.
+     */
+    void setFiniteDifferencesThreads(unsigned int nThreads);
+
     /**
      * @brief This method estimates parameter covariance by propagating data
      * covariance through the system using the following equation:
@@ -304,6 +330,18 @@ protected:
      */
     double boostShrinkFactor = 10;
 
+    /**
+     * @brief Flag indicating that the derived class implements a re-entrant getModelAt(const double *, double *),
+     * so that the finite differences Jacobian approximation can evaluate the parameter perturbations concurrently.
+     */
+    bool reentrantModel = false;
+
+    /**
+     * @brief Maximum number of threads used by the parallel finite differences Jacobian approximation; 0 selects
+     * the number of hardware threads.
+     */
+    unsigned int finiteDifferencesThreads = 0;
+
     /**
      * @brief Nx1 column vector of observed values
      *
@@ -338,6 +376,96 @@ protected:
      */
     double * params;
 
+    /**
+     * @brief Factorisation of a diagonal covariance matrix used to weight the residuals and Jacobian: the
+     * inverse standard deviation of each data point (Nx1). Computed once in setVariance(const double *).
+     */
+    VectorXd inverseSigma;
+
+    /**
+     * @brief Factorisation of a full covariance matrix used to weight the residuals and Jacobian: the lower
+     * triangular Cholesky factor L of the NxN covariance matrix C = L*L^T, so that the weighted residuals and
+     * Jacobian are L^{-1}*R and L^{-1}*J. Computed once in setCovariance(const double *).
+     */
+    MatrixXd covarianceCholesky;
+
+    // Workspace used during the fit, sized on construction so that the iterations don't allocate memory
+
+    /**
+     * @brief NxM Jacobian matrix, row-major as filled by getJacobian(double *).
+     */
+    Matrix<double, Dynamic, Dynamic, RowMajor> jacobian;
+
+    /**
+     * @brief Nx1 residuals (x - f(x)) of the current model.
+     */
+    VectorXd residuals;
+
+    /**
+     * @brief NxM Jacobian and Nx1 residuals, weighted by the inverse of the covariance factor.
+     */
+    MatrixXd weightedJacobian;
+    VectorXd weightedResiduals;
+
+    /**
+     * @brief MxM normal matrix J^T*W*J and Mx1 vector J^T*W*(residuals).
+     */
+    MatrixXd JTWJ;
+    VectorXd RHS;
+
+    /**
+     * @brief MxM damped normal matrix, the Mx1 parameter update, and a copy of the parameters prior to the update.
+     */
+    MatrixXd LHS;
+    VectorXd delta;
+    VectorXd initParams;
+
+    /**
+     * @brief Decompositions used to solve the damped normal equations. The LDLT is used in general, with the
+     * QR as a fallback when the damped normal matrix is not numerically positive definite.
+     */
+    LDLT<MatrixXd> ldlt;
+    ColPivHouseholderQR<MatrixXd> qr;
+
+    /**
+     * @brief Workspace for the parallel finite differences Jacobian approximation, sized on first use: the Mx1
+     * step sizes, the perturbed parameter set for each parameter (columns of the MxM matrix) and the model values
+     * for the positive and negative perturbation of each parameter (columns of the NxM matrices). Each parameter
+     * has its own columns so the threads don't share any buffers.
+     */
+    VectorXd finiteDifferencesSteps;
+    MatrixXd finiteDifferencesParams;
+    MatrixXd finiteDifferencesModelPlus;
+    MatrixXd finiteDifferencesModelMinus;
+
+    /**
+     * @brief Compute the Jacobian and residuals for the current parameters and model, and from them the
+     * normal matrix J^T*W*J and vector J^T*W*(residuals).
+     */
+    void computeNormalEquations();
+
+    /**
+     * @brief Compute the weighted residuals for the current model.
+     */
+    void computeWeightedResiduals();
+
+    /**
+     * @brief Solve the damped normal equations (J^T*W*J + lambda*diag(J^T*W*J))*delta = J^T*W*(residuals)
+     * for the parameter update.
+     *
+     * @param lambda Current value of the damping parameter
+     */
+    void solveDampedNormalEquations(const double &lambda);
+
+    /**
+     * @brief Finite differences Jacobian approximation that evaluates the parameter perturbations concurrently,
+     * using getModelAt(const double *, double *). Used by getJacobian(double *) when reentrantModel is set.
+     *
+     * @param jac
+     *  NxM element array that on exit will contain the Jacobian values, packed in row-major order.
+     */
+    void getJacobianParallel(double * jac);
+
     /**
      * @brief Each call performs one iteration of parameters.
      *
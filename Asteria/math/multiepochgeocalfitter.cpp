@@ -0,0 +1,296 @@
+#include "multiepochgeocalfitter.h"
+
+#include "util/coordinateutil.h"
+#include "util/mathutil.h"
+#include "util/timeutil.h"
+#include "util/parallelutil.h"
+#include "infra/calibrationinventory.h"
+
+MultiEpochGeoCalFitter::MultiEpochGeoCalFitter(CameraModelBase * cam) : cam(cam), useCameraModelKernels(true),
+    K(cam->getNumParameters()), intrinsics(K), initIntrinsics(K), V(K, K), g(K), S(K, K), s(K), deltaIntrinsics(K),
+    ldlt(K), qr(K, K) {
+    cam->getParameters(intrinsics.data());
+}
+
+void MultiEpochGeoCalFitter::addEpoch(Eigen::Quaterniond * q_sez_cam, std::vector<std::pair<Source, ReferenceStar>> * xms,
+                                      const double &gmst, const double &lon, const double &lat) {
+
+    // An epoch with no cross-matches contributes nothing and leaves the quaternion unconstrained
+    if(xms->empty()) {
+        return;
+    }
+
+    q_sez_cam->normalize();
+
+    // The GeoCalFitter takes the initial intrinsic parameters from the shared camera model
+    epochs.push_back(std::unique_ptr<GeoCalFitter>(new GeoCalFitter(cam, q_sez_cam, xms, gmst, lon, lat)));
+
+    unsigned int E = epochs.size();
+    quaternions.conservativeResize(4, E);
+    quaternions.col(E-1) << q_sez_cam->w(), q_sez_cam->x(), q_sez_cam->y(), q_sez_cam->z();
+}
+
+void MultiEpochGeoCalFitter::addEpoch(CalibrationInventory &inv) {
+    double gmst = TimeUtil::epochToGmst(inv.epochTimeUs);
+    double lon = MathUtil::toRadians(inv.longitude);
+    double lat = MathUtil::toRadians(inv.latitude);
+    addEpoch(&(inv.q_sez_cam), &(inv.xms), gmst, lon, lat);
+}
+
+unsigned int MultiEpochGeoCalFitter::getNumEpochs() const {
+    return epochs.size();
+}
+
+void MultiEpochGeoCalFitter::loadParameters() {
+    for(unsigned int e=0; e<epochs.size(); e++) {
+        double * params = epochs[e]->params;
+        std::copy(quaternions.col(e).data(), quaternions.col(e).data() + 4, params);
+        std::copy(intrinsics.data(), intrinsics.data() + K, params + 4);
+    }
+}
+
+void MultiEpochGeoCalFitter::forEachEpoch(const std::function<void(unsigned int)> &func) {
+
+    auto band = [&func](unsigned int start, unsigned int end) {
+        for(unsigned int e=start; e<end; e++) {
+            func(e);
+        }
+    };
+
+    // Without the kernels the model is computed by the shared camera model, so the epochs must be processed in turn
+    if(useCameraModelKernels && epochs[0]->hasCameraModelKernel()) {
+        ParallelUtil::forEachRowBand(epochs.size(), 0, band);
+    }
+    else {
+        band(0, epochs.size());
+    }
+}
+
+double MultiEpochGeoCalFitter::getChi2() {
+
+    loadParameters();
+
+    std::vector<double> chi2(epochs.size());
+    forEachEpoch([this, &chi2](unsigned int e) {
+        GeoCalFitter &epoch = *epochs[e];
+        epoch.getModel(epoch.model);
+        chi2[e] = epoch.getChi2();
+    });
+
+    double sum = 0.0;
+    for(double &c : chi2) {
+        sum += c;
+    }
+    return sum;
+}
+
+double MultiEpochGeoCalFitter::getDOF() {
+    double N = 0.0;
+    for(std::unique_ptr<GeoCalFitter> &epoch : epochs) {
+        N += epoch->N;
+    }
+    return N - (K + 4 * epochs.size());
+}
+
+double MultiEpochGeoCalFitter::getReducedChi2() {
+    return getChi2()/getDOF();
+}
+
+void MultiEpochGeoCalFitter::fit(unsigned int maxIterations, bool verbose) {
+
+    if(epochs.empty()) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: No epochs with cross-matches to fit!\n");
+        return;
+    }
+
+    for(std::unique_ptr<GeoCalFitter> &epoch : epochs) {
+        epoch->useCameraModelKernels = useCameraModelKernels;
+    }
+
+    uInvW.resize(epochs.size(), Matrix<double, 4, Dynamic>(4, K));
+    uInvG.resize(4, epochs.size());
+    deltaQuaternions.resize(4, epochs.size());
+
+    double chi2_initial = getChi2();
+
+    if(verbose) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: %d epochs, %d intrinsic parameters, %f degrees of freedom\n",
+                (int)epochs.size(), K, getDOF());
+        fprintf(stderr, "MultiEpochGeoCalFitter: Initial chi2 = %3.3f\n", chi2_initial);
+    }
+
+    // Get suitable starting value for damping parameter, from 10^{-3} times the average of the diagonal elements
+    // of the full normal matrix
+    computeNormalEquations();
+    double trace = V.trace();
+    for(std::unique_ptr<GeoCalFitter> &epoch : epochs) {
+        trace += epoch->JTWJ.topLeftCorner(4, 4).trace();
+    }
+    double lambda = trace / ((K + 4 * epochs.size()) * 1000.0);
+    double maxLambda = lambda * 1E32;
+
+    unsigned int nIterations = 0;
+
+    while(!iteration(lambda, maxLambda, verbose) && nIterations<maxIterations) {
+        if(verbose) {
+            fprintf(stderr, "MultiEpochGeoCalFitter: Iteration %d complete, residual = %3.3f\n", nIterations, getChi2());
+        }
+        nIterations++;
+    }
+
+    if(verbose) {
+        double chi2_final = getChi2();
+        fprintf(stderr, "MultiEpochGeoCalFitter: Number of iterations = %d\n", nIterations);
+        fprintf(stderr, "MultiEpochGeoCalFitter: Final chi2 = %3.3f\n", chi2_final);
+        fprintf(stderr, "MultiEpochGeoCalFitter: Reduced chi2 = %3.3f\n", getReducedChi2());
+        fprintf(stderr, "MultiEpochGeoCalFitter: Reduction factor = %3.3f\n", chi2_initial/chi2_final);
+    }
+
+    // Write the solution to the camera model and quaternions, and update the projected reference stars
+    loadParameters();
+    for(std::unique_ptr<GeoCalFitter> &epoch : epochs) {
+        epoch->applyParameters();
+    }
+    for(std::unique_ptr<GeoCalFitter> &epoch : epochs) {
+        Matrix3d r_bcrf_cam = epoch->q_sez_cam->toRotationMatrix() * CoordinateUtil::getEcefToSezRot(epoch->lon, epoch->lat) *
+                CoordinateUtil::getBcrfToEcefRot(epoch->gmst);
+        for(std::pair<Source, ReferenceStar> &xm : *(epoch->xms)) {
+            CoordinateUtil::projectReferenceStar(xm.second, r_bcrf_cam, *cam);
+        }
+    }
+}
+
+void MultiEpochGeoCalFitter::computeNormalEquations() {
+
+    // The normal equations of each epoch are computed from the model, so this must be current (see getChi2())
+    forEachEpoch([this](unsigned int e) {
+        epochs[e]->computeNormalEquations();
+    });
+
+    // Accumulate the intrinsic blocks
+    V.setZero();
+    g.setZero();
+    for(std::unique_ptr<GeoCalFitter> &epoch : epochs) {
+        V += epoch->JTWJ.bottomRightCorner(K, K);
+        g += epoch->RHS.tail(K);
+    }
+}
+
+void MultiEpochGeoCalFitter::solveDampedNormalEquations(const double &lambda) {
+
+    // The damped normal equations are:
+    //
+    // [ U*_1         W_1 ] [dq_1]   [g_1]
+    // [      U*_2    W_2 ] [dq_2] = [g_2]
+    // [ W_1^T W_2^T  V*  ] [dc  ]   [g  ]
+    //
+    // where U*_e = U_e + lambda*diag(U_e) etc. Eliminating the quaternion updates dq_e gives the reduced system
+    //
+    // (V* - sum_e W_e^T U*_e^{-1} W_e) dc = g - sum_e W_e^T U*_e^{-1} g_e
+    //
+    // following which dq_e = U*_e^{-1} (g_e - W_e dc).
+
+    S = V;
+    S.diagonal() += lambda * V.diagonal();
+    s = g;
+
+    for(unsigned int e=0; e<epochs.size(); e++) {
+        GeoCalFitter &epoch = *epochs[e];
+
+        Matrix4d U = epoch.JTWJ.topLeftCorner(4, 4);
+        U.diagonal() *= (1.0 + lambda);
+
+        auto W = epoch.JTWJ.topRightCorner(4, K);
+        Vector4d g_e = epoch.RHS.head(4);
+
+        LDLT<Matrix4d> uLdlt(U);
+        if(uLdlt.info() == Success && uLdlt.isPositive()) {
+            uInvW[e] = uLdlt.solve(W);
+            uInvG.col(e) = uLdlt.solve(g_e);
+        }
+        else {
+            FullPivLU<Matrix4d> uLu(U);
+            uInvW[e] = uLu.solve(W);
+            uInvG.col(e) = uLu.solve(g_e);
+        }
+
+        S.noalias() -= W.transpose() * uInvW[e];
+        s.noalias() -= W.transpose() * uInvG.col(e);
+    }
+
+    // Solve the reduced system; as in the LevenbergMarquardtSolver, fall back to QR if it's not numerically
+    // positive definite
+    ldlt.compute(S);
+    if(ldlt.info() == Success && ldlt.isPositive()) {
+        deltaIntrinsics = ldlt.solve(s);
+    }
+    if(!(ldlt.info() == Success && ldlt.isPositive()) || !deltaIntrinsics.allFinite()) {
+        qr.compute(S);
+        deltaIntrinsics = qr.solve(s);
+    }
+
+    // Back-substitute for the quaternion updates
+    for(unsigned int e=0; e<epochs.size(); e++) {
+        deltaQuaternions.col(e) = uInvG.col(e) - uInvW[e] * deltaIntrinsics;
+    }
+}
+
+bool MultiEpochGeoCalFitter::iteration(double &lambda, const double &maxLambda, bool verbose) {
+
+    // Compute the model and chi-square prior to parameter update
+    double chi2prev = getChi2();
+
+    computeNormalEquations();
+
+    // Copy initial parameters so we can restore them if necessary
+    initIntrinsics = intrinsics;
+    initQuaternions = quaternions;
+
+    // Exit status
+    bool done = true;
+
+    // Search for a good step
+    do {
+        solveDampedNormalEquations(lambda);
+
+        intrinsics += deltaIntrinsics;
+        quaternions += deltaQuaternions;
+        for(unsigned int e=0; e<epochs.size(); e++) {
+            quaternions.col(e).normalize();
+        }
+
+        double chi2 = getChi2();
+
+        // if rrise is negative, then current residuals are lower than those found on previous step
+        double rrise = (chi2-chi2prev)/chi2;
+
+        if (rrise < -1E-32) {
+            // Good step! Want more iterations.
+            done = false;
+            lambda /= 10.0;
+            break;
+        }
+
+        // Restore the parameters prior to the step
+        intrinsics = initIntrinsics;
+        quaternions = initQuaternions;
+
+        if (fabs(rrise) < 1E-32) {
+            // Residuals changed by a very small amount; we appear to be at the minimum
+            if(verbose) {
+                fprintf(stderr, "MultiEpochGeoCalFitter: Residual threshold exceeded\n");
+            }
+            break;
+        }
+
+        // Bad step (residuals increased)! Try again with larger damping.
+        lambda *= 10.0;
+    }
+    while (lambda<=maxLambda);
+
+    if(lambda>maxLambda && verbose) {
+        fprintf(stderr, "MultiEpochGeoCalFitter: Damping threshold exceeded (%f > %f)\n", lambda, maxLambda);
+    }
+
+    return done;
+}
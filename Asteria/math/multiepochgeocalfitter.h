@@ -0,0 +1,192 @@
+#ifndef MULTIEPOCHGEOCALFITTER_H
+#define MULTIEPOCHGEOCALFITTER_H
+
+#include "math/geocalfitter.h"
+#include "optics/cameramodelbase.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <Eigen/Dense>
+
+class CalibrationInventory;
+
+/**
+ * @brief The MultiEpochGeoCalFitter class performs a joint fit of the geometric calibration to the cross-matches
+ * from many calibrations (epochs), sharing the intrinsic parameters of the camera across all epochs while fitting
+ * one orientation quaternion per epoch. This constrains the camera model far better than any single calibration,
+ * particularly the distortion terms.
+ *
+ * The normal equations have a block-sparse (arrowhead) structure: each epoch contributes a 4x4 block for its
+ * quaternion, a 4xK block coupling it to the K intrinsic parameters and a KxK block to the intrinsic parameters,
+ * with no coupling between the quaternions of different epochs. The damped normal equations are solved by
+ * eliminating the quaternion blocks (Schur complement), which leaves a dense KxK system for the intrinsic
+ * parameters; the cost of each iteration is linear in the number of epochs.
+ *
+ * Each epoch is represented internally by a GeoCalFitter that shares the camera model, and which is used to
+ * compute the model, the weighted residuals and the normal equations for that epoch.
+ */
+class MultiEpochGeoCalFitter
+{
+public:
+
+    MultiEpochGeoCalFitter(CameraModelBase * cam);
+
+    /**
+     * @brief Pointer to the camera model that is being fitted; contains initial guess values for the intrinsic
+     * parameters of the camera, which are shared by all epochs.
+     */
+    CameraModelBase * cam;
+
+    /**
+     * @brief Flag indicating whether to evaluate the model and Jacobian using the compile-time specialised camera
+     * model kernels where the type of camera model permits. The epochs are processed in parallel if so.
+     */
+    bool useCameraModelKernels;
+
+    /**
+     * @brief Add the cross-matches from one epoch to the fit.
+     * @param q_sez_cam
+     *  Pointer to the quaternion defining the orientation of the CAM frame with respect to the SEZ frame for this
+     * epoch; contains the initial guess value and on exit from fit(unsigned int, bool) the fitted value.
+     * @param xms
+     *  Pointer to a vector containing the Source / ReferenceStar cross-matches for this epoch.
+     * @param gmst
+     *  Greenwich mean sidereal time of the epoch.
+     * @param lon
+     *  Longitude of the observing site [radians]
+     * @param lat
+     *  Latitude of the observing site [radians]
+     */
+    void addEpoch(Eigen::Quaterniond * q_sez_cam, std::vector<std::pair<Source, ReferenceStar>> * xms, const double &gmst,
+                  const double &lon, const double &lat);
+
+    /**
+     * @brief Add the cross-matches from a calibration to the fit. The fitted orientation is written to the
+     * quaternion of the calibration; the camera model of the calibration is not used.
+     * @param inv
+     *  The calibration.
+     */
+    void addEpoch(CalibrationInventory &inv);
+
+    /**
+     * @brief Get the number of epochs in the fit.
+     */
+    unsigned int getNumEpochs() const;
+
+    /**
+     * @brief Perform the fit, then write the fitted parameters to the camera model and quaternions and
+     * update the projected positions of the cross-matched reference stars.
+     * @param maxIterations  Maximum number of allowed iteration before convergence.
+     * @param verbose        Enables verbose logging
+     */
+    void fit(unsigned int maxIterations, bool verbose);
+
+    /**
+     * @brief Chi-square statistic summed over all epochs, for the current parameters.
+     */
+    double getChi2();
+
+    /**
+     * @brief Degrees of freedom of the fit.
+     */
+    double getDOF();
+
+    /**
+     * @brief Reduced Chi-square statistic.
+     */
+    double getReducedChi2();
+
+private:
+
+    /**
+     * @brief Fitters for the individual epochs; the parameters of each are the quaternion for the epoch followed
+     * by the (shared) intrinsic parameters.
+     */
+    std::vector<std::unique_ptr<GeoCalFitter>> epochs;
+
+    /**
+     * @brief Number of intrinsic parameters of the camera model.
+     */
+    unsigned int K;
+
+    /**
+     * @brief Kx1 vector of the current intrinsic parameters, and a copy of the parameters prior to an update.
+     */
+    VectorXd intrinsics;
+    VectorXd initIntrinsics;
+
+    /**
+     * @brief Current quaternion parameters of each epoch (4xE, one column per epoch), and a copy of the
+     * parameters prior to an update.
+     */
+    MatrixXd quaternions;
+    MatrixXd initQuaternions;
+
+    /**
+     * @brief KxK sum over the epochs of the intrinsic block of the normal matrix, and Kx1 sum of the intrinsic
+     * part of the right hand side.
+     */
+    MatrixXd V;
+    VectorXd g;
+
+    /**
+     * @brief KxK reduced (Schur complement) normal matrix and Kx1 right hand side for the intrinsic parameters,
+     * and the Kx1 intrinsic parameters update.
+     */
+    MatrixXd S;
+    VectorXd s;
+    VectorXd deltaIntrinsics;
+
+    /**
+     * @brief Update to the quaternion parameters of each epoch (4xE).
+     */
+    MatrixXd deltaQuaternions;
+
+    /**
+     * @brief For each epoch, the inverse of the damped quaternion block of the normal matrix applied to the
+     * quaternion/intrinsic coupling block (4xK) and to the quaternion part of the right hand side (columns of
+     * the 4xE matrix). These are needed to recover the quaternion updates once the intrinsic update is known.
+     */
+    std::vector<Matrix<double, 4, Dynamic>> uInvW;
+    MatrixXd uInvG;
+
+    /**
+     * @brief Decompositions used to solve the reduced normal equations; as in the LevenbergMarquardtSolver, the
+     * QR is used as a fallback when the reduced normal matrix is not numerically positive definite.
+     */
+    LDLT<MatrixXd> ldlt;
+    ColPivHouseholderQR<MatrixXd> qr;
+
+    /**
+     * @brief Load the current parameters into the fitter for each epoch.
+     */
+    void loadParameters();
+
+    /**
+     * @brief Call the function for each epoch, in parallel if the camera model kernels are used (in which case
+     * the epochs don't modify the shared camera model).
+     */
+    void forEachEpoch(const std::function<void(unsigned int)> &func);
+
+    /**
+     * @brief Compute the normal equations for each epoch at the current parameters, and accumulate the intrinsic
+     * blocks into V and g.
+     */
+    void computeNormalEquations();
+
+    /**
+     * @brief Solve the damped normal equations for the parameter update by eliminating the quaternion blocks.
+     * @param lambda Current value of the damping parameter
+     */
+    void solveDampedNormalEquations(const double &lambda);
+
+    /**
+     * @brief Each call performs one iteration of parameters; see LevenbergMarquardtSolver::iteration(...).
+     */
+    bool iteration(double &lambda, const double &maxLambda, bool verbose);
+
+};
+
+#endif // MULTIEPOCHGEOCALFITTER_H
@@ -3,6 +3,19 @@
 #include "optics/pinholecamera.h"
 #include "optics/pinholecamerawithradialdistortion.h"
 #include "optics/pinholecamerawithsipdistortion.h"
+#include "optics/inversedistortionmap.h"
+#include "util/parallelutil.h"
+
+#include <algorithm>             // min, max
+
+// Minimum number of vectors to give each thread in projectVectors(...); below this the cost of
+// starting the threads outweighs the gain.
+static const unsigned int minVectorsPerThread = 16384;
+
+// Number of vectors passed to each call of projectVectorBlock(...) in projectVectors(...)
+static const unsigned int vectorsPerBlock = 1024;
+
+constexpr double CameraModelBase::inverseDistortionMapAccuracy;
 
 const std::vector<CameraModelBase::CameraModelType> CameraModelBase::cameraModelTypes = {PINHOLECAMERA, PINHOLECAMERAWITHRADIALDISTORTION, PINHOLECAMERAWITHSIPDISTORTION};
 
@@ -25,3 +38,33 @@ CameraModelBase * CameraModelBase::getCameraModelFromEnum(const CameraModelType
     case PINHOLECAMERAWITHSIPDISTORTION: return new PinholeCameraWithSipDistortion();
     }
 }
+
+void CameraModelBase::projectVectors(const Eigen::Matrix3Xd & r_cam, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible, unsigned int nThreads) const {
+
+    unsigned int n = r_cam.cols();
+    i.resize(n);
+    j.resize(n);
+    visible.resize(n);
+
+    if(nThreads == 0) {
+        nThreads = ParallelUtil::getDefaultThreads();
+    }
+    nThreads = std::max(1u, std::min(nThreads, n / minVectorsPerThread));
+
+    // Each thread processes its share of the vectors in small blocks, so that the intermediate arrays stay in cache
+    ParallelUtil::forEachRowBand(n, nThreads, [&](unsigned int start, unsigned int end) {
+        for(unsigned int first = start; first < end; first += vectorsPerBlock) {
+            projectVectorBlock(r_cam, first, std::min(vectorsPerBlock, end - first), i, j, visible);
+        }
+    });
+}
+
+void CameraModelBase::projectVectorBlock(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible) const {
+    for(unsigned int v = first; v < first + n; v++) {
+        visible[v] = projectVector(r_cam.col(v), i[v], j[v]);
+    }
+}
+
+void CameraModelBase::buildInverseDistortionMap() {
+
+}
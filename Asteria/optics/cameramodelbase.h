@@ -4,9 +4,11 @@
 #include "util/serializationutil.h"
 
 #include <vector>
+#include <memory>
 
 #include <Eigen/Dense>
 
+class InverseDistortionMap;
 class PinholeCamera;
 class PinholeCameraWithRadialDistortion;
 class PinholeCameraWithSipDistortion;
@@ -35,7 +37,7 @@ public:
      */
     CameraModelBase(const unsigned int &width, const unsigned int &height);
 
-    ~CameraModelBase();
+    virtual ~CameraModelBase();
 
     /**
      * @brief The CameraModelType enum enumerates the available types of camera model.
@@ -171,6 +173,50 @@ public:
 	 */
     virtual bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const =0;
 
+    /**
+     * @brief Array of visibility flags for the batch projection functions.
+     */
+    typedef Eigen::Array<bool, Eigen::Dynamic, 1> ArrayXb;
+
+    /**
+     * @brief Project a set of camera frame position vectors into the image plane. This is equivalent to calling
+     * projectVector(...) for each vector, but much faster for large numbers of vectors such as the stars in a
+     * reference catalogue. The work can optionally be split across several threads.
+     *
+     * @param r_cam
+     *  Camera frame position vectors, one per column.
+     * @param i
+     *  On exit, contains the i image coordinates [pixels]
+     * @param j
+     *  On exit, contains the j image coordinates [pixels]
+     * @param visible
+     *  On exit, contains flags stating whether each projected point is within the visible image area; see
+     * projectVector(...).
+     * @param nThreads
+     *  The maximum number of threads to use, including the calling thread; 0 selects the number of hardware threads.
+     */
+    void projectVectors(const Eigen::Matrix3Xd & r_cam, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible, unsigned int nThreads = 1) const;
+
+    /**
+     * @brief Project a contiguous block of camera frame position vectors into the image plane. This is used by
+     * projectVectors(...) to process each thread's share of the vectors; the default implementation calls
+     * projectVector(...) for each vector, and derived classes override it with vectorised implementations.
+     *
+     * @param r_cam
+     *  Camera frame position vectors, one per column.
+     * @param first
+     *  Index of the first vector (column) in the block.
+     * @param n
+     *  Number of vectors in the block.
+     * @param i
+     *  Elements [first:first+n) are set to the i image coordinates [pixels]
+     * @param j
+     *  Elements [first:first+n) are set to the j image coordinates [pixels]
+     * @param visible
+     *  Elements [first:first+n) are set to the visibility flags.
+     */
+    virtual void projectVectorBlock(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible) const;
+
     /**
      * @brief Get the principal point of the camera, i.e. the point where the camera boresight intersects
      * the image, also the projection of the camera centre.
@@ -197,6 +243,21 @@ public:
      */
     virtual void init() =0;
 
+    /**
+     * @brief Accuracy of the interpolated inverse distortion offsets in the map built by
+     * buildInverseDistortionMap() [pixels]
+     */
+    static constexpr double inverseDistortionMapAccuracy = 0.001;
+
+    /**
+     * @brief Tabulate the inverse distortion offsets across the image, so that deprojectPixel(...) can
+     * interpolate them rather than iteratively inverting the distortion model for every point. This is
+     * worthwhile once the parameters are fixed, e.g. when a calibration is loaded; the map is discarded
+     * by init() whenever the parameters change. The default implementation does nothing, for camera
+     * models without distortion.
+     */
+    virtual void buildInverseDistortionMap();
+
     /**
      * @brief Returns the name of the camera model implemented by the derived class.
      * @return
@@ -204,6 +265,15 @@ public:
      */
     virtual std::string getModelName() const =0;
 
+protected:
+
+    /**
+     * @brief Lookup table of the inverse distortion offsets, if one has been built.
+     */
+    std::shared_ptr<InverseDistortionMap> inverseDistortionMap;
+
+public:
+
     friend class boost::serialization::access;
     template <typename Archive>
     void serialize(Archive &ar, const unsigned int version) {
@@ -0,0 +1,362 @@
+#ifndef CAMERAMODELKERNELS_H
+#define CAMERAMODELKERNELS_H
+
+#include "util/coordinateutil.h"
+
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Dense>
+
+/**
+ * @brief The PinholeCameraKernelBase class is the base for the compile-time specialised versions of
+ * the pinhole camera models (the 'kernels'). The kernels hold a copy of the parameters of a camera model
+ * and implement the projection and the partial derivatives without virtual functions and with fixed-size
+ * Eigen types, so that loops over many stars can be fully inlined. The polymorphic camera models delegate
+ * to the kernels, and GeoCalFitter uses them directly in its inner loops.
+ *
+ * The parts common to all the pinhole models are implemented here; the derived class provides the
+ * distortion model through the following functions (curiously recurring template pattern):
+ *
+ * bool applyDistortion(const double &i, const double &j, double &ip, double &jp) const;
+ *  Get the distorted image coordinates (ip, jp) of the ideal (undistorted) image coordinates (i, j), and
+ * return whether the ideal point lies within the valid range of the distortion model.
+ *
+ * void getNormalisedPartialDerivatives(const double &x, const double &y, Eigen::Matrix2d &dij_dxy, IntrinsicPartials &intrinsic) const;
+ *  Get the partial derivatives of the distorted image coordinates with respect to the normalised image
+ * coordinates (x, y) = (X/Z, Y/Z), and with respect to the intrinsic parameters, at the point (x, y).
+ *
+ * @param Derived
+ *  The derived kernel class.
+ * @param NumParameters
+ *  The number of intrinsic parameters of the camera model.
+ */
+template <class Derived, int NumParameters>
+class PinholeCameraKernelBase {
+
+public:
+
+    /**
+     * @brief Number of intrinsic parameters of the camera model.
+     */
+    static const int numParameters = NumParameters;
+
+    /**
+     * @brief Partial derivatives of the (i,j) coordinates (rows) with respect to the intrinsic parameters (columns).
+     * The column-major storage matches the layout used by CameraModelBase::getIntrinsicPartialDerivatives(...).
+     */
+    typedef Eigen::Matrix<double, 2, NumParameters> IntrinsicPartials;
+
+    /**
+     * @brief Partial derivatives of the (i,j) coordinates (rows) with respect to the quaternion elements (columns).
+     * The column-major storage matches the layout used by CameraModelBase::getExtrinsicPartialDerivatives(...).
+     */
+    typedef Eigen::Matrix<double, 2, 4> ExtrinsicPartials;
+
+    /**
+     * @brief Main constructor for the PinholeCameraKernelBase.
+     * @param width
+     *  Width of the detector [pixels]
+     * @param height
+     *  Height of the detector [pixels]
+     * @param params
+     *  Pointer to the parameters of the camera model, in the order used by CameraModelBase::getParameters(...);
+     * the first four are the focal lengths and principal point.
+     */
+    PinholeCameraKernelBase(const double &width, const double &height, const double * params) :
+        width(width), height(height), fi(params[0]), fj(params[1]), pi(params[2]), pj(params[3]) {
+    }
+
+    /**
+     * @brief Width and height of the detector [pixels]
+     */
+    double width, height;
+
+    /**
+     * @brief Focal lengths [pixels]
+     */
+    double fi, fj;
+
+    /**
+     * @brief Coordinates of the principal point [pixels]
+     */
+    double pi, pj;
+
+    /**
+     * @brief Project the given camera frame position vector into the image plane; see CameraModelBase::projectVector(...).
+     */
+    bool projectVector(const Eigen::Vector3d & r_cam, double & ip, double & jp) const {
+
+        // Project to ideal (undistorted) image coordinates; equivalent to multiplying by the camera
+        // matrix then dividing by the third element
+        double i = (fi * r_cam[0] + pi * r_cam[2]) / r_cam[2];
+        double j = (fj * r_cam[1] + pj * r_cam[2]) / r_cam[2];
+
+        bool valid = derived().applyDistortion(i, j, ip, jp);
+
+        // Ray in front of the camera, ideal point within the range of the distortion model and
+        // distorted point within the image area
+        return r_cam[2] >= 0.0 && valid && ip >= 0.0 && ip <= width && jp >= 0.0 && jp <= height;
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to the intrinsic parameters.
+     * @param r_cam
+     *  Position vector of the point in the CAM frame.
+     * @param intrinsic
+     *  On exit, contains the partial derivatives.
+     */
+    void getIntrinsicPartialDerivatives(const Eigen::Vector3d & r_cam, IntrinsicPartials & intrinsic) const {
+        Eigen::Matrix2d dij_dxy;
+        derived().getNormalisedPartialDerivatives(r_cam[0] / r_cam[2], r_cam[1] / r_cam[2], dij_dxy, intrinsic);
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to the elements of the quaternion
+     * that specifies the orientation of the camera.
+     * @param r_sez
+     *  Position vector of the point in the SEZ frame.
+     * @param q_sez_cam
+     *  The unit quaternion that rotates vectors from the SEZ frame to the CAM frame.
+     * @param extrinsic
+     *  On exit, contains the partial derivatives.
+     */
+    void getExtrinsicPartialDerivatives(const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam, ExtrinsicPartials & extrinsic) const {
+        Eigen::Vector3d r_cam = q_sez_cam.toRotationMatrix() * r_sez;
+        Eigen::Matrix<double, 3, 4> dr_cam_dq;
+        getSezToCamPartials(r_sez, q_sez_cam, dr_cam_dq);
+        IntrinsicPartials intrinsic;
+        getPartialDerivatives(r_cam, dr_cam_dq, intrinsic, extrinsic);
+    }
+
+    /**
+     * @brief Get the partial derivatives of the (i,j) coordinates with respect to both the intrinsic and extrinsic
+     * parameters in a single pass.
+     * @param r_cam
+     *  Position vector of the point in the CAM frame.
+     * @param dr_cam_dq
+     *  Partial derivatives of the CAM frame position vector (rows) with respect to the quaternion elements (columns).
+     * @param intrinsic
+     *  On exit, contains the partial derivatives with respect to the intrinsic parameters.
+     * @param extrinsic
+     *  On exit, contains the partial derivatives with respect to the quaternion elements.
+     */
+    void getPartialDerivatives(const Eigen::Vector3d & r_cam, const Eigen::Matrix<double, 3, 4> & dr_cam_dq,
+                               IntrinsicPartials & intrinsic, ExtrinsicPartials & extrinsic) const {
+
+        double x = r_cam[0] / r_cam[2];
+        double y = r_cam[1] / r_cam[2];
+
+        Eigen::Matrix2d dij_dxy;
+        derived().getNormalisedPartialDerivatives(x, y, dij_dxy, intrinsic);
+
+        // Partial derivatives of the normalised image coordinates with respect to the quaternion elements
+        Eigen::Matrix<double, 2, 4> dxy_dq;
+        dxy_dq.row(0) = (dr_cam_dq.row(0) - x * dr_cam_dq.row(2)) / r_cam[2];
+        dxy_dq.row(1) = (dr_cam_dq.row(1) - y * dr_cam_dq.row(2)) / r_cam[2];
+
+        extrinsic.noalias() = dij_dxy * dxy_dq;
+    }
+
+    /**
+     * @brief Get the partial derivatives of the CAM frame position vector with respect to the quaternion elements;
+     * see CoordinateUtil::getSezToCamPartials(...).
+     */
+    static void getSezToCamPartials(const Eigen::Vector3d & r_sez, const Eigen::Quaterniond & q_sez_cam, Eigen::Matrix<double, 3, 4> & dr_cam_dq) {
+        Eigen::Vector3d dr_cam_dq0, dr_cam_dq1, dr_cam_dq2, dr_cam_dq3;
+        CoordinateUtil::getSezToCamPartials(r_sez, q_sez_cam, dr_cam_dq0, dr_cam_dq1, dr_cam_dq2, dr_cam_dq3);
+        dr_cam_dq << dr_cam_dq0, dr_cam_dq1, dr_cam_dq2, dr_cam_dq3;
+    }
+
+protected:
+
+    const Derived & derived() const {
+        return static_cast<const Derived &>(*this);
+    }
+};
+
+/**
+ * @brief Kernel for the PinholeCamera.
+ */
+class PinholeCameraKernel : public PinholeCameraKernelBase<PinholeCameraKernel, 4> {
+
+public:
+
+    PinholeCameraKernel(const double &width, const double &height, const double * params) :
+        PinholeCameraKernelBase<PinholeCameraKernel, 4>(width, height, params) {
+    }
+
+    bool applyDistortion(const double &i, const double &j, double &ip, double &jp) const {
+        ip = i;
+        jp = j;
+        return true;
+    }
+
+    void getNormalisedPartialDerivatives(const double &x, const double &y, Eigen::Matrix2d &dij_dxy, IntrinsicPartials &intrinsic) const {
+
+        // i = fi * x + pi
+        // j = fj * y + pj
+        dij_dxy << fi,  0.0,
+                   0.0, fj;
+
+        // Columns: fi, fj, pi, pj
+        intrinsic << x,   0.0, 1.0, 0.0,
+                     0.0, y,   0.0, 1.0;
+    }
+};
+
+/**
+ * @brief Kernel for the PinholeCameraWithRadialDistortion.
+ */
+class PinholeCameraWithRadialDistortionKernel : public PinholeCameraKernelBase<PinholeCameraWithRadialDistortionKernel, 6> {
+
+public:
+
+    /**
+     * @brief Main constructor for the PinholeCameraWithRadialDistortionKernel.
+     * @param width
+     *  Width of the detector [pixels]
+     * @param height
+     *  Height of the detector [pixels]
+     * @param params
+     *  Pointer to the parameters of the camera model, in the order used by PinholeCameraWithRadialDistortion::getParameters(...)
+     * @param r_max
+     *  Threshold on the radial distance of ideal points from the distortion centre [pixels]; see PinholeCameraWithRadialDistortion::r_max.
+     * This only affects the visibility of projected points.
+     */
+    PinholeCameraWithRadialDistortionKernel(const double &width, const double &height, const double * params,
+                                            const double &r_max = std::numeric_limits<double>::infinity()) :
+        PinholeCameraKernelBase<PinholeCameraWithRadialDistortionKernel, 6>(width, height, params), k1(params[4]), k2(params[5]), r_max(r_max) {
+    }
+
+    double k1, k2, r_max;
+
+    /**
+     * @brief Get the displacement of the distorted image coordinates from the ideal image coordinates;
+     * see PinholeCameraWithRadialDistortion::getForwardDistortionOffset(...).
+     */
+    void getForwardDistortionOffset(const double &i, const double &j, double &di, double &dj) const {
+
+        double r = std::sqrt(((i-pi)/fi)*((i-pi)/fi) + ((j-pj)/fj)*((j-pj)/fj));
+
+        di = (k1 * r + k2 * r * r) * (i - pi);
+        dj = (k1 * r + k2 * r * r) * (j - pj);
+    }
+
+    bool applyDistortion(const double &i, const double &j, double &ip, double &jp) const {
+        double di, dj;
+        getForwardDistortionOffset(i, j, di, dj);
+        ip = i + di;
+        jp = j + dj;
+        return std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj)) <= r_max;
+    }
+
+    void getNormalisedPartialDerivatives(const double &x, const double &y, Eigen::Matrix2d &dij_dxy, IntrinsicPartials &intrinsic) const {
+
+        // i = fi * x * (1 + C) + pi
+        // j = fj * y * (1 + C) + pj
+        // where C = k1 * r + k2 * r^2 and r = sqrt(x^2 + y^2)
+        double r = std::sqrt(x*x + y*y);
+        double c = k1 * r + k2 * r * r;
+
+        // dC/dr divided by r; this is multiplied by terms that are second order in x & y so
+        // the limit at the distortion centre is zero
+        double dc_r = r > 0.0 ? (k1 + 2.0 * k2 * r) / r : 0.0;
+
+        dij_dxy << fi * (1.0 + c + x * x * dc_r), fi * x * y * dc_r,
+                   fj * x * y * dc_r,             fj * (1.0 + c + y * y * dc_r);
+
+        // Columns: fi, fj, pi, pj, k1, k2
+        intrinsic << x * (1.0 + c), 0.0,           1.0, 0.0, fi * x * r, fi * x * r * r,
+                     0.0,           y * (1.0 + c), 0.0, 1.0, fj * y * r, fj * y * r * r;
+    }
+};
+
+/**
+ * @brief Kernel for the PinholeCameraWithSipDistortion.
+ */
+class PinholeCameraWithSipDistortionKernel : public PinholeCameraKernelBase<PinholeCameraWithSipDistortionKernel, 18> {
+
+public:
+
+    /**
+     * @brief Main constructor for the PinholeCameraWithSipDistortionKernel.
+     * @param width
+     *  Width of the detector [pixels]
+     * @param height
+     *  Height of the detector [pixels]
+     * @param params
+     *  Pointer to the parameters of the camera model, in the order used by PinholeCameraWithSipDistortion::getParameters(...)
+     * @param r_max
+     *  Threshold on the radial distance of ideal points from the distortion centre [pixels]; see PinholeCameraWithSipDistortion::r_max.
+     * This only affects the visibility of projected points.
+     */
+    PinholeCameraWithSipDistortionKernel(const double &width, const double &height, const double * params,
+                                         const double &r_max = std::numeric_limits<double>::infinity()) :
+        PinholeCameraKernelBase<PinholeCameraWithSipDistortionKernel, 18>(width, height, params),
+        d0(params[4]), d1(params[5]), d2(params[6]), d3(params[7]), d4(params[8]), d5(params[9]), d6(params[10]),
+        e0(params[11]), e1(params[12]), e2(params[13]), e3(params[14]), e4(params[15]), e5(params[16]), e6(params[17]), r_max(r_max) {
+    }
+
+    double d0, d1, d2, d3, d4, d5, d6;
+    double e0, e1, e2, e3, e4, e5, e6;
+    double r_max;
+
+    /**
+     * @brief Get the displacement of the distorted image coordinates from the ideal image coordinates;
+     * see PinholeCameraWithSipDistortion::getForwardDistortionOffset(...).
+     */
+    void getForwardDistortionOffset(const double &i, const double &j, double &di, double &dj) const {
+
+        double ii = i - pi;
+        double jj = j - pj;
+
+        di = d0*ii*ii + d1*jj*jj + d2*ii*jj + d3*ii*ii*jj + d4*ii*jj*jj + d5*ii*ii*ii + d6*jj*jj*jj;
+        dj = e0*ii*ii + e1*jj*jj + e2*ii*jj + e3*ii*ii*jj + e4*ii*jj*jj + e5*ii*ii*ii + e6*jj*jj*jj;
+    }
+
+    bool applyDistortion(const double &i, const double &j, double &ip, double &jp) const {
+        double di, dj;
+        getForwardDistortionOffset(i, j, di, dj);
+        ip = i + di;
+        jp = j + dj;
+        return std::sqrt((i-pi)*(i-pi) + (j-pj)*(j-pj)) <= r_max;
+    }
+
+    void getNormalisedPartialDerivatives(const double &x, const double &y, Eigen::Matrix2d &dij_dxy, IntrinsicPartials &intrinsic) const {
+
+        // i = ii + D(ii, jj) + pi
+        // j = jj + E(ii, jj) + pj
+        // where ii = fi * x and jj = fj * y, and D & E are the SIP polynomials
+        double ii = fi * x;
+        double jj = fj * y;
+        double ii2 = ii * ii;
+        double jj2 = jj * jj;
+        double iijj = ii * jj;
+
+        double dD_dii = 2.0*d0*ii + d2*jj + 2.0*d3*iijj + d4*jj2 + 3.0*d5*ii2;
+        double dD_djj = 2.0*d1*jj + d2*ii + d3*ii2 + 2.0*d4*iijj + 3.0*d6*jj2;
+        double dE_dii = 2.0*e0*ii + e2*jj + 2.0*e3*iijj + e4*jj2 + 3.0*e5*ii2;
+        double dE_djj = 2.0*e1*jj + e2*ii + e3*ii2 + 2.0*e4*iijj + 3.0*e6*jj2;
+
+        dij_dxy << fi * (1.0 + dD_dii), fj * dD_djj,
+                   fi * dE_dii,         fj * (1.0 + dE_djj);
+
+        // Columns: fi, fj, pi, pj, d0 ... d6, e0 ... e6
+        intrinsic.setZero();
+        intrinsic(0, 0) = x * (1.0 + dD_dii);
+        intrinsic(1, 0) = x * dE_dii;
+        intrinsic(0, 1) = y * dD_djj;
+        intrinsic(1, 1) = y * (1.0 + dE_djj);
+        intrinsic(0, 2) = 1.0;
+        intrinsic(1, 3) = 1.0;
+
+        double monomials[7] = {ii2, jj2, iijj, ii2*jj, ii*jj2, ii2*ii, jj2*jj};
+        for(unsigned int k=0; k<7; k++) {
+            intrinsic(0, 4 + k) = monomials[k];
+            intrinsic(1, 11 + k) = monomials[k];
+        }
+    }
+};
+
+#endif // CAMERAMODELKERNELS_H
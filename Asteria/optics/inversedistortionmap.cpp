@@ -0,0 +1,89 @@
+#include "optics/inversedistortionmap.h"
+
+#include <cmath>
+#include <algorithm>
+#include <stdio.h>
+
+// Initial and minimum spacing of the grid nodes [pixels]
+static const double initialStep = 16.0;
+static const double minStep = 0.5;
+
+InverseDistortionMap::InverseDistortionMap(const unsigned int &width, const unsigned int &height, const double &accuracy,
+                                           const std::function<void(const double &, const double &, double &, double &)> &inverse)
+    : width(width), height(height), step(initialStep), nI(0), nJ(0) {
+
+    for(double s = initialStep; ; s /= 2.0) {
+
+        tabulate(s, inverse);
+
+        // Measure the interpolation error at the centre of each cell, where it's largest
+        double maxErr = 0.0;
+        for(unsigned int cj=0; cj<nJ-1; cj++) {
+            for(unsigned int ci=0; ci<nI-1; ci++) {
+                double ip = std::min((ci + 0.5) * step, this->width);
+                double jp = std::min((cj + 0.5) * step, this->height);
+                double dip, djp, dipMap, djpMap;
+                inverse(ip, jp, dip, djp);
+                getInverseDistortionOffset(ip, jp, dipMap, djpMap);
+                maxErr = std::max(maxErr, std::max(std::abs(dip - dipMap), std::abs(djp - djpMap)));
+            }
+        }
+
+        if(maxErr <= accuracy) {
+            break;
+        }
+        if(s / 2.0 < minStep) {
+            fprintf(stderr, "InverseDistortionMap: interpolation error %f exceeds requested accuracy %f at minimum grid spacing\n", maxErr, accuracy);
+            break;
+        }
+    }
+}
+
+void InverseDistortionMap::tabulate(const double &step, const std::function<void(const double &, const double &, double &, double &)> &inverse) {
+
+    this->step = step;
+
+    // Grid nodes are placed at multiples of the step, extending to the far edges of the image
+    nI = (unsigned int)std::ceil(width / step) + 1;
+    nJ = (unsigned int)std::ceil(height / step) + 1;
+    nI = std::max(nI, 2u);
+    nJ = std::max(nJ, 2u);
+
+    dI.resize(nI * nJ);
+    dJ.resize(nI * nJ);
+
+    for(unsigned int j=0; j<nJ; j++) {
+        for(unsigned int i=0; i<nI; i++) {
+            inverse(i * step, j * step, dI[j * nI + i], dJ[j * nI + i]);
+        }
+    }
+}
+
+bool InverseDistortionMap::getInverseDistortionOffset(const double &ip, const double &jp, double &dip, double &djp) const {
+
+    if(!(ip >= 0.0 && ip <= width && jp >= 0.0 && jp <= height)) {
+        return false;
+    }
+
+    // Find the cell containing the point, and the fractional position within it
+    double fi = ip / step;
+    double fj = jp / step;
+    unsigned int ci = std::min((unsigned int)fi, nI - 2);
+    unsigned int cj = std::min((unsigned int)fj, nJ - 2);
+    double ti = fi - ci;
+    double tj = fj - cj;
+
+    unsigned int n00 = cj * nI + ci;
+    unsigned int n01 = n00 + 1;
+    unsigned int n10 = n00 + nI;
+    unsigned int n11 = n10 + 1;
+
+    dip = (1.0 - tj) * ((1.0 - ti) * dI[n00] + ti * dI[n01]) + tj * ((1.0 - ti) * dI[n10] + ti * dI[n11]);
+    djp = (1.0 - tj) * ((1.0 - ti) * dJ[n00] + ti * dJ[n01]) + tj * ((1.0 - ti) * dJ[n10] + ti * dJ[n11]);
+
+    return true;
+}
+
+double InverseDistortionMap::getStep() const {
+    return step;
+}
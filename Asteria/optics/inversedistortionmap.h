@@ -0,0 +1,87 @@
+#ifndef INVERSEDISTORTIONMAP_H
+#define INVERSEDISTORTIONMAP_H
+
+#include <vector>
+#include <functional>
+
+/**
+ * @brief The InverseDistortionMap class provides a lookup table of the inverse distortion offsets for
+ * a camera model, so that distorted image coordinates can be corrected without the iterative inversion
+ * of the forward distortion model.
+ *
+ * The offsets are tabulated on a regular grid of nodes spanning the image area and bilinearly interpolated
+ * between them. The spacing of the nodes is halved until the interpolation error measured at the centre of
+ * each grid cell is within the requested accuracy. Points outside the image area are not covered by the map.
+ */
+class InverseDistortionMap
+{
+
+public:
+
+    /**
+     * @brief Main constructor for the InverseDistortionMap.
+     * @param width
+     *  Width of the detector [pixels]
+     * @param height
+     *  Height of the detector [pixels]
+     * @param accuracy
+     *  Required accuracy of the interpolated offsets [pixels]
+     * @param inverse
+     *  Function that computes the exact inverse distortion offsets (dip, djp) at the distorted pixel coordinates (ip, jp).
+     */
+    InverseDistortionMap(const unsigned int &width, const unsigned int &height, const double &accuracy,
+                         const std::function<void(const double &, const double &, double &, double &)> &inverse);
+
+    /**
+     * @brief Interpolate the displacement from the observed (distorted) pixel coordinate (ip, jp) of the
+     * ideal (undistorted) pixel coordinate (i, j).
+     *
+     * @param ip
+     *  The observed (distorted) pixel coordinate i^prime
+     * @param jp
+     *  The observed (distorted) pixel coordinate j^prime
+     * @param dip
+     *  On exit, contains the displacement between the observed (distorted) pixel coordinate i^prime and the ideal (undistorted) pixel coordinate i
+     * @param djp
+     *  On exit, contains the displacement between the observed (distorted) pixel coordinate j^prime and the ideal (undistorted) pixel coordinate j
+     * @return
+     *  True if the point lies within the map; otherwise the offsets are not set.
+     */
+    bool getInverseDistortionOffset(const double &ip, const double &jp, double &dip, double &djp) const;
+
+    /**
+     * @brief Get the spacing of the grid nodes.
+     * @return
+     *  The spacing of the grid nodes [pixels]
+     */
+    double getStep() const;
+
+private:
+
+    /**
+     * @brief Tabulate the offsets at the grid nodes for the given node spacing.
+     */
+    void tabulate(const double &step, const std::function<void(const double &, const double &, double &, double &)> &inverse);
+
+    /**
+     * @brief Extent of the map [pixels]
+     */
+    double width, height;
+
+    /**
+     * @brief Spacing of the grid nodes [pixels]
+     */
+    double step;
+
+    /**
+     * @brief Number of grid nodes along each axis.
+     */
+    unsigned int nI, nJ;
+
+    /**
+     * @brief Inverse distortion offsets at the grid nodes (row-packed) [pixels]
+     */
+    std::vector<double> dI, dJ;
+};
+
+#endif // INVERSEDISTORTIONMAP_H
@@ -1,7 +1,6 @@
 #include "optics/pinholecamera.h"
 #include "optics/pinholecamerawithradialdistortion.h"
 #include "optics/pinholecamerawithsipdistortion.h"
-#include "util/coordinateutil.h"
 
 BOOST_CLASS_EXPORT(PinholeCamera)
 
@@ -69,61 +68,24 @@ void PinholeCamera::setParameters(const double *params) {
 }
 
 void PinholeCamera::getIntrinsicPartialDerivatives(double * derivs, const Eigen::Vector3d & r_cam) const {
-    // di/dfi
-    derivs[0] = r_cam[0] / r_cam[2];
-    // dj/dfi
-    derivs[1] = 0.0;
-    // di/dfj
-    derivs[2] = 0.0;
-    // dj/dfj
-    derivs[3] = r_cam[1] / r_cam[2];
-    // di/dpi
-    derivs[4] = 1.0;
-    // dj/dpi
-    derivs[5] = 0.0;
-    // di/dpj
-    derivs[6] = 0.0;
-    // dj/dpj
-    derivs[7] = 1.0;
+    PinholeCameraKernel::IntrinsicPartials intrinsic;
+    getKernel().getIntrinsicPartialDerivatives(r_cam, intrinsic);
+    Eigen::Map<PinholeCameraKernel::IntrinsicPartials> result(derivs);
+    result = intrinsic;
 }
 
 void PinholeCamera::getExtrinsicPartialDerivatives(double *derivs, const Eigen::Vector3d &r_sez, const Quaterniond &q_sez_cam) const {
-
-    // Get the position vector in the camera frame
-    Matrix3d r_sez_cam = q_sez_cam.toRotationMatrix();
-    Eigen::Vector3d r_cam = r_sez_cam * r_sez;
-    double x_cam = r_cam[0];
-    double y_cam = r_cam[1];
-    double z_cam = r_cam[2];
-
-    // Get the partial derivatives of the position vector elements with respect to the quaternion elements
-    Eigen::Vector3d dr_cam_dq0;
-    Eigen::Vector3d dr_cam_dq1;
-    Eigen::Vector3d dr_cam_dq2;
-    Eigen::Vector3d dr_cam_dq3;
-
-    CoordinateUtil::getSezToCamPartials(r_sez, q_sez_cam, dr_cam_dq0, dr_cam_dq1, dr_cam_dq2, dr_cam_dq3);
-
-    double z_cam2 = z_cam * z_cam;
-
-    // di/dq0
-    derivs[0] = (fi/z_cam2) * (z_cam * dr_cam_dq0[0] - x_cam * dr_cam_dq0[2]);
-    // dj/dq0
-    derivs[1] = (fj/z_cam2) * (z_cam * dr_cam_dq0[1] - y_cam * dr_cam_dq0[2]);
-    // di/dq1
-    derivs[2] = (fi/z_cam2) * (z_cam * dr_cam_dq1[0] - x_cam * dr_cam_dq1[2]);
-    // dj/dq1
-    derivs[3] = (fj/z_cam2) * (z_cam * dr_cam_dq1[1] - y_cam * dr_cam_dq1[2]);
-    // di/dq2
-    derivs[4] = (fi/z_cam2) * (z_cam * dr_cam_dq2[0] - x_cam * dr_cam_dq2[2]);
-    // dj/dq2
-    derivs[5] = (fj/z_cam2) * (z_cam * dr_cam_dq2[1] - y_cam * dr_cam_dq2[2]);
-    // di/dq3
-    derivs[6] = (fi/z_cam2) * (z_cam * dr_cam_dq3[0] - x_cam * dr_cam_dq3[2]);
-    // dj/dq3
-    derivs[7] = (fj/z_cam2) * (z_cam * dr_cam_dq3[1] - y_cam * dr_cam_dq3[2]);
+    PinholeCameraKernel::ExtrinsicPartials extrinsic;
+    getKernel().getExtrinsicPartialDerivatives(r_sez, q_sez_cam, extrinsic);
+    Eigen::Map<PinholeCameraKernel::ExtrinsicPartials> result(derivs);
+    result = extrinsic;
 }
 
+PinholeCameraKernel PinholeCamera::getKernel() const {
+    double params[4];
+    PinholeCamera::getParameters(params);
+    return PinholeCameraKernel(width, height, params);
+}
 
 Eigen::Vector3d PinholeCamera::deprojectPixel(const double & i, const double & j) const {
     // Homogenous vector of the image plane coordinates
@@ -137,26 +99,25 @@ Eigen::Vector3d PinholeCamera::deprojectPixel(const double & i, const double & j
 }
 
 bool PinholeCamera::projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const {
-    // Project into image coordinates
-    Eigen::Vector3d r_im = k * r_cam;
-    i = r_im[0] / r_im[2];
-    j = r_im[1] / r_im[2];
-
+    return getKernel().projectVector(r_cam, i, j);
+}
 
-    // Determine visibility
+void PinholeCamera::projectVectorBlock(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible) const {
 
-    if(r_cam[2] < 0.0) {
-        // Ray is behind the camera
-        return false;
-    }
+    // Project into image coordinates
+    projectVectorBlockUndistorted(r_cam, first, n, i, j);
 
-    if(i<0 || i>width || j<0 || j>height) {
-        // Projected point is outside the image area
-        return false;
-    }
+    // Determine visibility: ray in front of the camera and projected point within the image area. The tests are
+    // combined into a single comparison, which is much faster than combining the results of separate comparisons.
+    visible.segment(first, n) = r_cam.block(2, first, 1, n).transpose().array().min(i.segment(first, n)).min((double)width - i.segment(first, n))
+            .min(j.segment(first, n)).min((double)height - j.segment(first, n)) >= 0.0;
+}
 
-    // Visibility checks passed
-    return true;
+void PinholeCamera::projectVectorBlockUndistorted(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j) const {
+    // Equivalent to multiplying by the camera matrix k then dividing by the third element
+    Eigen::ArrayXd z = r_cam.block(2, first, 1, n).transpose().array();
+    i.segment(first, n) = (fi * r_cam.block(0, first, 1, n).transpose().array() + pi * z) / z;
+    j.segment(first, n) = (fj * r_cam.block(1, first, 1, n).transpose().array() + pj * z) / z;
 }
 
 void PinholeCamera::getPrincipalPoint(double &pi, double &pj) const {
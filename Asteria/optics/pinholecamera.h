@@ -2,6 +2,7 @@
 #define PINHOLECAMERA_H
 
 #include "optics/cameramodelbase.h"
+#include "optics/cameramodelkernels.h"
 
 class PinholeCamera : public CameraModelBase {
 
@@ -95,6 +96,8 @@ public:
 
     bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const;
 
+    void projectVectorBlock(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible) const;
+
     void getPrincipalPoint(double &pi, double &pj) const;
 
     void zoom(double &factor);
@@ -103,6 +106,14 @@ public:
 
     std::string getModelName() const;
 
+    /**
+     * @brief Get the compile-time specialised version of the camera model, which implements the projection
+     * and partial derivatives for the current parameters without virtual dispatch; see cameramodelkernels.h.
+     * @return
+     *  The kernel for the camera model.
+     */
+    PinholeCameraKernel getKernel() const;
+
     friend class boost::serialization::access;
     template<class Archive>
     void serialize(Archive & ar, const unsigned int version) {
@@ -114,6 +125,26 @@ public:
         this->init();
     }
 
+protected:
+
+    /**
+     * @brief Project a contiguous block of camera frame position vectors to ideal (undistorted) image
+     * coordinates, without determining their visibility. This is shared by the projectVectorBlock(...)
+     * implementations of the pinhole camera models.
+     *
+     * @param r_cam
+     *  Camera frame position vectors, one per column.
+     * @param first
+     *  Index of the first vector (column) in the block.
+     * @param n
+     *  Number of vectors in the block.
+     * @param i
+     *  Elements [first:first+n) are set to the i image coordinates [pixels]
+     * @param j
+     *  Elements [first:first+n) are set to the j image coordinates [pixels]
+     */
+    void projectVectorBlockUndistorted(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j) const;
+
 };
 
 #endif // PINHOLECAMERA_H
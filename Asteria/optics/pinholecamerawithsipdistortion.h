@@ -82,10 +82,22 @@ public:
 
     bool projectVector(const Eigen::Vector3d & r_cam, double & i, double & j) const;
 
+    void projectVectorBlock(const Eigen::Matrix3Xd & r_cam, unsigned int first, unsigned int n, Eigen::ArrayXd & i, Eigen::ArrayXd & j, ArrayXb & visible) const;
+
     std::string getModelName() const;
 
     void init();
 
+    void buildInverseDistortionMap();
+
+    /**
+     * @brief Get the compile-time specialised version of the camera model, which implements the projection
+     * and partial derivatives for the current parameters without virtual dispatch; see cameramodelkernels.h.
+     * @return
+     *  The kernel for the camera model.
+     */
+    PinholeCameraWithSipDistortionKernel getKernel() const;
+
     /**
      * @brief This function returns the displacement from the ideal (undistorted) pixel coordinate (i, j)
      * of the observed (distorted) pixel coordinate (ip, jp) given the distortion model for the camera.
@@ -118,35 +130,6 @@ public:
      */
     void getInverseDistortionOffset(const double &ip, const double &jp, double &dip, double &djp, const double tol) const;
 
-    /**
-     * @brief Get the partial derivatives of the distortion offset in (i,j) with respect to each of
-     * the intrinsic parameters of the camera model.
-     *
-     * @param derivs
-     *  Pointer to the start of the array of double values that on exit will contain the partial
-     * derivatives of the distortion offset in (i,j) with respect to the intrinsic parameters of the geometric
-     * @param r_cam
-     *  Position vector of the point in the CAM frame.
-     */
-    void getForwardDistortionIntrinsicPartialDerivatives(double * derivs, const Eigen::Vector3d & r_cam) const;
-
-    /**
-     * @brief Get the partial derivatives of the distortion offset in (i,j) with respect to each of
-     * the extrinsic parameters of the camera model, being the four quaternion elements that
-     * specify the orientation of the camera in the external frame.
-     *
-     * @param derivs
-     *  Pointer to the start of the array of double values that on exit will contain the partial
-     * derivatives of the distortion offset in (i,j) with respect to the extrinsic parameters. There are
-     * eight elements, being the derivatives of the distortion offset in (i,j) with respect to the four
-     * quaternion elements.
-     * @param r_sez
-     *  Position vector of the point in the SEZ frame.
-     * @param q_sez_cam
-     *  The unit quaternion that rotates vectors from the SEZ frame to the CAM frame.
-     */
-    void getForwardDistortionExtrinsicPartialDerivatives(double *derivs, const Eigen::Vector3d & r_sez, const Eigen::Quaterniond &q_sez_cam) const;
-
     template<class Archive>
     void serialize(Archive & ar, const unsigned int version) {
         ar & BOOST_SERIALIZATION_BASE_OBJECT_NVP(PinholeCamera);
@@ -53,28 +53,6 @@ public:
      *  True if the path points to a regular file, false otherwise (non-existant / not a regular file).
      */
     static bool fileExists(std::string path);
-
-    /**
-     * @brief Maps the contents of the event or calibration directories by time. The events and calibration
-     * directories are structured according to e.g.
-     *
-     * 2017/
-     *  - 03/
-     *     - 13/
-     *        - 2018-03-13T22:27:41.891Z/
-     *
-     * This function walks the directory tree and builds a map of the full paths to the leaf nodes (the
-     * 2018-03-13T22:27:41.891Z directories) by event/calibration time in milliseconds since 1970. This is useful
-     * in locating the most recent calibration and in building the models of the analysis and calibration
-     * directory contents for the GUI.
-     *
-     * @param rootPath
-     *  The top level directory
-     * @return
-     *  A map of the full paths to the leaf nodes (the 2018-03-13T22:27:41.891Z directories) by
-     * event/calibration time in milliseconds since 1970.
-     */
-    static std::map<long long, std::string> mapVideoDirectory(std::string rootPath);
 };
 
 #endif
@@ -0,0 +1,259 @@
+#include "framediffutil.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define FRAMEDIFF_X86
+    #include <immintrin.h>
+#endif
+
+// Signatures of the kernels, used to dispatch to the best one for the CPU
+typedef unsigned int (*CountKernel)(const unsigned char *, const unsigned char *, const unsigned int, const unsigned char);
+typedef unsigned int (*ListKernel)(const unsigned char *, const unsigned char *, const unsigned int, const unsigned char,
+                                   std::vector<unsigned int> &, std::vector<unsigned int> &);
+
+FrameDiffUtil::FrameDiffUtil() {
+
+}
+
+namespace {
+
+    // Scalar versions, that process pixels in the range [start:end). Also used to handle
+    // the remainder pixels in the vectorised kernels.
+
+    unsigned int countScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int start, const unsigned int end, const unsigned char threshold) {
+        unsigned int nChanged = 0;
+        for(unsigned int p = start; p < end; p++) {
+            int diff = (int)newImage[p] - (int)oldImage[p];
+            if(std::abs(diff) > threshold) {
+                nChanged++;
+            }
+        }
+        return nChanged;
+    }
+
+    void listScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int start, const unsigned int end, const unsigned char threshold,
+                    std::vector<unsigned int> &positive, std::vector<unsigned int> &negative) {
+        for(unsigned int p = start; p < end; p++) {
+            int diff = (int)newImage[p] - (int)oldImage[p];
+            if(diff > threshold) {
+                positive.push_back(p);
+            }
+            else if(-diff > threshold) {
+                negative.push_back(p);
+            }
+        }
+    }
+
+    unsigned int countKernelScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned char threshold) {
+        return countScalar(newImage, oldImage, 0u, nPix, threshold);
+    }
+
+    unsigned int listKernelScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned char threshold,
+                                  std::vector<unsigned int> &positive, std::vector<unsigned int> &negative) {
+        listScalar(newImage, oldImage, 0u, nPix, threshold, positive, negative);
+        return positive.size() + negative.size();
+    }
+
+#ifdef FRAMEDIFF_X86
+
+    /**
+     * Appends the indices of the set bits in the mask, offset by p, to the vector.
+     */
+    inline void appendSetBits(unsigned int mask, const unsigned int p, std::vector<unsigned int> &indices) {
+        while(mask) {
+            indices.push_back(p + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    // Vectorised kernels. The absolute difference |a-b| of unsigned bytes is computed as the bitwise OR of the saturating
+    // differences (a-b) and (b-a), only one of which can be non-zero. The difference exceeds the threshold if the saturating
+    // difference (|a-b| - threshold) is non-zero. Counts are accumulated in 8-bit lanes for at most 255 iterations before
+    // being summed into 64-bit lanes with the SAD instruction.
+
+    __attribute__((target("sse2")))
+    unsigned int countKernelSse2(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned char threshold) {
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i thresh = _mm_set1_epi8((char)threshold);
+
+        // Number of unchanged pixels, in two 64-bit lanes
+        __m128i unchanged = zero;
+
+        unsigned int nBlocks = nPix / 16;
+        unsigned int p = 0;
+
+        while(nBlocks > 0) {
+            unsigned int n = std::min(nBlocks, 255u);
+            nBlocks -= n;
+            __m128i acc = zero;
+            for(unsigned int b = 0; b < n; b++, p += 16) {
+                __m128i a = _mm_loadu_si128((const __m128i *)(newImage + p));
+                __m128i c = _mm_loadu_si128((const __m128i *)(oldImage + p));
+                __m128i absDiff = _mm_or_si128(_mm_subs_epu8(a, c), _mm_subs_epu8(c, a));
+                // 0xFF in lanes where the difference does not exceed the threshold
+                __m128i same = _mm_cmpeq_epi8(_mm_subs_epu8(absDiff, thresh), zero);
+                acc = _mm_sub_epi8(acc, same);
+            }
+            unchanged = _mm_add_epi64(unchanged, _mm_sad_epu8(acc, zero));
+        }
+
+        unsigned int nUnchanged = (unsigned int)(_mm_cvtsi128_si32(unchanged) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(unchanged, unchanged)));
+
+        return (p - nUnchanged) + countScalar(newImage, oldImage, p, nPix, threshold);
+    }
+
+    __attribute__((target("sse2")))
+    unsigned int listKernelSse2(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned char threshold,
+                                std::vector<unsigned int> &positive, std::vector<unsigned int> &negative) {
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i thresh = _mm_set1_epi8((char)threshold);
+
+        unsigned int p = 0;
+        for(; p + 16 <= nPix; p += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(newImage + p));
+            __m128i c = _mm_loadu_si128((const __m128i *)(oldImage + p));
+            __m128i pos = _mm_subs_epu8(_mm_subs_epu8(a, c), thresh);
+            __m128i neg = _mm_subs_epu8(_mm_subs_epu8(c, a), thresh);
+            unsigned int posMask = (~_mm_movemask_epi8(_mm_cmpeq_epi8(pos, zero))) & 0xFFFF;
+            unsigned int negMask = (~_mm_movemask_epi8(_mm_cmpeq_epi8(neg, zero))) & 0xFFFF;
+            appendSetBits(posMask, p, positive);
+            appendSetBits(negMask, p, negative);
+        }
+        listScalar(newImage, oldImage, p, nPix, threshold, positive, negative);
+
+        return positive.size() + negative.size();
+    }
+
+    __attribute__((target("avx2")))
+    unsigned int countKernelAvx2(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned char threshold) {
+
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i thresh = _mm256_set1_epi8((char)threshold);
+
+        // Number of unchanged pixels, in four 64-bit lanes
+        __m256i unchanged = zero;
+
+        unsigned int nBlocks = nPix / 32;
+        unsigned int p = 0;
+
+        while(nBlocks > 0) {
+            unsigned int n = std::min(nBlocks, 255u);
+            nBlocks -= n;
+            __m256i acc = zero;
+            for(unsigned int b = 0; b < n; b++, p += 32) {
+                __m256i a = _mm256_loadu_si256((const __m256i *)(newImage + p));
+                __m256i c = _mm256_loadu_si256((const __m256i *)(oldImage + p));
+                __m256i absDiff = _mm256_or_si256(_mm256_subs_epu8(a, c), _mm256_subs_epu8(c, a));
+                __m256i same = _mm256_cmpeq_epi8(_mm256_subs_epu8(absDiff, thresh), zero);
+                acc = _mm256_sub_epi8(acc, same);
+            }
+            unchanged = _mm256_add_epi64(unchanged, _mm256_sad_epu8(acc, zero));
+        }
+
+        unsigned long long lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, unchanged);
+        unsigned int nUnchanged = (unsigned int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+        return (p - nUnchanged) + countScalar(newImage, oldImage, p, nPix, threshold);
+    }
+
+    __attribute__((target("avx2")))
+    unsigned int listKernelAvx2(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned char threshold,
+                                std::vector<unsigned int> &positive, std::vector<unsigned int> &negative) {
+
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i thresh = _mm256_set1_epi8((char)threshold);
+
+        unsigned int p = 0;
+        for(; p + 32 <= nPix; p += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(newImage + p));
+            __m256i c = _mm256_loadu_si256((const __m256i *)(oldImage + p));
+            __m256i pos = _mm256_subs_epu8(_mm256_subs_epu8(a, c), thresh);
+            __m256i neg = _mm256_subs_epu8(_mm256_subs_epu8(c, a), thresh);
+            unsigned int posMask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(pos, zero));
+            unsigned int negMask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(neg, zero));
+            appendSetBits(posMask, p, positive);
+            appendSetBits(negMask, p, negative);
+        }
+        listScalar(newImage, oldImage, p, nPix, threshold, positive, negative);
+
+        return positive.size() + negative.size();
+    }
+
+#endif
+
+    /**
+     * Selects the kernels to use on this CPU.
+     */
+    struct KernelSelection {
+
+        CountKernel count;
+        ListKernel list;
+        std::string name;
+
+        KernelSelection() : count(countKernelScalar), list(listKernelScalar), name("scalar") {
+#ifdef FRAMEDIFF_X86
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx2")) {
+                count = countKernelAvx2;
+                list = listKernelAvx2;
+                name = "AVX2";
+            }
+            else if(__builtin_cpu_supports("sse2")) {
+                count = countKernelSse2;
+                list = listKernelSse2;
+                name = "SSE2";
+            }
+#endif
+        }
+    };
+
+    const KernelSelection &getKernels() {
+        // Initialised once on first use (thread safe in C++11)
+        static const KernelSelection kernels;
+        return kernels;
+    }
+}
+
+unsigned int FrameDiffUtil::countChangedPixels(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold) {
+    if(threshold >= 255u) {
+        // No difference can exceed the threshold
+        return 0u;
+    }
+    return getKernels().count(newImage, oldImage, nPix, (unsigned char)threshold);
+}
+
+unsigned int FrameDiffUtil::getChangedPixels(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold,
+                                             std::vector<unsigned int> &changedPixelsPositive, std::vector<unsigned int> &changedPixelsNegative) {
+    changedPixelsPositive.clear();
+    changedPixelsNegative.clear();
+    if(threshold >= 255u) {
+        return 0u;
+    }
+    return getKernels().list(newImage, oldImage, nPix, (unsigned char)threshold, changedPixelsPositive, changedPixelsNegative);
+}
+
+std::string FrameDiffUtil::getKernelName() {
+    return getKernels().name;
+}
+
+unsigned int FrameDiffUtil::countChangedPixelsScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold) {
+    if(threshold >= 255u) {
+        return 0u;
+    }
+    return countKernelScalar(newImage, oldImage, nPix, (unsigned char)threshold);
+}
+
+unsigned int FrameDiffUtil::getChangedPixelsScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold,
+                                                   std::vector<unsigned int> &changedPixelsPositive, std::vector<unsigned int> &changedPixelsNegative) {
+    changedPixelsPositive.clear();
+    changedPixelsNegative.clear();
+    if(threshold >= 255u) {
+        return 0u;
+    }
+    return listKernelScalar(newImage, oldImage, nPix, (unsigned char)threshold, changedPixelsPositive, changedPixelsNegative);
+}
@@ -0,0 +1,75 @@
+#ifndef FRAMEDIFFUTIL_H
+#define FRAMEDIFFUTIL_H
+
+#include <vector>
+#include <string>
+
+/**
+ * @brief Kernels used to detect pixels that have changed significantly between two consecutive frames.
+ *
+ * A pixel is considered changed if the absolute difference in the 8-bit pixel values is greater than
+ * the threshold. The differences are computed with saturating unsigned-byte arithmetic, and are vectorised
+ * with AVX2 or SSE2 where the CPU supports them; the best available kernel is selected at runtime, with
+ * a scalar fallback for other platforms. All kernels produce identical results.
+ */
+class FrameDiffUtil
+{
+public:
+    FrameDiffUtil();
+
+    /**
+     * @brief Count the pixels that have changed significantly between two images.
+     * @param newImage
+     *  Pointer to the pixels of the later image.
+     * @param oldImage
+     *  Pointer to the pixels of the earlier image.
+     * @param nPix
+     *  The number of pixels in each image.
+     * @param threshold
+     *  Pixels with an absolute change greater than this are counted.
+     * @return
+     *  The number of changed pixels.
+     */
+    static unsigned int countChangedPixels(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold);
+
+    /**
+     * @brief Get the indices of the pixels that have changed significantly between two images. This is more
+     * expensive than countChangedPixels(...) and should only be used when the indices are required.
+     * @param newImage
+     *  Pointer to the pixels of the later image.
+     * @param oldImage
+     *  Pointer to the pixels of the earlier image.
+     * @param nPix
+     *  The number of pixels in each image.
+     * @param threshold
+     *  Pixels with an absolute change greater than this are recorded.
+     * @param changedPixelsPositive
+     *  On exit, contains the indices (in ascending order) of the pixels that got significantly brighter.
+     * @param changedPixelsNegative
+     *  On exit, contains the indices (in ascending order) of the pixels that got significantly darker.
+     * @return
+     *  The number of changed pixels.
+     */
+    static unsigned int getChangedPixels(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold,
+                                         std::vector<unsigned int> &changedPixelsPositive, std::vector<unsigned int> &changedPixelsNegative);
+
+    /**
+     * @brief Get the name of the kernel selected for this CPU, for logging.
+     * @return
+     *  One of "AVX2", "SSE2" or "scalar".
+     */
+    static std::string getKernelName();
+
+    /**
+     * @brief Scalar implementation of countChangedPixels(...); exposed for testing the vectorised kernels.
+     */
+    static unsigned int countChangedPixelsScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold);
+
+    /**
+     * @brief Scalar implementation of getChangedPixels(...); exposed for testing the vectorised kernels.
+     */
+    static unsigned int getChangedPixelsScalar(const unsigned char * newImage, const unsigned char * oldImage, const unsigned int nPix, const unsigned int threshold,
+                                               std::vector<unsigned int> &changedPixelsPositive, std::vector<unsigned int> &changedPixelsNegative);
+};
+
+#endif // FRAMEDIFFUTIL_H
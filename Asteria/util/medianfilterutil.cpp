@@ -0,0 +1,229 @@
+#include "util/medianfilterutil.h"
+#include "util/mathutil.h"
+#include "util/parallelutil.h"
+
+#include <algorithm>            // min, max, fill
+#include <cmath>                // lround
+
+const std::vector<std::string> MedianFilterUtil::algorithmNames = {"sort", "histogram"};
+
+constexpr double MedianFilterUtil::histogramBinWidth;
+const unsigned int MedianFilterUtil::histogramBins;
+
+// Number of fine bins per coarse bin in the two-level histograms
+static const unsigned int fineBinsPerCoarseBin = 64;
+static const unsigned int coarseBins = MedianFilterUtil::histogramBins / fineBinsPerCoarseBin;
+
+MedianFilterUtil::MedianFilterUtil() {
+
+}
+
+MedianFilterUtil::Algorithm MedianFilterUtil::getAlgorithmFromName(const std::string &name) {
+    if(name.compare(algorithmNames[SORT]) == 0) {
+        return SORT;
+    }
+    return HISTOGRAM;
+}
+
+void MedianFilterUtil::medianFilter(const std::vector<double> &in, std::vector<double> &out, unsigned int width, unsigned int height,
+                                    unsigned int hw, Algorithm algorithm, unsigned int nThreads) {
+    switch(algorithm) {
+    case SORT:
+        medianFilterSort(in, out, width, height, hw);
+        break;
+    case HISTOGRAM:
+    default:
+        medianFilterHistogram(in, out, width, height, hw, nThreads);
+        break;
+    }
+}
+
+void MedianFilterUtil::medianFilterSort(const std::vector<double> &in, std::vector<double> &out, unsigned int width, unsigned int height,
+                                        unsigned int hw) {
+
+    out.resize(width * height);
+
+    for(unsigned int k=0; k<height; k++) {
+        for(unsigned int l=0; l<width; l++) {
+
+            // Compute the boundary of the window region
+            unsigned int k_min = std::max((int)k - (int)hw, 0);
+            unsigned int k_max = std::min((int)k + (int)hw, (int)height);
+            unsigned int l_min = std::max((int)l - (int)hw, 0);
+            unsigned int l_max = std::min((int)l + (int)hw, (int)width);
+
+            // Pixels within the window
+            std::vector<double> pixels;
+            for(unsigned int kp=k_min; kp<k_max; kp++) {
+                for(unsigned int lp=l_min; lp<l_max; lp++) {
+                    unsigned int pixIdx = kp*width + lp;
+                    pixels.push_back(in[pixIdx]);
+                }
+            }
+
+            // Get the median value in the window
+            double median = MathUtil::getMedian(pixels);
+
+            unsigned int pixIdx = k*width + l;
+            out[pixIdx] = median;
+        }
+    }
+}
+
+void MedianFilterUtil::medianFilterHistogram(const std::vector<double> &in, std::vector<double> &out, unsigned int width, unsigned int height,
+                                             unsigned int hw, unsigned int nThreads) {
+
+    out.resize(width * height);
+
+    // Quantise the pixel values
+    std::vector<unsigned short> bins(width * height);
+    for(unsigned int p=0; p<width * height; p++) {
+        long bin = std::lround(in[p] / histogramBinWidth);
+        bins[p] = (unsigned short)std::min(std::max(bin, 0l), (long)histogramBins - 1);
+    }
+
+    ParallelUtil::forEachRowBand(height, nThreads, [&](unsigned int rowStart, unsigned int rowEnd) {
+        medianFilterHistogramRows(bins, out, width, height, hw, rowStart, rowEnd);
+    });
+}
+
+void MedianFilterUtil::medianFilterHistogramRows(const std::vector<unsigned short> &bins, std::vector<double> &out, unsigned int width,
+                                                 unsigned int height, unsigned int hw, unsigned int rowStart, unsigned int rowEnd) {
+
+    const int w = (int)width;
+    const int h = (int)height;
+    const int r = (int)hw;
+
+    // Histograms of the window rows in each column; fine and coarse levels
+    std::vector<unsigned short> colFine(width * histogramBins, 0);
+    std::vector<unsigned short> colCoarse(width * coarseBins, 0);
+
+    // Histogram of the whole window; the fine level of each coarse bin is only brought up to date
+    // when the median is found to lie in that coarse bin.
+    std::vector<unsigned int> fine(histogramBins);
+    std::vector<unsigned int> coarse(coarseBins);
+
+    // Column at which the fine level of each coarse bin was last brought up to date; -1 if it's not valid
+    std::vector<int> fineCol(coarseBins);
+
+    auto addPixel = [&](int k, int l) {
+        unsigned short bin = bins[k*w + l];
+        colFine[l*histogramBins + bin]++;
+        colCoarse[l*coarseBins + bin/fineBinsPerCoarseBin]++;
+    };
+    auto removePixel = [&](int k, int l) {
+        unsigned short bin = bins[k*w + l];
+        colFine[l*histogramBins + bin]--;
+        colCoarse[l*coarseBins + bin/fineBinsPerCoarseBin]--;
+    };
+
+    // Add or remove one column to/from the coarse and fine levels of the window histogram
+    auto addColumnCoarse = [&](int l, int sign) {
+        const unsigned short * col = &colCoarse[l*coarseBins];
+        for(unsigned int c=0; c<coarseBins; c++) {
+            coarse[c] += sign * col[c];
+        }
+    };
+    auto addColumnFine = [&](int l, unsigned int c, int sign) {
+        const unsigned short * col = &colFine[l*histogramBins + c*fineBinsPerCoarseBin];
+        unsigned int * f = &fine[c*fineBinsPerCoarseBin];
+        for(unsigned int b=0; b<fineBinsPerCoarseBin; b++) {
+            f[b] += sign * col[b];
+        }
+    };
+
+    // Bring the fine level of coarse bin c up to date with the window centred on column l
+    auto updateFine = [&](unsigned int c, int l) {
+        int p = fineCol[c];
+        if(p < 0 || l - p > r) {
+            // Cheaper to rebuild from the column histograms
+            std::fill(fine.begin() + c*fineBinsPerCoarseBin, fine.begin() + (c+1)*fineBinsPerCoarseBin, 0u);
+            for(int lp = std::max(l - r, 0); lp < std::min(l + r, w); lp++) {
+                addColumnFine(lp, c, 1);
+            }
+        }
+        else {
+            for(int q = p+1; q <= l; q++) {
+                if(q-1-r >= 0) {
+                    addColumnFine(q-1-r, c, -1);
+                }
+                if(q-1+r < w) {
+                    addColumnFine(q-1+r, c, 1);
+                }
+            }
+        }
+        fineCol[c] = l;
+    };
+
+    // Find the bin containing the pixel of the given rank (counting from zero) in the window centred on column l
+    auto findRank = [&](unsigned int rank, int l) {
+        unsigned int c = 0;
+        unsigned int cumulative = 0;
+        while(cumulative + coarse[c] <= rank) {
+            cumulative += coarse[c];
+            c++;
+        }
+        updateFine(c, l);
+        unsigned int b = c*fineBinsPerCoarseBin;
+        while(cumulative + fine[b] <= rank) {
+            cumulative += fine[b];
+            b++;
+        }
+        return b;
+    };
+
+    // Initialise the column histograms with the window for the first row of the band
+    for(int k = std::max((int)rowStart - r, 0); k < std::min((int)rowStart + r, h); k++) {
+        for(int l=0; l<w; l++) {
+            addPixel(k, l);
+        }
+    }
+
+    for(int k = (int)rowStart; k < (int)rowEnd; k++) {
+
+        // Slide the column histograms down one row
+        if(k > (int)rowStart) {
+            if(k-1-r >= 0) {
+                for(int l=0; l<w; l++) {
+                    removePixel(k-1-r, l);
+                }
+            }
+            if(k-1+r < h) {
+                for(int l=0; l<w; l++) {
+                    addPixel(k-1+r, l);
+                }
+            }
+        }
+
+        unsigned int nRows = std::min(k + r, h) - std::max(k - r, 0);
+
+        // Initialise the window histogram at the start of the row
+        std::fill(coarse.begin(), coarse.end(), 0u);
+        std::fill(fineCol.begin(), fineCol.end(), -1);
+        for(int l = 0; l < std::min(r, w); l++) {
+            addColumnCoarse(l, 1);
+        }
+
+        for(int l=0; l<w; l++) {
+
+            // Slide the window histogram along one column
+            if(l > 0) {
+                if(l-1-r >= 0) {
+                    addColumnCoarse(l-1-r, -1);
+                }
+                if(l-1+r < w) {
+                    addColumnCoarse(l-1+r, 1);
+                }
+            }
+
+            unsigned int nCols = std::min(l + r, w) - std::max(l - r, 0);
+            unsigned int n = nRows * nCols;
+
+            // Even number of elements - take average of central two; odd number - pick central one
+            unsigned int lower = findRank((n-1)/2, l);
+            unsigned int upper = (n % 2 == 0) ? findRank(n/2, l) : lower;
+
+            out[k*w + l] = (lower + upper) * histogramBinWidth / 2.0;
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef MEDIANFILTERUTIL_H
+#define MEDIANFILTERUTIL_H
+
+#include <vector>
+#include <string>
+
+/**
+ * @brief Sliding-window median filters, used to estimate the source-free background level in the calibration images.
+ *
+ * The window for the pixel at row k and column l covers rows [k-hw:k+hw) and columns [l-hw:l+hw), clipped to the
+ * image boundaries, where hw is the half-width. Two algorithms are provided:
+ *
+ * SORT      - collects and sorts the pixels in the window for every output pixel; O(hw^2 log hw) per pixel. This
+ *             is the original algorithm, retained for comparison.
+ * HISTOGRAM - quantises the pixel values into bins of width histogramBinWidth and maintains histograms of each
+ *             column of the window as it slides down the image, and of the whole window as it slides along each
+ *             row, using two-level (coarse and fine) histograms with lazily-updated fine levels so that the cost
+ *             per pixel is independent of the window size (Perreault & Hebert 2007, "Median filtering in constant
+ *             time"). The result differs from the SORT algorithm by at most half a bin width. Rows are processed
+ *             in parallel bands.
+ */
+class MedianFilterUtil
+{
+public:
+    MedianFilterUtil();
+
+    /**
+     * @brief Enumerates the median filter algorithms.
+     */
+    enum Algorithm{SORT, HISTOGRAM};
+    static const std::vector<std::string> algorithmNames;
+
+    /**
+     * @brief Get the Algorithm with the given name.
+     * @param name
+     *  The name of the algorithm, as listed in algorithmNames.
+     * @return
+     *  The Algorithm; HISTOGRAM if the name isn't recognised.
+     */
+    static Algorithm getAlgorithmFromName(const std::string &name);
+
+    /**
+     * @brief Width of the bins used to quantise the pixel values in the HISTOGRAM algorithm.
+     */
+    static constexpr double histogramBinWidth = 1.0 / 8.0;
+
+    /**
+     * @brief Number of bins used to quantise the pixel values in the HISTOGRAM algorithm; values outside the
+     * range [0:255] are clamped to the first or last bin.
+     */
+    static const unsigned int histogramBins = 2048;
+
+    /**
+     * @brief Apply a median filter to an image using the chosen algorithm.
+     * @param in
+     *  The input image pixels, in row-major order.
+     * @param out
+     *  On exit, contains the filtered image pixels.
+     * @param width
+     *  Width of the image [pixels]
+     * @param height
+     *  Height of the image [pixels]
+     * @param hw
+     *  Half-width of the window [pixels]
+     * @param algorithm
+     *  The algorithm to use.
+     * @param nThreads
+     *  The number of threads to use for the HISTOGRAM algorithm; 0 to use one per hardware thread.
+     */
+    static void medianFilter(const std::vector<double> &in, std::vector<double> &out, unsigned int width, unsigned int height,
+                             unsigned int hw, Algorithm algorithm, unsigned int nThreads = 0);
+
+    /**
+     * @brief Apply a median filter to an image by sorting the pixels in the window around each pixel.
+     * See medianFilter(...) for parameters.
+     */
+    static void medianFilterSort(const std::vector<double> &in, std::vector<double> &out, unsigned int width, unsigned int height,
+                                 unsigned int hw);
+
+    /**
+     * @brief Apply a median filter to an image using sliding histograms of the quantised pixel values.
+     * See medianFilter(...) for parameters.
+     */
+    static void medianFilterHistogram(const std::vector<double> &in, std::vector<double> &out, unsigned int width, unsigned int height,
+                                      unsigned int hw, unsigned int nThreads = 0);
+
+private:
+
+    /**
+     * @brief Apply the HISTOGRAM algorithm to a band of rows.
+     */
+    static void medianFilterHistogramRows(const std::vector<unsigned short> &bins, std::vector<double> &out, unsigned int width,
+                                          unsigned int height, unsigned int hw, unsigned int rowStart, unsigned int rowEnd);
+};
+
+#endif // MEDIANFILTERUTIL_H
@@ -0,0 +1,49 @@
+#include "util/parallelutil.h"
+
+#include <thread>
+#include <vector>
+#include <algorithm>            // min
+#include <functional>           // cref
+
+ParallelUtil::ParallelUtil() {
+
+}
+
+unsigned int ParallelUtil::getDefaultThreads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void ParallelUtil::forEachRowBand(unsigned int nRows, unsigned int nThreads, const std::function<void(unsigned int, unsigned int)> &band) {
+
+    if(nThreads == 0) {
+        nThreads = getDefaultThreads();
+    }
+    nThreads = std::min(nThreads, nRows);
+
+    if(nThreads <= 1) {
+        band(0, nRows);
+        return;
+    }
+
+    // Distribute the rows as evenly as possible; the first (nRows % nThreads) bands get one extra row
+    unsigned int rowsPerBand = nRows / nThreads;
+    unsigned int extraRows = nRows % nThreads;
+
+    std::vector<std::thread> threads;
+    threads.reserve(nThreads - 1);
+
+    unsigned int firstBandEnd = rowsPerBand + (extraRows > 0 ? 1 : 0);
+    unsigned int start = firstBandEnd;
+    for(unsigned int t = 1; t < nThreads; t++) {
+        unsigned int end = start + rowsPerBand + (t < extraRows ? 1 : 0);
+        threads.push_back(std::thread(std::cref(band), start, end));
+        start = end;
+    }
+
+    band(0, firstBandEnd);
+
+    for(std::thread &thread : threads) {
+        thread.join();
+    }
+}
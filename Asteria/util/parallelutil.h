@@ -0,0 +1,34 @@
+#ifndef PARALLELUTIL_H
+#define PARALLELUTIL_H
+
+#include <functional>
+
+/**
+ * @brief Helpers for splitting image processing work across threads.
+ */
+class ParallelUtil
+{
+public:
+    ParallelUtil();
+
+    /**
+     * @brief Get the default number of threads to use for parallel image processing.
+     * @return
+     *  The number of hardware threads, or 1 if that can't be determined.
+     */
+    static unsigned int getDefaultThreads();
+
+    /**
+     * @brief Split the rows of an image into contiguous bands and process each band in a separate thread.
+     * The calling thread processes the first band; the function returns once all bands have been processed.
+     * @param nRows
+     *  The number of rows in the image.
+     * @param nThreads
+     *  The maximum number of threads to use, including the calling thread; 0 selects getDefaultThreads().
+     * @param band
+     *  The function that processes a band, given the first row and one past the last row of the band.
+     */
+    static void forEachRowBand(unsigned int nRows, unsigned int nThreads, const std::function<void(unsigned int, unsigned int)> &band);
+};
+
+#endif // PARALLELUTIL_H
@@ -1,18 +1,22 @@
 #include "sourcedetector.h"
 
 #include <algorithm>
-#include <set>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
 
 SourceDetector::SourceDetector() {
 
 }
 
 /**
- * Main workhorse algorithm for source detection. The samples in the image are sorted into
- * descending order. The sources are gradually formed by either assigning an isolated sample
- * to a new source, or assigning a non-isolated sample to an existing source. The significance
- * of each source is measured by reference to the noise image and the background level. Sources
- * falling below the given significance threshold are culled.
+ * Main workhorse algorithm for source detection. Samples lying more than source_pixel_threshold_sigmas
+ * standard deviations above the background level are selected and sorted into descending order. The
+ * sources are gradually formed by either assigning an isolated sample to a new source, or assigning a
+ * non-isolated sample to an existing source. Samples that connect two or more existing sources are left
+ * unlabelled, so that the sources are deblended. The significance of each source is measured by reference
+ * to the noise image and the background level. Sources falling below the given significance threshold are
+ * culled.
  *
  * @param signal
  *            Vector of all pixel values; this is the measured image from which sources are to be extracted (row-packed) [ADU]
@@ -27,128 +31,121 @@ SourceDetector::SourceDetector() {
  * @param source_detection_threshold_sigmas
  *            Threshold for detection of significant sources, in terms of the number of standard deviations
  *            that the integrated flux lies above the background level [dimensionless].
+ * @param source_pixel_threshold_sigmas
+ *            Threshold for inclusion of individual samples in sources, in terms of the number of standard
+ *            deviations that the sample lies above the background level [dimensionless].
  * @return Vector containing the Sources detected in the window
  */
 std::vector<Source> SourceDetector::getSources(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
-                                               unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas) {
-
-    // Create an array and List of Samples. The array is used to get a sample for a given coordinate, and
-    // the list is used so that we can process the samples in intensity order
-    std::vector<Sample<double> *> sortedSamples;
-    std::vector<Sample<double> *> allSamples;
+                                               unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas,
+                                               double &source_pixel_threshold_sigmas) {
 
+    // Select the candidate samples that lie sufficiently far above the background
+    std::vector<unsigned int> candidates;
     for(unsigned int sIdx=0; sIdx<height * width; sIdx++) {
-        Sample<double> * sample = new Sample<double>(sIdx, width, signal[sIdx]);
-        allSamples.push_back(sample);
-        sortedSamples.push_back(sample);
+        if(signal[sIdx] - background[sIdx] > source_pixel_threshold_sigmas * noise[sIdx]) {
+            candidates.push_back(sIdx);
+        }
     }
 
-    // Sort the vector into order of decreasing intensity
-    std::sort(sortedSamples.begin(), sortedSamples.end(), Sample<double>::compareSamplePtrDecreasing);
+    // Sort the candidates into order of decreasing intensity
+    sortDecreasing(signal, candidates);
 
-    // Current source label; incremented each time a new source is found
-    unsigned int currentLabel = 1;
+    // Component label image; -1 indicates an unlabelled sample
+    std::vector<int> labels(height * width, -1);
 
-    // Process samples in decreasing order of intensity
-    for(unsigned int s=0; s<sortedSamples.size(); s++) {
+    Components components;
 
-        Sample<double> * sample = sortedSamples[s];
+    // Process samples in decreasing order of intensity
+    for(unsigned int sIdx : candidates) {
+
+        int x = sIdx % width;
+        int y = sIdx / width;
+
+        // Find the unique components among the eight neighbouring samples
+        int neighbourLabel = -1;
+        bool multipleLabels = false;
+        for(int dy = -1; dy < 2 && !multipleLabels; dy++) {
+            for(int dx = -1; dx < 2; dx++) {
+                int i = x + dx;
+                int j = y + dy;
+                // Don't compare the sample with itself, or with neighbours outside the image
+                if((dx==0 && dy==0) || i < 0 || i >= (int)width || j < 0 || j >= (int)height) {
+                    continue;
+                }
+                int label = labels[j * width + i];
+                if(label < 0 || label == neighbourLabel) {
+                    continue;
+                }
+                if(neighbourLabel >= 0) {
+                    multipleLabels = true;
+                    break;
+                }
+                neighbourLabel = label;
+            }
+        }
 
         // Is this sample
         // a) Isolated? If so, initialise a new source
         // b) Connected to an existing source? If so, give it the same label
         // c) Connected to more than one existing source? If so, leave it unlabelled
-        std::vector<unsigned int> neighbourLabels = getNeighbourUniqueLabels(sample, allSamples, width, height);
-
-        if(neighbourLabels.size()==0) {
-            // Isolated sample - initialise new source
-            sample->label = currentLabel;
-            currentLabel++;
+        unsigned int label;
+        if(multipleLabels) {
+            // Multiple labels! This is a faint sample sandwiched between two unconnected
+            // brighter samples - leave it unlabelled.
+            continue;
         }
-        else if(neighbourLabels.size()==1) {
-            // Neighbouring one source - connect the sample to it
-            sample->label = neighbourLabels.back();
+        else if(neighbourLabel < 0) {
+            // Isolated sample - initialise new source
+            label = components.add();
         }
         else {
-            // Multiple labels! This is a faint sample sandwiched between two unconnected
-            // brighter samples - leave it unlabelled.
+            // Neighbouring one source - connect the sample to it
+            label = neighbourLabel;
         }
+
+        labels[sIdx] = label;
+        components.addSample(label, signal[sIdx] - background[sIdx], noise[sIdx] * noise[sIdx], x, y);
     }
 
-    // Number of regions detected is indicated in the value of currentLabel.
-    // Now extract the samples for these regions into array
-    std::vector<Source> sources(currentLabel-1);
+    // Index of the output source for each component; -1 for components that aren't output
+    std::vector<int> sourceIndex(components.size(), -1);
 
-    // Assign each uniquely-labelled sample to the right source
-    for (Sample<double> * sample : allSamples) {
-        // Is Sample labelled?
-        if (sample->label != 0) {
-            sources[sample->label - 1].pixels.push_back(sample->index);
-        }
-    }
+    unsigned int nSources = 0;
+    unsigned int nSignificantSources = 0;
+    std::vector<Source> stellarSources;
 
-    std::vector<Source> significantSources;
+    // Post-process the sources to purge insignificant ones, and measure the flux-weighted sample dispersion
+    // matrix for each significant source.
+    for(unsigned int cIdx=0; cIdx<components.size(); cIdx++) {
 
-    // Post-process the sources to purge insignificant ones
-    for (unsigned int s=0; s<sources.size(); s++) {
+        nSources++;
 
-        Source source = sources[s];
+        Source source;
 
         // Integrated background-subtracted signal
-        source.adu = 0.0;
+        source.adu = components.s0[cIdx];
         // Uncertainty on that
-        source.sigma_adu = 0.0;
-        // Centre-of-flux
-        source.i = 0.0;
-        source.j = 0.0;
-
-        for(unsigned int sIdx : source.pixels) {
-            double adu = (double)signal[sIdx] - (double)background[sIdx];
-            source.adu += adu;
-            source.sigma_adu += noise[sIdx] * noise[sIdx];
-
-            unsigned int x = sIdx % width;
-            unsigned int y = sIdx / width;
-            source.i += ((double)x) * adu;
-            source.j += ((double)y) * adu;
-        }
-        source.sigma_adu = std::sqrt(source.sigma_adu);
-        source.i /= source.adu;
-        source.j /= source.adu;
+        source.sigma_adu = std::sqrt(components.var[cIdx]);
 
         // Detection significance of the source
         double sigmas = source.adu / source.sigma_adu;
-        if(sigmas > source_detection_threshold_sigmas) {
-            significantSources.push_back(source);
+        if(!(sigmas > source_detection_threshold_sigmas)) {
+            continue;
         }
-    }
-
-    std::vector<Source> stellarSources;
-
-    // Now measure the flux-weighted sample dispersion matrix for each source.
-    for (unsigned int s=0; s<significantSources.size(); s++) {
+        nSignificantSources++;
 
-        Source source = significantSources[s];
+        // Centre-of-flux
+        source.i = components.sx[cIdx] / source.adu;
+        source.j = components.sy[cIdx] / source.adu;
 
         // Compute the flux-weighted sample position dispersion matrix [pix],
         // as A =
         // [a b]
         // [b c]
-        double a = 0.0;
-        double b = 0.0;
-        double c = 0.0;
-
-        for(unsigned int sIdx : source.pixels) {
-
-            unsigned int x = sIdx % width;
-            unsigned int y = sIdx / width;
-
-            double weight = ((double)signal[sIdx] - (double)background[sIdx]) / source.adu;
-
-            a += (x - source.i) * (x - source.i) * weight;
-            b += (x - source.i) * (y - source.j) * weight;
-            c += (y - source.j) * (y - source.j) * weight;
-        }
+        double a = components.sxx[cIdx] / source.adu - source.i * source.i;
+        double b = components.sxy[cIdx] / source.adu - source.i * source.j;
+        double c = components.syy[cIdx] / source.adu - source.j * source.j;
 
         source.c_ii = a;
         source.c_ij = b;
@@ -203,62 +200,105 @@ std::vector<Source> SourceDetector::getSources(std::vector<double> &signal, std:
             source.orientation = std::atan(v_y / v_x);
         }
 
+        sourceIndex[cIdx] = stellarSources.size();
         stellarSources.push_back(source);
     }
 
-    fprintf(stderr, "Found %lu sources\n", sources.size());
-    fprintf(stderr, "Found %lu significant sources\n", significantSources.size());
+    // Assign each labelled sample to the right source
+    for(unsigned int sIdx=0; sIdx<height * width; sIdx++) {
+        if(labels[sIdx] >= 0) {
+            int s = sourceIndex[labels[sIdx]];
+            if(s >= 0) {
+                stellarSources[s].pixels.push_back(sIdx);
+            }
+        }
+    }
+
+    fprintf(stderr, "Found %u sources\n", nSources);
+    fprintf(stderr, "Found %u significant sources\n", nSignificantSources);
     fprintf(stderr, "Found %lu stellar sources\n", stellarSources.size());
 
     return stellarSources;
 }
 
 /**
- * @brief SourceDetector::getNeighbourUniqueLabels
- * Examines the labels assigned to the samples neighbouring the current one, and compiles the set of
- * unique labels (ignoring unlabelled, i.e. label=0, samples).
- * @param sample
- *  The central sample
- * @param samples
- *  A vector containing all the samples in the image
- * @param width
- *  The image width [pixels]
- * @param height
- *  The image height [pixels]
- * @return
- *  The set of unique labels found among the neighbouring samples; returned as a vector for ease of access.
+ * @brief Sorts the indices of a subset of values into order of decreasing value, using an LSD radix sort
+ * on the bit patterns of the values. Equal values keep their original order.
+ * @param values
+ *  The values
+ * @param indices
+ *  On entry, the indices of the values to sort; on exit, sorted into order of decreasing value.
  */
-std::vector<unsigned int> SourceDetector::getNeighbourUniqueLabels(Sample<double> *&sample, const std::vector<Sample<double> *> &samples, unsigned int &width, unsigned int &height) {
+void SourceDetector::sortDecreasing(const std::vector<double> &values, std::vector<unsigned int> &indices) {
+
+    unsigned int n = indices.size();
+
+    // Map the values to unsigned integer keys that sort in the reverse order to the values
+    std::vector<uint64_t> keys(n);
+    for(unsigned int s=0; s<n; s++) {
+        uint64_t bits;
+        std::memcpy(&bits, &values[indices[s]], sizeof(bits));
+        // Flip all the bits of negative values, and the sign bit of positive values, to get keys in
+        // increasing order, then invert them
+        bits = (bits & 0x8000000000000000ull) ? ~bits : (bits | 0x8000000000000000ull);
+        keys[s] = ~bits;
+    }
 
-    // Set of labels for the neighbouring samples
-    std::set<unsigned int> neighbourLabels;
+    std::vector<uint64_t> keysTmp(n);
+    std::vector<unsigned int> indicesTmp(n);
 
-    // Loop over eight neighbouring pixels
-    for(int di = -1; di < 2; di++) {
-        for(int dj = -1; dj < 2; dj++) {
-            if(di==0 && dj==0) {
-                // Don't compare the sample with itself!
-                continue;
-            }
-            // Coordinate of this neighbour
-            int i = sample->i + di;
-            int j = sample->j + dj;
+    // Counting sort on each byte in turn, from least to most significant
+    for(unsigned int shift=0; shift<64; shift+=8) {
 
-            // Is this neighbour outside of the image?
-            if (i < 0 || i >= width || j < 0 || j >= height) {
-                continue;
-            }
+        unsigned int counts[256] = {0};
+        for(unsigned int s=0; s<n; s++) {
+            counts[(keys[s] >> shift) & 0xFF]++;
+        }
 
-            unsigned int sIdx = j * width + i;
+        // Skip bytes that are the same for all keys
+        if(n == 0 || counts[(keys[0] >> shift) & 0xFF] == n) {
+            continue;
+        }
 
-            if(samples[sIdx]->label != 0) {
-                neighbourLabels.insert(samples[sIdx]->label);
-            }
+        unsigned int offset = 0;
+        for(unsigned int b=0; b<256; b++) {
+            unsigned int count = counts[b];
+            counts[b] = offset;
+            offset += count;
         }
+
+        for(unsigned int s=0; s<n; s++) {
+            unsigned int dest = counts[(keys[s] >> shift) & 0xFF]++;
+            keysTmp[dest] = keys[s];
+            indicesTmp[dest] = indices[s];
+        }
+        keys.swap(keysTmp);
+        indices.swap(indicesTmp);
     }
+}
 
-    // Read the set contents to a vector for ease of access later
-    std::vector<unsigned int> neighbourUniqueLabels(neighbourLabels.begin(), neighbourLabels.end());
+unsigned int SourceDetector::Components::add() {
+    unsigned int c = s0.size();
+    s0.push_back(0.0);
+    sx.push_back(0.0);
+    sy.push_back(0.0);
+    sxx.push_back(0.0);
+    sxy.push_back(0.0);
+    syy.push_back(0.0);
+    var.push_back(0.0);
+    return c;
+}
+
+unsigned int SourceDetector::Components::size() const {
+    return s0.size();
+}
 
-    return neighbourUniqueLabels;
+void SourceDetector::Components::addSample(unsigned int c, double adu, double variance, double x, double y) {
+    s0[c] += adu;
+    sx[c] += x * adu;
+    sy[c] += y * adu;
+    sxx[c] += x * x * adu;
+    sxy[c] += x * y * adu;
+    syy[c] += y * y * adu;
+    var[c] += variance;
 }
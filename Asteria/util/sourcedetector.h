@@ -2,10 +2,8 @@
 #define SOURCEDETECTOR_H
 
 #include "infra/source.h"
-#include "infra/sample.h"
 
 #include <vector>
-#include <set>
 
 class SourceDetector
 {
@@ -13,10 +11,31 @@ public:
     SourceDetector();
 
     static std::vector<Source> getSources(std::vector<double> &signal, std::vector<double> &background, std::vector<double> &noise,
-                                          unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas);
+                                          unsigned int &width, unsigned int &height, double &source_detection_threshold_sigmas,
+                                          double &source_pixel_threshold_sigmas);
 
 private:
-    static std::vector<unsigned int> getNeighbourUniqueLabels(Sample<double> *&sample, const std::vector<Sample<double> *> &samples, unsigned int &width, unsigned int &height);
+
+    /**
+     * @brief Running totals for the connected components formed during labelling, stored as a structure of arrays
+     * indexed by component.
+     */
+    struct Components {
+        // Sum of the background-subtracted samples [ADU]
+        std::vector<double> s0;
+        // First moments of the background-subtracted samples [ADU pixels]
+        std::vector<double> sx, sy;
+        // Second moments of the background-subtracted samples [ADU pixels^2]
+        std::vector<double> sxx, sxy, syy;
+        // Sum of the noise variance [ADU^2]
+        std::vector<double> var;
+
+        unsigned int add();
+        unsigned int size() const;
+        void addSample(unsigned int c, double adu, double variance, double x, double y);
+    };
+
+    static void sortDecreasing(const std::vector<double> &values, std::vector<unsigned int> &indices);
 };
 
 #endif // SOURCEDETECTOR_H
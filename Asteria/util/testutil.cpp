@@ -4,9 +4,42 @@
 #include "util/coordinateutil.h"
 #include "util/mathutil.h"
 #include "util/timeutil.h"
+#include "util/fileutil.h"
 #include "infra/imaged.h"
+#include "util/framediffutil.h"
+#include "infra/lockfreequeue.h"
+#include "infra/ringbuffer.h"
+#include "infra/pixelstatsaccumulator.h"
+#include "util/medianfilterutil.h"
+#include "util/sourcedetector.h"
+#include "util/parallelutil.h"
+#include "math/geocalfitter.h"
+#include "math/multiepochgeocalfitter.h"
+#include "infra/attitudetracker.h"
+#include "infra/asterismindex.h"
+#include "infra/clipfile.h"
+#include "infra/framecodec.h"
+#include "infra/videoencoder.h"
+#include "infra/archiveindex.h"
+#include "infra/eventcatalogue.h"
+#include "infra/platesolver.h"
+#include "infra/referencestarcatalogue.h"
+#include "infra/source.h"
+#include "optics/pinholecamera.h"
+#include "optics/pinholecamerawithradialdistortion.h"
+#include "optics/pinholecamerawithsipdistortion.h"
 
 #include <fstream>
+#include <random>
+#include <chrono>
+#include <sys/stat.h>
+#include <memory>
+#include <set>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <poll.h>
+#include <deque>
 
 #include <Eigen/Dense>
 
@@ -420,3 +453,1695 @@ void TestUtil::testImagedReadWrite() {
     }
 }
 
+
+/**
+ * @brief Tests the vectorised frame difference kernels against the scalar implementation, and
+ * compares their run times on a 1920x1080 image.
+ */
+void TestUtil::testFrameDifferenceKernels() {
+
+    // Odd image size so that the remainder pixels are handled by the scalar code
+    unsigned int nPix = 1921 * 1081;
+
+    // Random image, and a second image with mostly small differences and some large ones
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> pixel(0, 255);
+    std::uniform_int_distribution<int> noise(-2, 2);
+    std::vector<unsigned char> oldImage(nPix);
+    std::vector<unsigned char> newImage(nPix);
+    for(unsigned int p=0; p<nPix; p++) {
+        oldImage[p] = (unsigned char)pixel(gen);
+        newImage[p] = (p % 4 == 0) ? (unsigned char)pixel(gen) : (unsigned char)std::max(0, std::min(255, oldImage[p] + noise(gen)));
+    }
+
+    fprintf(stderr, "Using %s kernel\n", FrameDiffUtil::getKernelName().c_str());
+
+    unsigned int thresholds[] = {0u, 1u, 5u, 20u, 128u, 254u, 255u, 300u};
+    for(unsigned int threshold : thresholds) {
+        std::vector<unsigned int> pos, neg, posScalar, negScalar;
+        unsigned int count = FrameDiffUtil::countChangedPixels(&newImage[0], &oldImage[0], nPix, threshold);
+        unsigned int countScalar = FrameDiffUtil::countChangedPixelsScalar(&newImage[0], &oldImage[0], nPix, threshold);
+        FrameDiffUtil::getChangedPixels(&newImage[0], &oldImage[0], nPix, threshold, pos, neg);
+        FrameDiffUtil::getChangedPixelsScalar(&newImage[0], &oldImage[0], nPix, threshold, posScalar, negScalar);
+
+        bool pass = (count == countScalar) && (pos == posScalar) && (neg == negScalar);
+        fprintf(stderr, "Threshold %3d: count = %7d, scalar count = %7d, lists match = %d -> %s\n", threshold, count, countScalar,
+                (pos == posScalar) && (neg == negScalar), pass ? "PASS" : "FAIL");
+    }
+
+    // Timing
+    unsigned int trials = 100;
+    unsigned int sum = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for(unsigned int t=0; t<trials; t++) {
+        sum += FrameDiffUtil::countChangedPixels(&newImage[0], &oldImage[0], nPix, 20u);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for(unsigned int t=0; t<trials; t++) {
+        sum += FrameDiffUtil::countChangedPixelsScalar(&newImage[0], &oldImage[0], nPix, 20u);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    double simdMs = std::chrono::duration<double, std::milli>(t1 - t0).count() / trials;
+    double scalarMs = std::chrono::duration<double, std::milli>(t2 - t1).count() / trials;
+    fprintf(stderr, "Time per frame: %s = %f [ms], scalar = %f [ms] (checksum %d)\n", FrameDiffUtil::getKernelName().c_str(), simdMs, scalarMs, sum);
+}
+
+void TestUtil::testLockFreeQueue() {
+
+    // Multiple producers and consumers through a small queue, so that it fills and wraps many times. Each item
+    // encodes its producer and sequence number; every item must be delivered exactly once, and each consumer must
+    // receive the items from any one producer in the order they were pushed.
+    {
+        unsigned int nProducers = 4;
+        unsigned int nConsumers = 4;
+        unsigned int nItems = 50000;
+        LockFreeQueue<unsigned int> queue(64);
+
+        std::vector<std::vector<unsigned int>> received(nConsumers);
+        std::atomic<unsigned int> nReceived(0);
+        std::vector<std::thread> threads;
+        auto t0 = std::chrono::steady_clock::now();
+        for(unsigned int c=0; c<nConsumers; c++) {
+            threads.push_back(std::thread([&, c]() {
+                unsigned int item;
+                while(nReceived.load() < nProducers * nItems) {
+                    if(queue.pop(item, 1000)) {
+                        received[c].push_back(item);
+                        nReceived++;
+                    }
+                }
+            }));
+        }
+        for(unsigned int p=0; p<nProducers; p++) {
+            threads.push_back(std::thread([&, p]() {
+                for(unsigned int i=0; i<nItems; i++) {
+                    while(!queue.tryPush(p * nItems + i)) {
+                        std::this_thread::yield();
+                    }
+                }
+            }));
+        }
+        for(std::thread &thread : threads) {
+            thread.join();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+
+        std::vector<unsigned int> deliveries(nProducers * nItems, 0);
+        bool ordered = true;
+        for(unsigned int c=0; c<nConsumers; c++) {
+            std::vector<long long> last(nProducers, -1);
+            for(unsigned int item : received[c]) {
+                deliveries[item]++;
+                unsigned int p = item / nItems;
+                ordered &= ((long long)(item % nItems) > last[p]);
+                last[p] = item % nItems;
+            }
+        }
+        bool once = std::all_of(deliveries.begin(), deliveries.end(), [](unsigned int n) {return n == 1;});
+        bool pass = once && ordered && queue.size() == 0;
+        fprintf(stderr, "MPMC: %d producers, %d consumers, %d items in %f [ms]; each delivered once = %d, in order = %d -> %s\n",
+                nProducers, nConsumers, nProducers * nItems, std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                once, ordered, pass ? "PASS" : "FAIL");
+    }
+
+    // Single producer and consumer, with a third thread monitoring the size as the pipeline stages do
+    {
+        unsigned int nItems = 200000;
+        LockFreeQueue<unsigned int, true> queue(16);
+        bool ordered = true;
+        std::atomic<bool> done(false);
+        std::atomic<bool> sizeValid(true);
+        std::thread consumer([&]() {
+            unsigned int item;
+            for(unsigned int i=0; i<nItems; i++) {
+                queue.pop(item, -1);
+                ordered &= (item == i);
+            }
+        });
+        std::thread monitor([&]() {
+            while(!done.load()) {
+                if(queue.size() > queue.capacity()) {
+                    sizeValid = false;
+                }
+            }
+        });
+        for(unsigned int i=0; i<nItems; i++) {
+            while(!queue.tryPush(i)) {
+                std::this_thread::yield();
+            }
+        }
+        consumer.join();
+        done = true;
+        monitor.join();
+        bool pass = ordered && sizeValid.load() && queue.size() == 0;
+        fprintf(stderr, "SPSC: %d items; in order = %d, size within capacity = %d -> %s\n", nItems, ordered, sizeValid.load(), pass ? "PASS" : "FAIL");
+    }
+
+    // Blocking pop: times out on an empty queue, and wakes when an item is pushed from another thread
+    {
+        LockFreeQueue<unsigned int> queue(4);
+        unsigned int item = 0;
+
+        auto t0 = std::chrono::steady_clock::now();
+        bool popped = queue.pop(item, 20000);
+        double waitedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        bool timeoutPass = !popped && waitedMs >= 19.0;
+
+        std::chrono::steady_clock::time_point pushed;
+        std::thread producer([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            pushed = std::chrono::steady_clock::now();
+            queue.tryPush(42u);
+        });
+        popped = queue.pop(item, -1);
+        double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pushed).count();
+        producer.join();
+        bool wakePass = popped && item == 42u;
+
+        // The wakeup file descriptor becomes readable when an item is pushed, for consumers that poll() it
+        struct pollfd pfd = {queue.getWakeupFd(), POLLIN, 0};
+        queue.clearWakeup();
+        bool idle = poll(&pfd, 1, 0) == 0;
+        queue.tryPush(7u);
+        bool readable = poll(&pfd, 1, 0) == 1;
+        bool pollPass = idle && readable && queue.tryPop(item) && item == 7u;
+
+        fprintf(stderr, "Blocking pop: timed out after %f [ms] = %d; woken %f [ms] after push = %d; wakeup fd = %d -> %s\n",
+                waitedMs, timeoutPass, latencyMs, wakePass, pollPass, (timeoutPass && wakePass && pollPass) ? "PASS" : "FAIL");
+    }
+}
+
+void TestUtil::testRingBuffer() {
+
+    // Capacities that are and aren't powers of two; for the latter the storage is larger than the capacity
+    unsigned int caps[] = {1u, 3u, 5u, 8u, 30u};
+    for(unsigned int cap : caps) {
+
+        RingBuffer<std::shared_ptr<int>> ring(cap);
+        std::deque<std::shared_ptr<int>> model;
+        std::vector<std::weak_ptr<int>> pushed;
+
+        // Push enough elements to wrap around the storage several times, checking the contents against a
+        // deque after each push
+        bool contents = true;
+        bool released = true;
+        for(int n=0; n<(int)(5 * cap + 7); n++) {
+            std::shared_ptr<int> element = std::make_shared<int>(n);
+            pushed.push_back(element);
+            if(n % 3 == 0) {
+                ring.emplace(std::move(element));
+            }
+            else {
+                ring.push(element);
+            }
+            model.push_back(pushed.back().lock());
+            if(model.size() > cap) {
+                model.pop_front();
+            }
+
+            // Size, front, back and random access
+            contents &= ring.size() == model.size() && ring.full() == (model.size() == cap);
+            contents &= ring.front() == model.front() && ring.back() == model.back();
+            for(unsigned int i=0; i<model.size(); i++) {
+                contents &= ring[i] == model[i];
+            }
+
+            // Forward and reverse iteration
+            contents &= std::equal(ring.begin(), ring.end(), model.begin()) && (unsigned int)std::distance(ring.begin(), ring.end()) == model.size();
+            contents &= std::equal(ring.rbegin(), ring.rend(), model.rbegin());
+
+            // The spans together hold the elements in order
+            std::pair<RingBuffer<std::shared_ptr<int>>::Span, RingBuffer<std::shared_ptr<int>>::Span> spans = ring.spans();
+            std::vector<std::shared_ptr<int>> joined(spans.first.begin(), spans.first.end());
+            joined.insert(joined.end(), spans.second.begin(), spans.second.end());
+            contents &= joined.size() == model.size() && std::equal(joined.begin(), joined.end(), model.begin());
+            contents &= ring.unroll().size() == model.size();
+
+            // Only the retained elements are alive: dropped elements must not linger in unused slots
+            unsigned int alive = 0;
+            for(const std::weak_ptr<int> &p : pushed) {
+                alive += p.expired() ? 0 : 1;
+            }
+            released &= alive == model.size();
+        }
+
+        // When full, overwrite() returns the slot holding the dropped (oldest) element so that it can be reused
+        int oldest = *ring.front();
+        std::shared_ptr<int> &slot = ring.overwrite();
+        bool overwrite = slot && *slot == oldest && &ring[ring.size() - 1] == &slot && ring.size() == cap;
+        *slot = -1;
+        overwrite &= *ring.back() == -1;
+
+        // clear() releases all the elements
+        model.clear();
+        ring.clear();
+        for(const std::weak_ptr<int> &p : pushed) {
+            released &= p.expired();
+        }
+        released &= ring.empty() && !ring.front();
+
+        // moveTo() moves the elements out in order and leaves the ring empty
+        for(int n=0; n<(int)(2 * cap + 1); n++) {
+            ring.push(std::make_shared<int>(n));
+        }
+        std::vector<std::shared_ptr<int>> moved;
+        ring.moveTo(moved);
+        bool moveTo = ring.empty() && moved.size() == cap;
+        for(unsigned int i=0; i<moved.size(); i++) {
+            moveTo &= *moved[i] == (int)(cap + 1 + i);
+        }
+
+        bool pass = contents && released && overwrite && moveTo;
+        fprintf(stderr, "Capacity %2d: contents = %d, elements released = %d, overwrite = %d, moveTo = %d -> %s\n",
+                cap, contents, released, overwrite, moveTo, pass ? "PASS" : "FAIL");
+    }
+}
+
+void TestUtil::testPixelStatsAccumulator() {
+
+    unsigned int width = 640;
+    unsigned int height = 480;
+    unsigned int nFrames = 99;
+    double trimFraction = 0.05;
+
+    // Stack of frames with noise about a random level in each pixel, plus occasional outliers
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> level(0, 255);
+    std::normal_distribution<double> noise(0.0, 3.0);
+    std::uniform_int_distribution<int> outlier(0, 49);
+    std::vector<int> levels(width * height);
+    for(unsigned int p=0; p<width*height; p++) {
+        levels[p] = level(gen);
+    }
+    std::vector<std::shared_ptr<Imageuc>> frames(nFrames);
+    for(unsigned int f=0; f<nFrames; f++) {
+        frames[f] = std::make_shared<Imageuc>(width, height);
+        for(unsigned int p=0; p<width*height; p++) {
+            int value = (outlier(gen) == 0) ? level(gen) : levels[p] + (int)std::round(noise(gen));
+            frames[f]->rawImage[p] = (unsigned char)std::max(0, std::min(255, value));
+        }
+    }
+
+    // Accumulate the stack, including a partial stack to check that the trimming adapts
+    unsigned int stackSizes[] = {nFrames, 10u};
+    for(unsigned int stackSize : stackSizes) {
+
+        auto t0 = std::chrono::steady_clock::now();
+        PixelStatsAccumulator acc(width, height, nFrames, trimFraction);
+        for(unsigned int f=0; f<stackSize; f++) {
+            acc.addFrame(*frames[f]);
+        }
+        std::vector<double> mean, std;
+        acc.getTrimmedMeanStd(mean, std);
+        auto t1 = std::chrono::steady_clock::now();
+
+        // Reference: sort the values of each pixel
+        double maxMeanDiff = 0.0;
+        double maxStdDiff = 0.0;
+        for(unsigned int p=0; p<width*height; p++) {
+            std::vector<double> pixels(stackSize);
+            for(unsigned int f=0; f<stackSize; f++) {
+                pixels[f] = frames[f]->rawImage[p];
+            }
+            double refMean, refStd;
+            MathUtil::getTrimmedMeanStd(pixels, refMean, refStd, trimFraction);
+            maxMeanDiff = std::max(maxMeanDiff, std::abs(mean[p] - refMean));
+            if(!std::isnan(refStd)) {
+                maxStdDiff = std::max(maxStdDiff, std::abs(std[p] - refStd));
+            }
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        bool pass = maxMeanDiff < 1e-9 && maxStdDiff < 1e-6;
+        fprintf(stderr, "%2d frames: max mean diff = %g, max std diff = %g -> %s\n", stackSize, maxMeanDiff, maxStdDiff, pass ? "PASS" : "FAIL");
+        fprintf(stderr, "Time: accumulator = %f [ms], sorting = %f [ms]\n", std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                std::chrono::duration<double, std::milli>(t2 - t1).count());
+    }
+}
+
+void TestUtil::testMedianFilter() {
+
+    unsigned int width = 640;
+    unsigned int height = 480;
+
+    // Smoothly varying background with noise and a scattering of bright sources
+    std::mt19937 gen(1);
+    std::normal_distribution<double> noise(0.0, 3.0);
+    std::uniform_int_distribution<int> source(0, 199);
+    std::vector<double> signal(width * height);
+    for(unsigned int k=0; k<height; k++) {
+        for(unsigned int l=0; l<width; l++) {
+            double value = 20.0 + 40.0 * l / width + 20.0 * k / height + noise(gen);
+            if(source(gen) == 0) {
+                value += 150.0;
+            }
+            signal[k*width + l] = std::max(0.0, std::min(255.0, value));
+        }
+    }
+
+    unsigned int halfWidths[] = {1u, 2u, 5u, 10u, 15u, 20u, 29u};
+    for(unsigned int hw : halfWidths) {
+
+        std::vector<double> sorted, histogram;
+
+        auto t0 = std::chrono::steady_clock::now();
+        MedianFilterUtil::medianFilter(signal, sorted, width, height, hw, MedianFilterUtil::SORT);
+        auto t1 = std::chrono::steady_clock::now();
+        MedianFilterUtil::medianFilter(signal, histogram, width, height, hw, MedianFilterUtil::HISTOGRAM, 1);
+        auto t2 = std::chrono::steady_clock::now();
+        MedianFilterUtil::medianFilter(signal, histogram, width, height, hw, MedianFilterUtil::HISTOGRAM);
+        auto t3 = std::chrono::steady_clock::now();
+
+        // The quantisation of the pixel values limits the accuracy to half a bin width
+        double maxDiff = 0.0;
+        for(unsigned int p=0; p<width*height; p++) {
+            maxDiff = std::max(maxDiff, std::abs(sorted[p] - histogram[p]));
+        }
+
+        bool pass = maxDiff <= MedianFilterUtil::histogramBinWidth / 2.0 + 1e-9;
+        fprintf(stderr, "Half-width %2d: max diff = %f -> %s\n", hw, maxDiff, pass ? "PASS" : "FAIL");
+        fprintf(stderr, "Time: sort = %f [ms], histogram = %f [ms] (1 thread), %f [ms] (%d threads)\n",
+                std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                std::chrono::duration<double, std::milli>(t2 - t1).count(),
+                std::chrono::duration<double, std::milli>(t3 - t2).count(), ParallelUtil::getDefaultThreads());
+    }
+}
+
+/**
+ * @brief Reference source detection for the SourceDetector test: the original labelling algorithm, which
+ * sorts all the candidate samples and labels them one at a time from the set of labels of their neighbours,
+ * followed by the original two-pass measurement of the source moments. Samples that are not candidates are
+ * excluded, as for SourceDetector.
+ */
+static std::vector<Source> getSourcesReference(const std::vector<double> &signal, const std::vector<double> &background,
+                                               const std::vector<double> &noise, unsigned int width, unsigned int height,
+                                               double detectionSigmas, double pixelSigmas) {
+
+    std::vector<unsigned int> sorted;
+    for(unsigned int sIdx=0; sIdx<width * height; sIdx++) {
+        if(signal[sIdx] - background[sIdx] > pixelSigmas * noise[sIdx]) {
+            sorted.push_back(sIdx);
+        }
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [&signal](unsigned int a, unsigned int b) {return signal[a] > signal[b];});
+
+    // Label zero indicates an unlabelled sample
+    std::vector<unsigned int> labels(width * height, 0);
+    unsigned int currentLabel = 1;
+    for(unsigned int sIdx : sorted) {
+        std::set<unsigned int> neighbourLabels;
+        for(int dj = -1; dj < 2; dj++) {
+            for(int di = -1; di < 2; di++) {
+                int i = (int)(sIdx % width) + di;
+                int j = (int)(sIdx / width) + dj;
+                if((di==0 && dj==0) || i < 0 || i >= (int)width || j < 0 || j >= (int)height) {
+                    continue;
+                }
+                if(labels[j * width + i] != 0) {
+                    neighbourLabels.insert(labels[j * width + i]);
+                }
+            }
+        }
+        if(neighbourLabels.size()==0) {
+            labels[sIdx] = currentLabel++;
+        }
+        else if(neighbourLabels.size()==1) {
+            labels[sIdx] = *neighbourLabels.begin();
+        }
+    }
+
+    std::vector<Source> sources(currentLabel-1);
+    for(unsigned int sIdx=0; sIdx<width * height; sIdx++) {
+        if(labels[sIdx] != 0) {
+            sources[labels[sIdx] - 1].pixels.push_back(sIdx);
+        }
+    }
+
+    std::vector<Source> stellarSources;
+    for(Source source : sources) {
+        source.adu = 0.0;
+        source.sigma_adu = 0.0;
+        source.i = 0.0;
+        source.j = 0.0;
+        for(unsigned int sIdx : source.pixels) {
+            double adu = signal[sIdx] - background[sIdx];
+            source.adu += adu;
+            source.sigma_adu += noise[sIdx] * noise[sIdx];
+            source.i += (sIdx % width) * adu;
+            source.j += (sIdx / width) * adu;
+        }
+        source.sigma_adu = std::sqrt(source.sigma_adu);
+        source.i /= source.adu;
+        source.j /= source.adu;
+        if(!(source.adu / source.sigma_adu > detectionSigmas)) {
+            continue;
+        }
+        double a = 0.0, b = 0.0, c = 0.0;
+        for(unsigned int sIdx : source.pixels) {
+            double x = sIdx % width;
+            double y = sIdx / width;
+            double weight = (signal[sIdx] - background[sIdx]) / source.adu;
+            a += (x - source.i) * (x - source.i) * weight;
+            b += (x - source.i) * (y - source.j) * weight;
+            c += (y - source.j) * (y - source.j) * weight;
+        }
+        source.c_ii = a;
+        source.c_ij = b;
+        source.c_jj = c;
+        double disc = (a + c) * (a + c) / 4.0 - (a * c - b * b);
+        if(disc < 0.0) {
+            continue;
+        }
+        source.l1 = (a + c) / 2.0 + std::sqrt(disc);
+        source.l2 = (a + c) / 2.0 - std::sqrt(disc);
+        if(source.l1 <= 0.0 || source.l2 <= 0.0) {
+            continue;
+        }
+        stellarSources.push_back(source);
+    }
+    return stellarSources;
+}
+
+void TestUtil::testSourceDetector() {
+
+    unsigned int width = 160;
+    unsigned int height = 120;
+    double sigma = 2.0;
+    double detectionSigmas = 5.0;
+
+    // Gaussian stars [i, j, peak ADU]: an isolated bright star, a blended pair of bright stars whose
+    // profiles overlap, and a faint pair that are individually close to the detection threshold
+    double stars[][3] = {{30.0, 30.0, 200.0},
+                         {80.0, 60.0, 150.0}, {84.5, 61.0, 120.0},
+                         {120.0, 90.0, 6.0}, {123.0, 90.5, 5.0}};
+    double psfSigma = 1.2;
+
+    std::mt19937 gen(1);
+    std::normal_distribution<double> noiseDist(0.0, sigma);
+    std::vector<double> signal(width * height), background(width * height, 20.0), noise(width * height, sigma);
+    for(unsigned int sIdx=0; sIdx<width * height; sIdx++) {
+        double x = sIdx % width;
+        double y = sIdx / width;
+        signal[sIdx] = background[sIdx] + noiseDist(gen);
+        for(const double * star : stars) {
+            double r2 = (x - star[0]) * (x - star[0]) + (y - star[1]) * (y - star[1]);
+            signal[sIdx] += star[2] * std::exp(-r2 / (2.0 * psfSigma * psfSigma));
+        }
+    }
+
+    // Pixel thresholds; the very negative one includes every sample, as the original detector did
+    double pixelThresholds[] = {-1e9, 0.0, 2.5};
+    for(double pixelSigmas : pixelThresholds) {
+
+        std::vector<Source> sources = SourceDetector::getSources(signal, background, noise, width, height, detectionSigmas, pixelSigmas);
+        std::vector<Source> reference = getSourcesReference(signal, background, noise, width, height, detectionSigmas, pixelSigmas);
+
+        // Compare the sources in order of their first pixel
+        auto byFirstPixel = [](const Source &a, const Source &b) {return a.pixels[0] < b.pixels[0];};
+        std::sort(sources.begin(), sources.end(), byFirstPixel);
+        std::sort(reference.begin(), reference.end(), byFirstPixel);
+
+        bool match = (sources.size() == reference.size());
+        double maxDiff = 0.0;
+        for(unsigned int s=0; match && s<sources.size(); s++) {
+            match = (sources[s].pixels == reference[s].pixels);
+            double diffs[] = {sources[s].adu - reference[s].adu, sources[s].sigma_adu - reference[s].sigma_adu,
+                              sources[s].i - reference[s].i, sources[s].j - reference[s].j,
+                              sources[s].c_ii - reference[s].c_ii, sources[s].c_ij - reference[s].c_ij,
+                              sources[s].c_jj - reference[s].c_jj, sources[s].l1 - reference[s].l1, sources[s].l2 - reference[s].l2};
+            for(double diff : diffs) {
+                maxDiff = std::max(maxDiff, std::abs(diff));
+            }
+        }
+        bool pass = match && maxDiff < 1e-6;
+        fprintf(stderr, "Pixel threshold %g: %lu sources, %lu reference sources, labelling matches = %d, max difference = %g -> %s\n",
+                pixelSigmas, sources.size(), reference.size(), match, maxDiff, pass ? "PASS" : "FAIL");
+    }
+}
+
+void TestUtil::testReferenceStarCatalogue() {
+
+    // Catalogue of stars at random positions on the sky, plus some at the centres, edges and corners of the cube faces
+    // where the tiles meet
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> raDist(0.0, 2.0 * M_PI);
+    std::uniform_real_distribution<double> zDist(-1.0, 1.0);
+    std::uniform_real_distribution<double> magDist(0.0, 6.0);
+    std::vector<ReferenceStar> stars;
+    for(unsigned int s=0; s<20000; s++) {
+        stars.push_back(ReferenceStar(raDist(gen), std::asin(zDist(gen)), magDist(gen)));
+    }
+    std::vector<Eigen::Vector3d> special;
+    for(int i=-1; i<=1; i++) {
+        for(int j=-1; j<=1; j++) {
+            for(int k=-1; k<=1; k++) {
+                if(i != 0 || j != 0 || k != 0) {
+                    special.push_back(Eigen::Vector3d(i, j, k).normalized());
+                }
+            }
+        }
+    }
+    for(const Eigen::Vector3d &r : special) {
+        double ra, dec, norm;
+        CoordinateUtil::cartesianToSpherical(r, norm, ra, dec);
+        stars.push_back(ReferenceStar(ra, dec, 3.0));
+    }
+
+    // Unit vectors of the stars, computed as in the catalogue
+    std::vector<Eigen::Vector3d> r_stars(stars.size());
+    for(unsigned int s=0; s<stars.size(); s++) {
+        CoordinateUtil::sphericalToCartesian(r_stars[s], 1.0, stars[s].ra, stars[s].dec);
+    }
+
+    // Stars within a region found by examining every star, identified by position
+    auto fullScan = [&](const Eigen::Vector3d &r, double radius, double magLimit) {
+        std::multiset<std::pair<double, double>> found;
+        double cosRadius = std::cos(std::min(radius, M_PI));
+        for(unsigned int s=0; s<stars.size(); s++) {
+            if((float)stars[s].mag <= magLimit && r_stars[s][0] * r[0] + r_stars[s][1] * r[1] + r_stars[s][2] * r[2] >= cosRadius) {
+                found.insert(std::make_pair(stars[s].ra, stars[s].dec));
+            }
+        }
+        return found;
+    };
+
+    // Regions centred on random positions and on the face centres, edges and corners, of radii from tiny to the whole sky
+    std::vector<Eigen::Vector3d> centres = special;
+    for(unsigned int q=0; q<200; q++) {
+        Eigen::Vector3d r;
+        CoordinateUtil::sphericalToCartesian(r, 1.0, raDist(gen), std::asin(zDist(gen)));
+        centres.push_back(r);
+    }
+    double radii[] = {1e-3, 0.05, 0.3, 0.7, 1.2, M_PI / 2.0, 2.0, 3.0, M_PI};
+
+    unsigned int nsides[] = {1u, 3u, 16u, 0u};
+    for(unsigned int nside : nsides) {
+
+        std::shared_ptr<ReferenceStarCatalogue> catalogue = ReferenceStarCatalogue::build(stars, nside);
+
+        unsigned int nQueries = 0;
+        unsigned int nMismatched = 0;
+        for(const Eigen::Vector3d &r : centres) {
+            for(double radius : radii) {
+                double magLimit = (nQueries % 2 == 0) ? 6.0 : 4.0;
+                std::vector<ReferenceStar> found;
+                catalogue->getStars(r, radius, magLimit, found);
+                std::multiset<std::pair<double, double>> indexed;
+                for(const ReferenceStar &star : found) {
+                    indexed.insert(std::make_pair(star.ra, star.dec));
+                }
+                if(indexed != fullScan(r, radius, magLimit)) {
+                    nMismatched++;
+                }
+                nQueries++;
+            }
+        }
+
+        // Time a query of a typical field of view against examining every star
+        unsigned int nTimed = 100;
+        std::vector<ReferenceStar> found;
+        auto t0 = std::chrono::steady_clock::now();
+        for(unsigned int q=0; q<nTimed; q++) {
+            catalogue->getStars(centres[special.size() + q], 0.6, 6.0, found);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        for(unsigned int q=0; q<nTimed; q++) {
+            fullScan(centres[special.size() + q], 0.6, 6.0);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+
+        fprintf(stderr, "nside = %d: %d of %d queries differ from a full scan -> %s\n", nside, nMismatched, nQueries, (nMismatched == 0) ? "PASS" : "FAIL");
+        fprintf(stderr, "Time: query = %f [us], full scan = %f [us]\n", std::chrono::duration<double, std::micro>(t1 - t0).count() / nTimed,
+                std::chrono::duration<double, std::micro>(t2 - t1).count() / nTimed);
+    }
+
+    // Check that a saved catalogue can be loaded, and that catalogues with invalid tile offsets are rejected
+    std::string path = "/tmp/referencestars.cat";
+    std::shared_ptr<ReferenceStarCatalogue> catalogue = ReferenceStarCatalogue::build(stars, 4);
+    catalogue->save(path);
+    std::shared_ptr<ReferenceStarCatalogue> loaded = ReferenceStarCatalogue::load(path);
+    bool loadPass = loaded && loaded->size() == stars.size();
+
+    std::vector<char> data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    // The tile offsets follow the 24 byte header
+    auto loadCorrupted = [&](unsigned int tile, uint32_t offset) {
+        std::vector<char> corrupted(data);
+        memcpy(&corrupted[24 + 4 * tile], &offset, sizeof(offset));
+        std::ofstream out(path, std::ios::binary);
+        out.write(&corrupted[0], corrupted.size());
+        out.close();
+        return ReferenceStarCatalogue::load(path);
+    };
+    bool beyondPass = !loadCorrupted(1, stars.size() + 1);
+    bool decreasingPass = !loadCorrupted(2, 0) && !loadCorrupted(0, 1);
+    remove(path.c_str());
+
+    fprintf(stderr, "Load saved catalogue = %d, offsets beyond the stars rejected = %d, decreasing offsets rejected = %d -> %s\n",
+            loadPass, beyondPass, decreasingPass, (loadPass && beyondPass && decreasingPass) ? "PASS" : "FAIL");
+}
+
+void TestUtil::testProjectVectors() {
+
+    // Random unit vectors covering the whole sky, as for a reference star catalogue
+    unsigned int n = 1000000;
+    std::mt19937 gen(1);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    Eigen::Matrix3Xd r_cam(3, n);
+    for(unsigned int v=0; v<n; v++) {
+        Eigen::Vector3d r(normal(gen), normal(gen), normal(gen));
+        r_cam.col(v) = r.normalized();
+    }
+
+    PinholeCamera pinhole(640, 480, 200.0, 200.0, 320.0, 240.0);
+    PinholeCameraWithRadialDistortion radial(640, 480, 200.0, 200.0, 320.0, 240.0, -0.05, 0.01);
+    PinholeCameraWithSipDistortion sip(640, 480, 200.0, 200.0, 320.0, 240.0,
+                                       1e-5, -2e-5, 1e-5, 1e-8, -2e-8, 3e-8, 1e-8,
+                                       -1e-5, 2e-5, 1e-5, -1e-8, 2e-8, 1e-8, -3e-8);
+    const CameraModelBase * cams[] = {&pinhole, &radial, &sip};
+
+    for(const CameraModelBase * cam : cams) {
+
+        std::vector<double> i0(n), j0(n);
+        std::vector<bool> visible0(n);
+        // Allocate the outputs in advance so that the timings are comparable
+        Eigen::ArrayXd i1 = Eigen::ArrayXd::Zero(n), j1 = Eigen::ArrayXd::Zero(n);
+        Eigen::ArrayXd i2 = Eigen::ArrayXd::Zero(n), j2 = Eigen::ArrayXd::Zero(n);
+        CameraModelBase::ArrayXb visible1 = CameraModelBase::ArrayXb::Zero(n), visible2 = CameraModelBase::ArrayXb::Zero(n);
+
+        auto t0 = std::chrono::steady_clock::now();
+        for(unsigned int v=0; v<n; v++) {
+            visible0[v] = cam->projectVector(r_cam.col(v), i0[v], j0[v]);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        cam->projectVectors(r_cam, i1, j1, visible1, 1);
+        auto t2 = std::chrono::steady_clock::now();
+        cam->projectVectors(r_cam, i2, j2, visible2, 0);
+        auto t3 = std::chrono::steady_clock::now();
+
+        // Compare the coordinates of the visible points, and the visibility of all points
+        unsigned int nVisible = 0;
+        unsigned int nMismatch = 0;
+        double maxDiff = 0.0;
+        for(unsigned int v=0; v<n; v++) {
+            if(visible0[v] != visible1[v] || visible1[v] != visible2[v]) {
+                nMismatch++;
+            }
+            if(visible0[v]) {
+                nVisible++;
+                maxDiff = std::max(maxDiff, std::max(std::abs(i0[v] - i1[v]), std::abs(j0[v] - j1[v])));
+                maxDiff = std::max(maxDiff, std::max(std::abs(i1[v] - i2[v]), std::abs(j1[v] - j2[v])));
+            }
+        }
+
+        bool pass = nMismatch == 0 && maxDiff < 1e-9;
+        fprintf(stderr, "%s: %d visible, %d visibility mismatches, max diff = %g [pixels] -> %s\n",
+                cam->getModelName().c_str(), nVisible, nMismatch, maxDiff, pass ? "PASS" : "FAIL");
+        fprintf(stderr, "Time: single = %f [ms], batch = %f [ms] (1 thread), %f [ms] (%d threads)\n",
+                std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                std::chrono::duration<double, std::milli>(t2 - t1).count(),
+                std::chrono::duration<double, std::milli>(t3 - t2).count(), ParallelUtil::getDefaultThreads());
+    }
+}
+
+void TestUtil::testInverseDistortionMap() {
+
+    // Wide field cameras with distortion amounting to tens of pixels at the edges of the image
+    PinholeCameraWithRadialDistortion radial(640, 480, 200.0, 200.0, 320.0, 240.0, -0.05, 0.01);
+    PinholeCameraWithSipDistortion sip(640, 480, 200.0, 200.0, 320.0, 240.0,
+                                       1e-5, -2e-5, 1e-5, 1e-8, -2e-8, 3e-8, 1e-8,
+                                       -1e-5, 2e-5, 1e-5, -1e-8, 2e-8, 1e-8, -3e-8);
+    CameraModelBase * cams[] = {&radial, &sip};
+
+    // Random points in the image
+    unsigned int n = 100000;
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> iDist(0.0, 640.0);
+    std::uniform_real_distribution<double> jDist(0.0, 480.0);
+    std::vector<double> ip(n), jp(n);
+    for(unsigned int p=0; p<n; p++) {
+        ip[p] = iDist(gen);
+        jp[p] = jDist(gen);
+    }
+
+    for(CameraModelBase * cam : cams) {
+
+        std::vector<Eigen::Vector3d> r0(n), r1(n);
+
+        auto t0 = std::chrono::steady_clock::now();
+        for(unsigned int p=0; p<n; p++) {
+            r0[p] = cam->deprojectPixel(ip[p], jp[p]);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        cam->buildInverseDistortionMap();
+        auto t2 = std::chrono::steady_clock::now();
+        for(unsigned int p=0; p<n; p++) {
+            r1[p] = cam->deprojectPixel(ip[p], jp[p]);
+        }
+        auto t3 = std::chrono::steady_clock::now();
+
+        // Measure the error in the deprojected vectors by projecting them back into the image
+        double maxErr = 0.0;
+        for(unsigned int p=0; p<n; p++) {
+            double i0, j0, i1, j1;
+            cam->projectVector(r0[p], i0, j0);
+            cam->projectVector(r1[p], i1, j1);
+            maxErr = std::max(maxErr, std::sqrt((i0 - i1)*(i0 - i1) + (j0 - j1)*(j0 - j1)));
+        }
+
+        bool pass = maxErr < 2.0 * CameraModelBase::inverseDistortionMapAccuracy;
+        fprintf(stderr, "%s: max error = %f [pixels] -> %s\n", cam->getModelName().c_str(), maxErr, pass ? "PASS" : "FAIL");
+        fprintf(stderr, "Time: map build = %f [ms], deprojection = %f [us] (iterative), %f [us] (map)\n",
+                std::chrono::duration<double, std::milli>(t2 - t1).count(),
+                std::chrono::duration<double, std::micro>(t1 - t0).count() / n,
+                std::chrono::duration<double, std::micro>(t3 - t2).count() / n);
+
+        // Changing the parameters discards the map
+        cam->init();
+    }
+}
+
+/**
+ * @brief Simulate a calibration for the GeoCalFitter tests: cross-matches between reference stars at random
+ * positions in the image of a camera and noisy sources, for a camera of the given type.
+ */
+static CameraModelBase * simulateCrossMatches(const CameraModelBase::CameraModelType &type, const std::vector<double> &params,
+                                              const Eigen::Matrix3d &r_bcrf_cam, unsigned int nXms,
+                                              std::vector<std::pair<Source, ReferenceStar>> &xms, unsigned int seed = 1) {
+
+    CameraModelBase * truth = CameraModelBase::getCameraModelFromEnum(type);
+    truth->width = 640;
+    truth->height = 480;
+    truth->setParameters(params.data());
+
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> iDist(10.0, 630.0);
+    std::uniform_real_distribution<double> jDist(10.0, 470.0);
+    std::normal_distribution<double> noise(0.0, 0.1);
+    xms.clear();
+    for(unsigned int x=0; x<nXms; x++) {
+        double i = iDist(gen);
+        double j = jDist(gen);
+        Eigen::Vector3d r_bcrf = r_bcrf_cam.transpose() * truth->deprojectPixel(i, j);
+        double r, ra, dec;
+        CoordinateUtil::cartesianToSpherical(r_bcrf, r, ra, dec);
+        Source source;
+        source.i = i + noise(gen);
+        source.j = j + noise(gen);
+        source.c_ii = 0.01;
+        source.c_ij = 0.0;
+        source.c_jj = 0.01;
+        xms.push_back(std::pair<Source, ReferenceStar>(source, ReferenceStar(ra, dec, 0.0)));
+    }
+    return truth;
+}
+
+void TestUtil::testGeoCalFitterKernels() {
+
+    // Site and time of the simulated calibration
+    double gmst = 1.2;
+    double lon = MathUtil::toRadians(-3.2);
+    double lat = MathUtil::toRadians(55.9);
+
+    // True orientation of the camera
+    Eigen::Quaterniond q_true(0.9, 0.2, -0.3, 0.25);
+    q_true.normalize();
+    Eigen::Matrix3d r_bcrf_cam = q_true.toRotationMatrix() * CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+    // True parameters of each type of camera model
+    std::vector<std::vector<double>> params_true = {
+        {500.0, 505.0, 322.0, 238.0},
+        {500.0, 505.0, 322.0, 238.0, -0.02, 0.01},
+        {500.0, 505.0, 322.0, 238.0, 1e-5, -2e-5, 1e-5, 1e-8, -2e-8, 3e-8, 1e-8, -1e-5, 2e-5, 1e-5, -1e-8, 2e-8, 1e-8, -3e-8}
+    };
+
+    // Number of cross-matches and of repeated evaluations for the timings
+    unsigned int nXms = 100;
+    unsigned int nReps = 1000;
+
+    for(unsigned int t=0; t<CameraModelBase::cameraModelTypes.size(); t++) {
+
+        // Simulate cross-matches between reference stars at random positions in the image and noisy sources
+        std::vector<std::pair<Source, ReferenceStar>> xms;
+        CameraModelBase * truth = simulateCrossMatches(CameraModelBase::cameraModelTypes[t], params_true[t], r_bcrf_cam, nXms, xms);
+
+        // Initial guess parameters for each fitter, offset from the truth
+        std::vector<double> params_initial = params_true[t];
+        params_initial[0] *= 1.02;
+        params_initial[1] *= 0.98;
+        params_initial[2] += 3.0;
+        params_initial[3] -= 2.0;
+
+        CameraModelBase * cams[2];
+        Eigen::Quaterniond qs[2];
+        std::vector<std::pair<Source, ReferenceStar>> xmss[2] = {xms, xms};
+        for(unsigned int f=0; f<2; f++) {
+            cams[f] = CameraModelBase::getCameraModelFromEnum(CameraModelBase::cameraModelTypes[t]);
+            cams[f]->width = 640;
+            cams[f]->height = 480;
+            cams[f]->setParameters(params_initial.data());
+            qs[f] = Eigen::Quaterniond(q_true.w() + 0.01, q_true.x(), q_true.y() - 0.01, q_true.z());
+            qs[f].normalize();
+        }
+
+        GeoCalFitter kernelFitter(cams[0], &qs[0], &xmss[0], gmst, lon, lat);
+        GeoCalFitter virtualFitter(cams[1], &qs[1], &xmss[1], gmst, lon, lat);
+        virtualFitter.useCameraModelKernels = false;
+        GeoCalFitter * fitters[2] = {&kernelFitter, &virtualFitter};
+
+        // Compare the model and Jacobian from the two paths, and time them
+        unsigned int N = 2 * nXms;
+        unsigned int M = 4 + truth->getNumParameters();
+        std::vector<double> model[2], jac[2];
+        double tModel[2], tJac[2];
+        for(unsigned int f=0; f<2; f++) {
+            model[f].resize(N);
+            jac[f].resize(N * M);
+            auto t0 = std::chrono::steady_clock::now();
+            for(unsigned int rep=0; rep<nReps; rep++) {
+                fitters[f]->getModel(model[f].data());
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            for(unsigned int rep=0; rep<nReps; rep++) {
+                fitters[f]->getJacobian(jac[f].data());
+            }
+            auto t2 = std::chrono::steady_clock::now();
+            tModel[f] = std::chrono::duration<double, std::micro>(t1 - t0).count() / nReps;
+            tJac[f] = std::chrono::duration<double, std::micro>(t2 - t1).count() / nReps;
+        }
+
+        double maxModelDiff = 0.0;
+        for(unsigned int n=0; n<N; n++) {
+            maxModelDiff = std::max(maxModelDiff, std::abs(model[0][n] - model[1][n]));
+        }
+        double maxJacDiff = 0.0;
+        for(unsigned int n=0; n<N*M; n++) {
+            maxJacDiff = std::max(maxJacDiff, std::abs(jac[0][n] - jac[1][n]) / std::max(1.0, std::abs(jac[1][n])));
+        }
+
+        // Time the complete fits
+        double tFit[2];
+        for(unsigned int f=0; f<2; f++) {
+            auto t0 = std::chrono::steady_clock::now();
+            fitters[f]->fit(500, false);
+            auto t1 = std::chrono::steady_clock::now();
+            tFit[f] = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        }
+
+        // Compare the solutions
+        std::vector<double> params_fitted[2];
+        for(unsigned int f=0; f<2; f++) {
+            params_fitted[f].resize(M);
+            fitters[f]->getParameters(params_fitted[f].data());
+        }
+        double maxParamDiff = 0.0;
+        for(unsigned int m=0; m<M; m++) {
+            maxParamDiff = std::max(maxParamDiff, std::abs(params_fitted[0][m] - params_fitted[1][m]) / std::max(1.0, std::abs(params_fitted[1][m])));
+        }
+
+        bool pass = maxModelDiff < 1e-9 && maxJacDiff < 1e-9 && maxParamDiff < 1e-6;
+        fprintf(stderr, "%s: max difference in model = %g [pixels], Jacobian = %g, solution = %g -> %s\n",
+                truth->getModelName().c_str(), maxModelDiff, maxJacDiff, maxParamDiff, pass ? "PASS" : "FAIL");
+        fprintf(stderr, "Time: getModel = %f [us] (kernel), %f [us] (virtual); getJacobian = %f [us] (kernel), %f [us] (virtual); fit = %f [ms] (kernel), %f [ms] (virtual)\n",
+                tModel[0], tModel[1], tJac[0], tJac[1], tFit[0], tFit[1]);
+        fprintf(stderr, "Fitted chi2 = %f (kernel), %f (virtual); %d degrees of freedom\n",
+                kernelFitter.getChi2(), virtualFitter.getChi2(), (int)kernelFitter.getDOF());
+
+        delete truth;
+        delete cams[0];
+        delete cams[1];
+    }
+}
+
+void TestUtil::testFiniteDifferencesJacobian() {
+
+    // Site and time of the simulated calibration
+    double gmst = 1.2;
+    double lon = MathUtil::toRadians(-3.2);
+    double lat = MathUtil::toRadians(55.9);
+
+    // True orientation of the camera
+    Eigen::Quaterniond q_true(0.9, 0.2, -0.3, 0.25);
+    q_true.normalize();
+    Eigen::Matrix3d r_bcrf_cam = q_true.toRotationMatrix() * CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+    std::vector<double> params_true = {500.0, 505.0, 322.0, 238.0, 1e-5, -2e-5, 1e-5, 1e-8, -2e-8, 3e-8, 1e-8, -1e-5, 2e-5, 1e-5, -1e-8, 2e-8, 1e-8, -3e-8};
+
+    unsigned int nXms = 100;
+    unsigned int nReps = 20;
+
+    std::vector<std::pair<Source, ReferenceStar>> xms;
+    std::unique_ptr<CameraModelBase> cam(simulateCrossMatches(CameraModelBase::PINHOLECAMERAWITHSIPDISTORTION, params_true, r_bcrf_cam, nXms, xms));
+    Eigen::Quaterniond q = q_true;
+
+    GeoCalFitter fitter(cam.get(), &q, &xms, gmst, lon, lat);
+
+    unsigned int N = 2 * nXms;
+    unsigned int M = 4 + cam->getNumParameters();
+
+    // Analytic Jacobian; serial finite differences through the camera model; parallel finite differences using the kernel
+    std::vector<double> jac[3];
+    double tJac[3];
+    for(unsigned int f=0; f<3; f++) {
+        fitter.useFiniteDifferencesJacobian = (f > 0);
+        fitter.useCameraModelKernels = (f != 1);
+        jac[f].resize(N * M);
+        auto t0 = std::chrono::steady_clock::now();
+        for(unsigned int rep=0; rep<nReps; rep++) {
+            fitter.getJacobian(jac[f].data());
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        tJac[f] = std::chrono::duration<double, std::micro>(t1 - t0).count() / nReps;
+    }
+
+    // Compare each column of the finite differences Jacobians to the analytic Jacobian
+    double maxDiff[2] = {0.0, 0.0};
+    for(unsigned int f=1; f<3; f++) {
+        for(unsigned int m=0; m<M; m++) {
+            double maxAbs = 0.0;
+            double maxErr = 0.0;
+            for(unsigned int n=0; n<N; n++) {
+                maxAbs = std::max(maxAbs, std::abs(jac[0][n*M + m]));
+                maxErr = std::max(maxErr, std::abs(jac[f][n*M + m] - jac[0][n*M + m]));
+            }
+            maxDiff[f-1] = std::max(maxDiff[f-1], maxErr / maxAbs);
+        }
+    }
+
+    // Fit from an offset starting point using the analytic and the parallel finite differences Jacobians
+    std::vector<double> params_initial = params_true;
+    params_initial[0] *= 1.02;
+    params_initial[1] *= 0.98;
+    params_initial[2] += 3.0;
+    params_initial[3] -= 2.0;
+
+    std::unique_ptr<CameraModelBase> cams[2];
+    Eigen::Quaterniond qs[2];
+    std::vector<std::pair<Source, ReferenceStar>> xmss[2] = {xms, xms};
+    std::vector<double> params_fitted[2];
+    double tFit[2];
+    for(unsigned int f=0; f<2; f++) {
+        cams[f].reset(CameraModelBase::getCameraModelFromEnum(CameraModelBase::PINHOLECAMERAWITHSIPDISTORTION));
+        cams[f]->width = 640;
+        cams[f]->height = 480;
+        cams[f]->setParameters(params_initial.data());
+        qs[f] = Eigen::Quaterniond(q_true.w() + 0.01, q_true.x(), q_true.y() - 0.01, q_true.z());
+        qs[f].normalize();
+
+        GeoCalFitter fitter(cams[f].get(), &qs[f], &xmss[f], gmst, lon, lat);
+        fitter.useFiniteDifferencesJacobian = (f == 1);
+        auto t0 = std::chrono::steady_clock::now();
+        fitter.fit(500, false);
+        auto t1 = std::chrono::steady_clock::now();
+        tFit[f] = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        params_fitted[f].resize(M);
+        fitter.getParameters(params_fitted[f].data());
+    }
+    double maxParamDiff = 0.0;
+    for(unsigned int m=0; m<M; m++) {
+        maxParamDiff = std::max(maxParamDiff, std::abs(params_fitted[0][m] - params_fitted[1][m]) / std::max(1.0, std::abs(params_fitted[0][m])));
+    }
+
+    bool pass = maxDiff[0] < 1e-4 && maxDiff[1] < 1e-4 && maxParamDiff < 1e-4;
+    fprintf(stderr, "%s: max relative difference from analytic Jacobian = %g (serial), %g (parallel); solution = %g -> %s\n",
+            cam->getModelName().c_str(), maxDiff[0], maxDiff[1], maxParamDiff, pass ? "PASS" : "FAIL");
+    fprintf(stderr, "Time: getJacobian = %f [us] (analytic), %f [us] (serial finite differences), %f [us] (parallel finite differences, %d threads)\n",
+            tJac[0], tJac[1], tJac[2], ParallelUtil::getDefaultThreads());
+    fprintf(stderr, "Time: fit = %f [ms] (analytic), %f [ms] (parallel finite differences)\n", tFit[0], tFit[1]);
+}
+
+void TestUtil::testMultiEpochGeoCalFitter() {
+
+    // Site of the simulated calibrations
+    double lon = MathUtil::toRadians(-3.2);
+    double lat = MathUtil::toRadians(55.9);
+
+    std::vector<double> params_true = {500.0, 505.0, 322.0, 238.0, 1e-5, -2e-5, 1e-5, 1e-8, -2e-8, 3e-8, 1e-8, -1e-5, 2e-5, 1e-5, -1e-8, 2e-8, 1e-8, -3e-8};
+
+    // Initial guess intrinsic parameters, offset from the truth
+    std::vector<double> params_initial = params_true;
+    params_initial[0] *= 1.02;
+    params_initial[1] *= 0.98;
+    params_initial[2] += 3.0;
+    params_initial[3] -= 2.0;
+
+    unsigned int nXms = 60;
+    unsigned int nEpochs = 40;
+
+    // Simulate calibrations at different times through the night, with the camera orientation drifting slightly
+    std::vector<double> gmsts(nEpochs);
+    std::vector<Eigen::Quaterniond> qs_true(nEpochs);
+    std::vector<std::vector<std::pair<Source, ReferenceStar>>> xmss(nEpochs);
+    for(unsigned int e=0; e<nEpochs; e++) {
+        gmsts[e] = 1.2 + 0.02 * e;
+        qs_true[e] = Eigen::Quaterniond(0.9, 0.2 + 0.001 * e, -0.3, 0.25 - 0.0005 * e);
+        qs_true[e].normalize();
+        Eigen::Matrix3d r_bcrf_cam = qs_true[e].toRotationMatrix() * CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmsts[e]);
+        // Only the cross-matches are needed; the simulated camera is released straight away
+        std::unique_ptr<CameraModelBase>(simulateCrossMatches(CameraModelBase::PINHOLECAMERAWITHSIPDISTORTION, params_true, r_bcrf_cam, nXms, xmss[e], e + 1));
+    }
+
+    // Initial guess orientation for an epoch, offset from the truth
+    auto initialQuaternion = [](const Eigen::Quaterniond &q_true) {
+        Eigen::Quaterniond q(q_true.w() + 0.01, q_true.x(), q_true.y() - 0.01, q_true.z());
+        q.normalize();
+        return q;
+    };
+
+    // RMS error of the fitted calibration of the first epoch over a grid of points in the image. The orientation
+    // and the principal point are largely degenerate, so the rays are rotated through the fitted orientation.
+    std::unique_ptr<CameraModelBase> truth(CameraModelBase::getCameraModelFromEnum(CameraModelBase::PINHOLECAMERAWITHSIPDISTORTION));
+    truth->width = 640;
+    truth->height = 480;
+    truth->setParameters(params_true.data());
+    auto rmsError = [&truth, &qs_true](CameraModelBase &cam, const Eigen::Quaterniond &q) {
+        Eigen::Matrix3d r_true_fit = q.toRotationMatrix() * qs_true[0].toRotationMatrix().transpose();
+        double sum2 = 0.0;
+        unsigned int n = 0;
+        for(double i = 20.0; i < 640.0; i += 40.0) {
+            for(double j = 20.0; j < 480.0; j += 40.0) {
+                double ip, jp;
+                cam.projectVector(r_true_fit * truth->deprojectPixel(i, j), ip, jp);
+                sum2 += (ip - i) * (ip - i) + (jp - j) * (jp - j);
+                n++;
+            }
+        }
+        return std::sqrt(sum2 / n);
+    };
+
+    // Fit the first epoch alone
+    std::unique_ptr<CameraModelBase> single(CameraModelBase::getCameraModelFromEnum(CameraModelBase::PINHOLECAMERAWITHSIPDISTORTION));
+    single->width = 640;
+    single->height = 480;
+    single->setParameters(params_initial.data());
+    Eigen::Quaterniond q_single = initialQuaternion(qs_true[0]);
+    std::vector<std::pair<Source, ReferenceStar>> xms_single = xmss[0];
+    GeoCalFitter singleFitter(single.get(), &q_single, &xms_single, gmsts[0], lon, lat);
+    auto t0 = std::chrono::steady_clock::now();
+    singleFitter.fit(500, false);
+    auto t1 = std::chrono::steady_clock::now();
+    double tSingle = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    // Fit increasing numbers of epochs jointly, to check the solution improves and the cost scales linearly
+    bool pass = true;
+    double rmsSingle = rmsError(*single, q_single);
+    fprintf(stderr, "1 epoch (GeoCalFitter): RMS calibration error = %f [pixels]; fit = %f [ms]\n", rmsSingle, tSingle);
+    for(unsigned int nFit = 10; nFit <= nEpochs; nFit *= 2) {
+
+        std::unique_ptr<CameraModelBase> joint(CameraModelBase::getCameraModelFromEnum(CameraModelBase::PINHOLECAMERAWITHSIPDISTORTION));
+        joint->width = 640;
+        joint->height = 480;
+        joint->setParameters(params_initial.data());
+
+        std::vector<Eigen::Quaterniond> qs(nFit);
+        std::vector<std::vector<std::pair<Source, ReferenceStar>>> xms(xmss.begin(), xmss.begin() + nFit);
+        MultiEpochGeoCalFitter fitter(joint.get());
+        for(unsigned int e=0; e<nFit; e++) {
+            qs[e] = initialQuaternion(qs_true[e]);
+            fitter.addEpoch(&qs[e], &xms[e], gmsts[e], lon, lat);
+        }
+
+        t0 = std::chrono::steady_clock::now();
+        fitter.fit(500, false);
+        t1 = std::chrono::steady_clock::now();
+        double tJoint = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+        double rmsJoint = rmsError(*joint, qs[0]);
+        double reducedChi2 = fitter.getReducedChi2();
+        pass &= rmsJoint < rmsSingle && std::abs(reducedChi2 - 1.0) < 0.2;
+
+        fprintf(stderr, "%d epochs (MultiEpochGeoCalFitter): RMS calibration error = %f [pixels]; reduced chi2 = %f; fit = %f [ms]\n",
+                nFit, rmsJoint, reducedChi2, tJoint);
+    }
+
+    fprintf(stderr, "MultiEpochGeoCalFitter -> %s\n", pass ? "PASS" : "FAIL");
+}
+
+void TestUtil::testAttitudeTracker() {
+
+    // Site and time of the simulated frames
+    double lon = MathUtil::toRadians(-3.2);
+    double lat = MathUtil::toRadians(55.9);
+    long long epochTimeUs = 1500000000000000ll;
+    double gmst = TimeUtil::epochToGmst(epochTimeUs);
+    Eigen::Matrix3d r_bcrf_sez = CoordinateUtil::getEcefToSezRot(lon, lat) * CoordinateUtil::getBcrfToEcefRot(gmst);
+
+    // Catalogue of stars at random positions on the sky
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> raDist(0.0, 2.0 * M_PI);
+    std::uniform_real_distribution<double> zDist(-1.0, 1.0);
+    std::uniform_real_distribution<double> magDist(0.0, 6.0);
+    std::vector<ReferenceStar> stars;
+    for(unsigned int s=0; s<20000; s++) {
+        stars.push_back(ReferenceStar(raDist(gen), std::asin(zDist(gen)), magDist(gen)));
+    }
+    std::shared_ptr<ReferenceStarCatalogue> catalogue = ReferenceStarCatalogue::build(stars);
+
+    PinholeCamera cam(640, 480, 500.0, 505.0, 322.0, 238.0);
+
+    // Orientation of the calibration, and the true orientation after the camera has drifted
+    Eigen::Quaterniond q_cal(0.9, 0.2, -0.3, 0.25);
+    q_cal.normalize();
+    Eigen::Quaterniond q_drift(Eigen::AngleAxisd(MathUtil::toRadians(0.15), Eigen::Vector3d(0.3, -0.5, 0.8).normalized()));
+    Eigen::Quaterniond q_true = q_drift * q_cal;
+
+    // Render an image of the stars with the given orientation, with Gaussian PSFs and background noise
+    std::normal_distribution<double> noise(0.0, 2.0);
+    auto render = [&](const Eigen::Quaterniond &q) {
+        unsigned int width = 640;
+        unsigned int height = 480;
+        Imageuc image(width, height);
+        image.epochTimeUs = epochTimeUs;
+        std::vector<double> pixels(width * height, 20.0);
+        std::vector<ReferenceStar> visible;
+        catalogue->getVisibleStars(q.toRotationMatrix() * r_bcrf_sez, cam, 6.0, visible);
+        for(const ReferenceStar &star : visible) {
+            double amplitude = 200.0 * std::pow(10.0, -0.4 * (star.mag - 1.0));
+            for(int j = std::max(0, (int)star.j - 5); j <= std::min((int)height - 1, (int)star.j + 5); j++) {
+                for(int i = std::max(0, (int)star.i - 5); i <= std::min((int)width - 1, (int)star.i + 5); i++) {
+                    double r2 = (i - star.i) * (i - star.i) + (j - star.j) * (j - star.j);
+                    pixels[j * width + i] += amplitude * std::exp(-0.5 * r2 / (1.2 * 1.2));
+                }
+            }
+        }
+        for(unsigned int p = 0; p < width * height; p++) {
+            image.rawImage[p] = (unsigned char)std::min(std::max(std::round(pixels[p] + noise(gen)), 0.0), 255.0);
+        }
+        return image;
+    };
+
+    AttitudeTracker tracker(catalogue, 20, 5, 6.0, 1.0);
+    tracker.setCalibration(&cam, q_cal, lon, lat);
+
+    // Track the drifted orientation over a few frames
+    Imageuc drifted = render(q_true);
+    unsigned int nUpdates = 5;
+    auto t0 = std::chrono::steady_clock::now();
+    for(unsigned int u = 0; u < nUpdates; u++) {
+        tracker.update(drifted);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double tUpdate = std::chrono::duration<double, std::micro>(t1 - t0).count() / nUpdates;
+    double error = MathUtil::toDegrees(tracker.getAttitude().angularDistance(q_true)) * 3600.0;
+    bool trackedPass = error < 20.0 && tracker.getRmsResidual() < 0.5 && !tracker.isCalibrationRequired();
+    fprintf(stderr, "Drift of %f [arcsec]: tracked with %d stars to %f [arcsec], residual = %f [pixels] -> %s\n",
+            MathUtil::toDegrees(q_true.angularDistance(q_cal)) * 3600.0, tracker.getNumMeasured(), error, tracker.getRmsResidual(), trackedPass ? "PASS" : "FAIL");
+    fprintf(stderr, "Time: update = %f [us]\n", tUpdate);
+
+    // Bump the camera by more than the tracking can follow
+    Eigen::Quaterniond q_bump(Eigen::AngleAxisd(MathUtil::toRadians(3.0), Eigen::Vector3d(1.0, 0.0, 0.0)));
+    Imageuc bumped = render(q_bump * q_true);
+    for(unsigned int u = 0; u < AttitudeTracker::maxLostUpdates; u++) {
+        tracker.update(bumped);
+    }
+    bool bumpedPass = tracker.isCalibrationRequired();
+    fprintf(stderr, "Bump of 3 [deg]: %d stars measured, calibration required = %d -> %s\n", tracker.getNumMeasured(),
+            tracker.isCalibrationRequired(), bumpedPass ? "PASS" : "FAIL");
+}
+
+void TestUtil::testPlateSolver() {
+
+    // Catalogue of stars at random positions on the sky, with the number brighter than magnitude m increasing
+    // as 10^{0.5m} similar to the real sky
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<ReferenceStar> stars;
+    for(unsigned int s=0; s<5000; s++) {
+        stars.push_back(ReferenceStar(2.0 * M_PI * uniform(gen), std::asin(2.0 * uniform(gen) - 1.0), 6.0 + 2.0 * std::log10(1.0 - uniform(gen))));
+    }
+    std::shared_ptr<ReferenceStarCatalogue> catalogue = ReferenceStarCatalogue::build(stars);
+
+    // Build the index, and check that it can be saved and memory-mapped
+    auto t0 = std::chrono::steady_clock::now();
+    std::shared_ptr<AsterismIndex> built = AsterismIndex::build(*catalogue, 4.5);
+    auto t1 = std::chrono::steady_clock::now();
+    std::string path = "/tmp/asterismindex.idx";
+    built->save(path);
+    std::shared_ptr<AsterismIndex> index = AsterismIndex::load(path);
+    bool loadPass = index && index->getNumTriangles() == built->getNumTriangles() && index->getNumStars() == built->getNumStars();
+    fprintf(stderr, "Index of %d triangles from %d stars built in %f [ms]; reloaded -> %s\n", built->getNumTriangles(), built->getNumStars(),
+            std::chrono::duration<double, std::milli>(t1 - t0).count(), loadPass ? "PASS" : "FAIL");
+
+    // Camera with some distortion not included in the plate solution
+    PinholeCameraWithRadialDistortion cam(720, 576, 600.0, 600.0, 365.0, 283.0, -0.03, 0.0);
+
+    PlateSolver solver(index);
+    std::normal_distribution<double> noise(0.0, 0.3);
+    unsigned int nTrials = 10;
+    unsigned int nPass = 0;
+    double tSolve = 0.0;
+    for(unsigned int trial = 0; trial < nTrials; trial++) {
+
+        Eigen::Quaterniond q(uniform(gen) - 0.5, uniform(gen) - 0.5, uniform(gen) - 0.5, uniform(gen) - 0.5);
+        Eigen::Matrix3d r_bcrf_cam = q.normalized().toRotationMatrix();
+
+        // Sources from the visible stars, with some missing and some spurious sources
+        std::vector<ReferenceStar> visible;
+        catalogue->getVisibleStars(r_bcrf_cam, cam, 6.0, visible);
+        std::vector<Source> sources;
+        for(const ReferenceStar &star : visible) {
+            if(uniform(gen) < 0.2) {
+                continue;
+            }
+            Source source;
+            source.i = star.i + noise(gen);
+            source.j = star.j + noise(gen);
+            source.adu = 1000.0 * std::pow(10.0, -0.4 * star.mag);
+            sources.push_back(source);
+        }
+        for(unsigned int s=0; s<10; s++) {
+            Source source;
+            source.i = uniform(gen) * cam.width;
+            source.j = uniform(gen) * cam.height;
+            source.adu = 1000.0 * std::pow(10.0, -0.4 * 6.0 * uniform(gen));
+            sources.push_back(source);
+        }
+
+        Eigen::Matrix3d r_solved;
+        double f = 0.0;
+        t0 = std::chrono::steady_clock::now();
+        bool solved = solver.solve(sources, cam.width, cam.height, r_solved, f);
+        t1 = std::chrono::steady_clock::now();
+        tSolve += std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+        // The offset of the true principal point from the centre of the image is absorbed by a small rotation, so
+        // check the solution by the positions of the stars projected with the solved pinhole camera
+        double error = 0.0;
+        if(solved) {
+            PinholeCamera solvedCam(cam.width, cam.height, f, f, cam.width / 2.0, cam.height / 2.0);
+            std::vector<double> errors;
+            for(const ReferenceStar &star : visible) {
+                double i, j;
+                solvedCam.projectVector(r_solved * r_bcrf_cam.transpose() * star.r, i, j);
+                errors.push_back(std::sqrt((i - star.i) * (i - star.i) + (j - star.j) * (j - star.j)));
+            }
+            std::sort(errors.begin(), errors.end());
+            error = errors[errors.size() / 2];
+        }
+        bool pass = solved && error < 5.0 && std::abs(f - cam.fi) < 0.05 * cam.fi;
+        if(pass) {
+            nPass++;
+        }
+        fprintf(stderr, "Trial %d: %d sources, solved = %d with %d stars, median star position error = %f [pixels], f = %f [pixels], time = %f [ms] -> %s\n", trial,
+                (int)sources.size(), solved, solver.getNumMatched(), error, f, std::chrono::duration<double, std::milli>(t1 - t0).count(), pass ? "PASS" : "FAIL");
+    }
+    fprintf(stderr, "Solved %d of %d; mean time = %f [ms]\n", nPass, nTrials, tSolve / nTrials);
+
+    // Check that indexes with invalid bin offsets or star indices are rejected. The header is 48 bytes and holds
+    // nStars and nBins at bytes 12 and 20; the bin offsets follow it, then the star positions and the triangles.
+    std::vector<char> data;
+    {
+        std::ifstream in(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    uint32_t nStars, nBins;
+    memcpy(&nStars, &data[12], sizeof(nStars));
+    memcpy(&nBins, &data[20], sizeof(nBins));
+    size_t triangleOffset = ((48 + ((size_t)nBins * nBins + 1) * sizeof(uint32_t) + 7) & ~((size_t)7)) + 3 * (size_t)nStars * sizeof(double);
+    std::string corruptedPath = "/tmp/asterismindex_corrupted.idx";
+    auto loadCorrupted = [&](size_t offset, uint32_t value) {
+        std::vector<char> corrupted(data);
+        memcpy(&corrupted[offset], &value, sizeof(value));
+        std::ofstream out(corruptedPath, std::ios::binary);
+        out.write(&corrupted[0], corrupted.size());
+        out.close();
+        return AsterismIndex::load(corruptedPath);
+    };
+    bool beyondPass = !loadCorrupted(48 + 4 * 1, built->getNumTriangles() + 1);
+    bool decreasingPass = !loadCorrupted(48 + 4 * ((size_t)nBins * nBins - 1), 0) && !loadCorrupted(48, 1);
+    bool starPass = !loadCorrupted(triangleOffset + sizeof(AsterismIndex::Triangle) * (built->getNumTriangles() / 2), nStars);
+    remove(corruptedPath.c_str());
+
+    fprintf(stderr, "Offsets beyond the triangles rejected = %d, decreasing offsets rejected = %d, invalid star indices rejected = %d -> %s\n",
+            beyondPass, decreasingPass, starPass, (beyondPass && decreasingPass && starPass) ? "PASS" : "FAIL");
+
+    // Check that the saved index is reused for the same catalogue, and rebuilt for a different catalogue
+    std::shared_ptr<AsterismIndex> reused = AsterismIndex::loadOrBuild(path, *catalogue, 4.5);
+    bool reusePass = reused && reused->getNumTriangles() == built->getNumTriangles();
+    stars.resize(stars.size() / 2);
+    std::shared_ptr<ReferenceStarCatalogue> changed = ReferenceStarCatalogue::build(stars);
+    std::shared_ptr<AsterismIndex> rebuilt = AsterismIndex::loadOrBuild(path, *changed, 4.5);
+    std::shared_ptr<AsterismIndex> expected = AsterismIndex::build(*changed, 4.5);
+    bool rebuildPass = rebuilt && rebuilt->getNumStars() == expected->getNumStars() && rebuilt->getNumTriangles() == expected->getNumTriangles() &&
+            rebuilt->getNumStars() != built->getNumStars();
+    remove(path.c_str());
+
+    fprintf(stderr, "Index reused for the same catalogue = %d, rebuilt for a changed catalogue = %d -> %s\n",
+            reusePass, rebuildPass, (reusePass && rebuildPass) ? "PASS" : "FAIL");
+}
+
+/**
+ * @brief Tests writing a clip to a ClipFile and reading it back, both directly and after exporting it to PGM
+ * files, and compares the time taken to load the clip from each.
+ */
+void TestUtil::testClipFile() {
+
+    unsigned int width = 640;
+    unsigned int height = 480;
+    unsigned int nFrames = 500;
+
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<int> pixel(0, 255);
+
+    std::vector<std::shared_ptr<Imageuc>> frames;
+    for(unsigned int f=0; f<nFrames; f++) {
+        auto frame = std::make_shared<Imageuc>(width, height);
+        frame->epochTimeUs = 1500000000000000ll + f * 40000ll;
+        frame->field = (f % 2 == 0) ? V4L2_FIELD_NONE : V4L2_FIELD_INTERLACED;
+        for(unsigned char &p : frame->rawImage) {
+            p = (unsigned char)pixel(gen);
+        }
+        frames.push_back(frame);
+    }
+
+    std::string dir = "/tmp/clipfile";
+    mkdir(dir.c_str(), 0755);
+    std::string path = dir + "/" + ClipFile::filename;
+
+    auto t0 = std::chrono::steady_clock::now();
+    bool saved = ClipFile::save(path, frames, 0);
+    auto t1 = std::chrono::steady_clock::now();
+    fprintf(stderr, "Saved = %d; time = %f [ms]\n", saved, std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    t0 = std::chrono::steady_clock::now();
+    std::shared_ptr<ClipFile> clip = ClipFile::load(path);
+    t1 = std::chrono::steady_clock::now();
+    if(!clip) {
+        fprintf(stderr, "Couldn't load clip file -> FAIL\n");
+        return;
+    }
+    fprintf(stderr, "Loaded %d frames of %dx%d; time = %f [ms]\n", clip->size(), clip->getWidth(), clip->getHeight(),
+            std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    bool pass = clip->size() == nFrames;
+    for(unsigned int f=0; pass && f<nFrames; f++) {
+        pass = clip->getEpochTimeUs(f) == frames[f]->epochTimeUs && clip->getField(f) == frames[f]->field &&
+                ((size_t)clip->getPixels(f) % 4096) == 0 && memcmp(clip->getPixels(f), &(frames[f]->rawImage[0]), width * height) == 0;
+    }
+    fprintf(stderr, "Clip file contents -> %s\n", pass ? "PASS" : "FAIL");
+
+    // Export to PGMs, then remove the clip file so that they're loaded instead
+    bool exported = clip->exportPgm(dir);
+    clip.reset();
+    unlink(path.c_str());
+
+    std::vector<std::shared_ptr<Imageuc>> loaded;
+    t0 = std::chrono::steady_clock::now();
+    bool loadedPgm = ClipFile::loadFrames(dir, loaded);
+    t1 = std::chrono::steady_clock::now();
+    fprintf(stderr, "Loaded %d frames from PGM files; time = %f [ms]\n", (int)loaded.size(), std::chrono::duration<double, std::milli>(t1 - t0).count());
+
+    pass = exported && loadedPgm && loaded.size() == nFrames;
+    for(unsigned int f=0; pass && f<nFrames; f++) {
+        pass = loaded[f]->epochTimeUs == frames[f]->epochTimeUs && loaded[f]->field == frames[f]->field && loaded[f]->rawImage == frames[f]->rawImage;
+    }
+    fprintf(stderr, "Exported PGM files -> %s\n", pass ? "PASS" : "FAIL");
+
+    FileUtil::deleteFilePath(dir);
+}
+
+/**
+ * @brief Tests the lossless compression of clips by the FrameCodec on synthetic frames of a static sky with noise
+ * and a moving meteor, and reports the compression ratio and the time taken to encode and decode the frames.
+ */
+void TestUtil::testFrameCodec() {
+
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    unsigned int nPix = width * height;
+    unsigned int nFrames = 100;
+    unsigned int keyFrameInterval = 25;
+
+    std::mt19937 gen(1);
+    std::normal_distribution<double> noise(0.0, 1.5);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    // Static sky: background gradient and stars
+    std::vector<double> sky(nPix);
+    for(unsigned int y=0; y<height; y++) {
+        for(unsigned int x=0; x<width; x++) {
+            sky[y * width + x] = 10.0 + 10.0 * y / height;
+        }
+    }
+    for(unsigned int s=0; s<500; s++) {
+        unsigned int p = (unsigned int)(uniform(gen) * nPix);
+        sky[p] += 200.0 * uniform(gen);
+    }
+
+    std::vector<std::shared_ptr<Imageuc>> frames;
+    for(unsigned int f=0; f<nFrames; f++) {
+        auto frame = std::make_shared<Imageuc>(width, height);
+        frame->epochTimeUs = 1500000000000000ll + f * 40000ll;
+        frame->field = V4L2_FIELD_NONE;
+        // Meteor moving across the field
+        double mx = 200.0 + 15.0 * f;
+        double my = 300.0 + 5.0 * f;
+        for(unsigned int p=0; p<nPix; p++) {
+            double value = sky[p] + noise(gen);
+            double dx = (double)(p % width) - mx;
+            double dy = (double)(p / width) - my;
+            if(std::abs(dx) < 10.0 && std::abs(dy) < 10.0) {
+                value += 150.0 * std::exp(-(dx * dx + dy * dy) / 8.0);
+            }
+            frame->rawImage[p] = (unsigned char)std::max(0.0, std::min(255.0, value));
+        }
+        frames.push_back(frame);
+    }
+
+    // Encode and decode each frame directly
+    FrameCodec encoder;
+    FrameCodec decoder;
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned char> decoded(nPix);
+    double tEncode = 0.0;
+    double tDecode = 0.0;
+    size_t totalSize = 0;
+    bool pass = true;
+    for(unsigned int f=0; f<nFrames; f++) {
+        auto t0 = std::chrono::steady_clock::now();
+        encoder.encode(&(frames[f]->rawImage[0]), f % keyFrameInterval == 0, nPix, width, encoded);
+        auto t1 = std::chrono::steady_clock::now();
+        bool ok = decoder.decode(&encoded[0], encoded.size(), nPix, width, &decoded[0]);
+        auto t2 = std::chrono::steady_clock::now();
+        tEncode += std::chrono::duration<double, std::milli>(t1 - t0).count();
+        tDecode += std::chrono::duration<double, std::milli>(t2 - t1).count();
+        totalSize += encoded.size();
+        pass = pass && ok && memcmp(&decoded[0], &(frames[f]->rawImage[0]), nPix) == 0;
+    }
+    fprintf(stderr, "%dx%d: compression ratio = %f; mean encode time = %f [ms]; mean decode time = %f [ms] -> %s\n", width, height,
+            (double)nFrames * nPix / totalSize, tEncode / nFrames, tDecode / nFrames, pass ? "PASS" : "FAIL");
+
+    // Corrupt data must be detected rather than decoded, as must a frame decoded without its key frame
+    encoder.encode(&(frames[1]->rawImage[0]), false, nPix, width, encoded);
+    bool truncated = decoder.decode(&encoded[0], encoded.size() / 2, nPix, width, &decoded[0]);
+    bool noKey = FrameCodec().decode(&encoded[0], encoded.size(), nPix, width, &decoded[0]);
+    fprintf(stderr, "Truncated frame rejected = %d; frame without key frame rejected = %d -> %s\n", !truncated, !noKey, (!truncated && !noKey) ? "PASS" : "FAIL");
+
+    // Write a compressed clip file and read the frames back out of order
+    std::string path = "/tmp/framecodec.clip";
+    bool saved = ClipFile::save(path, frames, keyFrameInterval);
+    std::shared_ptr<ClipFile> clip = ClipFile::load(path);
+    pass = saved && clip && clip->isCompressed() && clip->size() == nFrames;
+    unsigned int order[] = {0, 1, 2, 60, 61, 30, 99, 24, 25, 26, 98};
+    for(unsigned int f : order) {
+        if(!pass) {
+            break;
+        }
+        std::shared_ptr<Imageuc> frame = clip->readFrame(f);
+        pass = frame && frame->epochTimeUs == frames[f]->epochTimeUs && frame->rawImage == frames[f]->rawImage;
+    }
+    fprintf(stderr, "Compressed clip file random access -> %s\n", pass ? "PASS" : "FAIL");
+    clip.reset();
+    unlink(path.c_str());
+}
+
+void TestUtil::testVideoEncoder() {
+
+    // Odd dimensions: the final row and column are left out of the video
+    unsigned int width = 641;
+    unsigned int height = 481;
+    unsigned int nFrames = 50;
+
+    std::vector<std::shared_ptr<Imageuc>> frames;
+    for(unsigned int f=0; f<nFrames; f++) {
+        auto frame = std::make_shared<Imageuc>(width, height);
+        frame->epochTimeUs = 1500000000000000ll + f * 40000ll;
+        for(unsigned int p=0; p<width * height; p++) {
+            frame->rawImage[p] = (unsigned char)((p % width + p / width + 4 * f) % 256);
+        }
+        frames.push_back(frame);
+    }
+
+    std::string path = "/tmp/videoencoder.avi";
+    auto t0 = std::chrono::steady_clock::now();
+    bool encoded = VideoEncoder::encode(path, nFrames, [&frames](unsigned int i) {return frames[i];});
+    auto t1 = std::chrono::steady_clock::now();
+
+    struct stat info;
+    bool exists = stat(path.c_str(), &info) == 0 && info.st_size > 0;
+
+    if(VideoEncoder::isAvailable()) {
+        fprintf(stderr, "Encoded %d frames in %f [ms]; file size = %ld [bytes] -> %s\n", nFrames,
+                std::chrono::duration<double, std::milli>(t1 - t0).count(), exists ? (long)info.st_size : 0l, (encoded && exists) ? "PASS" : "FAIL");
+    }
+    else {
+        // Without the encoder the request must fail cleanly, leaving no file behind
+        fprintf(stderr, "Video encoder not available: encode failed = %d, no file = %d -> %s\n", !encoded, !exists, (!encoded && !exists) ? "PASS" : "FAIL");
+    }
+    unlink(path.c_str());
+}
+
+void TestUtil::testArchiveIndex() {
+
+    std::string root = "/tmp/archiveindex";
+    FileUtil::deleteFilePath(root);
+    mkdir(root.c_str(), 0755);
+
+    // Create some clip directories, the last with a clip file
+    std::vector<std::string> utcs = {"2018-03-13T22:27:41.891Z", "2018-03-13T23:01:02.003Z", "2018-03-14T01:15:00.500Z"};
+    for(const std::string &utc : utcs) {
+        FileUtil::createDirs(root, {utc.substr(0, 4), utc.substr(5, 2), utc.substr(8, 2), utc, "raw"});
+    }
+    unsigned int width = 64;
+    unsigned int height = 48;
+    std::vector<std::shared_ptr<Imageuc>> frames;
+    for(unsigned int f=0; f<5; f++) {
+        auto frame = std::make_shared<Imageuc>(width, height);
+        frame->epochTimeUs = TimeUtil::utcStringToEpoch(utcs[2]) + f * 40000ll;
+        frames.push_back(frame);
+    }
+    ClipFile::save(root + "/2018/03/14/" + utcs[2] + "/raw/" + ClipFile::filename, frames, 0);
+
+    // Build the index from the directory tree
+    ArchiveIndex::Entry latest;
+    {
+        ArchiveIndex index(root);
+        bool pass = index.size() == 3 && index.getLatest(latest) && latest.utc == utcs[2] && latest.nFrames == 5 && latest.durationUs == 160000;
+        fprintf(stderr, "Built index: %d entries; latest = %s (%d frames) -> %s\n", index.size(), latest.utc.c_str(), latest.nFrames, pass ? "PASS" : "FAIL");
+
+        // Add a clip incrementally, as when it's saved
+        std::string utc = "2018-03-14T02:00:00.000Z";
+        FileUtil::createDirs(root, {"2018", "03", "14", utc});
+        index.add(utc, 100, 4000000);
+        long long start = TimeUtil::utcStringToEpoch("2018-03-13T00:00:00.000Z");
+        long long end = TimeUtil::utcStringToEpoch("2018-03-14T00:00:00.000Z");
+        pass = index.size() == 4 && index.getRange(start, end).size() == 2 && index.getRange(end, end + 86400000000ll).size() == 2;
+        fprintf(stderr, "Added clip: %d entries; time range queries -> %s\n", index.size(), pass ? "PASS" : "FAIL");
+    }
+
+    // Reopen the index from the file; a clip deleted since is dropped when the latest entry is looked up, and
+    // clips added by other means are found on reconciling
+    {
+        ArchiveIndex index(root);
+        bool reopened = index.size() == 4;
+        FileUtil::deleteFilePath(root + "/2018/03/14/2018-03-14T02:00:00.000Z");
+        bool pass = reopened && index.getLatest(latest) && latest.utc == utcs[2] && index.size() == 3;
+        fprintf(stderr, "Reopened index: %d; stale latest entry removed -> %s\n", reopened, pass ? "PASS" : "FAIL");
+
+        FileUtil::createDirs(root, {"2018", "04", "01", "2018-04-01T20:00:00.000Z"});
+        FileUtil::deleteFilePath(root + "/2018/03/13/" + utcs[0]);
+        index.reconcile();
+        std::vector<ArchiveIndex::Entry> all = index.getAll();
+        pass = all.size() == 3 && all[0].utc == utcs[1] && all[2].utc == "2018-04-01T20:00:00.000Z";
+        fprintf(stderr, "Reconciled index: %lu entries -> %s\n", all.size(), pass ? "PASS" : "FAIL");
+
+        index.remove(root + "/2018/03");
+        pass = index.size() == 1;
+        fprintf(stderr, "Removed month: %d entries -> %s\n", index.size(), pass ? "PASS" : "FAIL");
+    }
+
+    {
+        ArchiveIndex index(root);
+        bool pass = index.size() == 1 && index.getLatest(latest) && latest.utc == "2018-04-01T20:00:00.000Z";
+        fprintf(stderr, "Reopened index: %d entries -> %s\n", index.size(), pass ? "PASS" : "FAIL");
+    }
+
+    FileUtil::deleteFilePath(root);
+}
+
+void TestUtil::testEventCatalogue() {
+
+    std::string path = "/tmp/events.sqlite";
+    unlink(path.c_str());
+
+    // Summarise a clip in which the event moves diagonally across frames 2-7
+    unsigned int width = 100;
+    unsigned int height = 80;
+    Imageuc peakHold(width, height);
+    peakHold.rawImage[0] = 250;
+    peakHold.rawImage[40 * width + 40] = 180;
+    std::vector<MeteorImageLocationMeasurement> locs(10);
+    for(unsigned int f=0; f<locs.size(); f++) {
+        locs[f].epochTimeUs = 1500000000000000ll + f * 40000ll;
+        if(f >= 2 && f <= 7) {
+            locs[f].coarse_localisation_success = true;
+            locs[f].x_flux_centroid = 10.0 + 6.0 * f;
+            locs[f].y_flux_centroid = 20.0 + 8.0 * f;
+            locs[f].bb_xmin = 5 + 6 * f;
+            locs[f].bb_xmax = 15 + 6 * f;
+            locs[f].bb_ymin = 15 + 8 * f;
+            locs[f].bb_ymax = 25 + 8 * f;
+        }
+    }
+    EventCatalogue::Event event = EventCatalogue::summarise(locs, &peakHold);
+    // Motion of (30, 40) pixels; the bright pixel at the origin is outside the bounding box
+    bool pass = event.nFrames == 10 && event.nLocalised == 6 && std::abs(event.motion - 50.0) < 1e-9 && event.peak == 180 &&
+            event.bbXmin == 17 && event.bbXmax == 57 && event.bbYmin == 31 && event.bbYmax == 81 && event.endUs - event.startUs == 360000;
+    fprintf(stderr, "Summarised event: %d/%d frames localised; motion = %f; peak = %d -> %s\n", event.nLocalised, event.nFrames,
+            event.motion, event.peak, pass ? "PASS" : "FAIL");
+
+    {
+        EventCatalogue catalogue(path);
+
+        // Events from two stations at hourly intervals, with increasing motion
+        for(unsigned int e=0; e<10; e++) {
+            event.startUs = 1500000000000000ll + e * 3600000000ll;
+            event.clipId = TimeUtil::epochToUtcString(event.startUs);
+            event.station = (e % 2 == 0) ? "north" : "south";
+            event.path = "/videos/" + event.clipId.substr(0, 4) + "/" + event.clipId.substr(5, 2) + "/" + event.clipId.substr(8, 2) + "/" + event.clipId;
+            event.motion = 10.0 * e;
+            catalogue.add(event);
+        }
+        // Replacing an event doesn't duplicate it
+        catalogue.add(event);
+
+        EventCatalogue::Query query;
+        unsigned int all = catalogue.count(query);
+        query.startUs = 1500000000000000ll + 2 * 3600000000ll;
+        query.endUs = 1500000000000000ll + 6 * 3600000000ll;
+        std::vector<EventCatalogue::Event> range = catalogue.query(query);
+        query.minMotion = 45.0;
+        unsigned int moving = catalogue.count(query);
+        query.station = "south";
+        std::vector<EventCatalogue::Event> south = catalogue.query(query);
+        pass = all == 10 && range.size() == 4 && range[0].motion == 20.0 && moving == 1 && south.size() == 1 && south[0].motion == 50.0;
+        fprintf(stderr, "Queries: %d events; %lu in range; %d moving; %lu from south -> %s\n", all, range.size(), moving, south.size(), pass ? "PASS" : "FAIL");
+        EventCatalogue::print(stderr, range);
+
+        EventCatalogue::Query limited;
+        limited.limit = 3;
+        pass = catalogue.query(limited).size() == 3;
+        fprintf(stderr, "Limited query -> %s\n", pass ? "PASS" : "FAIL");
+
+        // A path that's a prefix of the clip paths but not a directory containing them removes nothing
+        catalogue.remove(range[0].path);
+        catalogue.remove("/videos/2017/07/1");
+        pass = catalogue.count(EventCatalogue::Query()) == 9;
+        fprintf(stderr, "Removed clip -> %s\n", pass ? "PASS" : "FAIL");
+    }
+
+    // The events persist
+    {
+        EventCatalogue catalogue(path);
+        pass = catalogue.isOpen() && catalogue.count(EventCatalogue::Query()) == 9;
+        fprintf(stderr, "Reopened catalogue -> %s\n", pass ? "PASS" : "FAIL");
+    }
+
+    unlink(path.c_str());
+    unlink((path + "-wal").c_str());
+    unlink((path + "-shm").c_str());
+}
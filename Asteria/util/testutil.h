@@ -16,6 +16,44 @@ public:
 
     static void testImagedReadWrite();
 
+    static void testFrameDifferenceKernels();
+
+    static void testLockFreeQueue();
+
+    static void testRingBuffer();
+
+    static void testPixelStatsAccumulator();
+
+    static void testMedianFilter();
+
+    static void testSourceDetector();
+
+    static void testReferenceStarCatalogue();
+
+    static void testProjectVectors();
+
+    static void testInverseDistortionMap();
+
+    static void testGeoCalFitterKernels();
+
+    static void testFiniteDifferencesJacobian();
+
+    static void testMultiEpochGeoCalFitter();
+
+    static void testAttitudeTracker();
+
+    static void testPlateSolver();
+
+    static void testClipFile();
+
+    static void testFrameCodec();
+
+    static void testVideoEncoder();
+
+    static void testArchiveIndex();
+
+    static void testEventCatalogue();
+
 };
 
 #endif // TESTUTIL_H